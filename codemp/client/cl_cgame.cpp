@@ -375,6 +375,7 @@ qboolean CL_GetServerCommand( int serverCommandNumber ) {
 	char	*s;
 	char	*cmd;
 	static char bigConfigString[BIG_INFO_STRING];
+	static char csdString[BIG_INFO_STRING];
 
 	// if we have irretrievably lost a reliable command, drop the connection
 	if ( serverCommandNumber <= clc.serverCommandSequence - MAX_RELIABLE_COMMANDS )
@@ -443,6 +444,22 @@ rescan:
 		goto rescan;
 	}
 
+	if ( !strcmp( cmd, "csd" ) ) {
+		// rebuild the whole string from the one we have and hand it on as a cs
+		int index = atoi( Cmd_Argv(1) );
+		if ( index < 0 || index >= MAX_CONFIGSTRINGS ) {
+			Com_Error( ERR_DROP, "CL_GetServerCommand: bad csd index %i", index );
+		}
+		Q_strncpyz( csdString, cl.gameState.stringData + cl.gameState.stringOffsets[ index ], sizeof( csdString ) );
+		if ( !Info_ApplyDelta( csdString, Cmd_Argv(2), sizeof( csdString ) ) ||
+			strlen( csdString ) + 16 >= BIG_INFO_STRING ) {
+			Com_Error( ERR_DROP, "csd exceeded BIG_INFO_STRING" );
+		}
+		Com_sprintf( bigConfigString, BIG_INFO_STRING, "cs %i \"%s\"", index, csdString );
+		s = bigConfigString;
+		goto rescan;
+	}
+
 	if ( !strcmp( cmd, "cs" ) ) {
 		CL_ConfigstringModified();
 		// reparse the string, because CL_ConfigstringModified may have done another Cmd_TokenizeString()
@@ -502,6 +519,35 @@ void CL_ShutdownCGame( void ) {
 	CL_UnbindCGame();
 }
 
+/*
+====================
+CL_PrefetchLevelAssets
+
+Starts reading the models and sounds the gamestate names on the file system's
+prefetch threads, so they are already inflated by the time cgame registers them
+====================
+*/
+static void CL_PrefetchLevelAssets( void ) {
+	const char	*name;
+	int			i;
+
+	for ( i = 1 ; i < MAX_MODELS ; i++ ) {
+		name = cl.gameState.stringData + cl.gameState.stringOffsets[ CS_MODELS + i ];
+		if ( !name[0] || name[0] == '*' ) {	// inline brush models live in the bsp
+			continue;
+		}
+		FS_PrefetchFile( name );
+	}
+
+	for ( i = 1 ; i < MAX_SOUNDS ; i++ ) {
+		name = cl.gameState.stringData + cl.gameState.stringOffsets[ CS_SOUNDS + i ];
+		if ( !name[0] ) {
+			continue;
+		}
+		S_PrefetchSound( name );
+	}
+}
+
 /*
 ====================
 CL_InitCGame
@@ -530,11 +576,16 @@ void CL_InitCGame( void ) {
 
 	cls.state = CA_LOADING;
 
+	CL_PrefetchLevelAssets();
+
 	// init for this gamestate
 	// use the lastExecutedServerCommand instead of the serverCommandSequence
 	// otherwise server commands sent just before a gamestate are dropped
 	CGVM_Init( clc.serverMessageSequence, clc.lastExecutedServerCommand, clc.clientNum );
 
+	// anything cgame didn't ask for isn't needed
+	FS_EndPrefetch();
+
 	int clRate = Cvar_VariableIntegerValue( "rate" );
 	if ( clRate == 4000 ) {
 		Com_Printf( S_COLOR_YELLOW "WARNING: Old default /rate value detected (4000). Suggest typing /rate 25000 into console for a smoother connection!\n" );
@@ -143,6 +143,7 @@ void CL_ShowIP_f(void);
 void CL_ServerStatus_f(void);
 void CL_ServerStatusResponse( netadr_t from, msg_t *msg );
 static void CL_ShutdownRef( qboolean restarting );
+static void CL_SendUserinfo( void );
 
 /*
 =======================================================================
@@ -235,6 +236,9 @@ void CL_StopRecord_f( void ) {
 	clc.demorecording = qfalse;
 	clc.spDemoRecording = qfalse;
 	Com_Printf ("Stopped demo.\n");
+
+	// let the server send configstring deltas again
+	cvar_modifiedFlags |= CVAR_USERINFO;
 }
 
 /*
@@ -330,6 +334,11 @@ void CL_Record_f( void ) {
 	// don't start saving messages until a non-delta compressed message is received
 	clc.demowaiting = qtrue;
 
+	// nor until the server has stopped sending csd configstring deltas,
+	// which a stock client can't play back
+	CL_SendUserinfo();
+	clc.demoDeltaSequence = clc.reliableSequence;
+
 	// write out the gamestate message
 	MSG_Init (&buf, bufData, sizeof(bufData));
 	MSG_Bitstream(&buf);
@@ -1564,6 +1573,7 @@ void CL_CheckForResend( void ) {
 		Info_SetValueForKey( info, "protocol", va("%i", PROTOCOL_VERSION ) );
 		Info_SetValueForKey( info, "qport", va("%i", port ) );
 		Info_SetValueForKey( info, "challenge", va("%i", clc.challenge ) );
+		Info_SetValueForKey( info, "csdelta", clc.demorecording ? "0" : "1" );
 
 		Com_sprintf(data, sizeof(data), "connect \"%s\"", info );
 		NET_OutOfBandData( NS_CLIENT, clc.serverAddress, (byte *)data, strlen(data) );
@@ -2100,6 +2110,22 @@ qboolean CL_CheckPaused(void)
 
 //============================================================================
 
+/*
+==================
+CL_SendUserinfo
+
+Queues the userinfo, saying whether the server may send csd configstring
+deltas for now, which it mustn't while a demo is recording
+==================
+*/
+static void CL_SendUserinfo( void ) {
+	char	info[MAX_INFO_STRING];
+
+	Q_strncpyz( info, Cvar_InfoString( CVAR_USERINFO ), sizeof( info ) );
+	Info_SetValueForKey( info, "csdelta", clc.demorecording ? "0" : "1" );
+	CL_AddReliableCommand( va("userinfo \"%s\"", info ), qfalse );
+}
+
 /*
 ==================
 CL_CheckUserinfo
@@ -2118,7 +2144,7 @@ void CL_CheckUserinfo( void ) {
 	// send a reliable userinfo update if needed
 	if ( cvar_modifiedFlags & CVAR_USERINFO ) {
 		cvar_modifiedFlags &= ~CVAR_USERINFO;
-		CL_AddReliableCommand( va("userinfo \"%s\"", Cvar_InfoString( CVAR_USERINFO ) ), qfalse );
+		CL_SendUserinfo();
 	}
 
 }
@@ -2139,6 +2165,8 @@ void CL_Frame ( int msec ) {
 		return;
 	}
 
+	Frame_Reset( FRAME_ARENA_CLIENT );
+
 	SE_CheckForLanguageUpdates();	// will take zero time to execute unless language changes, then will reload strings.
 									//	of course this still doesn't work for menus...
 
@@ -2352,9 +2380,7 @@ static void *CM_GetCachedMapDiskImage( void ) { return gpvCachedMapDiskImage; }
 static void CM_SetCachedMapDiskImage( void *ptr ) { gpvCachedMapDiskImage = ptr; }
 static void CM_SetUsingCache( qboolean usingCache ) { gbUsingCachedMapDataRightNow = usingCache; }
 
-#define G2_VERT_SPACE_SERVER_SIZE 256
 IHeapAllocator *G2VertSpaceServer = NULL;
-CMiniHeap IHeapAllocator_singleton(G2_VERT_SPACE_SERVER_SIZE * 1024);
 
 static IHeapAllocator *GetG2VertSpaceServer( void ) {
 	return G2VertSpaceServer;
@@ -2472,11 +2498,17 @@ void CL_InitRef( void ) {
 
 	//FIXME: Might have to do something about this...
 	ri.GetG2VertSpaceServer = GetG2VertSpaceServer;
-	G2VertSpaceServer = &IHeapAllocator_singleton;
+	G2VertSpaceServer = Frame_HeapAllocator( FRAME_ARENA_SERVER );
 
 	ri.PD_Store = PD_Store;
 	ri.PD_Load = PD_Load;
 
+	ri.ParallelFor = Com_ParallelFor;
+
+	ri.FS_PrefetchFile = FS_PrefetchFile;
+
+	ri.Z_HeapAllocs = Z_HeapAllocs;
+
 	ret = GetRefAPI( REF_API_VERSION, &ri );
 
 //	Com_Printf( "-------------------------------\n");
@@ -2619,8 +2651,6 @@ static void CL_AddFavorite_f( void ) {
 	}
 }
 
-#define G2_VERT_SPACE_CLIENT_SIZE 256
-
 /*
 ===============
 CL_GenerateQKey
@@ -2840,7 +2870,7 @@ void CL_Init( void ) {
 
 	Cvar_Set( "cl_running", "1" );
 
-	G2VertSpaceClient = new CMiniHeap (G2_VERT_SPACE_CLIENT_SIZE * 1024);
+	G2VertSpaceClient = Frame_HeapAllocator( FRAME_ARENA_CLIENT );
 
 	CL_GenerateQKey();
 	CL_UpdateGUID( NULL, 0 );
@@ -2866,11 +2896,7 @@ void CL_Shutdown( void ) {
 	}
 	recursive = qtrue;
 
-	if (G2VertSpaceClient)
-	{
-		delete G2VertSpaceClient;
-		G2VertSpaceClient = 0;
-	}
+	G2VertSpaceClient = 0;
 
 	CL_Disconnect( qtrue );
 
@@ -257,7 +257,10 @@ void CL_ParseSnapshot( msg_t *msg ) {
 	if ( newSnap.deltaNum <= 0 ) {
 		newSnap.valid = qtrue;		// uncompressed frame
 		old = NULL;
-		clc.demowaiting = qfalse;	// we can start recording now
+		// we can start recording now, unless the server may still send csd
+		if ( clc.reliableAcknowledge >= clc.demoDeltaSequence && clc.demoDeltaMessage != clc.serverMessageSequence ) {
+			clc.demowaiting = qfalse;
+		}
 	} else {
 		old = &cl.snapshots[newSnap.deltaNum & PACKET_MASK];
 		if ( !old->valid ) {
@@ -741,6 +744,13 @@ void CL_ParseCommandString( msg_t *msg ) {
 	seq = MSG_ReadLong( msg );
 	s = MSG_ReadString( msg );
 
+	// a stock client can't play back a csd, even a resent one, so keep this
+	// message out of the demo and wait for a whole snapshot again
+	if ( clc.demorecording && !Q_strncmp( s, "csd ", 4 ) ) {
+		clc.demowaiting = qtrue;
+		clc.demoDeltaMessage = clc.serverMessageSequence;
+	}
+
 	// see if we have already executed stored it off
 	if ( clc.serverCommandSequence >= seq ) {
 		return;
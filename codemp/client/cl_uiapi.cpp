@@ -1427,9 +1427,17 @@ void CL_BindUI( void ) {
 		uii.ext.R_Font_StrLenPixels				= re->ext.Font_StrLenPixels;
 		uii.ext.AddCommand						= CL_AddUICommand;
 		uii.ext.RemoveCommand					= UIVM_Cmd_RemoveCommand;
+		uii.ext.Cvar_FindHandle					= Cvar_FindHandle;
+		uii.ext.Cvar_HandleValue				= Cvar_HandleValue;
+		uii.ext.Cvar_HandleStringBuffer			= Cvar_HandleStringBuffer;
 
 		GetUIAPI = (GetUIAPI_t)uivm->GetModuleAPI;
 		ret = GetUIAPI( UI_API_VERSION, &uii );
+		if ( !ret ) {
+			// modules from before the appended imports only take the original
+			// table, which ours starts with
+			ret = GetUIAPI( UI_API_VERSION_3, &uii );
+		}
 		if ( !ret ) {
 			//free VM?
 			cls.uiStarted = qfalse;
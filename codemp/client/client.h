@@ -230,6 +230,8 @@ typedef struct clientConnection_s {
 	qboolean	demorecording;
 	qboolean	demoplaying;
 	qboolean	demowaiting;	// don't record until a non-delta message is received
+	int			demoDeltaSequence;	// userinfo command that asked the server to hold csd deltas
+	int			demoDeltaMessage;	// last message that carried a csd, which can't be recorded
 	qboolean	firstDemoFrameSkipped;
 	fileHandle_t	demofile;
 
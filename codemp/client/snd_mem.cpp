@@ -701,6 +701,64 @@ static qboolean S_LoadSound_FileLoadAndNameAdjuster(char *psFilename, byte **pDa
 	return qtrue;
 }
 
+/*
+==============
+S_PrefetchSound
+
+Starts reading the file S_LoadSound_FileLoadAndNameAdjuster would pick for the
+name, trying the same substitutes in the same order
+==============
+*/
+qboolean S_PrefetchSound( const char *name )
+{
+	char	sLoadName[MAX_QPATH];
+	char	*psVoice;
+	int		len;
+
+	len = strlen( name );
+	if ( len < 5 || len >= MAX_QPATH || name[0] == '*' ) {
+		return qfalse;
+	}
+
+	Q_strncpyz( sLoadName, name, sizeof( sLoadName ) );
+	Q_strlwr( sLoadName );
+	if ( sLoadName[len-4] != '.' ) {
+		COM_DefaultExtension( sLoadName, sizeof( sLoadName ), ".wav" );
+		len = strlen( sLoadName );
+	}
+
+	psVoice = strstr( sLoadName, "chars" );
+	if ( psVoice ) {
+		extern cvar_t* s_language;
+		if ( s_language && !Q_stricmp( "DEUTSCH", s_language->string ) )
+			strncpy( psVoice, "chr_d", 5 );
+		else if ( s_language && !Q_stricmp( "FRANCAIS", s_language->string ) )
+			strncpy( psVoice, "chr_f", 5 );
+		else if ( s_language && !Q_stricmp( "ESPANOL", s_language->string ) )
+			strncpy( psVoice, "chr_e", 5 );
+		else
+			psVoice = NULL;
+	}
+
+	for ( ;; ) {
+		if ( FS_PrefetchFile( sLoadName ) ) {
+			return qtrue;
+		}
+		strcpy( &sLoadName[len-3], "mp3" );
+		if ( FS_PrefetchFile( sLoadName ) ) {
+			return qtrue;
+		}
+		if ( !psVoice ) {
+			return qfalse;
+		}
+
+		// the foreign one is missing, fall back to the english
+		strncpy( psVoice, "chars", 5 );
+		strcpy( &sLoadName[len-3], "wav" );
+		psVoice = NULL;
+	}
+}
+
 // returns qtrue if this dir is allowed to keep loaded MP3s, else qfalse if they should be WAV'd instead...
 //
 // note that this is passed the original, un-language'd name
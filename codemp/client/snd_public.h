@@ -76,6 +76,10 @@ void S_BeginRegistration( void );
 // checks for missing files
 sfxHandle_t	S_RegisterSound( const char *sample );
 
+// starts reading the file S_RegisterSound would load for the name, qfalse
+// if there's none
+qboolean S_PrefetchSound( const char *name );
+
 extern qboolean s_shutUp;
 
 void S_FreeAllSFXMem(void);
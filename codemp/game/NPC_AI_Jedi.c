@@ -251,12 +251,7 @@ void WP_ResistForcePush( gentity_t *self, gentity_t *pusher, qboolean noPenalty
 	NPC_SetAnim( self, parts, BOTH_RESISTPUSH, SETANIM_FLAG_OVERRIDE|SETANIM_FLAG_HOLD );
 	if ( !noPenalty )
 	{
-		char buf[128];
-		float tFVal = 0;
-
-		trap->Cvar_VariableStringBuffer("timescale", buf, sizeof(buf));
-
-		tFVal = atof(buf);
+		float tFVal = trap->Cvar_HandleValue( gTimescaleHandle );
 
 		if ( !runningResist )
 		{
@@ -252,12 +252,7 @@ qboolean NPC_UpdateAngles ( qboolean doPitch, qboolean doYaw )
 
 	if ( NPCS.NPC->s.weapon == WP_SABER && NPCS.NPC->client->ps.fd.forcePowersActive&(1<<FP_SPEED) )
 	{
-		char buf[128];
-		float tFVal = 0;
-
-		trap->Cvar_VariableStringBuffer("timescale", buf, sizeof(buf));
-
-		tFVal = atof(buf);
+		float tFVal = trap->Cvar_HandleValue( gTimescaleHandle );
 
 		yawSpeed *= 1.0f/tFVal;
 	}
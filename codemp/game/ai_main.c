@@ -2155,19 +2155,26 @@ int PassLovedOneCheck(bot_state_t *bs, gentity_t *ent)
 qboolean G_ThereIsAMaster(void);
 
 //standard check to find a new enemy.
+#define SCAN_TRACE_BATCH 4 //enemies traced at a time, nearest first
+
 int ScanForEnemies(bot_state_t *bs)
 {
 	vec3_t a;
 	float distcheck;
 	float closest;
-	int bestindex;
 	int i;
 	float hasEnemyDist = 0;
 	qboolean noAttackNonJM = qfalse;
+	traceRequest_t visRequests[SCAN_TRACE_BATCH];
+	trace_t visTraces[SCAN_TRACE_BATCH];
+	float visDist[MAX_CLIENTS+1];
+	int visClient[MAX_CLIENTS+1];
+	int numVis = 0;
+	int numBatch;
+	int v, j;
 
 	closest = 999999;
 	i = 0;
-	bestindex = -1;
 
 	if (bs->currentEnemy)
 	{ //only switch to a new enemy if he's significantly closer
@@ -2208,39 +2215,53 @@ int ScanForEnemies(bot_state_t *bs)
 				distcheck = 1;
 			}
 
-			if (distcheck < closest && ((InFieldOfVision(bs->viewangles, 90, a) && !BotMindTricked(bs->client, i)) || BotCanHear(bs, &g_entities[i], distcheck)) && OrgVisible(bs->eye, g_entities[i].client->ps.origin, -1))
-			{
-				if (BotMindTricked(bs->client, i))
-				{
-					if (distcheck < 256 || (level.time - g_entities[i].client->dangerTime) < 100)
-					{
-						if (!hasEnemyDist || distcheck < (hasEnemyDist - 128))
-						{ //if we have an enemy, only switch to closer if he is 128+ closer to avoid flipping out
-							if (!noAttackNonJM || g_entities[i].client->ps.isJediMaster)
-							{
-								closest = distcheck;
-								bestindex = i;
-							}
-						}
-					}
-				}
-				else
+			if (distcheck < closest && ((InFieldOfVision(bs->viewangles, 90, a) && !BotMindTricked(bs->client, i)) || BotCanHear(bs, &g_entities[i], distcheck)) &&
+				(!BotMindTricked(bs->client, i) || distcheck < 256 || (level.time - g_entities[i].client->dangerTime) < 100) &&
+				(!hasEnemyDist || distcheck < (hasEnemyDist - 128)) && //if we have an enemy, only switch to closer if he is 128+ closer to avoid flipping out
+				(!noAttackNonJM || g_entities[i].client->ps.isJediMaster))
+			{ //everything but the trace says we'd take this one, keep them sorted nearest first
+				for (v = numVis; v > 0 && visDist[v-1] > distcheck; v--)
 				{
-					if (!hasEnemyDist || distcheck < (hasEnemyDist - 128))
-					{ //if we have an enemy, only switch to closer if he is 128+ closer to avoid flipping out
-						if (!noAttackNonJM || g_entities[i].client->ps.isJediMaster)
-						{
-							closest = distcheck;
-							bestindex = i;
-						}
-					}
+					visDist[v] = visDist[v-1];
+					visClient[v] = visClient[v-1];
 				}
+				visDist[v] = distcheck;
+				visClient[v] = i;
+				numVis++;
 			}
 		}
 		i++;
 	}
 
-	return bestindex;
+	//the nearest one we can see is the one, so trace a few at a time from the
+	//nearest and stop at the first that's clear
+	for (v = 0; v < numVis; v += numBatch)
+	{
+		numBatch = Q_min(SCAN_TRACE_BATCH, numVis - v);
+
+		for (j = 0; j < numBatch; j++)
+		{ //same trace as OrgVisible
+			traceRequest_t *req = &visRequests[j];
+
+			memset(req, 0, sizeof(*req));
+			VectorCopy(bs->eye, req->start);
+			VectorCopy(g_entities[visClient[v+j]].client->ps.origin, req->end);
+			req->passEntityNum = -1;
+			req->contentmask = MASK_SOLID;
+		}
+
+		trap->TraceBatch(visTraces, visRequests, numBatch);
+
+		for (j = 0; j < numBatch; j++)
+		{
+			if (visTraces[j].fraction == 1)
+			{
+				return visClient[v+j];
+			}
+		}
+	}
+
+	return -1;
 }
 
 int WaitingForNow(bot_state_t *bs, vec3_t goalpos)
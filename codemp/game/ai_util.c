@@ -367,7 +367,7 @@ int BotDoChat(bot_state_t *bs, char *section, int always)
 		return 0;
 	}
 
-	if (trap->Cvar_VariableIntegerValue("se_language"))
+	if (trap->Cvar_HandleIntegerValue(gSeLanguageHandle))
 	{ //no chatting unless English.
 		return 0;
 	}
@@ -498,12 +498,7 @@ int Q3_PlaySound( int taskID, int entID, const char *name, const char *channel )
 
 	if ( type_voice )
 	{
-		char buf[128];
-		float tFVal = 0;
-
-		trap->Cvar_VariableStringBuffer("timescale", buf, sizeof(buf));
-
-		tFVal = atof(buf);
+		float tFVal = trap->Cvar_HandleValue( gTimescaleHandle );
 
 
 		if ( tFVal > 1.0f )
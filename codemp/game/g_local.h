@@ -1323,6 +1323,10 @@ void DeathmatchScoreboardMessage (gentity_t *client);
 extern vmCvar_t g_ff_objectives;
 extern qboolean gDoSlowMoDuel;
 extern int gSlowMoDuelTime;
+extern cvarHandle_t gTimescaleHandle;
+extern cvarHandle_t gSeLanguageHandle;
+
+void G_FillAppendedImports( gameImport_t *import );
 
 void G_PowerDuelCount(int *loners, int *doubles, qboolean countSpec);
 
@@ -203,6 +203,9 @@ void G_InitGame( int levelTime, int randomSeed, int restart ) {
 
 	G_RegisterCvars();
 
+	gTimescaleHandle = trap->Cvar_FindHandle( "timescale" );
+	gSeLanguageHandle = trap->Cvar_FindHandle( "se_language" );
+
 	G_ProcessIPBans();
 
 	G_InitMemory();
@@ -2851,6 +2854,10 @@ int g_TimeSinceLastFrame = 0;
 qboolean gDoSlowMoDuel = qfalse;
 int gSlowMoDuelTime = 0;
 
+// engine cvars read during the frame, looked up once in G_InitGame
+cvarHandle_t gTimescaleHandle = -1;
+cvarHandle_t gSeLanguageHandle = -1;
+
 //#define _G_FRAME_PERFANAL
 
 void NAV_CheckCalcPaths( void )
@@ -2951,12 +2958,7 @@ void G_RunFrame( int levelTime ) {
 	{
 		if (level.restarted)
 		{
-			char buf[128];
-			float tFVal = 0;
-
-			trap->Cvar_VariableStringBuffer("timescale", buf, sizeof(buf));
-
-			tFVal = atof(buf);
+			float tFVal = trap->Cvar_HandleValue( gTimescaleHandle );
 
 			trap->Cvar_Set("timescale", "1");
 			if (tFVal == 1.0f)
@@ -2988,12 +2990,7 @@ void G_RunFrame( int levelTime ) {
 			}
 			else
 			{
-				char buf[128];
-				float tFVal = 0;
-
-				trap->Cvar_VariableStringBuffer("timescale", buf, sizeof(buf));
-
-				tFVal = atof(buf);
+				float tFVal = trap->Cvar_HandleValue( gTimescaleHandle );
 
 				trap->Cvar_Set("timescale", "1");
 				if (timeDif > 1500 && tFVal == 1.0f)
@@ -3552,6 +3549,70 @@ static qboolean	G_NAV_CheckNodeFailedForEnt( int entID, int nodeNum ) {
 	return NAV_CheckNodeFailedForEnt( &g_entities[entID], nodeNum );
 }
 
+/*
+============
+G_FillAppendedImports
+
+Engines without the imports appended after G2API_GetSurfaceName get these,
+which do the same through the original ones
+============
+*/
+
+static void G_Fallback_TraceBatch( trace_t *results, const traceRequest_t *requests, int numRequests ) {
+	int i;
+	for ( i=0; i<numRequests; i++ ) {
+		const traceRequest_t *req = &requests[i];
+		trap->Trace( &results[i], req->start, req->mins, req->maxs, req->end, req->passEntityNum, req->contentmask, req->capsule, req->traceFlags, req->useLod );
+	}
+}
+
+// a handle indexes the names kept here, names that don't fit get -1 and read
+// as an undefined cvar
+#define MAX_FALLBACK_CVAR_HANDLES	64
+static char fallbackCvarNames[MAX_FALLBACK_CVAR_HANDLES][MAX_QPATH];
+static int numFallbackCvarNames;
+
+static cvarHandle_t G_Fallback_Cvar_FindHandle( const char *var_name ) {
+	int i;
+	if ( strlen( var_name ) >= MAX_QPATH )
+		return -1;
+	for ( i=0; i<numFallbackCvarNames; i++ ) {
+		if ( !Q_stricmp( fallbackCvarNames[i], var_name ) )
+			return i;
+	}
+	if ( numFallbackCvarNames == MAX_FALLBACK_CVAR_HANDLES )
+		return -1;
+	Q_strncpyz( fallbackCvarNames[numFallbackCvarNames], var_name, MAX_QPATH );
+	return numFallbackCvarNames++;
+}
+
+static void G_Fallback_Cvar_HandleStringBuffer( cvarHandle_t handle, char *buffer, int bufsize ) {
+	if ( (unsigned)handle >= (unsigned)numFallbackCvarNames )
+		*buffer = '\0';
+	else
+		trap->Cvar_VariableStringBuffer( fallbackCvarNames[handle], buffer, bufsize );
+}
+
+static float G_Fallback_Cvar_HandleValue( cvarHandle_t handle ) {
+	char buf[MAX_CVAR_VALUE_STRING];
+	G_Fallback_Cvar_HandleStringBuffer( handle, buf, sizeof( buf ) );
+	return atof( buf );
+}
+
+static int G_Fallback_Cvar_HandleIntegerValue( cvarHandle_t handle ) {
+	if ( (unsigned)handle >= (unsigned)numFallbackCvarNames )
+		return 0;
+	return trap->Cvar_VariableIntegerValue( fallbackCvarNames[handle] );
+}
+
+void G_FillAppendedImports( gameImport_t *import ) {
+	import->TraceBatch						= G_Fallback_TraceBatch;
+	import->Cvar_FindHandle					= G_Fallback_Cvar_FindHandle;
+	import->Cvar_HandleValue				= G_Fallback_Cvar_HandleValue;
+	import->Cvar_HandleIntegerValue			= G_Fallback_Cvar_HandleIntegerValue;
+	import->Cvar_HandleStringBuffer			= G_Fallback_Cvar_HandleStringBuffer;
+}
+
 /*
 ============
 GetModuleAPI
@@ -3563,15 +3624,23 @@ gameImport_t *trap = NULL;
 Q_EXPORT gameExport_t* QDECL GetModuleAPI( int apiVersion, gameImport_t *import )
 {
 	static gameExport_t ge = {0};
+	static gameImport_t import1;
 
 	assert( import );
+	if ( apiVersion == GAME_API_VERSION_1 ) {
+		// the engine's table ends before the appended imports
+		memset( &import1, 0, sizeof( import1 ) );
+		memcpy( &import1, import, offsetof( gameImport_t, TraceBatch ) );
+		G_FillAppendedImports( &import1 );
+		import = &import1;
+	}
 	trap = import;
 	Com_Printf	= trap->Print;
 	Com_Error	= trap->Error;
 
 	memset( &ge, 0, sizeof( ge ) );
 
-	if ( apiVersion != GAME_API_VERSION ) {
+	if ( apiVersion != GAME_API_VERSION && apiVersion != GAME_API_VERSION_1 ) {
 		trap->Print( "Mismatched GAME_API_VERSION: expected %i, got %i\n", GAME_API_VERSION, apiVersion );
 		return NULL;
 	}
@@ -29,7 +29,8 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 
 #define Q3_INFINITE			16777216
 
-#define	GAME_API_VERSION	1
+#define	GAME_API_VERSION	2
+#define	GAME_API_VERSION_1	1	// the table up to G2API_GetSurfaceName, still offered to older modules
 
 // entity->svFlags
 // the server does not know how to interpret most of the values
@@ -254,6 +255,18 @@ typedef struct sharedEntity_s {
 	int				next_roff_time; //rww - npc's need to know when they're getting roff'd
 } sharedEntity_t;
 
+// one trace for trap->TraceBatch, same arguments as trap->Trace
+typedef struct traceRequest_s {
+	vec3_t		start;
+	vec3_t		mins, maxs;		// zero for a point trace
+	vec3_t		end;
+	int			passEntityNum;
+	int			contentmask;
+	int			capsule;
+	int			traceFlags;
+	int			useLod;
+} traceRequest_t;
+
 #if !defined(_GAME) && defined(__cplusplus)
 class CSequencer;
 class CTaskManager;
@@ -1093,6 +1106,19 @@ typedef struct gameImport_s {
 	void		(*G2API_CleanEntAttachments)			( void );
 	qboolean	(*G2API_OverrideServer)					( void *serverInstance );
 	void		(*G2API_GetSurfaceName)					( void *ghoul2, int surfNumber, int modelIndex, char *fillBuf );
+
+	// imports below are only there from GAME_API_VERSION 2 on, an engine that
+	// offers GAME_API_VERSION_1 ends the table above
+
+	// runs numRequests traces, results[i] is what Trace would return for requests[i]
+	void		(*TraceBatch)							( trace_t *results, const traceRequest_t *requests, int numRequests );
+
+	// a handle stays bound to its cvar name for the whole session, so it can be
+	// looked up once and read every frame without hashing the name
+	cvarHandle_t	(*Cvar_FindHandle)					( const char *var_name );
+	float		(*Cvar_HandleValue)						( cvarHandle_t handle );
+	int			(*Cvar_HandleIntegerValue)				( cvarHandle_t handle );
+	void		(*Cvar_HandleStringBuffer)				( cvarHandle_t handle, char *buffer, int bufsize );
 } gameImport_t;
 
 typedef struct gameExport_s {
@@ -42,8 +42,8 @@ public:
 	virtual int New()=0;
 	virtual void Delete(int handle)=0;
 	virtual bool IsValid(int handle) const=0;
-	virtual std::vector<CGhoul2Info> &Get(int handle)=0;
-	virtual const std::vector<CGhoul2Info> &Get(int handle) const=0;
+	virtual ghoul2Info_v &Get(int handle)=0;
+	virtual const ghoul2Info_v &Get(int handle) const=0;
 };
 
 IGhoul2InfoArray &TheGhoul2InfoArray();
@@ -69,18 +69,29 @@ class CGhoul2Info_v
 			mItem=0;
 		}
 	}
-	std::vector<CGhoul2Info> &Array()
+	ghoul2Info_v &Array()
 	{
 		assert(InfoArray().IsValid(mItem));
 		return InfoArray().Get(mItem);
 	}
-	const std::vector<CGhoul2Info> &Array() const
+	const ghoul2Info_v &Array() const
 	{
 		assert(InfoArray().IsValid(mItem));
 		return InfoArray().Get(mItem);
 	}
 public:
 	int mItem;	//dont' be bad and muck with this
+
+	// the handles come out of the same pool as the lists they lead to
+	static void *operator new(size_t size)
+	{
+		return G2_PoolAlloc(size);
+	}
+	static void operator delete(void *ptr, size_t size)
+	{
+		G2_PoolFree(ptr, size);
+	}
+
 	CGhoul2Info_v()
 	{
 		mItem=0;
@@ -230,9 +230,52 @@ struct SSkinGoreData
 
 #define MAX_GHOUL_COUNT_BITS 8 // bits required to send across the MAX_G2_MODELS inside of the networking - this is the only restriction on ghoul models possible per entity
 
-typedef std::vector <surfaceInfo_t> surfaceInfo_v;
-typedef std::vector <boneInfo_t> boneInfo_v;
-typedef std::vector <boltInfo_t> boltInfo_v;
+// the lists of every ghoul2 instance come out of one pool in the renderer
+// instead of a heap block each, see G2_PoolAlloc
+void	*G2_PoolAlloc(size_t size);
+void	G2_PoolFree(void *ptr, size_t size);
+
+template <typename T>
+class CG2PoolAllocator
+{
+public:
+	typedef T value_type;
+
+	CG2PoolAllocator() {}
+	template <typename U>
+	CG2PoolAllocator(const CG2PoolAllocator<U> &) {}
+
+	template <typename U>
+	struct rebind
+	{
+		typedef CG2PoolAllocator<U> other;
+	};
+
+	T *allocate(size_t n)
+	{
+		return (T *)G2_PoolAlloc(n * sizeof(T));
+	}
+	void deallocate(T *ptr, size_t n)
+	{
+		G2_PoolFree(ptr, n * sizeof(T));
+	}
+};
+
+template <typename T, typename U>
+inline bool operator==(const CG2PoolAllocator<T> &, const CG2PoolAllocator<U> &)
+{
+	return true;
+}
+
+template <typename T, typename U>
+inline bool operator!=(const CG2PoolAllocator<T> &, const CG2PoolAllocator<U> &)
+{
+	return false;
+}
+
+typedef std::vector <surfaceInfo_t, CG2PoolAllocator<surfaceInfo_t> > surfaceInfo_v;
+typedef std::vector <boneInfo_t, CG2PoolAllocator<boneInfo_t> > boneInfo_v;
+typedef std::vector <boltInfo_t, CG2PoolAllocator<boltInfo_t> > boltInfo_v;
 typedef std::vector <std::pair<int,mdxaBone_t> > mdxaBone_v;
 
 // defines for stuff to go into the mflags
@@ -321,6 +364,8 @@ public:
 	}
 };
 
+typedef std::vector <CGhoul2Info, CG2PoolAllocator<CGhoul2Info> > ghoul2Info_v;
+
 class CGhoul2Info_v;
 
 // collision detection stuff
@@ -0,0 +1,669 @@
+/*
+===========================================================================
+Copyright (C) 2013 - 2015, OpenJK contributors
+
+This file is part of the OpenJK source code.
+
+OpenJK is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see <http://www.gnu.org/licenses/>.
+===========================================================================
+*/
+
+// cm_cache.cpp -- saves built clip maps so the next load of the same bsp skips building them
+
+#include "cm_local.h"
+#include "cm_patch.h"
+
+/*
+==============================================================================
+
+A cache file is one block holding the clipMap_t and everything it points
+to: planes, brushes with their SIMD side planes, nodes, leafs with their
+BVHs, submodels and the patch collision facets.  Every pointer in it is
+stored as an offset from the start of the file, so loading is a single read
+into the hunk followed by adding the address of the block to each of them.
+
+The entity string and visibility are still copied out of the bsp, which has
+to be read anyway for its checksum, and the area flood state is rebuilt.
+
+Caches are keyed on the bsp checksum and on the size of every structure in
+them, so a changed map or an engine with different structures builds the
+clip map again and replaces the file.  They live in cmcache/ under
+fs_homepath and are never read from a pak.
+
+==============================================================================
+*/
+
+#define	CM_CACHE_IDENT		(('H'<<24)+('C'<<16)+('M'<<8)+'C')
+#define	CM_CACHE_VERSION	1
+#define	CM_CACHE_ALIGN		32		// for the SIMD side planes
+
+typedef struct cmCacheHeader_s {
+	int			ident;
+	int			version;
+	uint32_t	layout;			// see CM_CacheLayout
+	uint32_t	bspChecksum;
+	uint32_t	checksum;		// of the whole file with this set to 0
+	int			size;
+	clipMap_t	cm;				// pointers are offsets from the start of the file
+} cmCacheHeader_t;
+
+static uint32_t CM_CacheLayout( void ) {
+	static const size_t sizes[] = {
+		sizeof( void * ), sizeof( clipMap_t ), sizeof( CCMShader ), sizeof( cplane_t ), sizeof( cbrushside_t ),
+		sizeof( cbrush_t ), sizeof( cNode_t ), sizeof( cLeaf_t ), sizeof( cmodel_t ), sizeof( cPatch_t ),
+		sizeof( patchCollide_t ), sizeof( patchPlane_t ), sizeof( facet_t ), sizeof( cmLeafBVH_t ),
+		sizeof( cmBVHNode_t ), CM_SIDE_LANES, BOX_BRUSHES, BOX_SIDES, BOX_LEAFS, BOX_PLANES,
+	};
+	uint32_t	layout = 0;
+
+	for ( size_t i = 0 ; i < ARRAY_LEN( sizes ) ; i++ ) {
+		layout = layout * 31 + (uint32_t)sizes[i];
+	}
+	return layout;
+}
+
+static void CM_CacheName( const char *name, char *cacheName, int size ) {
+	char	base[MAX_QPATH];
+
+	COM_StripExtension( name, base, sizeof( base ) );
+	Com_sprintf( cacheName, size, "cmcache/%s.cmc", base );
+}
+
+/*
+==============================================================================
+
+WRITING
+
+==============================================================================
+*/
+
+class CCMCacheWriter
+{
+public:
+	std::vector<byte>	data;
+
+	// room for count elements, the offset is aligned for the SIMD code
+	template<typename T> int Add( const T *src, int count ) {
+		int ofs = (int)PAD( data.size(), CM_CACHE_ALIGN );
+
+		data.resize( ofs + count * sizeof( T ), 0 );
+		if ( src && count ) {
+			Com_Memcpy( &data[ofs], src, count * sizeof( T ) );
+		}
+		return ofs;
+	}
+
+	template<typename T> T *At( int ofs ) { return (T *)&data[ofs]; }
+};
+
+// where p ends up in the cache when the array starting at base was added at baseOfs
+template<typename T> static T *CM_CacheOffset( const T *p, const void *base, int baseOfs ) {
+	if ( !p ) {
+		return NULL;
+	}
+	return (T *)(intptr_t)( baseOfs + ( (const byte *)p - (const byte *)base ) );
+}
+
+static cmLeafBVH_t *CM_WriteLeafBVH( CCMCacheWriter &w, const cmLeafBVH_t *bvh ) {
+	int				ofs;
+	cmLeafBVH_t		*out;
+
+	if ( !bvh ) {
+		return NULL;
+	}
+
+	ofs = w.Add( (const byte *)bvh, sizeof( *bvh ) + bvh->numNodes * sizeof( cmBVHNode_t ) + bvh->numItems * sizeof( int ) );
+	out = w.At<cmLeafBVH_t>( ofs );
+	out->nodes = CM_CacheOffset( bvh->nodes, bvh, ofs );
+	out->items = CM_CacheOffset( bvh->items, bvh, ofs );
+	return (cmLeafBVH_t *)(intptr_t)ofs;
+}
+
+static void CM_WriteLeaf( CCMCacheWriter &w, cLeaf_t *out, const cLeaf_t *leaf ) {
+	out->brushBVH = CM_WriteLeafBVH( w, leaf->brushBVH );
+	out->patchBVH = CM_WriteLeafBVH( w, leaf->patchBVH );
+}
+
+/*
+=================
+CM_WriteMapCache
+
+Called right after a clip map was built from the bsp, before the box hull
+is added
+=================
+*/
+void CM_WriteMapCache( const clipMap_t &cm, const char *name, uint32_t bspChecksum ) {
+	CCMCacheWriter		w;
+	cmCacheHeader_t		*header;
+	clipMap_t			*out;
+	char				cacheName[MAX_QPATH];
+	fileHandle_t		f;
+	int					i, ofs, numSideBlocks, msec;
+	int					planes, sides, brushes, sidePlanes, leafs, models, surfaces;
+
+	if ( !cm_mapCache || !cm_mapCache->integer ) {
+		return;
+	}
+	msec = Sys_Milliseconds();
+
+	w.Add<cmCacheHeader_t>( NULL, 1 );
+
+	planes = w.Add( cm.planes, BOX_PLANES + cm.numPlanes );
+
+	ofs = w.Add( cm.shaders, 1 + cm.numShaders );
+	w.At<cmCacheHeader_t>( 0 )->cm.shaders = (CCMShader *)(intptr_t)ofs;
+	for ( i = 0 ; i < 1 + cm.numShaders ; i++ ) {
+		w.At<CCMShader>( ofs )[i].SetNext( NULL );
+	}
+
+	sides = w.Add( cm.brushsides, BOX_SIDES + cm.numBrushSides );
+	for ( i = 0 ; i < BOX_SIDES + cm.numBrushSides ; i++ ) {
+		cbrushside_t *side = &w.At<cbrushside_t>( sides )[i];
+		side->plane = CM_CacheOffset( side->plane, cm.planes, planes );
+	}
+
+	numSideBlocks = CM_NumSideBlocks( cm );
+	sidePlanes = w.Add( cm.numBrushes ? cm.brushes[0].sidePlanes : NULL, numSideBlocks * CM_SIDE_BLOCK );
+
+	brushes = w.Add( cm.brushes, BOX_BRUSHES + cm.numBrushes );
+	for ( i = 0 ; i < BOX_BRUSHES + cm.numBrushes ; i++ ) {
+		cbrush_t *brush = &w.At<cbrush_t>( brushes )[i];
+		brush->sides = CM_CacheOffset( brush->sides, cm.brushsides, sides );
+		brush->sidePlanes = CM_CacheOffset( brush->sidePlanes, cm.brushes[0].sidePlanes, sidePlanes );
+	}
+
+	ofs = w.Add( cm.nodes, cm.numNodes );
+	w.At<cmCacheHeader_t>( 0 )->cm.nodes = (cNode_t *)(intptr_t)ofs;
+	for ( i = 0 ; i < cm.numNodes ; i++ ) {
+		cNode_t *node = &w.At<cNode_t>( ofs )[i];
+		node->plane = CM_CacheOffset( node->plane, cm.planes, planes );
+	}
+
+	leafs = w.Add( cm.leafs, BOX_LEAFS + cm.numLeafs );
+	for ( i = 0 ; i < cm.numLeafs ; i++ ) {
+		cLeaf_t leaf;
+
+		CM_WriteLeaf( w, &leaf, &cm.leafs[i] );
+		w.At<cLeaf_t>( leafs )[i].brushBVH = leaf.brushBVH;
+		w.At<cLeaf_t>( leafs )[i].patchBVH = leaf.patchBVH;
+	}
+
+	// submodel leafs have their own brush and surface lists, firstLeafBrush
+	// and firstLeafSurface are where those are in the cache until loaded
+	models = w.Add( cm.cmodels, cm.numSubModels );
+	for ( i = 0 ; i < cm.numSubModels ; i++ ) {
+		const cLeaf_t	*leaf = &cm.cmodels[i].leaf;
+		cLeaf_t			bvhs;
+		int				brushList, surfaceList;
+
+		CM_WriteLeaf( w, &bvhs, leaf );
+		if ( cm.cmodels[i].firstNode == -1 ) {
+			brushList = w.Add( cm.leafbrushes + leaf->firstLeafBrush, leaf->numLeafBrushes );
+			surfaceList = w.Add( cm.leafsurfaces + leaf->firstLeafSurface, leaf->numLeafSurfaces );
+		} else {
+			brushList = surfaceList = 0;
+		}
+
+		cLeaf_t *out = &w.At<cmodel_t>( models )[i].leaf;
+		out->brushBVH = bvhs.brushBVH;
+		out->patchBVH = bvhs.patchBVH;
+		out->firstLeafBrush = brushList;
+		out->firstLeafSurface = surfaceList;
+	}
+
+	// patches, each with its facets
+	surfaces = w.Add( cm.surfaces, cm.numSurfaces );
+	for ( i = 0 ; i < cm.numSurfaces ; i++ ) {
+		const cPatch_t	*patch = cm.surfaces[i];
+		int				patchOfs, pcOfs, facets, patchPlanes;
+
+		if ( !patch ) {
+			continue;
+		}
+		patchOfs = w.Add( patch, 1 );
+		pcOfs = w.Add( patch->pc, 1 );
+		patchPlanes = w.Add( patch->pc->planes, patch->pc->numPlanes );
+		facets = w.Add( patch->pc->facets, patch->pc->numFacets );
+
+		w.At<patchCollide_t>( pcOfs )->planes = (patchPlane_t *)(intptr_t)patchPlanes;
+		w.At<patchCollide_t>( pcOfs )->facets = (facet_t *)(intptr_t)facets;
+		w.At<cPatch_t>( patchOfs )->pc = (patchCollide_t *)(intptr_t)pcOfs;
+		w.At<cPatch_t *>( surfaces )[i] = (cPatch_t *)(intptr_t)patchOfs;
+	}
+
+	// the leaf lists last, they don't need any fixing up
+	header = w.At<cmCacheHeader_t>( 0 );
+	out = &header->cm;
+	CCMShader *shaders = out->shaders;
+	cNode_t *nodes = out->nodes;
+	*out = cm;
+	Com_Memset( out->name, 0, sizeof( out->name ) );
+	out->shaders = shaders;
+	out->nodes = nodes;
+	out->planes = (cplane_t *)(intptr_t)planes;
+	out->brushsides = (cbrushside_t *)(intptr_t)sides;
+	out->brushes = (cbrush_t *)(intptr_t)brushes;
+	out->leafs = (cLeaf_t *)(intptr_t)leafs;
+	out->cmodels = (cmodel_t *)(intptr_t)models;
+	out->surfaces = (cPatch_t **)(intptr_t)surfaces;
+	out->visibility = NULL;
+	out->entityString = NULL;
+	out->areas = NULL;
+	out->areaPortals = NULL;
+
+	ofs = w.Add( cm.leafbrushes, cm.numLeafBrushes + BOX_BRUSHES );
+	w.At<cmCacheHeader_t>( 0 )->cm.leafbrushes = (int *)(intptr_t)ofs;
+	ofs = w.Add( cm.leafsurfaces, cm.numLeafSurfaces );
+	w.At<cmCacheHeader_t>( 0 )->cm.leafsurfaces = (int *)(intptr_t)ofs;
+
+	header = w.At<cmCacheHeader_t>( 0 );
+	header->ident = CM_CACHE_IDENT;
+	header->version = CM_CACHE_VERSION;
+	header->layout = CM_CacheLayout();
+	header->bspChecksum = bspChecksum;
+	header->size = (int)w.data.size();
+	header->checksum = 0;
+	header->checksum = Com_BlockChecksum( w.data.data(), header->size );
+
+	CM_CacheName( name, cacheName, sizeof( cacheName ) );
+	f = FS_SV_FOpenFileWrite( cacheName );
+	if ( !f ) {
+		Com_Printf( "Couldn't write clip map cache %s\n", cacheName );
+		return;
+	}
+	FS_Write( w.data.data(), (int)w.data.size(), f );
+	FS_FCloseFile( f );
+
+	Com_DPrintf( "Wrote %s, %i KB in %i msec\n", cacheName, (int)( w.data.size() >> 10 ), Sys_Milliseconds() - msec );
+}
+
+/*
+==============================================================================
+
+READING
+
+A cache is not trusted any more than a bsp, its checksum is only there to
+catch damage.  Every offset is checked to land in the block and every count
+and index against the array it is used with before the collision code gets
+to follow them.
+
+==============================================================================
+*/
+
+class CCMCacheReader
+{
+public:
+	byte	*base;
+	int		len;
+
+	// turns the offset p back into a pointer, it has to be past the header and
+	// have room for count elements, anything read through it is checked too
+	template<typename T> bool Relocate( T *&p, int64_t count ) const {
+		intptr_t	ofs = (intptr_t)p;
+
+		if ( ofs < (intptr_t)sizeof( cmCacheHeader_t ) || ofs > len ) {
+			return false;
+		}
+		p = (T *)( base + ofs );
+		return Inside( p, count );
+	}
+
+	// for pointers nothing is read through until CM_CheckMapCache has looked at them
+	template<typename T> void RelocateUnchecked( T *&p ) const {
+		if ( p ) {
+			p = (T *)( (intptr_t)base + (intptr_t)p );
+		}
+	}
+
+	// p points to count elements of the block past the header
+	template<typename T> bool Inside( const T *p, int64_t count ) const {
+		intptr_t	ofs = (intptr_t)p - (intptr_t)base;
+
+		return count >= 0 && ofs >= (intptr_t)sizeof( cmCacheHeader_t ) && ofs <= len && ofs % alignof( T ) == 0
+			&& count <= ( len - ofs ) / (int64_t)sizeof( T );
+	}
+
+	// p points to num elements of array, which holds count
+	template<typename T> bool Within( const T *p, const T *array, int count, int num ) const {
+		intptr_t	ofs = (intptr_t)p - (intptr_t)array;
+
+		return num >= 0 && ofs >= 0 && ofs % sizeof( T ) == 0 && ofs / (intptr_t)sizeof( T ) <= count - num;
+	}
+
+	// num indexes starting at first of array, all of them below count
+	bool List( const int *array, int64_t first, int num, int count ) const {
+		const int	*list = (const int *)( (intptr_t)array + first * (int64_t)sizeof( int ) );
+
+		if ( first < -len || first > len || !Inside( list, num ) ) {
+			return false;
+		}
+		for ( int i = 0 ; i < num ; i++ ) {
+			if ( list[i] < 0 || list[i] >= count ) {
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+static bool CM_RelocateLeaf( const CCMCacheReader &r, cLeaf_t *leaf ) {
+	cmLeafBVH_t		*bvhs[2] = { leaf->brushBVH, leaf->patchBVH };
+
+	for ( int i = 0 ; i < 2 ; i++ ) {
+		if ( bvhs[i] ) {
+			if ( !r.Relocate( bvhs[i], 1 ) ) {
+				return false;
+			}
+			r.RelocateUnchecked( bvhs[i]->nodes );
+			r.RelocateUnchecked( bvhs[i]->items );
+		}
+	}
+	leaf->brushBVH = bvhs[0];
+	leaf->patchBVH = bvhs[1];
+	return true;
+}
+
+/*
+=================
+CM_RelocateMapCache
+
+Turns the offsets in cm back into pointers.  Anything they are followed to
+is checked to be in the block first, but as parts of a damaged file can
+overlap, what ends up there is only checked by CM_CheckMapCache afterwards.
+=================
+*/
+static bool CM_RelocateMapCache( clipMap_t &cm, const CCMCacheReader &r ) {
+	int		i;
+
+	if ( cm.numShaders < 0 || cm.numBrushSides < 0 || cm.numPlanes < 1 || cm.numNodes < 1 || cm.numLeafs < 1
+		|| cm.numLeafBrushes < 0 || cm.numLeafSurfaces < 0 || cm.numSubModels < 1 || cm.numSubModels > MAX_SUBMODELS
+		|| cm.numBrushes < 0 || cm.numSurfaces < 0 || cm.numClusters < 0 || cm.numClusters > MAX_MAP_LEAFS
+		|| cm.numAreas < 0 || cm.numAreas > MAX_MAP_AREAS ) {
+		return false;
+	}
+
+	if ( !r.Relocate( cm.shaders, 1 + (int64_t)cm.numShaders )
+		|| !r.Relocate( cm.planes, BOX_PLANES + (int64_t)cm.numPlanes )
+		|| !r.Relocate( cm.brushsides, BOX_SIDES + (int64_t)cm.numBrushSides )
+		|| !r.Relocate( cm.brushes, BOX_BRUSHES + (int64_t)cm.numBrushes )
+		|| !r.Relocate( cm.nodes, cm.numNodes )
+		|| !r.Relocate( cm.leafs, BOX_LEAFS + (int64_t)cm.numLeafs )
+		|| !r.Relocate( cm.leafbrushes, BOX_BRUSHES + (int64_t)cm.numLeafBrushes )
+		|| !r.Relocate( cm.leafsurfaces, cm.numLeafSurfaces )
+		|| !r.Relocate( cm.cmodels, cm.numSubModels )
+		|| !r.Relocate( cm.surfaces, cm.numSurfaces ) ) {
+		return false;
+	}
+
+	for ( i = 0 ; i < cm.numBrushSides ; i++ ) {
+		r.RelocateUnchecked( cm.brushsides[i].plane );
+	}
+	for ( i = 0 ; i < cm.numBrushes ; i++ ) {
+		r.RelocateUnchecked( cm.brushes[i].sides );
+		r.RelocateUnchecked( cm.brushes[i].sidePlanes );
+	}
+	for ( i = 0 ; i < cm.numNodes ; i++ ) {
+		r.RelocateUnchecked( cm.nodes[i].plane );
+	}
+	for ( i = 0 ; i < cm.numLeafs ; i++ ) {
+		if ( !CM_RelocateLeaf( r, &cm.leafs[i] ) ) {
+			return false;
+		}
+	}
+	for ( i = 0 ; i < cm.numSubModels ; i++ ) {
+		cLeaf_t *leaf = &cm.cmodels[i].leaf;
+
+		if ( !CM_RelocateLeaf( r, leaf ) ) {
+			return false;
+		}
+		if ( cm.cmodels[i].firstNode == -1 ) {
+			leaf->firstLeafBrush = ( leaf->firstLeafBrush - ( (byte *)cm.leafbrushes - r.base ) ) / (ptrdiff_t)sizeof( int );
+			leaf->firstLeafSurface = ( leaf->firstLeafSurface - ( (byte *)cm.leafsurfaces - r.base ) ) / (ptrdiff_t)sizeof( int );
+		}
+	}
+	for ( i = 0 ; i < cm.numSurfaces ; i++ ) {
+		if ( cm.surfaces[i] ) {
+			if ( !r.Relocate( cm.surfaces[i], 1 ) || !r.Relocate( cm.surfaces[i]->pc, 1 ) ) {
+				return false;
+			}
+			r.RelocateUnchecked( cm.surfaces[i]->pc->planes );
+			r.RelocateUnchecked( cm.surfaces[i]->pc->facets );
+		}
+	}
+
+	// the box hull entries are zero after a bsp load until CM_InitBoxHull
+	// fills them in, so make them that way whatever the file says
+	Com_Memset( cm.planes + cm.numPlanes, 0, BOX_PLANES * sizeof( *cm.planes ) );
+	Com_Memset( cm.brushsides + cm.numBrushSides, 0, BOX_SIDES * sizeof( *cm.brushsides ) );
+	Com_Memset( cm.brushes + cm.numBrushes, 0, BOX_BRUSHES * sizeof( *cm.brushes ) );
+	Com_Memset( cm.leafs + cm.numLeafs, 0, BOX_LEAFS * sizeof( *cm.leafs ) );
+	Com_Memset( cm.leafbrushes + cm.numLeafBrushes, 0, BOX_BRUSHES * sizeof( *cm.leafbrushes ) );
+	for ( i = 0 ; i < 1 + cm.numShaders ; i++ ) {
+		cm.shaders[i].shader[MAX_QPATH - 1] = '\0';
+		cm.shaders[i].SetNext( NULL );
+	}
+	return true;
+}
+
+// the nodes have to be laid out depth first the way CM_BuildBVHNodes makes
+// them, with the leaf nodes taking the items in order, or CM_CullLeafBVH
+// could run past its stack or its item list
+static int CM_CheckBVHNode( const cmLeafBVH_t *bvh, int nodeNum, int depth, int *nextItem ) {
+	const cmBVHNode_t	*node;
+	int					end;
+
+	if ( nodeNum >= bvh->numNodes || depth > 32 ) {
+		return -1;
+	}
+	node = &bvh->nodes[nodeNum];
+	if ( node->numItems ) {
+		if ( node->numItems < 0 || node->firstItem != *nextItem || node->numItems > bvh->numItems - *nextItem ) {
+			return -1;
+		}
+		*nextItem += node->numItems;
+		return nodeNum + 1;
+	}
+
+	end = CM_CheckBVHNode( bvh, nodeNum + 1, depth + 1, nextItem );
+	if ( end < 0 || node->firstItem != end ) {
+		return -1;
+	}
+	return CM_CheckBVHNode( bvh, end, depth + 1, nextItem );
+}
+
+static bool CM_CheckLeafBVH( const CCMCacheReader &r, const cmLeafBVH_t *bvh, int numLeafItems ) {
+	int		nextItem;
+
+	if ( !bvh ) {
+		return true;
+	}
+	if ( !r.Inside( bvh, 1 ) || bvh->numNodes < 1 || bvh->numItems > numLeafItems
+		|| !r.Inside( bvh->nodes, bvh->numNodes ) || !r.List( bvh->items, 0, bvh->numItems, numLeafItems ) ) {
+		return false;
+	}
+
+	nextItem = 0;
+	return CM_CheckBVHNode( bvh, 0, 0, &nextItem ) == bvh->numNodes && nextItem == bvh->numItems;
+}
+
+static bool CM_CheckLeaf( const CCMCacheReader &r, const clipMap_t &cm, const cLeaf_t *leaf ) {
+	return r.List( cm.leafbrushes, leaf->firstLeafBrush, leaf->numLeafBrushes, cm.numBrushes )
+		&& r.List( cm.leafsurfaces, leaf->firstLeafSurface, leaf->numLeafSurfaces, cm.numSurfaces )
+		&& CM_CheckLeafBVH( r, leaf->brushBVH, leaf->numLeafBrushes )
+		&& CM_CheckLeafBVH( r, leaf->patchBVH, leaf->numLeafSurfaces );
+}
+
+static bool CM_CheckPatch( const CCMCacheReader &r, const cPatch_t *patch ) {
+	const patchCollide_t	*pc = patch->pc;
+	int						i;
+
+	if ( !r.Inside( patch, 1 ) || !r.Inside( pc, 1 ) || pc->numPlanes > MAX_PATCH_PLANES || pc->numFacets > MAX_FACETS
+		|| !r.Inside( pc->planes, pc->numPlanes ) || !r.Inside( pc->facets, pc->numFacets ) ) {
+		return false;
+	}
+
+	for ( i = 0 ; i < pc->numPlanes ; i++ ) {
+		if ( pc->planes[i].signbits & ~7 ) {
+			return false;
+		}
+	}
+	for ( i = 0 ; i < pc->numFacets ; i++ ) {
+		const facet_t *facet = &pc->facets[i];
+
+		if ( facet->surfacePlane < 0 || facet->surfacePlane >= pc->numPlanes
+			|| facet->numBorders < 0 || facet->numBorders > (int)ARRAY_LEN( facet->borderPlanes )
+			|| !r.List( facet->borderPlanes, 0, facet->numBorders, pc->numPlanes ) ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+=================
+CM_CheckMapCache
+
+Once nothing more is written to the block, checks every pointer and index
+the collision code follows against the array it is meant to be in
+=================
+*/
+static bool CM_CheckMapCache( const clipMap_t &cm, const CCMCacheReader &r ) {
+	int		i, j;
+
+	for ( i = 0 ; i < cm.numPlanes ; i++ ) {
+		if ( cm.planes[i].signbits & ~7 ) {
+			return false;
+		}
+	}
+	for ( i = 0 ; i < cm.numBrushSides ; i++ ) {
+		const cbrushside_t *side = &cm.brushsides[i];
+
+		if ( !r.Within( side->plane, cm.planes, cm.numPlanes, 1 ) || side->shaderNum < 0 || side->shaderNum >= cm.numShaders ) {
+			return false;
+		}
+	}
+	for ( i = 0 ; i < cm.numBrushes ; i++ ) {
+		const cbrush_t	*brush = &cm.brushes[i];
+		int				numBlocks = ( brush->numsides + CM_SIDE_LANES - 1 ) / CM_SIDE_LANES;
+
+		if ( brush->shaderNum < 0 || brush->shaderNum >= cm.numShaders
+			|| !r.Within( brush->sides, cm.brushsides, cm.numBrushSides, brush->numsides )
+			|| !r.Inside( brush->sidePlanes, (int64_t)numBlocks * CM_SIDE_BLOCK )
+			|| ( (byte *)brush->sidePlanes - r.base ) % CM_CACHE_ALIGN ) {
+			return false;
+		}
+	}
+	for ( i = 0 ; i < cm.numNodes ; i++ ) {
+		const cNode_t *node = &cm.nodes[i];
+
+		if ( !r.Within( node->plane, cm.planes, cm.numPlanes, 1 ) ) {
+			return false;
+		}
+		for ( j = 0 ; j < 2 ; j++ ) {
+			if ( node->children[j] < -cm.numLeafs || node->children[j] >= cm.numNodes ) {
+				return false;
+			}
+		}
+	}
+	for ( i = 0 ; i < cm.numLeafs ; i++ ) {
+		const cLeaf_t *leaf = &cm.leafs[i];
+
+		if ( leaf->cluster < -1 || leaf->cluster >= cm.numClusters || leaf->area < -1 || leaf->area >= cm.numAreas
+			|| leaf->firstLeafBrush < 0 || leaf->firstLeafBrush + (int64_t)leaf->numLeafBrushes > cm.numLeafBrushes
+			|| leaf->firstLeafSurface < 0 || leaf->firstLeafSurface + (int64_t)leaf->numLeafSurfaces > cm.numLeafSurfaces
+			|| !CM_CheckLeaf( r, cm, leaf ) ) {
+			return false;
+		}
+	}
+	for ( i = 0 ; i < cm.numSubModels ; i++ ) {
+		const cmodel_t *model = &cm.cmodels[i];
+
+		if ( model->firstNode < -1 || model->firstNode >= cm.numNodes
+			|| ( model->firstNode == -1 ? !CM_CheckLeaf( r, cm, &model->leaf ) : model->leaf.brushBVH || model->leaf.patchBVH ) ) {
+			return false;
+		}
+	}
+	for ( i = 0 ; i < cm.numSurfaces ; i++ ) {
+		if ( cm.surfaces[i] && !CM_CheckPatch( r, cm.surfaces[i] ) ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+=================
+CM_ReadMapCache
+
+Loads everything but the entity string, visibility and areas from the cache
+of the bsp, returns qfalse if there is no usable one
+=================
+*/
+qboolean CM_ReadMapCache( clipMap_t &cm, const char *name, uint32_t bspChecksum ) {
+	cmCacheHeader_t		header;
+	CCMCacheReader		r;
+	clipMap_t			loaded;
+	char				cacheName[MAX_QPATH];
+	fileHandle_t		f;
+	byte				*block;
+	uint32_t			checksum;
+	int					len, msec;
+
+	if ( !cm_mapCache || !cm_mapCache->integer ) {
+		return qfalse;
+	}
+	msec = Sys_Milliseconds();
+
+	// only ever a file this engine wrote, never one from a pak
+	CM_CacheName( name, cacheName, sizeof( cacheName ) );
+	len = FS_SV_FOpenFileRead( cacheName, &f );
+	if ( !f ) {
+		return qfalse;
+	}
+
+	if ( len < (int)sizeof( header ) || FS_Read( &header, sizeof( header ), f ) != sizeof( header )
+		|| header.ident != CM_CACHE_IDENT || header.version != CM_CACHE_VERSION || header.layout != CM_CacheLayout()
+		|| header.bspChecksum != bspChecksum || header.size != len ) {
+		FS_FCloseFile( f );
+		Com_DPrintf( "%s is out of date\n", cacheName );
+		return qfalse;
+	}
+
+	block = (byte *)Hunk_Alloc( len + CM_CACHE_ALIGN, h_high );
+	r.base = (byte *)PADP( block, CM_CACHE_ALIGN );
+	r.len = len;
+	Com_Memcpy( r.base, &header, sizeof( header ) );
+	if ( FS_Read( r.base + sizeof( header ), len - sizeof( header ), f ) != len - (int)sizeof( header ) ) {
+		FS_FCloseFile( f );
+		Z_Free( block );
+		return qfalse;
+	}
+	FS_FCloseFile( f );
+
+	( (cmCacheHeader_t *)r.base )->checksum = 0;
+	checksum = Com_BlockChecksum( r.base, len );
+	loaded = header.cm;
+	if ( checksum != header.checksum || !CM_RelocateMapCache( loaded, r ) || !CM_CheckMapCache( loaded, r ) ) {
+		Z_Free( block );
+		Com_Printf( "%s is damaged, rebuilding it\n", cacheName );
+		return qfalse;
+	}
+	cm = loaded;
+
+	// not cached, the flood state changes while playing
+	cm.areas = (cArea_t *)Hunk_Alloc( cm.numAreas * sizeof( *cm.areas ), h_high );
+	cm.areaPortals = (int *)Hunk_Alloc( cm.numAreas * cm.numAreas * sizeof( *cm.areaPortals ), h_high );
+
+	Com_DPrintf( "Loaded %s in %i msec\n", cacheName, Sys_Milliseconds() - msec );
+	return qtrue;
+}
@@ -22,7 +22,11 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 */
 
 // cmodel.c -- model loading
+#include <algorithm>
+#include <mutex>
+
 #include "cm_local.h"
+#include "cm_patch.h"
 #include "qcommon/qfiles.h"
 
 #ifdef BSPC
@@ -43,19 +47,11 @@ void SetPlaneSignbits (cplane_t *out) {
 }
 #endif //BSPC
 
-// to allow boxes to be treated as brush models, we allocate
-// some extra indexes along with those needed by the map
-#define	BOX_BRUSHES		1
-#define	BOX_SIDES		6
-#define	BOX_LEAFS		2
-#define	BOX_PLANES		12
-
 #define	LL(x) x=LittleLong(x)
 
 
 clipMap_t	cmg; //rwwRMG - changed from cm
-int			c_pointcontents;
-int			c_traces, c_brush_traces, c_patch_traces;
+int			cm_numCheckBrushes, cm_numCheckSurfaces;
 
 
 byte		*cmod_base;
@@ -65,10 +61,13 @@ cvar_t		*cm_noAreas;
 cvar_t		*cm_noCurves;
 cvar_t		*cm_playerCurveClip;
 cvar_t		*cm_extraVerbose;
+cvar_t		*cm_debugSurfaceUpdate;
+cvar_t		*cm_simd;
+cvar_t		*cm_leafBVH;
+cvar_t		*cm_mapCache;
 #endif
 
 cmodel_t	box_model;
-cplane_t	*box_planes;
 cbrush_t	*box_brush;
 
 
@@ -240,6 +239,58 @@ void CM_BoundBrush( cbrush_t *b ) {
 }
 
 
+/*
+=================
+CM_NumSideBlocks
+=================
+*/
+int CM_NumSideBlocks( const clipMap_t &cm ) {
+	int		i, numBlocks;
+
+	numBlocks = 0;
+	for ( i = 0 ; i < cm.numBrushes ; i++ ) {
+		numBlocks += ( cm.brushes[i].numsides + CM_SIDE_LANES - 1 ) / CM_SIDE_LANES;
+	}
+	return numBlocks;
+}
+
+/*
+=================
+CM_BuildSidePlanes
+
+Copies the side planes of every brush into CM_SIDE_LANES wide blocks of
+normal x, normal y, normal z and dist for the brush kernels
+=================
+*/
+static void CM_BuildSidePlanes( clipMap_t &cm ) {
+	cbrush_t	*brush;
+	float		*block;
+	cplane_t	*plane;
+	int			i, j, lane;
+
+	// one block aligned for the widest kernel, CM_WriteMapCache counts on that
+	block = (float *)Hunk_Alloc( CM_NumSideBlocks( cm ) * CM_SIDE_BLOCK * sizeof( float ) + 32, h_high );
+	block = (float *)PADP( block, 32 );
+
+	for ( i = 0, brush = cm.brushes ; i < cm.numBrushes ; i++, brush++ ) {
+		brush->sidePlanes = block;
+		for ( j = 0 ; j < brush->numsides ; j += CM_SIDE_LANES, block += CM_SIDE_BLOCK ) {
+			for ( lane = 0 ; lane < CM_SIDE_LANES ; lane++ ) {
+				if ( j + lane < brush->numsides ) {
+					plane = brush->sides[j + lane].plane;
+					block[lane] = plane->normal[0];
+					block[CM_SIDE_LANES + lane] = plane->normal[1];
+					block[2 * CM_SIDE_LANES + lane] = plane->normal[2];
+					block[3 * CM_SIDE_LANES + lane] = plane->dist;
+				} else {
+					block[lane] = block[CM_SIDE_LANES + lane] = block[2 * CM_SIDE_LANES + lane] = 0.0f;
+					block[3 * CM_SIDE_LANES + lane] = CM_SIDE_PAD_DIST;
+				}
+			}
+		}
+	}
+}
+
 /*
 =================
 CMod_LoadBrushes
@@ -275,6 +326,7 @@ void CMod_LoadBrushes( const lump_t *l, clipMap_t &cm ) {
 		CM_BoundBrush( out );
 	}
 
+	CM_BuildSidePlanes( cm );
 }
 
 /*
@@ -572,6 +624,154 @@ static void CMod_LoadPatches( const lump_t *surfs, const lump_t *verts, clipMap_
 	}
 }
 
+/*
+=================
+CM_BuildBVHNodes
+
+Splits items at the median of the longest axis of their centers until
+there are only a few left
+=================
+*/
+typedef struct bvhItem_s {
+	int			item;
+	int			contents;
+	vec3_t		bounds[2];
+	float		center[3];
+} bvhItem_t;
+
+static void CM_BuildBVHNodes( std::vector<cmBVHNode_t> &nodes, bvhItem_t *items, int first, int count ) {
+	cmBVHNode_t	node;
+	vec3_t		centerMins, centerMaxs;
+	int			i, axis, half, self;
+
+	ClearBounds( node.bounds[0], node.bounds[1] );
+	ClearBounds( centerMins, centerMaxs );
+	node.contents = 0;
+	for ( i = first ; i < first + count ; i++ ) {
+		AddPointToBounds( items[i].bounds[0], node.bounds[0], node.bounds[1] );
+		AddPointToBounds( items[i].bounds[1], node.bounds[0], node.bounds[1] );
+		AddPointToBounds( items[i].center, centerMins, centerMaxs );
+		node.contents |= items[i].contents;
+	}
+
+	self = (int)nodes.size();
+	if ( count <= CM_BVH_LEAF_ITEMS ) {
+		node.firstItem = first;
+		node.numItems = count;
+		nodes.push_back( node );
+		return;
+	}
+
+	node.numItems = 0;
+	nodes.push_back( node );
+
+	axis = 0;
+	for ( i = 1 ; i < 3 ; i++ ) {
+		if ( centerMaxs[i] - centerMins[i] > centerMaxs[axis] - centerMins[axis] ) {
+			axis = i;
+		}
+	}
+	half = count / 2;
+	std::nth_element( items + first, items + first + half, items + first + count,
+		[axis]( const bvhItem_t &a, const bvhItem_t &b ) { return a.center[axis] < b.center[axis]; } );
+
+	CM_BuildBVHNodes( nodes, items, first, half );
+	nodes[self].firstItem = (int)nodes.size();
+	CM_BuildBVHNodes( nodes, items, first + half, count - half );
+}
+
+static cmLeafBVH_t *CM_BuildLeafBVH( std::vector<bvhItem_t> &items ) {
+	std::vector<cmBVHNode_t>	nodes;
+	cmLeafBVH_t					*bvh;
+	int							i;
+
+	if ( items.size() < CM_BVH_MIN_ITEMS ) {
+		return NULL;
+	}
+
+	for ( i = 0 ; i < (int)items.size() ; i++ ) {
+		VectorAdd( items[i].bounds[0], items[i].bounds[1], items[i].center );
+		VectorScale( items[i].center, 0.5f, items[i].center );
+	}
+	CM_BuildBVHNodes( nodes, items.data(), 0, (int)items.size() );
+
+	// all in one block, CM_WriteMapCache counts on that
+	bvh = (cmLeafBVH_t *)Hunk_Alloc( sizeof( *bvh ) + nodes.size() * sizeof( cmBVHNode_t ) + items.size() * sizeof( int ), h_high );
+	bvh->numNodes = (int)nodes.size();
+	bvh->nodes = (cmBVHNode_t *)( bvh + 1 );
+	bvh->numItems = (int)items.size();
+	bvh->items = (int *)( bvh->nodes + nodes.size() );
+	Com_Memcpy( bvh->nodes, nodes.data(), nodes.size() * sizeof( cmBVHNode_t ) );
+	for ( i = 0 ; i < (int)items.size() ; i++ ) {
+		bvh->items[i] = items[i].item;
+	}
+	return bvh;
+}
+
+/*
+=================
+CM_BuildLeafBVHs
+
+Gives every leaf and submodel with many brushes or patches a bounding volume
+hierarchy over them so traces can skip the ones far away in groups.  Brushes
+without sides and surfaces that aren't patches are left out since traces
+skip them anyway.
+=================
+*/
+static void CM_BuildLeafBVHs( clipMap_t &cm ) {
+	std::vector<bvhItem_t>	items;
+	bvhItem_t				item;
+	cLeaf_t					*leaf;
+	cbrush_t				*brush;
+	cPatch_t				*patch;
+	int						i, k, numBVHs;
+
+	numBVHs = 0;
+	for ( i = 0 ; i < cm.numLeafs + cm.numSubModels ; i++ ) {
+		if ( i < cm.numLeafs ) {
+			leaf = &cm.leafs[i];
+		} else if ( cm.cmodels[i - cm.numLeafs].firstNode == -1 ) {
+			leaf = &cm.cmodels[i - cm.numLeafs].leaf;
+		} else {
+			continue;	// the world model uses the tree
+		}
+
+		items.clear();
+		for ( k = 0 ; k < leaf->numLeafBrushes ; k++ ) {
+			brush = &cm.brushes[cm.leafbrushes[leaf->firstLeafBrush + k]];
+			if ( !brush->numsides ) {
+				continue;
+			}
+			item.item = k;
+			item.contents = brush->contents;
+			VectorCopy( brush->bounds[0], item.bounds[0] );
+			VectorCopy( brush->bounds[1], item.bounds[1] );
+			items.push_back( item );
+		}
+		leaf->brushBVH = CM_BuildLeafBVH( items );
+
+		items.clear();
+		for ( k = 0 ; k < leaf->numLeafSurfaces ; k++ ) {
+			patch = cm.surfaces[cm.leafsurfaces[leaf->firstLeafSurface + k]];
+			if ( !patch ) {
+				continue;
+			}
+			item.item = k;
+			item.contents = patch->contents;
+			VectorCopy( patch->pc->bounds[0], item.bounds[0] );
+			VectorCopy( patch->pc->bounds[1], item.bounds[1] );
+			items.push_back( item );
+		}
+		leaf->patchBVH = CM_BuildLeafBVH( items );
+
+		numBVHs += ( leaf->brushBVH != NULL ) + ( leaf->patchBVH != NULL );
+	}
+
+	if ( cm_extraVerbose && cm_extraVerbose->integer ) {
+		Com_Printf( "Built %i leaf BVHs\n", numBVHs );
+	}
+}
+
 //==================================================================
 
 /*
@@ -635,6 +835,10 @@ static void CM_LoadMap_Actual( const char *name, qboolean clientload, int *check
 	cm_noCurves = Cvar_Get ("cm_noCurves", "0", CVAR_CHEAT);
 	cm_playerCurveClip = Cvar_Get ("cm_playerCurveClip", "1", CVAR_ARCHIVE_ND|CVAR_CHEAT );
 	cm_extraVerbose = Cvar_Get ("cm_extraVerbose", "0", CVAR_TEMP );
+	cm_debugSurfaceUpdate = Cvar_Get ("r_debugSurfaceUpdate", "1", 0 );
+	cm_simd = Cvar_Get( "cm_simd", "1", CVAR_ARCHIVE_ND, "Use SIMD kernels to trace through brushes if the CPU has them, applied on map load" );
+	cm_leafBVH = Cvar_Get( "cm_leafBVH", "1", CVAR_ARCHIVE_ND, "Skip far away brushes and patches of big leafs in groups when tracing" );
+	cm_mapCache = Cvar_Get( "cm_mapCache", "1", CVAR_ARCHIVE_ND, "Save built clip maps in cmcache/ and load them from there next time" );
 #endif
 	Com_DPrintf( "CM_LoadMap( %s, %i )\n", name, clientload );
 
@@ -730,25 +934,41 @@ static void CM_LoadMap_Actual( const char *name, qboolean clientload, int *check
 	cmod_base = (byte *)buf;
 
 	// load into heap
-	CMod_LoadShaders( &header.lumps[LUMP_SHADERS], cm );
-	CMod_LoadLeafs (&header.lumps[LUMP_LEAFS], cm);
-	CMod_LoadLeafBrushes (&header.lumps[LUMP_LEAFBRUSHES], cm);
-	CMod_LoadLeafSurfaces (&header.lumps[LUMP_LEAFSURFACES], cm);
-	CMod_LoadPlanes (&header.lumps[LUMP_PLANES], cm);
-	CMod_LoadBrushSides (&header.lumps[LUMP_BRUSHSIDES], cm);
-	CMod_LoadBrushes (&header.lumps[LUMP_BRUSHES], cm);
-	CMod_LoadSubmodels (&header.lumps[LUMP_MODELS], cm);
-	CMod_LoadNodes (&header.lumps[LUMP_NODES], cm);
+#ifndef BSPC
+	if ( !CM_ReadMapCache( cm, name, last_checksum ) )
+#endif
+	{
+		CMod_LoadShaders( &header.lumps[LUMP_SHADERS], cm );
+		CMod_LoadLeafs (&header.lumps[LUMP_LEAFS], cm);
+		CMod_LoadLeafBrushes (&header.lumps[LUMP_LEAFBRUSHES], cm);
+		CMod_LoadLeafSurfaces (&header.lumps[LUMP_LEAFSURFACES], cm);
+		CMod_LoadPlanes (&header.lumps[LUMP_PLANES], cm);
+		CMod_LoadBrushSides (&header.lumps[LUMP_BRUSHSIDES], cm);
+		CMod_LoadBrushes (&header.lumps[LUMP_BRUSHES], cm);
+		CMod_LoadSubmodels (&header.lumps[LUMP_MODELS], cm);
+		CMod_LoadNodes (&header.lumps[LUMP_NODES], cm);
+		CMod_LoadPatches( &header.lumps[LUMP_SURFACES], &header.lumps[LUMP_DRAWVERTS], cm );
+		CM_BuildLeafBVHs( cm );
+#ifndef BSPC
+		CM_WriteMapCache( cm, name, last_checksum );
+#endif
+	}
 	CMod_LoadEntityString (&header.lumps[LUMP_ENTITIES], cm, name);
 	CMod_LoadVisibility( &header.lumps[LUMP_VISIBILITY], cm );
-	CMod_LoadPatches( &header.lumps[LUMP_SURFACES], &header.lumps[LUMP_DRAWVERTS], cm );
 
 	TotalSubModels += cm.numSubModels;
 
+	// make room in the trace contexts, counting the box brush
+	cm.checkBrushBase = cm_numCheckBrushes;
+	cm.checkSurfaceBase = cm_numCheckSurfaces;
+	cm_numCheckBrushes += cm.numBrushes + BOX_BRUSHES;
+	cm_numCheckSurfaces += cm.numSurfaces;
+
 	if (&cm == &cmg)
 	{
 		// Load in the shader text - return instantly if already loaded
 		CM_InitBoxHull ();
+		CM_SelectBrushKernels();
 	}
 
 #ifndef BSPC	// I hope we can lose this crap soon
@@ -805,6 +1025,8 @@ void CM_ClearMap( void )
 {
 	int		i;
 
+	CM_StopTraceRecord();
+
 	Com_Memset( &cmg, 0, sizeof( cmg ) );
 	CM_ClearLevelPatches();
 
@@ -814,6 +1036,8 @@ void CM_ClearMap( void )
 	}
 	NumSubBSP = 0;
 	TotalSubModels = 0;
+	cm_numCheckBrushes = 0;
+	cm_numCheckSurfaces = 0;
 }
 
 /*
@@ -843,7 +1067,7 @@ cmodel_t	*CM_ClipHandleToModel( clipHandle_t handle, clipMap_t **clipMap ) {
 		{
 			*clipMap = &cmg;
 		}
-		return &box_model;
+		return &CM_TraceContext()->boxModel;
 	}
 
 	count = cmg.numSubModels;
@@ -924,11 +1148,8 @@ void CM_InitBoxHull (void)
 {
 	int			i;
 	int			side;
-	cplane_t	*p;
 	cbrushside_t	*s;
 
-	box_planes = &cmg.planes[cmg.numPlanes];
-
 	box_brush = &cmg.brushes[cmg.numBrushes];
 	box_brush->numsides = 6;
 	box_brush->sides = cmg.brushsides + cmg.numBrushSides;
@@ -940,6 +1161,7 @@ void CM_InitBoxHull (void)
 	box_model.leaf.firstLeafBrush = cmg.numLeafBrushes;
 	cmg.leafbrushes[cmg.numLeafBrushes] = cmg.numBrushes;
 
+	// the planes themselves are per thread, see CM_InitTraceBox
 	for (i=0 ; i<6 ; i++)
 	{
 		side = i&1;
@@ -948,15 +1170,44 @@ void CM_InitBoxHull (void)
 		s = &cmg.brushsides[cmg.numBrushSides+i];
 		s->plane = 	cmg.planes + (cmg.numPlanes+i*2+side);
 		s->shaderNum = cmg.numShaders;
+	}
+}
+
+/*
+===================
+CM_InitTraceBox
+
+Sets up the box hull of a trace context the same way CM_InitBoxHull does
+for the map
+===================
+*/
+static void CM_InitTraceBox( cmTraceContext_t *tc )
+{
+	int			i;
+	int			side;
+	cplane_t	*p;
+
+	tc->boxBrush.numsides = 6;
+	tc->boxBrush.sides = tc->boxSides;
+	tc->boxBrush.sidePlanes = NULL;
+	tc->boxBrush.contents = CONTENTS_BODY;
+	tc->boxModel.firstNode = -1;
+
+	for (i=0 ; i<6 ; i++)
+	{
+		side = i&1;
+
+		// brush sides
+		tc->boxSides[i].plane = &tc->boxPlanes[i*2+side];
 
 		// planes
-		p = &box_planes[i*2];
+		p = &tc->boxPlanes[i*2];
 		p->type = i>>1;
 		p->signbits = 0;
 		VectorClear (p->normal);
 		p->normal[i>>1] = 1;
 
-		p = &box_planes[i*2+1];
+		p = &tc->boxPlanes[i*2+1];
 		p->type = 3 + (i>>1);
 		p->signbits = 0;
 		VectorClear (p->normal);
@@ -966,6 +1217,98 @@ void CM_InitBoxHull (void)
 	}
 }
 
+/*
+===================
+CM_TraceContext
+
+Returns the trace context of the calling thread, creating it on first use.
+Contexts are never freed, like the worker threads that use them.
+===================
+*/
+static std::mutex				cm_traceContextLock;
+static cmTraceContext_t			*cm_traceContexts;
+static thread_local cmTraceContext_t	*cm_threadTraceContext;
+
+cmTraceContext_t *CM_TraceContext( void )
+{
+	cmTraceContext_t	*tc = cm_threadTraceContext;
+
+	if ( !tc )
+	{
+		tc = new cmTraceContext_t();
+		tc->checkcount = 0;
+		tc->traces = 0;
+		tc->brushTraces = 0;
+		tc->patchTraces = 0;
+		tc->pointContents = 0;
+		CM_InitTraceBox( tc );
+
+		std::lock_guard<std::mutex> lock( cm_traceContextLock );
+		tc->next = cm_traceContexts;
+		cm_traceContexts = tc;
+		cm_threadTraceContext = tc;
+	}
+
+	return tc;
+}
+
+/*
+===================
+CM_BeginTrace
+
+Starts a new set of brush and patch checks
+===================
+*/
+void CM_BeginTrace( cmTraceContext_t *tc )
+{
+	// a map was loaded since this thread last traced
+	if ( (int)tc->brushChecks.size() < cm_numCheckBrushes )
+	{
+		tc->brushChecks.resize( cm_numCheckBrushes, 0 );
+	}
+	if ( (int)tc->surfaceChecks.size() < cm_numCheckSurfaces )
+	{
+		tc->surfaceChecks.resize( cm_numCheckSurfaces, 0 );
+	}
+
+	if ( !++tc->checkcount )
+	{
+		std::fill( tc->brushChecks.begin(), tc->brushChecks.end(), 0 );
+		std::fill( tc->surfaceChecks.begin(), tc->surfaceChecks.end(), 0 );
+		tc->checkcount = 1;
+	}
+}
+
+/*
+===================
+CM_TraceStats
+
+Sums the statistics of every thread, optionally clearing them
+===================
+*/
+void CM_TraceStats( int *traces, int *brushTraces, int *patchTraces, int *pointContents, qboolean clear )
+{
+	cmTraceContext_t	*tc;
+
+	*traces = *brushTraces = *patchTraces = *pointContents = 0;
+
+	std::lock_guard<std::mutex> lock( cm_traceContextLock );
+	for ( tc = cm_traceContexts ; tc ; tc = tc->next )
+	{
+		*traces += tc->traces.load( std::memory_order_relaxed );
+		*brushTraces += tc->brushTraces.load( std::memory_order_relaxed );
+		*patchTraces += tc->patchTraces.load( std::memory_order_relaxed );
+		*pointContents += tc->pointContents.load( std::memory_order_relaxed );
+		if ( clear )
+		{
+			tc->traces = 0;
+			tc->brushTraces = 0;
+			tc->patchTraces = 0;
+			tc->pointContents = 0;
+		}
+	}
+}
+
 /*
 ===================
 CM_TempBoxModel
@@ -976,14 +1319,23 @@ Capsules are handled differently though.
 ===================
 */
 clipHandle_t CM_TempBoxModel( const vec3_t mins, const vec3_t maxs, int capsule ) {
+	cmTraceContext_t	*tc = CM_TraceContext();
+	cplane_t			*box_planes = tc->boxPlanes;
+	int					i;
 
-	VectorCopy( mins, box_model.mins );
-	VectorCopy( maxs, box_model.maxs );
+	VectorCopy( mins, tc->boxModel.mins );
+	VectorCopy( maxs, tc->boxModel.maxs );
 
 	if ( capsule ) {
 		return CAPSULE_MODEL_HANDLE;
 	}
 
+	// the leaf and shader move with the map
+	tc->boxModel.leaf = box_model.leaf;
+	for ( i = 0 ; i < 6 ; i++ ) {
+		tc->boxSides[i].shaderNum = cmg.numShaders;
+	}
+
 	box_planes[0].dist = maxs[0];
 	box_planes[1].dist = -maxs[0];
 	box_planes[2].dist = mins[0];
@@ -997,8 +1349,8 @@ clipHandle_t CM_TempBoxModel( const vec3_t mins, const vec3_t maxs, int capsule
 	box_planes[10].dist = mins[2];
 	box_planes[11].dist = -mins[2];
 
-	VectorCopy( mins, box_brush->bounds[0] );
-	VectorCopy( maxs, box_brush->bounds[1] );
+	VectorCopy( mins, tc->boxBrush.bounds[0] );
+	VectorCopy( maxs, tc->boxBrush.bounds[1] );
 
 	return BOX_MODEL_HANDLE;
 }
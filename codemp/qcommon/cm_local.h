@@ -23,6 +23,9 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 
 #pragma once
 
+#include <atomic>
+#include <vector>
+
 #include "cm_polylib.h"
 #include "cm_public.h"
 #include "qcommon/qcommon.h"
@@ -31,6 +34,13 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 #define	BOX_MODEL_HANDLE		(MAX_SUBMODELS-1)
 #define CAPSULE_MODEL_HANDLE	(MAX_SUBMODELS-2)
 
+// to allow boxes to be treated as brush models, we allocate
+// some extra indexes along with those needed by the map
+#define	BOX_BRUSHES		1
+#define	BOX_SIDES		6
+#define	BOX_LEAFS		2
+#define	BOX_PLANES		12
+
 struct Point
 {
 	long x, y;
@@ -41,6 +51,25 @@ typedef struct cNode_s {
 	int			children[2];		// negative numbers are leafs
 } cNode_t;
 
+// bounding volume hierarchy over the brushes or patches of a big leaf, the
+// nodes are stored depth first so the first child of an inner node follows it
+typedef struct cmBVHNode_s {
+	vec3_t		bounds[2];
+	int			contents;		// ored contents of everything below
+	int			firstItem;		// inner node: index of the second child
+	int			numItems;		// 0 for an inner node
+} cmBVHNode_t;
+
+typedef struct cmLeafBVH_s {
+	int			numNodes;
+	cmBVHNode_t	*nodes;
+	int			numItems;
+	int			*items;			// positions in the leaf's brush or surface list
+} cmLeafBVH_t;
+
+#define	CM_BVH_MIN_ITEMS	16	// smaller leafs are just walked
+#define	CM_BVH_LEAF_ITEMS	4
+
 typedef struct cLeaf_s {
 	int			cluster;
 	int			area;
@@ -50,6 +79,9 @@ typedef struct cLeaf_s {
 
 	ptrdiff_t	firstLeafSurface;
 	int			numLeafSurfaces;
+
+	cmLeafBVH_t	*brushBVH;		// NULL for small leafs
+	cmLeafBVH_t	*patchBVH;
 } cLeaf_t;
 
 typedef struct cmodel_s {
@@ -69,9 +101,16 @@ typedef struct cbrush_s {
 	vec3_t				bounds[2];
 	cbrushside_t		*sides;
 	unsigned short		numsides;
-	unsigned short		checkcount;		// to avoid repeated testings
+	float				*sidePlanes;	// sides as CM_SIDE_LANES wide blocks of x, y, z, dist, NULL for the box brush
 } cbrush_t;
 
+// brush side planes are also stored structure of arrays so the SIMD kernels
+// in cm_trace.cpp can test a block of sides at once, unused lanes have a
+// zero normal and a huge distance so every point is behind them
+#define	CM_SIDE_LANES		8
+#define	CM_SIDE_BLOCK		( 4 * CM_SIDE_LANES )
+#define	CM_SIDE_PAD_DIST	1.0e30f
+
 class CCMShader
 {
 public:
@@ -87,7 +126,6 @@ public:
 };
 
 typedef struct cPatch_s {
-	int			checkcount;				// to avoid repeated testings
 	int			surfaceFlags;
 	int			contents;
 	struct patchCollide_s	*pc;
@@ -145,7 +183,11 @@ typedef struct clipMap_s {
 	cPatch_t	**surfaces;			// non-patches will be NULL
 
 	int			floodvalid;
-	int			checkcount;					// incremented on each trace
+
+	// where this map's brushes and surfaces start in the check arrays
+	// of a trace context, after the world's and earlier sub bsps'
+	int			checkBrushBase;
+	int			checkSurfaceBase;
 } clipMap_t;
 
 
@@ -154,12 +196,94 @@ typedef struct clipMap_s {
 #define	SURFACE_CLIP_EPSILON	(0.125)
 
 extern	clipMap_t	cmg; //rwwRMG - changed from cm
-extern	int			c_pointcontents;
-extern	int			c_traces, c_brush_traces, c_patch_traces;
+extern	int			cm_numCheckBrushes, cm_numCheckSurfaces;	// check array sizes for all loaded maps
 extern	cvar_t		*cm_noAreas;
 extern	cvar_t		*cm_noCurves;
 extern	cvar_t		*cm_playerCurveClip;
 extern	cvar_t		*cm_extraVerbose;
+extern	cvar_t		*cm_debugSurfaceUpdate;
+extern	cvar_t		*cm_simd;
+extern	cvar_t		*cm_leafBVH;
+extern	cvar_t		*cm_mapCache;
+
+/*
+Everything a trace writes lives in the trace context of the thread running
+it, so the loaded clip maps are only ever read and any number of threads can
+trace at once.  That is the brushes and patches already tested by the current
+trace, the temporary box model and the statistics.
+*/
+typedef struct cmTraceContext_s {
+	unsigned				checkcount;			// incremented on each trace
+	std::vector<unsigned>	brushChecks;		// checkcount of the last trace that tested each brush
+	std::vector<unsigned>	surfaceChecks;		// same for patches
+
+	// CM_TempBoxModel for this thread, the box brush stands in for the
+	// one past the end of cmg.brushes that the box model's leaf points at
+	cmodel_t				boxModel;
+	cbrush_t				boxBrush;
+	cbrushside_t			boxSides[6];
+	cplane_t				boxPlanes[12];
+
+	std::vector<int>		leafItems;			// brushes or patches of a leaf its BVH didn't cull
+
+	// statistics, only this thread adds to them
+	std::atomic<int>		traces;
+	std::atomic<int>		brushTraces;
+	std::atomic<int>		patchTraces;
+	std::atomic<int>		pointContents;
+
+	struct cmTraceContext_s	*next;
+} cmTraceContext_t;
+
+#define CM_COUNT( counter )	( counter ).store( ( counter ).load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed )
+
+cmTraceContext_t *CM_TraceContext( void );
+void CM_BeginTrace( cmTraceContext_t *tc );
+
+/*
+================
+CM_LeafBrush
+================
+*/
+static inline cbrush_t *CM_LeafBrush( cmTraceContext_t *tc, clipMap_t *local, int brushnum ) {
+	if ( brushnum == local->numBrushes ) {
+		return &tc->boxBrush;
+	}
+	return &local->brushes[brushnum];
+}
+
+/*
+================
+CM_BrushChecked
+
+Returns qtrue if the current trace already tested the brush in another
+leaf, otherwise marks it as tested
+================
+*/
+static inline qboolean CM_BrushChecked( cmTraceContext_t *tc, const clipMap_t *local, int brushnum ) {
+	unsigned *check = &tc->brushChecks[local->checkBrushBase + brushnum];
+
+	if ( *check == tc->checkcount ) {
+		return qtrue;
+	}
+	*check = tc->checkcount;
+	return qfalse;
+}
+
+/*
+================
+CM_SurfaceChecked
+================
+*/
+static inline qboolean CM_SurfaceChecked( cmTraceContext_t *tc, const clipMap_t *local, int surfacenum ) {
+	unsigned *check = &tc->surfaceChecks[local->checkSurfaceBase + surfacenum];
+
+	if ( *check == tc->checkcount ) {
+		return qtrue;
+	}
+	*check = tc->checkcount;
+	return qfalse;
+}
 
 // cm_test.c
 
@@ -197,6 +321,8 @@ typedef struct traceWork_s { //rwwRMG - modified
 	bool			startout;
 	bool			getout;
 
+	cmTraceContext_t	*tc;	// of the thread running the trace
+
 } traceWork_t;
 
 typedef struct leafList_s {
@@ -209,6 +335,11 @@ typedef struct leafList_s {
 	void	(*storeLeafs)( struct leafList_s *ll, int nodenum );
 } leafList_t;
 
+void CM_SelectBrushKernels( void );
+const char *CM_BrushKernelName( void );
+int CM_NumBrushKernels( void );
+qboolean CM_SetBrushKernel( int kernel );
+
 void CM_StoreLeafs( leafList_t *ll, int nodenum );
 void CM_StoreBrushes( leafList_t *ll, int nodenum );
 
@@ -232,3 +363,8 @@ void		CM_GetModelFormalName ( const char* model, const char* skin, char* name, i
 
 // cm_load.cpp
 void CM_GetWorldBounds ( vec3_t mins, vec3_t maxs );
+int CM_NumSideBlocks( const clipMap_t &cm );
+
+// cm_cache.cpp
+qboolean CM_ReadMapCache( clipMap_t &cm, const char *name, uint32_t bspChecksum );
+void CM_WriteMapCache( const clipMap_t &cm, const char *name, uint32_t bspChecksum );
@@ -66,8 +66,9 @@ int	c_totalPatchBlocks;
 int	c_totalPatchSurfaces;
 int	c_totalPatchEdges;
 
-static const patchCollide_t	*debugPatchCollide;
-static const facet_t		*debugFacet;
+// set by traces on any thread
+static std::atomic<const patchCollide_t *>	debugPatchCollide;
+static std::atomic<const facet_t *>			debugFacet;
 static qboolean		debugBlock;
 static vec3_t		debugBlockPoints[4];
 
@@ -1251,10 +1252,6 @@ static inline void CM_TracePointThroughPatchCollide( traceWork_t *tw, trace_t &t
 	int			i, j, k;
 	float		offset;
 	float		d1, d2;
-#ifndef BSPC
-	static cvar_t *cv;
-#endif //BSPC
-
 #ifndef BSPC
 	if ( !cm_playerCurveClip->integer || !tw->isPoint ) {
 		return;
@@ -1311,10 +1308,7 @@ static inline void CM_TracePointThroughPatchCollide( traceWork_t *tw, trace_t &t
 		if ( j == facet->numBorders ) {
 			// we hit this facet
 #ifndef BSPC
-			if (!cv) {
-				cv = Cvar_Get( "r_debugSurfaceUpdate", "1", 0 );
-			}
-			if (cv->integer) {
+			if (cm_debugSurfaceUpdate->integer) {
 				debugPatchCollide = pc;
 				debugFacet = facet;
 			}
@@ -1396,9 +1390,6 @@ void CM_TraceThroughPatchCollide( traceWork_t *tw, trace_t &trace, const struct
 	facet_t	*facet;
 	float plane[4] = { 0.0f }, bestplane[4] = { 0.0f };
 	vec3_t startp, endp;
-#ifndef BSPC
-	static cvar_t *cv;
-#endif //BSPC
 
 #ifndef CULL_BBOX
 	// I'm not sure if test is strictly correct.  Are all
@@ -1508,10 +1499,7 @@ void CM_TraceThroughPatchCollide( traceWork_t *tw, trace_t &trace, const struct
 					enterFrac = 0;
 				}
 #ifndef BSPC
-				if (!cv) {
-					cv = Cvar_Get( "r_debugSurfaceUpdate", "1", 0 );
-				}
-				if (cv && cv->integer) {
+				if (cm_debugSurfaceUpdate->integer) {
 					debugPatchCollide = pc;
 					debugFacet = facet;
 				}
@@ -43,6 +43,10 @@ int			CM_TransformedPointContents( const vec3_t p, clipHandle_t model, const vec
 
 void		CM_BoxTrace ( trace_t *results, const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs, clipHandle_t model, int brushmask, int capsule );
 void		CM_TransformedBoxTrace( trace_t *results, const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs, clipHandle_t model, int brushmask, const vec3_t origin, const vec3_t angles, int capsule );
+void		CM_TraceStats( int *traces, int *brushTraces, int *patchTraces, int *pointContents, qboolean clear );
+void		CM_TraceRecord_f( void );
+void		CM_TraceReplay_f( void );
+void		CM_StopTraceRecord( void );
 
 byte		*CM_ClusterPVS (int cluster);
 
@@ -49,7 +49,7 @@ int CM_PointLeafnum_r( const vec3_t p, int num, clipMap_t *local ) {
 			num = node->children[0];
 	}
 
-	c_pointcontents++;		// optimize counter
+	CM_COUNT( CM_TraceContext()->pointContents );		// optimize counter
 
 	return -1 - num;
 }
@@ -94,6 +94,7 @@ void CM_StoreBrushes( leafList_t *ll, int nodenum ) {
 	int			brushnum;
 	cLeaf_t		*leaf;
 	cbrush_t	*b;
+	cmTraceContext_t *tc = CM_TraceContext();
 
 	leafnum = -1 - nodenum;
 
@@ -101,11 +102,10 @@ void CM_StoreBrushes( leafList_t *ll, int nodenum ) {
 
 	for ( k = 0 ; k < leaf->numLeafBrushes ; k++ ) {
 		brushnum = cmg.leafbrushes[leaf->firstLeafBrush+k];
-		b = &cmg.brushes[brushnum];
-		if ( b->checkcount == cmg.checkcount ) {
+		if ( CM_BrushChecked( tc, &cmg, brushnum ) ) {
 			continue;	// already checked this brush in another leaf
 		}
-		b->checkcount = cmg.checkcount;
+		b = &cmg.brushes[brushnum];
 		for ( i = 0 ; i < 3 ; i++ ) {
 			if ( b->bounds[0][i] >= ll->bounds[1][i] || b->bounds[1][i] <= ll->bounds[0][i] ) {
 				break;
@@ -175,7 +175,7 @@ int	CM_BoxLeafnums( const vec3_t mins, const vec3_t maxs, int *boxList, int list
 	//rwwRMG - changed to boxList to not conflict with list type
 	leafList_t	ll;
 
-	cmg.checkcount++;
+	CM_BeginTrace( CM_TraceContext() );	// for CM_StoreBrushes
 
 	VectorCopy( mins, ll.bounds[0] );
 	VectorCopy( maxs, ll.bounds[1] );
@@ -212,11 +212,14 @@ int CM_PointContents( const vec3_t p, clipHandle_t model ) {
 	float		d;
 	cmodel_t	*clipm;
 	clipMap_t	*local;
+	cmTraceContext_t *tc;
 
 	if (!cmg.numNodes) {	// map not loaded
 		return 0;
 	}
 
+	tc = CM_TraceContext();
+
 	if ( model )
 	{
 		clipm = CM_ClipHandleToModel( model, &local );
@@ -240,7 +243,7 @@ int CM_PointContents( const vec3_t p, clipHandle_t model ) {
 	contents = 0;
 	for (k=0 ; k<leaf->numLeafBrushes ; k++) {
 		brushnum = local->leafbrushes[leaf->firstLeafBrush+k];
-		b = &local->brushes[brushnum];
+		b = CM_LeafBrush( tc, local, brushnum );
 
 		// see if the point is in the brush
 		for ( i = 0 ; i < b->numsides ; i++ ) {
@@ -23,6 +23,9 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 
 #include "cm_local.h"
 
+#include <algorithm>
+#include <mutex>
+
 // always use bbox vs. bbox collision and never capsule vs. bbox or vice versa
 //#define ALWAYS_BBOX_VS_BBOX
 // always use capsule vs. capsule collision and never capsule vs. bbox or vice versa
@@ -124,6 +127,408 @@ POSITION TESTING
 ===============================================================================
 */
 
+/*
+===============================================================================
+
+BRUSH SIDE KERNELS
+
+The loops over the sides of a brush in CM_TraceThroughBrush and
+CM_TestBoxInBrush have SSE2 and AVX versions that test a block of sides at
+once from the structure of arrays copy built by CM_BuildSidePlanes.  Plane
+distances are computed with the same multiplies and adds in the same order
+as the scalar code, and the sides a trace crosses are still clipped one at a
+time in side order, so every kernel returns bit identical traces and clients
+predict exactly what the server computes.
+
+===============================================================================
+*/
+
+#if defined(__SSE2__) || defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 )
+	#define CM_SIMD
+	#include <immintrin.h>
+	#if defined(_MSC_VER)
+		#include <intrin.h>
+		#define CM_TARGET_AVX
+	#else
+		#define CM_TARGET_AVX	__attribute__((target("avx")))
+	#endif
+#endif
+
+bool CM_PlaneCollision( traceWork_t *tw, cbrushside_t *side );
+
+typedef struct cmBrushKernel_s {
+	const char	*name;
+	bool		(*traceSides)( traceWork_t *tw, cbrush_t *brush );		// false for a quick getout
+	bool		(*testSides)( const traceWork_t *tw, const cbrush_t *brush );	// true if the start is behind all bevels
+} cmBrushKernel_t;
+
+/*
+================
+CM_ClipToSide
+
+Moves the enter or leave fraction of a trace that crosses a brush side
+================
+*/
+static inline void CM_ClipToSide( traceWork_t *tw, cbrushside_t *side, float d1, float d2 )
+{
+	float	f;
+
+	if (d1 > d2)
+	{	// enter
+		f = (d1 - SURFACE_CLIP_EPSILON);
+		if ( f < 0.0f )
+		{
+			f = 0.0f;
+			if (f > tw->enterFrac)
+			{
+				tw->enterFrac = f;
+				tw->clipplane = side->plane;
+				tw->leadside = side;
+			}
+		}
+		else if (f > tw->enterFrac * (d1 - d2) )
+		{
+			tw->enterFrac = f / (d1 - d2);
+			tw->clipplane = side->plane;
+			tw->leadside = side;
+		}
+	}
+	else
+	{	// leave
+		f = (d1 + SURFACE_CLIP_EPSILON);
+		if ( f < (d1 - d2) )
+		{
+			f = 1.0f;
+			if (f < tw->leaveFrac)
+			{
+				tw->leaveFrac = f;
+			}
+		}
+		else if (f > tw->leaveFrac * (d1 - d2) )
+		{
+			tw->leaveFrac = f / (d1 - d2);
+		}
+	}
+}
+
+static bool CM_TraceSides_Scalar( traceWork_t *tw, cbrush_t *brush ) {
+	int		i;
+
+	for ( i = 0 ; i < brush->numsides ; i++ ) {
+		if ( !CM_PlaneCollision( tw, brush->sides + i ) ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool CM_TestSides_Scalar( const traceWork_t *tw, const cbrush_t *brush ) {
+	int			i;
+	cplane_t	*plane;
+	float		dist, d1;
+
+	// the first six planes are the axial planes, so we only
+	// need to test the remainder
+	for ( i = 6 ; i < brush->numsides ; i++ ) {
+		plane = brush->sides[i].plane;
+
+		// adjust the plane distance appropriately for mins/maxs
+		dist = plane->dist - DotProduct( tw->offsets[ plane->signbits ], plane->normal );
+
+		d1 = DotProduct( tw->start, plane->normal ) - dist;
+
+		// if completely in front of face, no intersection
+		if ( d1 > 0 ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+#ifdef CM_SIMD
+// picks the mins or maxs of the swept box for each lane like offsets[signbits]
+#define CM_SSE_OFFSET( n, lo, hi )	_mm_or_ps( _mm_and_ps( _mm_cmplt_ps( n, zero ), hi ), _mm_andnot_ps( _mm_cmplt_ps( n, zero ), lo ) )
+
+static bool CM_TraceSides_SSE2( traceWork_t *tw, cbrush_t *brush ) {
+	const __m128	zero = _mm_setzero_ps(), epsilon = _mm_set1_ps( SURFACE_CLIP_EPSILON );
+	const __m128	sx = _mm_set1_ps( tw->start[0] ), sy = _mm_set1_ps( tw->start[1] ), sz = _mm_set1_ps( tw->start[2] );
+	const __m128	ex = _mm_set1_ps( tw->end[0] ), ey = _mm_set1_ps( tw->end[1] ), ez = _mm_set1_ps( tw->end[2] );
+	const __m128	lox = _mm_set1_ps( tw->offsets[0][0] ), loy = _mm_set1_ps( tw->offsets[0][1] ), loz = _mm_set1_ps( tw->offsets[0][2] );
+	const __m128	hix = _mm_set1_ps( tw->offsets[7][0] ), hiy = _mm_set1_ps( tw->offsets[7][1] ), hiz = _mm_set1_ps( tw->offsets[7][2] );
+	__m128			nx, ny, nz, dist, d1, d2, out1;
+	float			d1s[4], d2s[4];
+	const float		*block;
+	int				i, lane, cross;
+
+	if ( !brush->sidePlanes ) {
+		return CM_TraceSides_Scalar( tw, brush );
+	}
+
+	for ( i = 0 ; i < brush->numsides ; i += 4 ) {
+		block = brush->sidePlanes + ( i / CM_SIDE_LANES ) * CM_SIDE_BLOCK + ( i % CM_SIDE_LANES );
+		nx = _mm_load_ps( block );
+		ny = _mm_load_ps( block + CM_SIDE_LANES );
+		nz = _mm_load_ps( block + 2 * CM_SIDE_LANES );
+
+		// adjust the plane distance appropriately for mins/maxs
+		dist = _mm_mul_ps( CM_SSE_OFFSET( nx, lox, hix ), nx );
+		dist = _mm_add_ps( dist, _mm_mul_ps( CM_SSE_OFFSET( ny, loy, hiy ), ny ) );
+		dist = _mm_add_ps( dist, _mm_mul_ps( CM_SSE_OFFSET( nz, loz, hiz ), nz ) );
+		dist = _mm_sub_ps( _mm_load_ps( block + 3 * CM_SIDE_LANES ), dist );
+
+		d1 = _mm_add_ps( _mm_add_ps( _mm_mul_ps( sx, nx ), _mm_mul_ps( sy, ny ) ), _mm_mul_ps( sz, nz ) );
+		d1 = _mm_sub_ps( d1, dist );
+		d2 = _mm_add_ps( _mm_add_ps( _mm_mul_ps( ex, nx ), _mm_mul_ps( ey, ny ) ), _mm_mul_ps( ez, nz ) );
+		d2 = _mm_sub_ps( d2, dist );
+
+		// if completely in front of face, no intersection with the entire brush
+		out1 = _mm_cmpgt_ps( d1, zero );
+		if ( _mm_movemask_ps( _mm_and_ps( out1, _mm_or_ps( _mm_cmpge_ps( d2, epsilon ), _mm_cmpge_ps( d2, d1 ) ) ) ) ) {
+			return false;
+		}
+		if ( _mm_movemask_ps( _mm_cmpgt_ps( d2, zero ) ) ) {
+			tw->getout = true;
+		}
+		if ( _mm_movemask_ps( out1 ) ) {
+			tw->startout = true;
+		}
+
+		// clip to the sides it crosses in order
+		cross = ~_mm_movemask_ps( _mm_and_ps( _mm_cmple_ps( d1, zero ), _mm_cmple_ps( d2, zero ) ) ) & 15;
+		if ( cross ) {
+			_mm_storeu_ps( d1s, d1 );
+			_mm_storeu_ps( d2s, d2 );
+			for ( lane = 0 ; lane < 4 ; lane++ ) {
+				if ( cross & ( 1 << lane ) ) {
+					CM_ClipToSide( tw, brush->sides + i + lane, d1s[lane], d2s[lane] );
+				}
+			}
+		}
+	}
+	return true;
+}
+
+static bool CM_TestSides_SSE2( const traceWork_t *tw, const cbrush_t *brush ) {
+	const __m128	zero = _mm_setzero_ps();
+	const __m128	sx = _mm_set1_ps( tw->start[0] ), sy = _mm_set1_ps( tw->start[1] ), sz = _mm_set1_ps( tw->start[2] );
+	const __m128	lox = _mm_set1_ps( tw->offsets[0][0] ), loy = _mm_set1_ps( tw->offsets[0][1] ), loz = _mm_set1_ps( tw->offsets[0][2] );
+	const __m128	hix = _mm_set1_ps( tw->offsets[7][0] ), hiy = _mm_set1_ps( tw->offsets[7][1] ), hiz = _mm_set1_ps( tw->offsets[7][2] );
+	__m128			nx, ny, nz, dist, d1;
+	const float		*block;
+	int				i, out;
+
+	if ( !brush->sidePlanes ) {
+		return CM_TestSides_Scalar( tw, brush );
+	}
+
+	// the first six planes are the axial planes, so we only
+	// need to test the remainder
+	for ( i = 4 ; i < brush->numsides ; i += 4 ) {
+		block = brush->sidePlanes + ( i / CM_SIDE_LANES ) * CM_SIDE_BLOCK + ( i % CM_SIDE_LANES );
+		nx = _mm_load_ps( block );
+		ny = _mm_load_ps( block + CM_SIDE_LANES );
+		nz = _mm_load_ps( block + 2 * CM_SIDE_LANES );
+
+		dist = _mm_mul_ps( CM_SSE_OFFSET( nx, lox, hix ), nx );
+		dist = _mm_add_ps( dist, _mm_mul_ps( CM_SSE_OFFSET( ny, loy, hiy ), ny ) );
+		dist = _mm_add_ps( dist, _mm_mul_ps( CM_SSE_OFFSET( nz, loz, hiz ), nz ) );
+		dist = _mm_sub_ps( _mm_load_ps( block + 3 * CM_SIDE_LANES ), dist );
+
+		d1 = _mm_add_ps( _mm_add_ps( _mm_mul_ps( sx, nx ), _mm_mul_ps( sy, ny ) ), _mm_mul_ps( sz, nz ) );
+		d1 = _mm_sub_ps( d1, dist );
+
+		// if completely in front of face, no intersection
+		out = _mm_movemask_ps( _mm_cmpgt_ps( d1, zero ) );
+		if ( i == 4 ) {
+			out &= ~3;
+		}
+		if ( out ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+#define CM_AVX_OFFSET( n, lo, hi )	_mm256_blendv_ps( lo, hi, _mm256_cmp_ps( n, zero, _CMP_LT_OQ ) )
+
+static CM_TARGET_AVX bool CM_TraceSides_AVX( traceWork_t *tw, cbrush_t *brush ) {
+	const __m256	zero = _mm256_setzero_ps(), epsilon = _mm256_set1_ps( SURFACE_CLIP_EPSILON );
+	const __m256	sx = _mm256_set1_ps( tw->start[0] ), sy = _mm256_set1_ps( tw->start[1] ), sz = _mm256_set1_ps( tw->start[2] );
+	const __m256	ex = _mm256_set1_ps( tw->end[0] ), ey = _mm256_set1_ps( tw->end[1] ), ez = _mm256_set1_ps( tw->end[2] );
+	const __m256	lox = _mm256_set1_ps( tw->offsets[0][0] ), loy = _mm256_set1_ps( tw->offsets[0][1] ), loz = _mm256_set1_ps( tw->offsets[0][2] );
+	const __m256	hix = _mm256_set1_ps( tw->offsets[7][0] ), hiy = _mm256_set1_ps( tw->offsets[7][1] ), hiz = _mm256_set1_ps( tw->offsets[7][2] );
+	__m256			nx, ny, nz, dist, d1, d2, out1;
+	float			d1s[CM_SIDE_LANES], d2s[CM_SIDE_LANES];
+	const float		*block;
+	int				i, lane, cross;
+
+	if ( !brush->sidePlanes ) {
+		return CM_TraceSides_Scalar( tw, brush );
+	}
+
+	for ( i = 0, block = brush->sidePlanes ; i < brush->numsides ; i += CM_SIDE_LANES, block += CM_SIDE_BLOCK ) {
+		nx = _mm256_load_ps( block );
+		ny = _mm256_load_ps( block + CM_SIDE_LANES );
+		nz = _mm256_load_ps( block + 2 * CM_SIDE_LANES );
+
+		// adjust the plane distance appropriately for mins/maxs
+		dist = _mm256_mul_ps( CM_AVX_OFFSET( nx, lox, hix ), nx );
+		dist = _mm256_add_ps( dist, _mm256_mul_ps( CM_AVX_OFFSET( ny, loy, hiy ), ny ) );
+		dist = _mm256_add_ps( dist, _mm256_mul_ps( CM_AVX_OFFSET( nz, loz, hiz ), nz ) );
+		dist = _mm256_sub_ps( _mm256_load_ps( block + 3 * CM_SIDE_LANES ), dist );
+
+		d1 = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( sx, nx ), _mm256_mul_ps( sy, ny ) ), _mm256_mul_ps( sz, nz ) );
+		d1 = _mm256_sub_ps( d1, dist );
+		d2 = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( ex, nx ), _mm256_mul_ps( ey, ny ) ), _mm256_mul_ps( ez, nz ) );
+		d2 = _mm256_sub_ps( d2, dist );
+
+		// if completely in front of face, no intersection with the entire brush
+		out1 = _mm256_cmp_ps( d1, zero, _CMP_GT_OQ );
+		if ( _mm256_movemask_ps( _mm256_and_ps( out1, _mm256_or_ps( _mm256_cmp_ps( d2, epsilon, _CMP_GE_OQ ), _mm256_cmp_ps( d2, d1, _CMP_GE_OQ ) ) ) ) ) {
+			return false;
+		}
+		if ( _mm256_movemask_ps( _mm256_cmp_ps( d2, zero, _CMP_GT_OQ ) ) ) {
+			tw->getout = true;
+		}
+		if ( _mm256_movemask_ps( out1 ) ) {
+			tw->startout = true;
+		}
+
+		// clip to the sides it crosses in order
+		cross = ~_mm256_movemask_ps( _mm256_and_ps( _mm256_cmp_ps( d1, zero, _CMP_LE_OQ ), _mm256_cmp_ps( d2, zero, _CMP_LE_OQ ) ) ) & 255;
+		if ( cross ) {
+			_mm256_storeu_ps( d1s, d1 );
+			_mm256_storeu_ps( d2s, d2 );
+			for ( lane = 0 ; lane < CM_SIDE_LANES ; lane++ ) {
+				if ( cross & ( 1 << lane ) ) {
+					CM_ClipToSide( tw, brush->sides + i + lane, d1s[lane], d2s[lane] );
+				}
+			}
+		}
+	}
+	return true;
+}
+
+static CM_TARGET_AVX bool CM_TestSides_AVX( const traceWork_t *tw, const cbrush_t *brush ) {
+	const __m256	zero = _mm256_setzero_ps();
+	const __m256	sx = _mm256_set1_ps( tw->start[0] ), sy = _mm256_set1_ps( tw->start[1] ), sz = _mm256_set1_ps( tw->start[2] );
+	const __m256	lox = _mm256_set1_ps( tw->offsets[0][0] ), loy = _mm256_set1_ps( tw->offsets[0][1] ), loz = _mm256_set1_ps( tw->offsets[0][2] );
+	const __m256	hix = _mm256_set1_ps( tw->offsets[7][0] ), hiy = _mm256_set1_ps( tw->offsets[7][1] ), hiz = _mm256_set1_ps( tw->offsets[7][2] );
+	__m256			nx, ny, nz, dist, d1;
+	const float		*block;
+	int				i, out;
+
+	// the first six planes are the axial planes, so we only
+	// need to test the remainder
+	if ( brush->numsides <= 6 ) {
+		return true;
+	}
+	if ( !brush->sidePlanes ) {
+		return CM_TestSides_Scalar( tw, brush );
+	}
+
+	for ( i = 0, block = brush->sidePlanes ; i < brush->numsides ; i += CM_SIDE_LANES, block += CM_SIDE_BLOCK ) {
+		nx = _mm256_load_ps( block );
+		ny = _mm256_load_ps( block + CM_SIDE_LANES );
+		nz = _mm256_load_ps( block + 2 * CM_SIDE_LANES );
+
+		dist = _mm256_mul_ps( CM_AVX_OFFSET( nx, lox, hix ), nx );
+		dist = _mm256_add_ps( dist, _mm256_mul_ps( CM_AVX_OFFSET( ny, loy, hiy ), ny ) );
+		dist = _mm256_add_ps( dist, _mm256_mul_ps( CM_AVX_OFFSET( nz, loz, hiz ), nz ) );
+		dist = _mm256_sub_ps( _mm256_load_ps( block + 3 * CM_SIDE_LANES ), dist );
+
+		d1 = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( sx, nx ), _mm256_mul_ps( sy, ny ) ), _mm256_mul_ps( sz, nz ) );
+		d1 = _mm256_sub_ps( d1, dist );
+
+		// if completely in front of face, no intersection
+		out = _mm256_movemask_ps( _mm256_cmp_ps( d1, zero, _CMP_GT_OQ ) );
+		if ( i == 0 ) {
+			out &= ~63;
+		}
+		if ( out ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+================
+CM_CPUHasAVX
+================
+*/
+static qboolean CM_CPUHasAVX( void ) {
+#if defined(_MSC_VER)
+	int		info[4];
+
+	__cpuid( info, 1 );
+	// AVX and OSXSAVE, then the OS has to save the ymm registers
+	if ( ( info[2] & ( 1 << 28 ) ) && ( info[2] & ( 1 << 27 ) ) ) {
+		return (qboolean)( ( _xgetbv( 0 ) & 6 ) == 6 );
+	}
+	return qfalse;
+#else
+	return (qboolean)( __builtin_cpu_supports( "avx" ) != 0 );
+#endif
+}
+#endif // CM_SIMD
+
+static const cmBrushKernel_t cm_brushKernels[] = {
+	{ "scalar", CM_TraceSides_Scalar, CM_TestSides_Scalar },
+#ifdef CM_SIMD
+	{ "sse2", CM_TraceSides_SSE2, CM_TestSides_SSE2 },
+	{ "avx", CM_TraceSides_AVX, CM_TestSides_AVX },
+#endif
+};
+
+static const cmBrushKernel_t *cm_brushKernel = &cm_brushKernels[0];
+
+/*
+================
+CM_NumBrushKernels
+
+Kernels this CPU can run, the best last
+================
+*/
+int CM_NumBrushKernels( void ) {
+#ifdef CM_SIMD
+	static int	numKernels;
+
+	if ( !numKernels ) {
+		numKernels = CM_CPUHasAVX() ? 3 : 2;
+	}
+	return numKernels;
+#else
+	return 1;
+#endif
+}
+
+qboolean CM_SetBrushKernel( int kernel ) {
+	if ( kernel < 0 || kernel >= CM_NumBrushKernels() ) {
+		return qfalse;
+	}
+	cm_brushKernel = &cm_brushKernels[kernel];
+	return qtrue;
+}
+
+const char *CM_BrushKernelName( void ) {
+	return cm_brushKernel->name;
+}
+
+/*
+================
+CM_SelectBrushKernels
+
+Called on map load, never while traces are running
+================
+*/
+void CM_SelectBrushKernels( void ) {
+	CM_SetBrushKernel( ( cm_simd && cm_simd->integer ) ? CM_NumBrushKernels() - 1 : 0 );
+	if ( cm_extraVerbose && cm_extraVerbose->integer ) {
+		Com_Printf( "Tracing through brushes with the %s kernel\n", CM_BrushKernelName() );
+	}
+}
+
 /*
 ================
 CM_TestBoxInBrush
@@ -178,23 +583,8 @@ void CM_TestBoxInBrush( traceWork_t *tw, trace_t &trace, cbrush_t *brush ) {
 				return;
 			}
 		}
-	} else {
-		// the first six planes are the axial planes, so we only
-		// need to test the remainder
-		for ( i = 6 ; i < brush->numsides ; i++ ) {
-			side = brush->sides + i;
-			plane = side->plane;
-
-			// adjust the plane distance appropriately for mins/maxs
-			dist = plane->dist - DotProduct( tw->offsets[ plane->signbits ], plane->normal );
-
-			d1 = DotProduct( tw->start, plane->normal ) - dist;
-
-			// if completely in front of face, no intersection
-			if ( d1 > 0 ) {
-				return;
-			}
-		}
+	} else if ( !cm_brushKernel->testSides( tw, brush ) ) {
+		return;
 	}
 
 	// inside this brush
@@ -204,6 +594,62 @@ void CM_TestBoxInBrush( traceWork_t *tw, trace_t &trace, cbrush_t *brush ) {
 }
 
 
+/*
+================
+CM_CullLeafBVH
+
+Returns the positions in a leaf's brush or patch list of the ones the
+trace bounds touch, in list order so the trace tests them in the same order
+as walking the whole list and gets the same result.  Returns NULL to walk
+the whole list when the leaf has no BVH.
+================
+*/
+static const int *CM_CullLeafBVH( traceWork_t *tw, const cmLeafBVH_t *bvh, int numItems, int *count ) {
+	const cmBVHNode_t	*node;
+	int					stack[64], depth, *items, n, i;
+
+	if ( !bvh || !cm_leafBVH->integer ) {
+		*count = numItems;
+		return NULL;
+	}
+
+	if ( (int)tw->tc->leafItems.size() < numItems ) {
+		tw->tc->leafItems.resize( numItems );
+	}
+	items = tw->tc->leafItems.data();
+
+	n = 0;
+	depth = 0;
+	stack[depth++] = 0;
+	while ( depth ) {
+		node = &bvh->nodes[stack[--depth]];
+
+		// the same test the brushes and patches do against their own bounds
+		if ( tw->bounds[0][0] > node->bounds[1][0]
+			|| tw->bounds[0][1] > node->bounds[1][1]
+			|| tw->bounds[0][2] > node->bounds[1][2]
+			|| tw->bounds[1][0] < node->bounds[0][0]
+			|| tw->bounds[1][1] < node->bounds[0][1]
+			|| tw->bounds[1][2] < node->bounds[0][2]
+			|| !( node->contents & tw->contents ) ) {
+			continue;
+		}
+
+		if ( node->numItems ) {
+			for ( i = 0 ; i < node->numItems ; i++ ) {
+				items[n++] = bvh->items[node->firstItem + i];
+			}
+		} else {
+			stack[depth++] = node->firstItem;
+			stack[depth++] = node - bvh->nodes + 1;
+		}
+	}
+
+	std::sort( items, items + n );
+	*count = n;
+	return items;
+}
+
 /*
 ================
 CM_TestInLeaf
@@ -211,19 +657,21 @@ CM_TestInLeaf
 */
 void CM_TestInLeaf( traceWork_t *tw, trace_t &trace, cLeaf_t *leaf, clipMap_t *local )
 {
-	int			k;
-	int			brushnum;
+	int			i, k, count;
+	int			brushnum, surfacenum;
 	cbrush_t	*b;
 	cPatch_t	*patch;
+	const int	*items;
 
 	// test box position against all brushes in the leaf
-	for (k=0 ; k<leaf->numLeafBrushes ; k++) {
+	items = CM_CullLeafBVH( tw, leaf->brushBVH, leaf->numLeafBrushes, &count );
+	for (i=0 ; i<count ; i++) {
+		k = items ? items[i] : i;
 		brushnum = local->leafbrushes[leaf->firstLeafBrush+k];
-		b = &local->brushes[brushnum];
-		if (b->checkcount == local->checkcount) {
+		if ( CM_BrushChecked( tw->tc, local, brushnum ) ) {
 			continue;	// already checked this brush in another leaf
 		}
-		b->checkcount = local->checkcount;
+		b = CM_LeafBrush( tw->tc, local, brushnum );
 
 		if ( !(b->contents & tw->contents)) {
 			continue;
@@ -235,21 +683,22 @@ void CM_TestInLeaf( traceWork_t *tw, trace_t &trace, cLeaf_t *leaf, clipMap_t *l
 		}
 	}
 
-	// test against all patches
+	// test against all patches, the position test doesn't check their
+	// bounds so they can't be culled by the BVH
 #ifdef BSPC
 	if (1) {
 #else
 	if ( !cm_noCurves->integer ) {
 #endif //BSPC
 		for ( k = 0 ; k < leaf->numLeafSurfaces ; k++ ) {
-			patch = local->surfaces[ local->leafsurfaces[ leaf->firstLeafSurface + k ] ];
+			surfacenum = local->leafsurfaces[ leaf->firstLeafSurface + k ];
+			patch = local->surfaces[ surfacenum ];
 			if ( !patch ) {
 				continue;
 			}
-			if ( patch->checkcount == local->checkcount ) {
+			if ( CM_SurfaceChecked( tw->tc, local, surfacenum ) ) {
 				continue;	// already checked this brush in another leaf
 			}
-			patch->checkcount = local->checkcount;
 
 			if ( !(patch->contents & tw->contents)) {
 				continue;
@@ -399,13 +848,8 @@ void CM_PositionTest( traceWork_t *tw, trace_t &trace ) {
 	ll.lastLeaf = 0;
 	ll.overflowed = qfalse;
 
-	cmg.checkcount++;
-
 	CM_BoxLeafnums_r( &ll, 0 );
 
-
-	cmg.checkcount++;
-
 	// test the contents of the leafs
 	for (i=0 ; i < ll.count ; i++) {
 		CM_TestInLeaf( tw, trace, &cmg.leafs[leafs[i]], &cmg );
@@ -433,7 +877,7 @@ CM_TraceThroughPatch
 void CM_TraceThroughPatch( traceWork_t *tw, trace_t &trace, cPatch_t *patch ) {
 	float		oldFrac;
 
-	c_patch_traces++;
+	CM_COUNT( tw->tc->patchTraces );
 
 	oldFrac = trace.fraction;
 
@@ -455,7 +899,7 @@ CM_PlaneCollision
 
 bool CM_PlaneCollision(traceWork_t *tw, cbrushside_t *side)
 {
-	float			dist, f;
+	float			dist;
 	float			d1, d2;
 
 	cplane_t		*plane = side->plane;
@@ -489,42 +933,7 @@ bool CM_PlaneCollision(traceWork_t *tw, cbrushside_t *side)
 		return(true);
 	}
 	// crosses face
-	if (d1 > d2)
-	{	// enter
-		f = (d1 - SURFACE_CLIP_EPSILON);
-		if ( f < 0.0f )
-		{
-			f = 0.0f;
-			if (f > tw->enterFrac)
-			{
-				tw->enterFrac = f;
-				tw->clipplane = plane;
-				tw->leadside = side;
-			}
-		}
-		else if (f > tw->enterFrac * (d1 - d2) )
-		{
-			tw->enterFrac = f / (d1 - d2);
-			tw->clipplane = plane;
-			tw->leadside = side;
-		}
-	}
-	else
-	{	// leave
-		f = (d1 + SURFACE_CLIP_EPSILON);
-		if ( f < (d1 - d2) )
-		{
-			f = 1.0f;
-			if (f < tw->leaveFrac)
-			{
-				tw->leaveFrac = f;
-			}
-		}
-		else if (f > tw->leaveFrac * (d1 - d2) )
-		{
-			tw->leaveFrac = f / (d1 - d2);
-		}
-	}
+	CM_ClipToSide(tw, side, d1, d2);
 	return(true);
 }
 
@@ -535,9 +944,6 @@ CM_TraceThroughBrush
 */
 void CM_TraceThroughBrush( traceWork_t *tw, trace_t &trace, cbrush_t *brush, bool infoOnly )
 {
-	int				i;
-	cbrushside_t	*side;
-
 	tw->enterFrac = -1.0f;
 	tw->leaveFrac = 1.0f;
 	tw->clipplane = NULL;
@@ -560,6 +966,8 @@ void CM_TraceThroughBrush( traceWork_t *tw, trace_t &trace, cbrush_t *brush, boo
 		return;
 	}
 
+	CM_COUNT( tw->tc->brushTraces );
+
 	tw->getout = false;
 	tw->startout = false;
 	tw->leadside = NULL;
@@ -569,14 +977,9 @@ void CM_TraceThroughBrush( traceWork_t *tw, trace_t &trace, cbrush_t *brush, boo
 	// find the latest time the trace crosses a plane towards the interior
 	// and the earliest time the trace crosses a plane towards the exterior
 	//
-	for (i = 0; i < brush->numsides; i++)
+	if (!cm_brushKernel->traceSides(tw, brush))
 	{
-		side = brush->sides + i;
-
-		if(!CM_PlaneCollision(tw, side))
-		{
-			return;
-		}
+		return;
 	}
 
 	//
@@ -649,20 +1052,22 @@ CM_TraceThroughLeaf
 ================
 */
 void CM_TraceThroughLeaf( traceWork_t *tw, trace_t &trace, clipMap_t *local, cLeaf_t *leaf ) {
-	int			k;
-	int			brushnum;
+	int			i, k, count;
+	int			brushnum, surfacenum;
 	cbrush_t	*b;
 	cPatch_t	*patch;
+	const int	*items;
 
 	// trace line against all brushes in the leaf
-	for ( k = 0 ; k < leaf->numLeafBrushes ; k++ ) {
+	items = CM_CullLeafBVH( tw, leaf->brushBVH, leaf->numLeafBrushes, &count );
+	for ( i = 0 ; i < count ; i++ ) {
+		k = items ? items[i] : i;
 		brushnum = local->leafbrushes[leaf->firstLeafBrush+k];
 
-		b = &local->brushes[brushnum];
-		if ( b->checkcount == local->checkcount ) {
+		if ( CM_BrushChecked( tw->tc, local, brushnum ) ) {
 			continue;	// already checked this brush in another leaf
 		}
-		b->checkcount = local->checkcount;
+		b = CM_LeafBrush( tw->tc, local, brushnum );
 
 		if ( !(b->contents & tw->contents) ) {
 			continue;
@@ -681,15 +1086,17 @@ void CM_TraceThroughLeaf( traceWork_t *tw, trace_t &trace, clipMap_t *local, cLe
 #else
 	if ( !cm_noCurves->integer ) {
 #endif
-		for ( k = 0 ; k < leaf->numLeafSurfaces ; k++ ) {
-			patch = local->surfaces[ local->leafsurfaces[ leaf->firstLeafSurface + k ] ];
+		items = CM_CullLeafBVH( tw, leaf->patchBVH, leaf->numLeafSurfaces, &count );
+		for ( i = 0 ; i < count ; i++ ) {
+			k = items ? items[i] : i;
+			surfacenum = local->leafsurfaces[ leaf->firstLeafSurface + k ];
+			patch = local->surfaces[ surfacenum ];
 			if ( !patch ) {
 				continue;
 			}
-			if ( patch->checkcount == local->checkcount ) {
+			if ( CM_SurfaceChecked( tw->tc, local, surfacenum ) ) {
 				continue;	// already checked this patch in another leaf
 			}
-			patch->checkcount = local->checkcount;
 
 			if ( !(patch->contents & tw->contents) ) {
 				continue;
@@ -1006,7 +1413,7 @@ CM_TraceToLeaf
 void CM_TraceToLeaf( traceWork_t *tw, trace_t &trace, cLeaf_t *leaf, clipMap_t *local )
 {
 	int			k;
-	int			brushnum;
+	int			brushnum, surfacenum;
 	cbrush_t	*b;
 	cPatch_t	*patch;
 
@@ -1015,12 +1422,11 @@ void CM_TraceToLeaf( traceWork_t *tw, trace_t &trace, cLeaf_t *leaf, clipMap_t *
 	{
 		brushnum = local->leafbrushes[leaf->firstLeafBrush + k];
 
-		b = &local->brushes[brushnum];
-		if ( b->checkcount == local->checkcount )
+		if ( CM_BrushChecked( tw->tc, local, brushnum ) )
 		{
 			continue;	// already checked this brush in another leaf
 		}
-		b->checkcount = local->checkcount;
+		b = CM_LeafBrush( tw->tc, local, brushnum );
 
 		if ( !(b->contents & tw->contents) )
 		{
@@ -1041,14 +1447,14 @@ void CM_TraceToLeaf( traceWork_t *tw, trace_t &trace, cLeaf_t *leaf, clipMap_t *
 	if ( !cm_noCurves->integer ) {
 #endif
 		for ( k = 0 ; k < leaf->numLeafSurfaces ; k++ ) {
-			patch = local->surfaces[ local->leafsurfaces[ leaf->firstLeafSurface + k ] ];
+			surfacenum = local->leafsurfaces[ leaf->firstLeafSurface + k ];
+			patch = local->surfaces[ surfacenum ];
 			if ( !patch ) {
 				continue;
 			}
-			if ( patch->checkcount == local->checkcount ) {
+			if ( CM_SurfaceChecked( tw->tc, local, surfacenum ) ) {
 				continue;	// already checked this patch in another leaf
 			}
-			patch->checkcount = local->checkcount;
 
 			if ( !(patch->contents & tw->contents) ) {
 				continue;
@@ -1225,12 +1631,13 @@ void CM_Trace( trace_t *trace, const vec3_t start, const vec3_t end,
 
 	cmod = CM_ClipHandleToModel( model, &local );
 
-	local->checkcount++;		// for multi-check avoidance
-
-	c_traces++;				// for statistics, may be zeroed
-
 	// fill in a default trace
 	Com_Memset( &tw, 0, sizeof(tw) );
+	tw.tc = CM_TraceContext();
+
+	CM_BeginTrace( tw.tc );		// for multi-check avoidance
+
+	CM_COUNT( tw.tc->traces );	// for statistics, may be zeroed
 	memset(trace, 0, sizeof(*trace));
 	trace->fraction = 1;	// assume it goes the entire distance until shown otherwise
 	VectorCopy(origin, tw.modelOrigin);
@@ -1456,6 +1863,262 @@ void CM_Trace( trace_t *trace, const vec3_t start, const vec3_t end,
                VectorLengthSquared(trace->plane.normal) > 0.9999);
 }
 
+/*
+===============================================================================
+
+TRACE RECORDING
+
+tracerecord saves the box traces run while playing a map so tracereplay can
+time them again later with every brush kernel and check the kernels agree.
+
+===============================================================================
+*/
+
+#define	TRACE_RECORD_IDENT		(('R'<<24)+('T'<<16)+('M'<<8)+'C')
+#define	TRACE_RECORD_VERSION	1
+#define	TRACE_RECORD_DEFAULT	200000
+
+typedef struct traceRecordHeader_s {
+	int			ident;
+	int			version;
+	char		mapname[MAX_QPATH];
+	int			numTraces;
+} traceRecordHeader_t;
+
+// stored in native byte order
+typedef struct traceRecord_s {
+	vec3_t		start, end;
+	vec3_t		mins, maxs;
+	vec3_t		origin, angles;
+	vec3_t		boxMins, boxMaxs;		// for the box and capsule models
+	int			model;
+	int			brushmask;
+	int			capsule;
+	int			transformed;
+} traceRecord_t;
+
+static std::atomic<bool>			cm_traceRecording( false );
+static std::mutex					cm_traceRecordLock;
+static std::vector<traceRecord_t>	cm_traceRecords;
+static size_t						cm_traceRecordMax;
+static char							cm_traceRecordName[MAX_QPATH];
+
+static void CM_RecordTrace( const vec3_t start, const vec3_t end, const vec3_t mins, const vec3_t maxs,
+						   clipHandle_t model, int brushmask, const vec3_t origin, const vec3_t angles, int capsule ) {
+	traceRecord_t	rec;
+
+	Com_Memset( &rec, 0, sizeof( rec ) );
+	VectorCopy( start, rec.start );
+	VectorCopy( end, rec.end );
+	if ( mins ) {
+		VectorCopy( mins, rec.mins );
+	}
+	if ( maxs ) {
+		VectorCopy( maxs, rec.maxs );
+	}
+	if ( origin ) {
+		VectorCopy( origin, rec.origin );
+		VectorCopy( angles, rec.angles );
+		rec.transformed = 1;
+	}
+	if ( model == BOX_MODEL_HANDLE || model == CAPSULE_MODEL_HANDLE ) {
+		cmodel_t *box = &CM_TraceContext()->boxModel;
+
+		VectorCopy( box->mins, rec.boxMins );
+		VectorCopy( box->maxs, rec.boxMaxs );
+	}
+	rec.model = model;
+	rec.brushmask = brushmask;
+	rec.capsule = capsule;
+
+	std::lock_guard<std::mutex> lock( cm_traceRecordLock );
+	if ( cm_traceRecords.size() < cm_traceRecordMax ) {
+		cm_traceRecords.push_back( rec );
+	}
+}
+
+/*
+==================
+CM_StopTraceRecord
+
+Writes out the traces recorded so far, also called when the map is cleared
+==================
+*/
+void CM_StopTraceRecord( void ) {
+	traceRecordHeader_t	header;
+	fileHandle_t		f;
+
+	if ( !cm_traceRecording ) {
+		return;
+	}
+	cm_traceRecording = false;
+
+	f = FS_FOpenFileWrite( cm_traceRecordName );
+	if ( !f ) {
+		Com_Printf( "Couldn't write %s\n", cm_traceRecordName );
+	} else {
+		Com_Memset( &header, 0, sizeof( header ) );
+		header.ident = TRACE_RECORD_IDENT;
+		header.version = TRACE_RECORD_VERSION;
+		Q_strncpyz( header.mapname, cmg.name, sizeof( header.mapname ) );
+		header.numTraces = (int)cm_traceRecords.size();
+		FS_Write( &header, sizeof( header ), f );
+		FS_Write( cm_traceRecords.data(), header.numTraces * sizeof( traceRecord_t ), f );
+		FS_FCloseFile( f );
+		Com_Printf( "Wrote %i traces to %s\n", header.numTraces, cm_traceRecordName );
+	}
+
+	cm_traceRecords.clear();
+	cm_traceRecords.shrink_to_fit();
+}
+
+/*
+==================
+CM_TraceRecord_f
+
+tracerecord <file> [count]
+tracerecord stop
+==================
+*/
+void CM_TraceRecord_f( void ) {
+	if ( Cmd_Argc() < 2 ) {
+		Com_Printf( "usage: tracerecord <file> [count] | stop\n" );
+		return;
+	}
+	if ( !Q_stricmp( Cmd_Argv( 1 ), "stop" ) ) {
+		if ( !cm_traceRecording ) {
+			Com_Printf( "Not recording traces.\n" );
+		}
+		CM_StopTraceRecord();
+		return;
+	}
+	if ( !cmg.name[0] ) {
+		Com_Printf( "No map loaded.\n" );
+		return;
+	}
+
+	CM_StopTraceRecord();
+
+	Q_strncpyz( cm_traceRecordName, Cmd_Argv( 1 ), sizeof( cm_traceRecordName ) );
+	COM_DefaultExtension( cm_traceRecordName, sizeof( cm_traceRecordName ), ".trc" );
+	cm_traceRecordMax = Cmd_Argc() > 2 ? Com_Clampi( 1, 10000000, atoi( Cmd_Argv( 2 ) ) ) : TRACE_RECORD_DEFAULT;
+	cm_traceRecords.reserve( cm_traceRecordMax );
+	cm_traceRecording = true;
+
+	Com_Printf( "Recording up to %i traces to %s\n", (int)cm_traceRecordMax, cm_traceRecordName );
+}
+
+static void CM_ReplayTrace( const traceRecord_t *rec, trace_t *tr ) {
+	clipHandle_t	model = rec->model;
+
+	if ( model == BOX_MODEL_HANDLE || model == CAPSULE_MODEL_HANDLE ) {
+		model = CM_TempBoxModel( rec->boxMins, rec->boxMaxs, model == CAPSULE_MODEL_HANDLE );
+	}
+	if ( rec->transformed ) {
+		CM_TransformedBoxTrace( tr, rec->start, rec->end, rec->mins, rec->maxs, model, rec->brushmask, rec->origin, rec->angles, rec->capsule );
+	} else {
+		CM_BoxTrace( tr, rec->start, rec->end, rec->mins, rec->maxs, model, rec->brushmask, rec->capsule );
+	}
+}
+
+/*
+==================
+CM_TraceReplay_f
+
+tracereplay <file> [passes]
+
+Runs recorded traces against the loaded map with the stock code and then
+with leaf BVHs and each brush kernel the CPU supports, checks they all give
+the same traces bit for bit and prints how long each took
+==================
+*/
+void CM_TraceReplay_f( void ) {
+	traceRecordHeader_t	*header;
+	traceRecord_t		*records;
+	trace_t				*results[2];
+	char				name[MAX_QPATH], leafBVH[16];
+	byte				*file;
+	int					fileLen, passes, kernel, pass, i, mismatches, msec, scalarMsec;
+
+	if ( Cmd_Argc() < 2 ) {
+		Com_Printf( "usage: tracereplay <file> [passes]\n" );
+		return;
+	}
+	if ( cm_traceRecording ) {
+		Com_Printf( "Can't replay traces while recording them.\n" );
+		return;
+	}
+	passes = Cmd_Argc() > 2 ? Com_Clampi( 1, 1000, atoi( Cmd_Argv( 2 ) ) ) : 5;
+	Q_strncpyz( leafBVH, cm_leafBVH->string, sizeof( leafBVH ) );
+
+	Q_strncpyz( name, Cmd_Argv( 1 ), sizeof( name ) );
+	COM_DefaultExtension( name, sizeof( name ), ".trc" );
+	fileLen = FS_ReadFile( name, (void **)&file );
+	if ( !file ) {
+		Com_Printf( "Couldn't read %s\n", name );
+		return;
+	}
+
+	header = (traceRecordHeader_t *)file;
+	if ( fileLen < (int)sizeof( *header ) || header->ident != TRACE_RECORD_IDENT || header->version != TRACE_RECORD_VERSION
+		|| header->numTraces < 0 || fileLen < (int)( sizeof( *header ) + header->numTraces * sizeof( traceRecord_t ) ) ) {
+		Com_Printf( "%s is not a trace recording\n", name );
+		FS_FreeFile( file );
+		return;
+	}
+	if ( Q_stricmp( header->mapname, cmg.name ) ) {
+		Com_Printf( "%s was recorded on %s, load that map first\n", name, header->mapname );
+		FS_FreeFile( file );
+		return;
+	}
+	records = (traceRecord_t *)( header + 1 );
+
+	results[0] = (trace_t *)Z_Malloc( header->numTraces * sizeof( trace_t ), TAG_TEMP_WORKSPACE, qtrue );
+	results[1] = (trace_t *)Z_Malloc( header->numTraces * sizeof( trace_t ), TAG_TEMP_WORKSPACE, qtrue );
+
+	// the first run is the stock code, scalar and without leaf BVHs
+	scalarMsec = 0;
+	for ( kernel = -1 ; kernel < CM_NumBrushKernels() ; kernel++ ) {
+		trace_t *out = results[kernel < 0 ? 0 : 1];
+
+		CM_SetBrushKernel( Q_max( kernel, 0 ) );
+		Cvar_Set( "cm_leafBVH", kernel < 0 ? "0" : leafBVH );
+
+		msec = Sys_Milliseconds();
+		for ( pass = 0 ; pass < passes ; pass++ ) {
+			for ( i = 0 ; i < header->numTraces ; i++ ) {
+				CM_ReplayTrace( &records[i], &out[i] );
+			}
+		}
+		msec = Sys_Milliseconds() - msec;
+
+		mismatches = 0;
+		if ( kernel >= 0 ) {
+			for ( i = 0 ; i < header->numTraces ; i++ ) {
+				if ( memcmp( &results[0][i], &results[1][i], sizeof( trace_t ) ) ) {
+					if ( !mismatches ) {
+						Com_Printf( S_COLOR_RED "trace %i differs: fraction %f/%f\n", i, results[1][i].fraction, results[0][i].fraction );
+					}
+					mismatches++;
+				}
+			}
+		} else {
+			scalarMsec = msec;
+		}
+
+		Com_Printf( "%-8s %-7s %6i msec for %i x %i traces, %.2fx stock, %s%i mismatches\n", CM_BrushKernelName(),
+			cm_leafBVH->integer ? "bvh" : "no bvh", msec, passes, header->numTraces, (float)scalarMsec / Q_max( 1, msec ),
+			mismatches ? S_COLOR_RED : "", mismatches );
+	}
+
+	CM_SelectBrushKernels();
+	Cvar_Set( "cm_leafBVH", leafBVH );
+
+	Z_Free( results[1] );
+	Z_Free( results[0] );
+	FS_FreeFile( file );
+}
+
 /*
 ==================
 CM_BoxTrace
@@ -1464,6 +2127,9 @@ CM_BoxTrace
 void CM_BoxTrace( trace_t *results, const vec3_t start, const vec3_t end,
 						  const vec3_t mins, const vec3_t maxs,
 						  clipHandle_t model, int brushmask, int capsule ) {
+	if ( cm_traceRecording.load( std::memory_order_relaxed ) ) {
+		CM_RecordTrace( start, end, mins, maxs, model, brushmask, NULL, NULL, capsule );
+	}
 	CM_Trace( results, start, end, mins, maxs, model, vec3_origin, brushmask, capsule, NULL );
 }
 
@@ -1490,6 +2156,10 @@ void CM_TransformedBoxTrace( trace_t *trace, const vec3_t start, const vec3_t en
 	float		t;
 	sphere_t	sphere;
 
+	if ( cm_traceRecording.load( std::memory_order_relaxed ) ) {
+		CM_RecordTrace( start, end, mins, maxs, model, brushmask, origin, angles, capsule );
+	}
+
 	if ( !mins ) {
 		mins = vec3_origin;
 	}
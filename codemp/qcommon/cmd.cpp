@@ -346,6 +346,7 @@ typedef struct cmd_function_s
 	char					*description;
 	xcommand_t				function;
 	completionFunc_t		complete;
+	uint32_t				hash;
 } cmd_function_t;
 
 
@@ -357,6 +358,15 @@ static	char		cmd_cmd[BIG_INFO_STRING]; // the original command we received (no t
 
 static	cmd_function_t	*cmd_functions;		// possible commands to execute
 
+// cmd_functions by name, open addressing with linear probing
+#define	CMD_HASH_MIN_SIZE	512
+
+static	cmd_function_t	**cmd_hashTable;
+static	int				cmd_hashSize;		// power of 2
+static	int				cmd_hashUsed;		// commands plus removed entries
+static	int				cmd_numFunctions;
+static	cmd_function_t	cmd_hashRemoved;	// marks an entry whose command was removed
+
 
 /*
 ============
@@ -632,6 +642,67 @@ void Cmd_TokenizeStringIgnoreQuotes( const char *text_in ) {
 	Cmd_TokenizeString2( text_in, qtrue );
 }
 
+/*
+============
+Cmd_HashName
+============
+*/
+static uint32_t Cmd_HashName( const char *cmd_name ) {
+	uint32_t	hash;
+
+	hash = 2166136261u;
+	for ( ; *cmd_name ; cmd_name++ ) {
+		hash = ( hash ^ (byte)tolower( (unsigned char)*cmd_name ) ) * 16777619u;
+	}
+	return hash;
+}
+
+/*
+============
+Cmd_HashInsert
+============
+*/
+static void Cmd_HashInsert( cmd_function_t *cmd ) {
+	int		i;
+
+	for ( i = cmd->hash & (cmd_hashSize-1) ; cmd_hashTable[i] && cmd_hashTable[i] != &cmd_hashRemoved ; i = (i+1) & (cmd_hashSize-1) ) {
+	}
+	if ( !cmd_hashTable[i] ) {
+		cmd_hashUsed++;
+	}
+	cmd_hashTable[i] = cmd;
+}
+
+/*
+============
+Cmd_HashRebuild
+
+Sizes the table for the current commands and drops the removed entries
+============
+*/
+static void Cmd_HashRebuild( void ) {
+	cmd_function_t	*cmd;
+	int				size;
+
+	for ( size = CMD_HASH_MIN_SIZE ; size < cmd_numFunctions * 2 ; size <<= 1 ) {
+	}
+
+	if ( cmd_hashTable && size == cmd_hashSize ) {
+		memset( cmd_hashTable, 0, cmd_hashSize * sizeof( *cmd_hashTable ) );
+	} else {
+		if ( cmd_hashTable ) {
+			Z_Free( cmd_hashTable );
+		}
+		cmd_hashTable = (cmd_function_t **)Z_Malloc( size * sizeof( *cmd_hashTable ), TAG_GENERAL, qtrue );
+		cmd_hashSize = size;
+	}
+
+	cmd_hashUsed = 0;
+	for ( cmd = cmd_functions ; cmd ; cmd = cmd->next ) {
+		Cmd_HashInsert( cmd );
+	}
+}
+
 /*
 ============
 Cmd_FindCommand
@@ -639,10 +710,19 @@ Cmd_FindCommand
 */
 cmd_function_t *Cmd_FindCommand( const char *cmd_name )
 {
-	cmd_function_t *cmd;
-	for( cmd = cmd_functions; cmd; cmd = cmd->next )
-		if( !Q_stricmp( cmd_name, cmd->name ) )
+	cmd_function_t	*cmd;
+	uint32_t		hash;
+	int				i;
+
+	if ( !cmd_hashTable ) {
+		return NULL;
+	}
+
+	hash = Cmd_HashName( cmd_name );
+	for ( i = hash & (cmd_hashSize-1) ; (cmd = cmd_hashTable[i]) != NULL ; i = (i+1) & (cmd_hashSize-1) ) {
+		if ( cmd->hash == hash && cmd != &cmd_hashRemoved && !Q_stricmp( cmd_name, cmd->name ) )
 			return cmd;
+	}
 	return NULL;
 }
 
@@ -673,8 +753,18 @@ void	Cmd_AddCommand( const char *cmd_name, xcommand_t function, const char *cmd_
 		cmd->description = NULL;
 	cmd->function = function;
 	cmd->complete = NULL;
+	cmd->hash = Cmd_HashName( cmd_name );
 	cmd->next = cmd_functions;
 	cmd_functions = cmd;
+
+	cmd_numFunctions++;
+
+	// keep the table at most half full, removed entries included
+	if ( (cmd_hashUsed + 1) * 2 > cmd_hashSize ) {
+		Cmd_HashRebuild();
+	} else {
+		Cmd_HashInsert( cmd );
+	}
 }
 
 void Cmd_AddCommandList( const cmdList_t *cmdList )
@@ -701,10 +791,10 @@ Cmd_SetCommandCompletionFunc
 ============
 */
 void Cmd_SetCommandCompletionFunc( const char *command, completionFunc_t complete ) {
-	for ( cmd_function_t *cmd=cmd_functions; cmd; cmd=cmd->next ) {
-		if ( !Q_stricmp( command, cmd->name ) )
-			cmd->complete = complete;
-	}
+	cmd_function_t *cmd = Cmd_FindCommand( command );
+
+	if ( cmd )
+		cmd->complete = complete;
 }
 
 /*
@@ -714,23 +804,26 @@ Cmd_RemoveCommand
 */
 void	Cmd_RemoveCommand( const char *cmd_name ) {
 	cmd_function_t	*cmd, **back;
+	int				i;
 
-	back = &cmd_functions;
-	while( 1 ) {
-		cmd = *back;
-		if ( !cmd ) {
-			// command wasn't active
-			return;
-		}
-		if ( !strcmp( cmd_name, cmd->name ) ) {
-			*back = cmd->next;
-			Z_Free(cmd->name);
-			Z_Free(cmd->description);
-			Z_Free (cmd);
-			return;
-		}
-		back = &cmd->next;
+	cmd = Cmd_FindCommand( cmd_name );
+	if ( !cmd || strcmp( cmd_name, cmd->name ) ) {
+		// command wasn't active
+		return;
+	}
+
+	for ( i = cmd->hash & (cmd_hashSize-1) ; cmd_hashTable[i] != cmd ; i = (i+1) & (cmd_hashSize-1) ) {
+	}
+	cmd_hashTable[i] = &cmd_hashRemoved;
+	cmd_numFunctions--;
+
+	for ( back = &cmd_functions ; *back != cmd ; back = &(*back)->next ) {
 	}
+	*back = cmd->next;
+
+	Z_Free(cmd->name);
+	Z_Free(cmd->description);
+	Z_Free (cmd);
 }
 
 /*
@@ -806,10 +899,10 @@ Cmd_CompleteArgument
 ============
 */
 void Cmd_CompleteArgument( const char *command, char *args, int argNum ) {
-	for ( cmd_function_t *cmd=cmd_functions; cmd; cmd=cmd->next ) {
-		if ( !Q_stricmp( command, cmd->name ) && cmd->complete )
-			cmd->complete( args, argNum );
-	}
+	cmd_function_t *cmd = Cmd_FindCommand( command );
+
+	if ( cmd && cmd->complete )
+		cmd->complete( args, argNum );
 }
 
 /*
@@ -820,7 +913,7 @@ A complete command line has been parsed, so try to execute it
 ============
 */
 void	Cmd_ExecuteString( const char *text ) {
-	cmd_function_t	*cmd, **prev;
+	cmd_function_t	*cmd;
 
 	// execute the command line
 	Cmd_TokenizeString( text );
@@ -828,25 +921,13 @@ void	Cmd_ExecuteString( const char *text ) {
 		return;		// no tokens
 	}
 
-	// check registered command functions
-	for ( prev = &cmd_functions ; *prev ; prev = &cmd->next ) {
-		cmd = *prev;
-		if ( !Q_stricmp( Cmd_Argv(0), cmd->name ) ) {
-			// rearrange the links so that the command will be
-			// near the head of the list next time it is used
-			*prev = cmd->next;
-			cmd->next = cmd_functions;
-			cmd_functions = cmd;
-
-			// perform the action
-			if ( !cmd->function ) {
-				// let the cgame or game handle it
-				break;
-			} else {
-				cmd->function ();
-			}
-			return;
-		}
+	// check registered command functions, the cgame or game handle the
+	// ones without a function
+	cmd = Cmd_FindCommand( Cmd_Argv(0) );
+	if ( cmd && cmd->function ) {
+		// perform the action
+		cmd->function ();
+		return;
 	}
 
 	// check cvars
@@ -946,6 +1027,66 @@ static void Cmd_PrintHelp_f( void )
 		Com_Printf( "Command %s does not exist.\n", name );
 }
 
+/*
+============
+Cmd_Benchmark_f
+
+Looks every command up by walking the command list, the way
+Cmd_ExecuteString used to, then through the hash table
+============
+*/
+#define CMD_BENCH_LOOKUPS	1000000
+
+static void Cmd_Benchmark_f( void ) {
+	const cmd_function_t	*cmd;
+	const char				**names;
+	int						numNames, i, start, msec[2];
+	int						misses[2];
+
+	if ( !cmd_numFunctions ) {
+		return;
+	}
+
+	names = (const char **)Z_Malloc( cmd_numFunctions * sizeof( *names ), TAG_TEMP_WORKSPACE, qfalse );
+	numNames = 0;
+	for ( cmd = cmd_functions ; cmd ; cmd = cmd->next ) {
+		names[numNames++] = cmd->name;
+	}
+
+	misses[0] = misses[1] = 0;
+
+	start = Sys_Milliseconds();
+	for ( i = 0 ; i < CMD_BENCH_LOOKUPS ; i++ ) {
+		const char *name = names[i % numNames];
+		for ( cmd = cmd_functions ; cmd ; cmd = cmd->next ) {
+			if ( !Q_stricmp( name, cmd->name ) ) {
+				break;
+			}
+		}
+		if ( !cmd ) {
+			misses[0]++;
+		}
+	}
+	msec[0] = Sys_Milliseconds() - start;
+
+	start = Sys_Milliseconds();
+	for ( i = 0 ; i < CMD_BENCH_LOOKUPS ; i++ ) {
+		if ( !Cmd_FindCommand( names[i % numNames] ) ) {
+			misses[1]++;
+		}
+	}
+	msec[1] = Sys_Milliseconds() - start;
+
+	Z_Free( (void *)names );
+
+	Com_Printf( "%i lookups over %i commands\n", CMD_BENCH_LOOKUPS, numNames );
+	Com_Printf( "list: %5i msec, %6.1f nsec per lookup\n", msec[0], msec[0] * 1000000.0 / CMD_BENCH_LOOKUPS );
+	Com_Printf( "hash: %5i msec, %6.1f nsec per lookup\n", msec[1], msec[1] * 1000000.0 / CMD_BENCH_LOOKUPS );
+	if ( misses[0] || misses[1] ) {
+		Com_Printf( S_COLOR_RED "%i and %i lookups missed\n", misses[0], misses[1] );
+	}
+}
+
 /*
 ==================
 Cmd_CompleteCmdName
@@ -991,5 +1132,6 @@ void Cmd_Init (void) {
 	Cmd_AddCommand( "vstr", Cmd_Vstr_f, "Execute the value of a cvar" );
 	Cmd_SetCommandCompletionFunc( "vstr", Cvar_CompleteCvarName );
 	Cmd_AddCommand( "wait", Cmd_Wait_f, "Pause command buffer execution" );
+	Cmd_AddCommand( "cmd_benchmark", Cmd_Benchmark_f, "Time command lookups through the list and the hash" );
 }
 
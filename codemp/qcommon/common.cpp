@@ -871,16 +871,21 @@ int Com_EventLoop( void ) {
 	byte		bufData[MAX_MSGLEN];
 	msg_t		buf;
 
-	MSG_Init( &buf, bufData, sizeof( bufData ) );
-
 	while ( 1 ) {
 		ev = Com_GetEvent();
 
 		// if no more events are available
 		if ( ev.evType == SE_NONE ) {
-			// manually send packet events for the loopback channel
+			// packets the receive thread picked up since the last NET_Sleep
+			NET_ProcessReceiveQueue();
+
+			// manually send packet events for the loopback channel, buf is
+			// set up again each time as netchan may point it at its own
+			// reassembly buffer
+			MSG_Init( &buf, bufData, sizeof( bufData ) );
 			while ( NET_GetLoopPacket( NS_CLIENT, &evFrom, &buf ) ) {
 				CL_PacketEvent( evFrom, &buf );
+				MSG_Init( &buf, bufData, sizeof( bufData ) );
 			}
 
 			while ( NET_GetLoopPacket( NS_SERVER, &evFrom, &buf ) ) {
@@ -888,6 +893,7 @@ int Com_EventLoop( void ) {
 				if ( com_sv_running->integer ) {
 					Com_RunAndTimeServerPacket( &evFrom, &buf );
 				}
+				MSG_Init( &buf, bufData, sizeof( bufData ) );
 			}
 
 			return ev.evTime;
@@ -1177,6 +1183,9 @@ void Com_Init( char *commandLine ) {
 			Cmd_AddCommand ("freeze", Com_Freeze_f);
 		}
 		Cmd_AddCommand ("quit", Com_Quit_f, "Quits the game" );
+		Cmd_AddCommand ("huffbench", MSG_HuffmanBenchmark_f, "Compare message huffman coding speed on a demo" );
+		Cmd_AddCommand ("tracerecord", CM_TraceRecord_f, "Record the collision traces run on the current map to a file" );
+		Cmd_AddCommand ("tracereplay", CM_TraceReplay_f, "Time recorded collision traces with and without the collision speedups" );
 #ifndef FINAL_BUILD
 		Cmd_AddCommand ("changeVectors", MSG_ReportChangeVectors_f );
 #endif
@@ -1618,16 +1627,11 @@ void Com_Frame( void ) {
 		// trace optimization tracking
 		//
 		if ( com_showtrace->integer ) {
+			int		c_traces, c_brush_traces, c_patch_traces, c_pointcontents;
 
-			extern	int c_traces, c_brush_traces, c_patch_traces;
-			extern	int	c_pointcontents;
-
+			CM_TraceStats( &c_traces, &c_brush_traces, &c_patch_traces, &c_pointcontents, qtrue );
 			Com_Printf ("%4i traces  (%ib %ip) %4i points\n", c_traces,
 				c_brush_traces, c_patch_traces, c_pointcontents);
-			c_traces = 0;
-			c_brush_traces = 0;
-			c_patch_traces = 0;
-			c_pointcontents = 0;
 		}
 
 		if ( com_affinity->modified )
@@ -1664,6 +1668,8 @@ Com_Shutdown
 void MSG_shutdownHuffman();
 void Com_Shutdown (void)
 {
+	Com_ShutdownWorkers();
+
 	CM_ClearMap();
 
 	if (logfile) {
@@ -34,8 +34,21 @@ uint32_t	cvar_modifiedFlags;
 cvar_t		cvar_indexes[MAX_CVARS];
 int			cvar_numIndexes;
 
-#define FILE_HASH_SIZE		512
-static	cvar_t*		hashTable[FILE_HASH_SIZE];
+// Every cvar name is interned to a slot of cvar_indexes the first time it is
+// seen, and keeps that slot when the cvar is unset and created again, so a
+// slot number is a stable handle for the name. cvar_hashTable is an open
+// addressing table from name to slot.
+#define CVAR_HASH_SIZE		(MAX_CVARS*2)
+
+typedef struct cvarHashEntry_s {
+	uint32_t	hash;
+	int			slot;		// slot + 1, 0 for an empty entry
+} cvarHashEntry_t;
+
+static	cvarHashEntry_t	cvar_hashTable[CVAR_HASH_SIZE];
+static	char			*cvar_names[MAX_CVARS];
+static	int				cvar_numNames;
+static	qboolean		cvar_nameHandedOut[MAX_CVARS];	// Cvar_FindHandle gave the slot out, never reuse it
 static	qboolean cvar_sort = qfalse;
 
 static char *lastMemPool = NULL;
@@ -53,25 +66,109 @@ static void Cvar_FreeString(char *string)
 
 /*
 ================
-return a hash value for the filename
+Cvar_HashName
 ================
 */
-static long generateHashValue( const char *fname ) {
-	int		i;
-	long	hash;
-	char	letter;
+static uint32_t Cvar_HashName( const char *var_name ) {
+	uint32_t	hash;
 
-	hash = 0;
-	i = 0;
-	while (fname[i] != '\0') {
-		letter = tolower((unsigned char)fname[i]);
-		hash+=(long)(letter)*(i+119);
-		i++;
+	hash = 2166136261u;
+	for ( ; *var_name ; var_name++ ) {
+		hash = ( hash ^ (byte)tolower( (unsigned char)*var_name ) ) * 16777619u;
 	}
-	hash &= (FILE_HASH_SIZE-1);
 	return hash;
 }
 
+/*
+================
+Cvar_FindName
+
+Returns the slot var_name is interned to, or -1
+================
+*/
+static int Cvar_FindName( const char *var_name, uint32_t hash ) {
+	int		i;
+
+	for ( i = hash & (CVAR_HASH_SIZE-1) ; cvar_hashTable[i].slot ; i = (i+1) & (CVAR_HASH_SIZE-1) ) {
+		if ( cvar_hashTable[i].hash == hash && !Q_stricmp( var_name, cvar_names[cvar_hashTable[i].slot-1] ) ) {
+			return cvar_hashTable[i].slot-1;
+		}
+	}
+	return -1;
+}
+
+/*
+================
+Cvar_ForgetName
+
+Drops the name of a slot that has no cvar, pulling the rest of its probe run
+back over the hole so no lookup stops early
+================
+*/
+static void Cvar_ForgetName( int slot ) {
+	int		i, j, home;
+
+	for ( i = Cvar_HashName( cvar_names[slot] ) & (CVAR_HASH_SIZE-1) ; cvar_hashTable[i].slot != slot+1 ; i = (i+1) & (CVAR_HASH_SIZE-1) ) {
+	}
+	cvar_hashTable[i].slot = 0;
+
+	for ( j = (i+1) & (CVAR_HASH_SIZE-1) ; cvar_hashTable[j].slot ; j = (j+1) & (CVAR_HASH_SIZE-1) ) {
+		home = cvar_hashTable[j].hash & (CVAR_HASH_SIZE-1);
+		if ( ((j - home) & (CVAR_HASH_SIZE-1)) >= ((j - i) & (CVAR_HASH_SIZE-1)) ) {
+			cvar_hashTable[i] = cvar_hashTable[j];
+			cvar_hashTable[j].slot = 0;
+			i = j;
+		}
+	}
+
+	Z_Free( cvar_names[slot] );
+	cvar_names[slot] = NULL;
+}
+
+/*
+================
+Cvar_InternName
+
+Returns the slot of var_name, interning it if it's new, or -1 if every slot
+holds a cvar or has been handed out as a handle
+================
+*/
+static int Cvar_InternName( const char *var_name ) {
+	uint32_t	hash;
+	int			slot, i;
+
+	hash = Cvar_HashName( var_name );
+	slot = Cvar_FindName( var_name, hash );
+	if ( slot >= 0 ) {
+		return slot;
+	}
+
+	if ( cvar_numNames < MAX_CVARS ) {
+		slot = cvar_numNames++;
+	} else {
+		// out of fresh slots, take back the name of a cvar that is gone,
+		// unless someone may still be holding its slot as a handle
+		for ( slot = 0 ; slot < MAX_CVARS ; slot++ ) {
+			if ( !cvar_indexes[slot].name && !cvar_nameHandedOut[slot] ) {
+				break;
+			}
+		}
+		if ( slot >= MAX_CVARS ) {
+			return -1;
+		}
+		Com_DPrintf( S_COLOR_YELLOW "Cvar_InternName: reusing the slot of \"%s\" for \"%s\"\n", cvar_names[slot], var_name );
+		Cvar_ForgetName( slot );
+	}
+
+	cvar_names[slot] = CopyString( var_name );
+	for ( i = hash & (CVAR_HASH_SIZE-1) ; cvar_hashTable[i].slot ; i = (i+1) & (CVAR_HASH_SIZE-1) ) {
+	}
+	cvar_hashTable[i].hash = hash;
+	cvar_hashTable[i].slot = slot+1;
+
+	return slot;
+}
+
 /*
 ============
 Cvar_ValidateString
@@ -99,18 +196,27 @@ Cvar_FindVar
 ============
 */
 static cvar_t *Cvar_FindVar( const char *var_name ) {
-	cvar_t	*var;
-	long hash;
+	int		slot;
 
-	hash = generateHashValue(var_name);
+	slot = Cvar_FindName( var_name, Cvar_HashName( var_name ) );
+	if ( slot < 0 || !cvar_indexes[slot].name ) {
+		return NULL;
+	}
 
-	for (var=hashTable[hash] ; var ; var=var->hashNext) {
-		if (!Q_stricmp(var_name, var->name)) {
-			return var;
-		}
+	return &cvar_indexes[slot];
+}
+
+/*
+============
+Cvar_FromHandle
+============
+*/
+static cvar_t *Cvar_FromHandle( cvarHandle_t handle ) {
+	if ( (unsigned)handle >= (unsigned)cvar_numNames || !cvar_indexes[handle].name ) {
+		return NULL;
 	}
 
-	return NULL;
+	return &cvar_indexes[handle];
 }
 
 /*
@@ -206,6 +312,70 @@ uint32_t Cvar_Flags( const char *var_name ) {
 	}
 }
 
+/*
+============
+Cvar_FindHandle
+============
+*/
+cvarHandle_t Cvar_FindHandle( const char *var_name ) {
+	int		slot;
+
+	if ( !var_name || !Cvar_ValidateString( var_name ) ) {
+		return -1;
+	}
+
+	slot = Cvar_InternName( var_name );
+	if ( slot >= 0 ) {
+		cvar_nameHandedOut[slot] = qtrue;
+	}
+	return slot;
+}
+
+/*
+============
+Cvar_HandleValue
+============
+*/
+float Cvar_HandleValue( cvarHandle_t handle ) {
+	cvar_t	*var;
+
+	var = Cvar_FromHandle( handle );
+	if ( !var )
+		return 0;
+	return var->value;
+}
+
+/*
+============
+Cvar_HandleIntegerValue
+============
+*/
+int Cvar_HandleIntegerValue( cvarHandle_t handle ) {
+	cvar_t	*var;
+
+	var = Cvar_FromHandle( handle );
+	if ( !var )
+		return 0;
+	return var->integer;
+}
+
+/*
+============
+Cvar_HandleStringBuffer
+============
+*/
+void Cvar_HandleStringBuffer( cvarHandle_t handle, char *buffer, int bufsize ) {
+	cvar_t	*var;
+
+	var = Cvar_FromHandle( handle );
+	if ( !var ) {
+		*buffer = 0;
+	}
+	else {
+		Q_strncpyz( buffer, var->string, bufsize );
+	}
+}
+
 /*
 ============
 Cvar_CommandCompletion
@@ -336,7 +506,6 @@ The flags will be or'ed in if the variable exists.
 */
 cvar_t *Cvar_Get( const char *var_name, const char *var_value, uint32_t flags, const char *var_desc ) {
 	cvar_t	*var;
-	long	hash;
 	int		index;
 
     if ( !var_name || ! var_value ) {
@@ -442,14 +611,8 @@ cvar_t *Cvar_Get( const char *var_name, const char *var_value, uint32_t flags, c
 	// allocate a new cvar
 	//
 
-	// find a free cvar
-	for(index = 0; index < MAX_CVARS; index++)
-	{
-		if(!cvar_indexes[index].name)
-			break;
-	}
-
-	if(index >= MAX_CVARS)
+	index = Cvar_InternName( var_name );
+	if(index < 0)
 	{
 		if(!com_errorEntered)
 			Com_Error(ERR_FATAL, "Error: Too many cvars, cannot create a new one!");
@@ -462,7 +625,14 @@ cvar_t *Cvar_Get( const char *var_name, const char *var_value, uint32_t flags, c
 	if(index >= cvar_numIndexes)
 		cvar_numIndexes = index + 1;
 
-	var->name = CopyString (var_name);
+	// take the spelling of the latest creation
+	if(strcmp(cvar_names[index], var_name))
+	{
+		Z_Free(cvar_names[index]);
+		cvar_names[index] = CopyString(var_name);
+	}
+
+	var->name = cvar_names[index];
 	var->string = CopyString (var_value);
 	if ( var_desc && var_desc[0] != '\0' )
 		var->description = CopyString( var_desc );
@@ -487,16 +657,6 @@ cvar_t *Cvar_Get( const char *var_name, const char *var_value, uint32_t flags, c
 	// note what types of cvars have been modified (userinfo, archive, serverinfo, systeminfo)
 	cvar_modifiedFlags |= var->flags;
 
-	hash = generateHashValue(var_name);
-	var->hashIndex = hash;
-
-	var->hashNext = hashTable[hash];
-	if(hashTable[hash])
-		hashTable[hash]->hashPrev = var;
-
-	var->hashPrev = NULL;
-	hashTable[hash] = var;
-
 	// sort on write
 	cvar_sort = qtrue;
 
@@ -1296,8 +1456,7 @@ cvar_t *Cvar_Unset(cvar_t *cv)
 	// note what types of cvars have been modified (userinfo, archive, serverinfo, systeminfo)
 	cvar_modifiedFlags |= cv->flags;
 
-	if(cv->name)
-		Cvar_FreeString(cv->name);
+	// the name stays interned to this slot
 	if(cv->description)
 		Cvar_FreeString(cv->description);
 	if(cv->string)
@@ -1314,13 +1473,6 @@ cvar_t *Cvar_Unset(cvar_t *cv)
 	if(cv->next)
 		cv->next->prev = cv->prev;
 
-	if(cv->hashPrev)
-		cv->hashPrev->hashNext = cv->hashNext;
-	else
-		hashTable[cv->hashIndex] = cv->hashNext;
-	if(cv->hashNext)
-		cv->hashNext->hashPrev = cv->hashPrev;
-
 	memset(cv, 0, sizeof(*cv));
 
 	return next;
@@ -1573,6 +1725,94 @@ void Cvar_CompleteCvarName( char *args, int argNum )
 	}
 }
 
+/*
+============
+Cvar_Benchmark_f
+
+Looks every cvar up by name through a copy of the old 512 bucket chained
+hash, then through the interned name table, then by handle
+============
+*/
+#define CVAR_BENCH_LOOKUPS	4000000
+#define CVAR_BENCH_BUCKETS	512
+
+static int Cvar_BenchmarkChainHash( const char *var_name ) {
+	int		i, hash;
+
+	hash = 0;
+	for ( i = 0 ; var_name[i] ; i++ ) {
+		hash += tolower( (unsigned char)var_name[i] ) * (i+119);
+	}
+	return hash & (CVAR_BENCH_BUCKETS-1);
+}
+
+static void Cvar_Benchmark_f( void ) {
+	int		*slots, *chainNext;
+	int		chainHead[CVAR_BENCH_BUCKETS];
+	int		numSlots, i, j, start, msec[3];
+	unsigned int	checksum[3];
+	cvar_t	*var;
+
+	slots = (int *)Z_Malloc( cvar_numIndexes * sizeof( *slots ), TAG_TEMP_WORKSPACE, qfalse );
+	chainNext = (int *)Z_Malloc( cvar_numIndexes * sizeof( *chainNext ), TAG_TEMP_WORKSPACE, qfalse );
+
+	memset( chainHead, -1, sizeof( chainHead ) );
+	numSlots = 0;
+	for ( i = 0 ; i < cvar_numIndexes ; i++ ) {
+		if ( !cvar_indexes[i].name ) {
+			continue;
+		}
+		slots[numSlots++] = i;
+		j = Cvar_BenchmarkChainHash( cvar_indexes[i].name );
+		chainNext[i] = chainHead[j];
+		chainHead[j] = i;
+	}
+
+	if ( !numSlots ) {
+		Z_Free( chainNext );
+		Z_Free( slots );
+		return;
+	}
+
+	memset( checksum, 0, sizeof( checksum ) );
+
+	start = Sys_Milliseconds();
+	for ( i = 0 ; i < CVAR_BENCH_LOOKUPS ; i++ ) {
+		const char *name = cvar_indexes[slots[i % numSlots]].name;
+		for ( j = chainHead[Cvar_BenchmarkChainHash( name )] ; j >= 0 ; j = chainNext[j] ) {
+			if ( !Q_stricmp( name, cvar_indexes[j].name ) ) {
+				checksum[0] += cvar_indexes[j].integer;
+				break;
+			}
+		}
+	}
+	msec[0] = Sys_Milliseconds() - start;
+
+	start = Sys_Milliseconds();
+	for ( i = 0 ; i < CVAR_BENCH_LOOKUPS ; i++ ) {
+		var = Cvar_FindVar( cvar_indexes[slots[i % numSlots]].name );
+		checksum[1] += var->integer;
+	}
+	msec[1] = Sys_Milliseconds() - start;
+
+	start = Sys_Milliseconds();
+	for ( i = 0 ; i < CVAR_BENCH_LOOKUPS ; i++ ) {
+		checksum[2] += Cvar_HandleIntegerValue( slots[i % numSlots] );
+	}
+	msec[2] = Sys_Milliseconds() - start;
+
+	Z_Free( chainNext );
+	Z_Free( slots );
+
+	Com_Printf( "%i lookups over %i cvars\n", CVAR_BENCH_LOOKUPS, numSlots );
+	Com_Printf( "chained hash: %5i msec, %6.1f nsec per lookup\n", msec[0], msec[0] * 1000000.0 / CVAR_BENCH_LOOKUPS );
+	Com_Printf( "interned:     %5i msec, %6.1f nsec per lookup\n", msec[1], msec[1] * 1000000.0 / CVAR_BENCH_LOOKUPS );
+	Com_Printf( "handle:       %5i msec, %6.1f nsec per lookup\n", msec[2], msec[2] * 1000000.0 / CVAR_BENCH_LOOKUPS );
+	if ( checksum[0] != checksum[1] || checksum[0] != checksum[2] ) {
+		Com_Printf( S_COLOR_RED "lookups disagree\n" );
+	}
+}
+
 /*
 ============
 Cvar_Init
@@ -1582,7 +1822,10 @@ Reads in all archived cvars
 */
 void Cvar_Init (void) {
 	memset( cvar_indexes, 0, sizeof( cvar_indexes ) );
-	memset( hashTable, 0, sizeof( hashTable ) );
+	memset( cvar_hashTable, 0, sizeof( cvar_hashTable ) );
+	memset( cvar_names, 0, sizeof( cvar_names ) );
+	memset( cvar_nameHandedOut, 0, sizeof( cvar_nameHandedOut ) );
+	cvar_numNames = 0;
 
 	cvar_cheats = Cvar_Get( "sv_cheats", "1", CVAR_ROM|CVAR_SYSTEMINFO, "Allow cheats on server if set to 1" );
 
@@ -1617,6 +1860,7 @@ void Cvar_Init (void) {
 	Cmd_AddCommand( "cvar_usercreated", Cvar_ListUserCreated_f, "Show all user created cvars" );
 	Cmd_AddCommand( "cvar_modified", Cvar_ListModified_f, "Show all modified cvars" );
 	Cmd_AddCommand( "cvar_restart", Cvar_Restart_f, "Resetart the cvar sub-system" );
+	Cmd_AddCommand( "cvar_benchmark", Cvar_Benchmark_f, "Time cvar lookups by name and by handle" );
 }
 
 static void Cvar_Realloc(char **string, char *memPool, int &memPoolUsed)
@@ -1641,9 +1885,6 @@ void Cvar_Defrag(void)
 
 	for (var = cvar_vars; var; var = var->next)
 	{
-		if (var->name) {
-			totalMem += strlen(var->name) + 1;
-		}
 		if (var->description) {
 			totalMem += strlen(var->description) + 1;
 		}
@@ -1664,7 +1905,6 @@ void Cvar_Defrag(void)
 
 	for (var = cvar_vars; var; var = var->next)
 	{
-		Cvar_Realloc(&var->name, mem, totalMem);
 		Cvar_Realloc(&var->string, mem, totalMem);
 		Cvar_Realloc(&var->resetString, mem, totalMem);
 		Cvar_Realloc(&var->latchedString, mem, totalMem);
@@ -30,6 +30,11 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
  *
  *****************************************************************************/
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 #include "qcommon/qcommon.h"
 
 #ifndef DEDICATED
@@ -41,6 +46,10 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 
 #if defined(_WIN32)
 #include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #endif
 
 // for rmdir
@@ -197,6 +206,9 @@ typedef struct fileInPack_s {
 	char					*name;		// name of the file
 	unsigned long			pos;		// file info position in zip
 	unsigned long			len;		// uncompress file size
+	unsigned long			localPos;	// local header position in zip, for mapped paks
+	unsigned long			csize;		// compressed file size, for mapped paks
+	int						method;		// 0 (stored) or Z_DEFLATED, for mapped paks
 	struct	fileInPack_s*	next;		// next file in the hash
 } fileInPack_t;
 
@@ -213,6 +225,8 @@ typedef struct pack_s {
 	int				hashSize;					// hash table size (power of 2)
 	fileInPack_t*	*hashTable;					// hash table
 	fileInPack_t*	buildBuffer;				// buffer with the filenames etc.
+	const byte		*mapData;					// the whole pk3 mapped into memory, or NULL
+	size_t			mapSize;
 } pack_t;
 
 typedef struct directory_s {
@@ -228,6 +242,21 @@ typedef struct searchpath_s {
 	directory_t	*dir;
 } searchpath_t;
 
+// every file of every pak, hashed by name, in search path order
+typedef struct pathIndexEntry_s {
+	fileInPack_t				*file;
+	pack_t						*pack;
+	searchpath_t				*search;
+	struct pathIndexEntry_s		*next;		// next file in the hash
+} pathIndexEntry_t;
+
+typedef struct pathIndex_s {
+	int					hashSize;			// power of 2
+	pathIndexEntry_t	**hashTable;
+	int					numEntries;
+	pathIndexEntry_t	*entries;
+} pathIndex_t;
+
 static char		fs_gamedir[MAX_OSPATH];	// this will be a single file name with no separators
 static cvar_t		*fs_debug;
 static cvar_t		*fs_homepath;
@@ -243,7 +272,11 @@ static cvar_t		*fs_cdpath;
 static cvar_t		*fs_copyfiles;
 static cvar_t		*fs_gamedirvar;
 static cvar_t		*fs_dirbeforepak; //rww - when building search path, keep directories at top and insert pk3's under them
+static cvar_t		*fs_pathIndex;
+static cvar_t		*fs_mapPaks;
+static cvar_t		*fs_prefetchThreads;
 static searchpath_t	*fs_searchpaths;
+static pathIndex_t	fs_index;				// rebuilt whenever fs_searchpaths changes
 static int			fs_readCount;			// total bytes read
 static int			fs_loadCount;			// total files read
 static int			fs_packFiles = 0;		// total number of files in packs
@@ -269,6 +302,13 @@ typedef struct fileHandleData_s {
 	int			zipFileLen;
 	qboolean	zipFile;
 	char		name[MAX_ZPATH];
+
+	// files in mapped paks are inflated straight from the mapping
+	const byte	*zipData;		// compressed data, NULL when read through minizip
+	int			zipDataLen;
+	int			zipMethod;
+	int			zipReadPos;		// uncompressed bytes read so far
+	z_stream	zipStream;
 } fileHandleData_t;
 
 static fileHandleData_t	fsh[MAX_FILE_HANDLES];
@@ -1020,15 +1060,23 @@ There are three cases handled:
     the system minizip handle to the pak3 file, but its own dedicated one.
     The dedicated handle is closed with unzClose.
 
+  * file in a mapped pak3 archive: only the inflate state is released.
+
 ===========
 */
 void FS_FCloseFile( fileHandle_t f ) {
 	FS_AssertInitialised();
 
 	if (fsh[f].zipFile == qtrue) {
-		unzCloseCurrentFile( fsh[f].handleFiles.file.z );
-		if ( fsh[f].handleFiles.unique ) {
-			unzClose( fsh[f].handleFiles.file.z );
+		if ( fsh[f].zipData ) {
+			if ( fsh[f].zipMethod == Z_DEFLATED ) {
+				inflateEnd( &fsh[f].zipStream );
+			}
+		} else {
+			unzCloseCurrentFile( fsh[f].handleFiles.file.z );
+			if ( fsh[f].handleFiles.unique ) {
+				unzClose( fsh[f].handleFiles.file.z );
+			}
 		}
 		Com_Memset( &fsh[f], 0, sizeof( fsh[f] ) );
 		return;
@@ -1285,6 +1333,397 @@ bool FS_FileCacheable(const char* const filename)
 	return( strchr(filename, '/') != 0 );
 }
 
+/*
+==============================================================================
+
+MAPPED PAKS
+
+On 64 bit builds every pk3 is mapped read only, and files are inflated
+straight out of the mapping from the offsets in the central directory,
+instead of going through a minizip handle that seeks and reads the pk3.
+
+==============================================================================
+*/
+
+#define ZIP_CENTRAL_SIG		0x02014b50
+#define ZIP_CENTRAL_SIZE	46
+#define ZIP_LOCAL_SIG		0x04034b50
+#define ZIP_LOCAL_SIZE		30
+
+static unsigned int FS_ZipShort( const byte *p ) {
+	return p[0] | ( p[1] << 8 );
+}
+
+static unsigned int FS_ZipLong( const byte *p ) {
+	return p[0] | ( p[1] << 8 ) | ( p[2] << 16 ) | ( (unsigned int)p[3] << 24 );
+}
+
+/*
+=================
+FS_MapPak
+=================
+*/
+static const byte *FS_MapPak( const char *zipfile, size_t *size ) {
+#if !defined(idx64)
+	// all the paks won't fit in a 32 bit address space next to the hunk
+	return NULL;
+#elif defined(_WIN32)
+	HANDLE			file, mapping;
+	LARGE_INTEGER	fileSize;
+	void			*data;
+
+	file = CreateFileA( zipfile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( file == INVALID_HANDLE_VALUE ) {
+		return NULL;
+	}
+	if ( !GetFileSizeEx( file, &fileSize ) || !fileSize.QuadPart ) {
+		CloseHandle( file );
+		return NULL;
+	}
+	mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+	CloseHandle( file );
+	if ( !mapping ) {
+		return NULL;
+	}
+	// the view keeps the mapping alive
+	data = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+	CloseHandle( mapping );
+	*size = (size_t)fileSize.QuadPart;
+	return (const byte *)data;
+#else
+	struct stat		st;
+	void			*data;
+	int				fd;
+
+	fd = open( zipfile, O_RDONLY );
+	if ( fd == -1 ) {
+		return NULL;
+	}
+	if ( fstat( fd, &st ) == -1 || !st.st_size ) {
+		close( fd );
+		return NULL;
+	}
+	data = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+	close( fd );
+	if ( data == MAP_FAILED ) {
+		return NULL;
+	}
+	*size = st.st_size;
+	return (const byte *)data;
+#endif
+}
+
+static void FS_UnmapPak( pack_t *pak ) {
+	if ( !pak->mapData ) {
+		return;
+	}
+#if defined(_WIN32)
+	UnmapViewOfFile( pak->mapData );
+#else
+	munmap( (void *)pak->mapData, pak->mapSize );
+#endif
+	pak->mapData = NULL;
+	pak->mapSize = 0;
+}
+
+/*
+=================
+FS_MapPakFile
+
+Reads where the data of a file is from its central directory entry, returns
+qfalse if the file can only be read through minizip
+=================
+*/
+static qboolean FS_MapPakFile( const pack_t *pak, fileInPack_t *pakFile ) {
+	const byte		*entry;
+	unsigned int	method, csize, localPos;
+
+	// pos is an offset into the central directory, which is also one into the
+	// file unless something was prepended to the zip
+	if ( pak->mapSize < ZIP_CENTRAL_SIZE || pakFile->pos > pak->mapSize - ZIP_CENTRAL_SIZE ) {
+		return qfalse;
+	}
+	entry = pak->mapData + pakFile->pos;
+	if ( FS_ZipLong( entry ) != ZIP_CENTRAL_SIG || ( FS_ZipShort( entry + 8 ) & 1 ) ) {
+		return qfalse;	// not where it should be, or encrypted
+	}
+
+	method = FS_ZipShort( entry + 10 );
+	csize = FS_ZipLong( entry + 20 );
+	localPos = FS_ZipLong( entry + 42 );
+	if ( method != Z_DEFLATED && ( method != 0 || csize != pakFile->len ) ) {
+		return qfalse;
+	}
+	if ( FS_ZipLong( entry + 24 ) != pakFile->len || localPos > pak->mapSize - ZIP_LOCAL_SIZE ) {
+		return qfalse;
+	}
+
+	pakFile->localPos = localPos;
+	pakFile->csize = csize;
+	pakFile->method = method;
+	return qtrue;
+}
+
+/*
+=================
+FS_MappedPakData
+
+The local header is only read when the file is opened, so loading a pak
+doesn't touch every page of it
+=================
+*/
+static const byte *FS_MappedPakData( const pack_t *pak, const fileInPack_t *pakFile ) {
+	const byte		*local;
+	size_t			dataPos;
+
+	local = pak->mapData + pakFile->localPos;
+	if ( FS_ZipLong( local ) != ZIP_LOCAL_SIG ) {
+		return NULL;
+	}
+	dataPos = pakFile->localPos + ZIP_LOCAL_SIZE + FS_ZipShort( local + 26 ) + FS_ZipShort( local + 28 );
+	if ( dataPos > pak->mapSize || pakFile->csize > pak->mapSize - dataPos ) {
+		return NULL;
+	}
+	return pak->mapData + dataPos;
+}
+
+/*
+==============================================================================
+
+PATH INDEX
+
+Every file of every pak hashed into one table in search path order, so a
+lookup finds the pak a file comes from without asking each pak in turn.
+Directories aren't indexed, FS_FOpenFileRead still checks those in order.
+
+==============================================================================
+*/
+
+static unsigned int FS_HashPathIndex( const char *fname ) {
+	unsigned int	hash;
+	char			letter;
+
+	// same folding as FS_HashFileName, but with the extension and a better spread
+	hash = 2166136261u;
+	for ( ; *fname ; fname++ ) {
+		letter = tolower( *fname );
+		if ( letter == '\\' || letter == PATH_SEP ) {
+			letter = '/';
+		}
+		hash = ( hash ^ (byte)letter ) * 16777619u;
+	}
+	return hash;
+}
+
+static void FS_FreePathIndex( void ) {
+	// a name may not lead to the same file any more
+	FS_EndPrefetch();
+
+	if ( fs_index.hashTable ) {
+		Z_Free( fs_index.hashTable );
+	}
+	if ( fs_index.entries ) {
+		Z_Free( fs_index.entries );
+	}
+	Com_Memset( &fs_index, 0, sizeof( fs_index ) );
+}
+
+/*
+================
+FS_BuildPathIndex
+
+Called whenever the search path changes
+================
+*/
+static void FS_BuildPathIndex( void ) {
+	searchpath_t		*search, **paks;
+	pathIndexEntry_t	*entry;
+	fileInPack_t		*pakFile;
+	pack_t				*pak;
+	unsigned int		hash;
+	int					i, j, numPaks, numFiles;
+
+	FS_FreePathIndex();
+
+	numPaks = numFiles = 0;
+	for ( search = fs_searchpaths ; search ; search = search->next ) {
+		if ( search->pack ) {
+			numPaks++;
+			numFiles += search->pack->numfiles;
+		}
+	}
+	if ( !numFiles ) {
+		return;
+	}
+
+	paks = (searchpath_t **)Z_Malloc( numPaks * sizeof( *paks ), TAG_FILESYS, qfalse );
+	for ( i = 0, search = fs_searchpaths ; search ; search = search->next ) {
+		if ( search->pack ) {
+			paks[i++] = search;
+		}
+	}
+
+	for ( fs_index.hashSize = MAX_FILEHASH_SIZE ; fs_index.hashSize < numFiles ; fs_index.hashSize <<= 1 ) {
+	}
+	fs_index.hashTable = (pathIndexEntry_t **)Z_Malloc( fs_index.hashSize * sizeof( *fs_index.hashTable ), TAG_FILESYS, qtrue );
+	fs_index.entries = (pathIndexEntry_t *)Z_Malloc( numFiles * sizeof( *fs_index.entries ), TAG_FILESYS, qfalse );
+
+	// chains are built front first, so add the lowest priority pak first, and
+	// within a pak the files in the order its own hash chains were built
+	for ( i = numPaks - 1 ; i >= 0 ; i-- ) {
+		pak = paks[i]->pack;
+		for ( j = 0 ; j < pak->numfiles ; j++ ) {
+			pakFile = &pak->buildBuffer[j];
+			if ( !pakFile->name ) {
+				break;	// FS_LoadZipFile stopped at a bad entry
+			}
+			hash = FS_HashPathIndex( pakFile->name ) & ( fs_index.hashSize - 1 );
+			entry = &fs_index.entries[fs_index.numEntries++];
+			entry->file = pakFile;
+			entry->pack = pak;
+			entry->search = paks[i];
+			entry->next = fs_index.hashTable[hash];
+			fs_index.hashTable[hash] = entry;
+		}
+	}
+
+	Z_Free( paks );
+}
+
+/*
+================
+FS_FindInPathIndex
+
+Returns the pak file a lookup of filename would open, the same one the
+walk over each pak's own hash table finds
+================
+*/
+static const pathIndexEntry_t *FS_FindInPathIndex( const char *filename ) {
+	const pathIndexEntry_t	*entry;
+
+	for ( entry = fs_index.hashTable[FS_HashPathIndex( filename ) & ( fs_index.hashSize - 1 )] ; entry ; entry = entry->next ) {
+		if ( !FS_FilenameCompare( entry->file->name, filename ) && FS_PakIsPure( entry->pack ) ) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+/*
+===========
+FS_OpenFileInPak
+
+Opens a file found in a pak on handle f and marks the pak as referenced
+===========
+*/
+static long FS_OpenFileInPak( const char *filename, pack_t *pak, fileInPack_t *pakFile, fileHandle_t f, qboolean uniqueFILE ) {
+	int		l;
+
+	// mark the pak as having been referenced and mark specifics on cgame and ui
+	// shaders, txt, arena files  by themselves do not count as a reference as
+	// these are loaded from all pk3s
+	// from every pk3 file..
+
+	// The x86.dll suffixes are needed in order for sv_pure to continue to
+	// work on non-x86/windows systems...
+
+	l = strlen( filename );
+	if ( !(pak->referenced & FS_GENERAL_REF)) {
+		if( !FS_IsExt(filename, ".shader", l) &&
+		    !FS_IsExt(filename, ".txt", l) &&
+		    !FS_IsExt(filename, ".str", l) &&
+		    !FS_IsExt(filename, ".cfg", l) &&
+		    !FS_IsExt(filename, ".config", l) &&
+		    !FS_IsExt(filename, ".bot", l) &&
+		    !FS_IsExt(filename, ".arena", l) &&
+		    !FS_IsExt(filename, ".menu", l) &&
+		    !FS_IsExt(filename, ".fcf", l) &&
+		    Q_stricmp(filename, "jampgamex86.dll") != 0 &&
+		    //Q_stricmp(filename, "vm/qagame.qvm") != 0 &&
+		    !strstr(filename, "levelshots"))
+		{
+			pak->referenced |= FS_GENERAL_REF;
+		}
+	}
+
+	if (!(pak->referenced & FS_CGAME_REF))
+	{
+		if ( Q_stricmp( filename, "cgame.qvm" ) == 0 ||
+				Q_stricmp( filename, "cgamex86.dll" ) == 0 )
+		{
+			pak->referenced |= FS_CGAME_REF;
+		}
+	}
+
+	if (!(pak->referenced & FS_UI_REF))
+	{
+		if ( Q_stricmp( filename, "ui.qvm" ) == 0 ||
+				Q_stricmp( filename, "uix86.dll" ) == 0 )
+		{
+			pak->referenced |= FS_UI_REF;
+		}
+	}
+
+	fsh[f].zipData = NULL;
+	if ( pak->mapData && fs_mapPaks->integer ) {
+		fsh[f].zipData = FS_MappedPakData( pak, pakFile );
+	}
+	if ( fsh[f].zipData ) {
+		// the pak's own minizip handle is never read here, it just marks the handle used
+		fsh[f].handleFiles.file.z = pak->handle;
+		fsh[f].handleFiles.unique = qfalse;
+		fsh[f].zipDataLen = pakFile->csize;
+		fsh[f].zipMethod = pakFile->method;
+		fsh[f].zipReadPos = 0;
+		if ( pakFile->method == Z_DEFLATED ) {
+			Com_Memset( &fsh[f].zipStream, 0, sizeof( fsh[f].zipStream ) );
+			fsh[f].zipStream.next_in = (Bytef *)fsh[f].zipData;
+			fsh[f].zipStream.avail_in = fsh[f].zipDataLen;
+			if ( inflateInit2( &fsh[f].zipStream, -MAX_WBITS ) != Z_OK ) {
+				fsh[f].zipData = NULL;
+			}
+		}
+	}
+
+	if ( !fsh[f].zipData ) {
+		if ( uniqueFILE ) {
+			// open a new file on the pakfile
+			fsh[f].handleFiles.file.z = unzOpen (pak->pakFilename);
+			if (fsh[f].handleFiles.file.z == NULL) {
+				Com_Error (ERR_FATAL, "Couldn't open %s", pak->pakFilename);
+			}
+		} else {
+			fsh[f].handleFiles.file.z = pak->handle;
+		}
+
+		// set the file position in the zip file (also sets the current file info)
+		unzSetOffset(fsh[f].handleFiles.file.z, pakFile->pos);
+
+		// open the file in the zip
+		unzOpenCurrentFile(fsh[f].handleFiles.file.z);
+	}
+
+	Q_strncpyz( fsh[f].name, filename, sizeof( fsh[f].name ) );
+	fsh[f].zipFile = qtrue;
+	fsh[f].zipFilePos = pakFile->pos;
+	fsh[f].zipFileLen = pakFile->len;
+
+	if ( fs_debug->integer ) {
+		Com_Printf( "FS_FOpenFileRead: %s (found in '%s')\n",
+			filename, pak->pakFilename );
+	}
+#ifndef DEDICATED
+#ifndef FINAL_BUILD
+	// Check for unprecached files when in game but not in the menus
+	if((cls.state == CA_ACTIVE) && !(Key_GetCatcher( ) & KEYCATCH_UI))
+	{
+		Com_Printf(S_COLOR_YELLOW "WARNING: File %s not precached\n", filename);
+	}
+#endif
+#endif // DEDICATED
+	return pakFile->len;
+}
+
 /*
 ===========
 FS_FOpenFileRead
@@ -1304,10 +1743,10 @@ long FS_FOpenFileRead( const char *filename, fileHandle_t *file, qboolean unique
 	fileInPack_t	*pakFile;
 	directory_t		*dir;
 	long			hash;
-	//unz_s			*zfi;
-	//void			*temp;
 	int				l;
 	bool			isUserConfig = false;
+	const pathIndexEntry_t	*indexed;
+	qboolean		useIndex;
 
 	hash = 0;
 
@@ -1350,6 +1789,14 @@ long FS_FOpenFileRead( const char *filename, fileHandle_t *file, qboolean unique
 	*file = FS_HandleForFile();
 	fsh[*file].handleFiles.unique = uniqueFILE;
 
+	// the index says which pak it comes from, if any, so only the directories
+	// in front of that one still need a look
+	useIndex = (qboolean)( fs_index.hashTable && fs_pathIndex->integer );
+	indexed = NULL;
+	if ( useIndex && !isUserConfig ) {
+		indexed = FS_FindInPathIndex( filename );
+	}
+
 	// this new bool is in for an optimisation, if you (eg) opened a BSP file under fs_copyfiles==2,
 	//	then it triggered a copy operation to update your local HD version, then this will re-open the
 	//	file handle on your local version, not the net build. This uses a bit more CPU to re-do the loop
@@ -1362,6 +1809,13 @@ long FS_FOpenFileRead( const char *filename, fileHandle_t *file, qboolean unique
 		bFasterToReOpenUsingNewLocalFile = qfalse;
 
 		for ( search = fs_searchpaths ; search ; search = search->next ) {
+			if ( useIndex && search->pack ) {
+				if ( indexed && indexed->search == search ) {
+					return FS_OpenFileInPak( filename, indexed->pack, indexed->file, *file, uniqueFILE );
+				}
+				continue;
+			}
+
 			//
 			if ( search->pack ) {
 				hash = FS_HashFileName(filename, search->pack->hashSize);
@@ -1385,100 +1839,7 @@ long FS_FOpenFileRead( const char *filename, fileHandle_t *file, qboolean unique
 					// case and separator insensitive comparisons
 					if ( !FS_FilenameCompare( pakFile->name, filename ) ) {
 						// found it!
-
-						// mark the pak as having been referenced and mark specifics on cgame and ui
-						// shaders, txt, arena files  by themselves do not count as a reference as
-						// these are loaded from all pk3s
-						// from every pk3 file..
-
-						// The x86.dll suffixes are needed in order for sv_pure to continue to
-						// work on non-x86/windows systems...
-
-						l = strlen( filename );
-						if ( !(pak->referenced & FS_GENERAL_REF)) {
-							if( !FS_IsExt(filename, ".shader", l) &&
-							    !FS_IsExt(filename, ".txt", l) &&
-							    !FS_IsExt(filename, ".str", l) &&
-							    !FS_IsExt(filename, ".cfg", l) &&
-							    !FS_IsExt(filename, ".config", l) &&
-							    !FS_IsExt(filename, ".bot", l) &&
-							    !FS_IsExt(filename, ".arena", l) &&
-							    !FS_IsExt(filename, ".menu", l) &&
-							    !FS_IsExt(filename, ".fcf", l) &&
-							    Q_stricmp(filename, "jampgamex86.dll") != 0 &&
-							    //Q_stricmp(filename, "vm/qagame.qvm") != 0 &&
-							    !strstr(filename, "levelshots"))
-							{
-								pak->referenced |= FS_GENERAL_REF;
-							}
-						}
-
-						if (!(pak->referenced & FS_CGAME_REF))
-						{
-							if ( Q_stricmp( filename, "cgame.qvm" ) == 0 ||
-									Q_stricmp( filename, "cgamex86.dll" ) == 0 )
-							{
-								pak->referenced |= FS_CGAME_REF;
-							}
-						}
-
-						if (!(pak->referenced & FS_UI_REF))
-						{
-							if ( Q_stricmp( filename, "ui.qvm" ) == 0 ||
-									Q_stricmp( filename, "uix86.dll" ) == 0 )
-							{
-								pak->referenced |= FS_UI_REF;
-							}
-						}
-
-						if ( uniqueFILE ) {
-							// open a new file on the pakfile
-							fsh[*file].handleFiles.file.z = unzOpen (pak->pakFilename);
-							if (fsh[*file].handleFiles.file.z == NULL) {
-								Com_Error (ERR_FATAL, "Couldn't open %s", pak->pakFilename);
-							}
-						} else {
-							fsh[*file].handleFiles.file.z = pak->handle;
-						}
-						Q_strncpyz( fsh[*file].name, filename, sizeof( fsh[*file].name ) );
-						fsh[*file].zipFile = qtrue;
-
-						// set the file position in the zip file (also sets the current file info)
-						unzSetOffset(fsh[*file].handleFiles.file.z, pakFile->pos);
-
-						// open the file in the zip
-						unzOpenCurrentFile(fsh[*file].handleFiles.file.z);
-
-#if 0
-						zfi = (unz_s *)fsh[*file].handleFiles.file.z;
-						// in case the file was new
-						temp = zfi->filestream;
-						// set the file position in the zip file (also sets the current file info)
-						unzSetOffset(pak->handle, pakFile->pos);
-						// copy the file info into the unzip structure
-						Com_Memcpy( zfi, pak->handle, sizeof(unz_s) );
-						// we copy this back into the structure
-						zfi->filestream = temp;
-						// open the file in the zip
-						unzOpenCurrentFile( fsh[*file].handleFiles.file.z );
-#endif
-						fsh[*file].zipFilePos = pakFile->pos;
-						fsh[*file].zipFileLen = pakFile->len;
-
-						if ( fs_debug->integer ) {
-							Com_Printf( "FS_FOpenFileRead: %s (found in '%s')\n",
-								filename, pak->pakFilename );
-						}
-	#ifndef DEDICATED
-	#ifndef FINAL_BUILD
-						// Check for unprecached files when in game but not in the menus
-						if((cls.state == CA_ACTIVE) && !(Key_GetCatcher( ) & KEYCATCH_UI))
-						{
-							Com_Printf(S_COLOR_YELLOW "WARNING: File %s not precached\n", filename);
-						}
-	#endif
-	#endif // DEDICATED
-						return pakFile->len;
+						return FS_OpenFileInPak( filename, pak, pakFile, *file, uniqueFILE );
 					}
 					pakFile = pakFile->next;
 				} while(pakFile != NULL);
@@ -1645,6 +2006,58 @@ qboolean FS_FindPureDLL(const char *name)
 	return qfalse;
 }
 
+/*
+=================
+FS_ReadMappedPakFile
+
+Copies or inflates the next len bytes of a file in a mapped pak
+=================
+*/
+static int FS_ReadMappedPakFile( fileHandleData_t *fh, void *buffer, int len ) {
+	z_stream	*zs;
+
+	if ( len > fh->zipFileLen - fh->zipReadPos ) {
+		len = fh->zipFileLen - fh->zipReadPos;
+	}
+	if ( len <= 0 ) {
+		return 0;
+	}
+
+	if ( fh->zipMethod == Z_DEFLATED ) {
+		zs = &fh->zipStream;
+		zs->next_out = (Bytef *)buffer;
+		zs->avail_out = len;
+		while ( zs->avail_out && inflate( zs, Z_SYNC_FLUSH ) == Z_OK ) {
+		}
+		len -= zs->avail_out;
+	} else {
+		Com_Memcpy( buffer, fh->zipData + fh->zipReadPos, len );
+	}
+
+	fh->zipReadPos += len;
+	return len;
+}
+
+/*
+=================
+FS_RewindPakFile
+=================
+*/
+static void FS_RewindPakFile( fileHandleData_t *fh ) {
+	if ( !fh->zipData ) {
+		unzSetOffset( fh->handleFiles.file.z, fh->zipFilePos );
+		unzOpenCurrentFile( fh->handleFiles.file.z );
+		return;
+	}
+
+	fh->zipReadPos = 0;
+	if ( fh->zipMethod == Z_DEFLATED ) {
+		inflateReset( &fh->zipStream );
+		fh->zipStream.next_in = (Bytef *)fh->zipData;
+		fh->zipStream.avail_in = fh->zipDataLen;
+	}
+}
+
 /*
 =================
 FS_Read
@@ -1691,6 +2104,8 @@ int FS_Read( void *buffer, int len, fileHandle_t f ) {
 			buf += read;
 		}
 		return len;
+	} else if ( fsh[f].zipData ) {
+		return FS_ReadMappedPakFile( &fsh[f], buffer, len );
 	} else {
 		return unzReadCurrentFile(fsh[f].handleFiles.file.z, buffer, len);
 	}
@@ -1812,8 +2227,7 @@ int FS_Seek( fileHandle_t f, long offset, int origin ) {
 				if ( remainder == currentPosition ) {
 					return offset;
 				}
-				unzSetOffset(fsh[f].handleFiles.file.z, fsh[f].zipFilePos);
-				unzOpenCurrentFile(fsh[f].handleFiles.file.z);
+				FS_RewindPakFile( &fsh[f] );
 				//fallthrough
 
 			case FS_SEEK_END:
@@ -1855,6 +2269,377 @@ int FS_Seek( fileHandle_t f, long offset, int origin ) {
 /*
 ======================================================================================
 
+PREFETCH
+
+Level loading names the files it is going to need up front, and worker
+threads inflate them out of the mapped paks into buffers while the main
+thread is busy with the files before them.  FS_ReadFile then hands over
+the buffer, or inflates the file itself if no worker got to it yet.
+
+Only files from mapped paks are read ahead, a worker never touches a file
+handle, the zone or the search path.  Everything a worker needs is copied
+into its prefetchFile_t on the main thread, which also allocates and frees
+the buffers.  Anything that changes which file a name resolves to drops
+what was prefetched first.  FS_Shutdown joins the workers and frees the
+whole thing.
+
+======================================================================================
+*/
+
+#define	MAX_PREFETCH_THREADS	8
+#define	MAX_PREFETCH_FILES		4096
+#define	PREFETCH_HASH_SIZE		1024
+#define	PREFETCH_BUDGET			(64*1024*1024)		// bytes of buffers read ahead at a time
+
+enum {
+	PREFETCH_QUEUED,		// waiting for a buffer
+	PREFETCH_PENDING,		// has a buffer, waiting for a worker
+	PREFETCH_READING,
+	PREFETCH_READY,
+	PREFETCH_FAILED,
+	PREFETCH_TAKEN			// handed over or dropped
+};
+
+typedef struct prefetchFile_s {
+	char					name[MAX_QPATH];
+	const byte				*data;			// compressed data in the mapped pak
+	int						dataLen;
+	int						method;
+	int						len;
+	byte					*buffer;
+	std::atomic<int>		state;
+	struct prefetchFile_s	*next;			// next file in the hash
+} prefetchFile_t;
+
+typedef struct prefetch_s {
+	std::mutex				mutex;
+	std::condition_variable	wake;			// a file became pending
+	std::condition_variable	done;			// a file finished reading
+	std::thread				threads[MAX_PREFETCH_THREADS];
+	int						numThreads;
+
+	// protected by mutex
+	int						nextRead;		// next file for a worker
+	bool					shutdown;
+
+	// main thread only
+	int						numFiles;
+	int						nextBuffer;		// next file to get a buffer
+	int						bufferBytes;	// in buffers not handed over yet
+	prefetchFile_t			*hashTable[PREFETCH_HASH_SIZE];
+	prefetchFile_t			files[MAX_PREFETCH_FILES];
+} prefetch_t;
+
+static prefetch_t	*fs_prefetch;
+
+/*
+=================
+FS_InflatePakData
+
+Thread safe, it only reads the mapping and writes out
+=================
+*/
+static qboolean FS_InflatePakData( const byte *data, int dataLen, int method, byte *out, int len ) {
+	z_stream	zs;
+	int			err;
+
+	if ( method != Z_DEFLATED ) {
+		Com_Memcpy( out, data, len );
+		return qtrue;
+	}
+
+	Com_Memset( &zs, 0, sizeof( zs ) );
+	zs.next_in = (Bytef *)data;
+	zs.avail_in = dataLen;
+	zs.next_out = out;
+	zs.avail_out = len;
+	if ( inflateInit2( &zs, -MAX_WBITS ) != Z_OK ) {
+		return qfalse;
+	}
+	err = inflate( &zs, Z_FINISH );
+	inflateEnd( &zs );
+
+	return (qboolean)( ( err == Z_STREAM_END || err == Z_OK || err == Z_BUF_ERROR ) && !zs.avail_out );
+}
+
+static void FS_ReadPrefetched( prefetchFile_t *pf ) {
+	qboolean ok = FS_InflatePakData( pf->data, pf->dataLen, pf->method, pf->buffer, pf->len );
+
+	{
+		std::lock_guard<std::mutex> lock( fs_prefetch->mutex );
+		pf->state = ok ? PREFETCH_READY : PREFETCH_FAILED;
+	}
+	fs_prefetch->done.notify_all();
+}
+
+static void FS_PrefetchThread( prefetch_t *prefetch ) {
+	prefetchFile_t	*pf;
+	int				expected;
+
+	std::unique_lock<std::mutex> lock( prefetch->mutex );
+	for ( ;; ) {
+		while ( !prefetch->shutdown && prefetch->nextRead >= prefetch->nextBuffer ) {
+			prefetch->wake.wait( lock );
+		}
+		if ( prefetch->shutdown ) {
+			return;
+		}
+		pf = &prefetch->files[prefetch->nextRead++];
+
+		// the main thread may have taken it already
+		expected = PREFETCH_PENDING;
+		if ( !pf->state.compare_exchange_strong( expected, PREFETCH_READING ) ) {
+			continue;
+		}
+
+		lock.unlock();
+		FS_ReadPrefetched( pf );
+		lock.lock();
+	}
+}
+
+/*
+=================
+FS_GiveOutPrefetchBuffers
+
+Gives queued files buffers while the budget allows and wakes the workers
+=================
+*/
+static void FS_GiveOutPrefetchBuffers( void ) {
+	prefetchFile_t	*pf;
+	int				numThreads, start;
+
+	start = fs_prefetch->nextBuffer;
+	while ( fs_prefetch->nextBuffer < fs_prefetch->numFiles ) {
+		pf = &fs_prefetch->files[fs_prefetch->nextBuffer];
+		if ( pf->state == PREFETCH_QUEUED ) {
+			// always let one through, however big
+			if ( fs_prefetch->bufferBytes && fs_prefetch->bufferBytes + pf->len + 1 > PREFETCH_BUDGET ) {
+				break;
+			}
+			pf->buffer = (byte *)Z_Malloc( pf->len + 1, TAG_FILESYS, qfalse );
+			fs_prefetch->bufferBytes += pf->len + 1;
+			pf->state = PREFETCH_PENDING;
+		}
+
+		// workers read nextBuffer, so it only moves under the lock
+		std::lock_guard<std::mutex> lock( fs_prefetch->mutex );
+		fs_prefetch->nextBuffer++;
+	}
+	if ( fs_prefetch->nextBuffer == start ) {
+		return;
+	}
+
+	numThreads = Com_Clampi( 0, MAX_PREFETCH_THREADS, fs_prefetchThreads->integer );
+	while ( fs_prefetch->numThreads < numThreads ) {
+		fs_prefetch->threads[fs_prefetch->numThreads] = std::thread( FS_PrefetchThread, fs_prefetch );
+		fs_prefetch->numThreads++;
+	}
+	fs_prefetch->wake.notify_all();
+}
+
+static prefetchFile_t *FS_FindPrefetched( const char *qpath ) {
+	prefetchFile_t	*pf;
+
+	for ( pf = fs_prefetch->hashTable[FS_HashPathIndex( qpath ) & ( PREFETCH_HASH_SIZE - 1 )] ; pf ; pf = pf->next ) {
+		if ( !FS_FilenameCompare( pf->name, qpath ) ) {
+			return pf;
+		}
+	}
+	return NULL;
+}
+
+/*
+=================
+FS_PrefetchFile
+=================
+*/
+qboolean FS_PrefetchFile( const char *qpath ) {
+	prefetchFile_t	*pf;
+	fileHandle_t	h;
+	long			len;
+	unsigned int	hash;
+
+	FS_AssertInitialised();
+
+	if ( !qpath || !qpath[0] ) {
+		return qfalse;
+	}
+	if ( fs_prefetchThreads->integer <= 0 || strstr( qpath, ".cfg" ) ) {
+		return (qboolean)( FS_ReadFile( qpath, NULL ) >= 0 );
+	}
+
+	if ( !fs_prefetch ) {
+		fs_prefetch = new prefetch_t;
+		fs_prefetch->numThreads = 0;
+		fs_prefetch->nextRead = 0;
+		fs_prefetch->shutdown = false;
+		fs_prefetch->numFiles = 0;
+		fs_prefetch->nextBuffer = 0;
+		fs_prefetch->bufferBytes = 0;
+		Com_Memset( fs_prefetch->hashTable, 0, sizeof( fs_prefetch->hashTable ) );
+	}
+	if ( FS_FindPrefetched( qpath ) ) {
+		return qtrue;
+	}
+
+	// resolve it exactly like the read will
+	len = FS_FOpenFileRead( qpath, &h, qfalse );
+	if ( !h ) {
+		return qfalse;
+	}
+	if ( !fsh[h].zipData || fs_prefetch->numFiles == MAX_PREFETCH_FILES || strlen( qpath ) >= MAX_QPATH ) {
+		FS_FCloseFile( h );
+		return qtrue;
+	}
+
+	pf = &fs_prefetch->files[fs_prefetch->numFiles++];
+	Q_strncpyz( pf->name, qpath, sizeof( pf->name ) );
+	pf->data = fsh[h].zipData;
+	pf->dataLen = fsh[h].zipDataLen;
+	pf->method = fsh[h].zipMethod;
+	pf->len = len;
+	pf->buffer = NULL;
+	pf->state = PREFETCH_QUEUED;
+	FS_FCloseFile( h );
+
+	hash = FS_HashPathIndex( qpath ) & ( PREFETCH_HASH_SIZE - 1 );
+	pf->next = fs_prefetch->hashTable[hash];
+	fs_prefetch->hashTable[hash] = pf;
+
+	FS_GiveOutPrefetchBuffers();
+	return qtrue;
+}
+
+/*
+=================
+FS_TakePrefetched
+
+Returns the length and the buffer if qpath was prefetched, -1 to read it
+the normal way
+=================
+*/
+static long FS_TakePrefetched( const char *qpath, void **buffer ) {
+	prefetchFile_t	*pf;
+	int				expected;
+
+	if ( !fs_prefetch || !fs_prefetch->numFiles || !buffer ) {
+		return -1;
+	}
+	pf = FS_FindPrefetched( qpath );
+	if ( !pf || pf->state == PREFETCH_TAKEN ) {
+		return -1;
+	}
+
+	// nobody got to it yet, so read it here
+	expected = PREFETCH_PENDING;
+	if ( pf->state.compare_exchange_strong( expected, PREFETCH_READING ) ) {
+		FS_ReadPrefetched( pf );
+	}
+
+	if ( pf->state == PREFETCH_READING ) {
+		std::unique_lock<std::mutex> lock( fs_prefetch->mutex );
+		while ( pf->state == PREFETCH_READING ) {
+			fs_prefetch->done.wait( lock );
+		}
+	}
+
+	if ( pf->buffer ) {
+		fs_prefetch->bufferBytes -= pf->len + 1;
+	}
+	if ( pf->state != PREFETCH_READY ) {
+		if ( pf->buffer ) {
+			Z_Free( pf->buffer );
+			pf->buffer = NULL;
+		}
+		pf->state = PREFETCH_TAKEN;
+		FS_GiveOutPrefetchBuffers();
+		return -1;
+	}
+
+	pf->state = PREFETCH_TAKEN;
+	pf->buffer[pf->len] = 0;
+	*buffer = pf->buffer;
+	pf->buffer = NULL;
+
+	fs_readCount += pf->len;
+	fs_loadCount++;
+
+	FS_GiveOutPrefetchBuffers();
+	return pf->len;
+}
+
+/*
+=================
+FS_EndPrefetch
+=================
+*/
+void FS_EndPrefetch( void ) {
+	prefetchFile_t	*pf;
+	int				i, expected;
+
+	if ( !fs_prefetch || !fs_prefetch->numFiles ) {
+		return;
+	}
+
+	// no worker starts on anything after this
+	for ( i = 0 ; i < fs_prefetch->numFiles ; i++ ) {
+		expected = PREFETCH_PENDING;
+		fs_prefetch->files[i].state.compare_exchange_strong( expected, PREFETCH_TAKEN );
+	}
+
+	std::unique_lock<std::mutex> lock( fs_prefetch->mutex );
+	for ( i = 0 ; i < fs_prefetch->numFiles ; i++ ) {
+		pf = &fs_prefetch->files[i];
+		while ( pf->state == PREFETCH_READING ) {
+			fs_prefetch->done.wait( lock );
+		}
+		if ( pf->buffer ) {
+			Z_Free( pf->buffer );
+			pf->buffer = NULL;
+		}
+	}
+
+	fs_prefetch->numFiles = 0;
+	fs_prefetch->nextBuffer = 0;
+	fs_prefetch->nextRead = 0;
+	fs_prefetch->bufferBytes = 0;
+	Com_Memset( fs_prefetch->hashTable, 0, sizeof( fs_prefetch->hashTable ) );
+}
+
+/*
+=================
+FS_ShutdownPrefetch
+
+Drops everything prefetched, joins the workers and frees the lot
+=================
+*/
+static void FS_ShutdownPrefetch( void ) {
+	int		i;
+
+	if ( !fs_prefetch ) {
+		return;
+	}
+
+	FS_EndPrefetch();
+
+	{
+		std::lock_guard<std::mutex> lock( fs_prefetch->mutex );
+		fs_prefetch->shutdown = true;
+	}
+	fs_prefetch->wake.notify_all();
+
+	for ( i = 0 ; i < fs_prefetch->numThreads ; i++ ) {
+		fs_prefetch->threads[i].join();
+	}
+
+	delete fs_prefetch;
+	fs_prefetch = NULL;
+}
+
+/*
+======================================================================================
+
 CONVENIENCE FUNCTIONS FOR ENTIRE FILES
 
 ======================================================================================
@@ -1984,6 +2769,14 @@ long FS_ReadFile( const char *qpath, void **buffer ) {
 		isConfig = qfalse;
 	}
 
+	// read ahead by a worker if the level load asked for it
+	if ( !isConfig ) {
+		len = FS_TakePrefetched( qpath, buffer );
+		if ( len >= 0 ) {
+			return len;
+		}
+	}
+
 	// look for it in the filesystem or pack files
 	len = FS_FOpenFileRead( qpath, &h, qfalse );
 	if ( h == 0 ) {
@@ -2157,6 +2950,9 @@ static pack_t *FS_LoadZipFile( const char *zipfile, const char *basename )
 
 	pack->handle = uf;
 	pack->numfiles = gi.number_entry;
+	if ( fs_mapPaks && fs_mapPaks->integer ) {
+		pack->mapData = FS_MapPak( zipfile, &pack->mapSize );
+	}
 	unzGoToFirstFile(uf);
 
 	for (i = 0; i < gi.number_entry; i++)
@@ -2176,6 +2972,9 @@ static pack_t *FS_LoadZipFile( const char *zipfile, const char *basename )
 		// store the file position in the zip
 		buildBuffer[i].pos = unzGetOffset(uf);
 		buildBuffer[i].len = file_info.uncompressed_size;
+		if ( pack->mapData && !FS_MapPakFile( pack, &buildBuffer[i] ) ) {
+			FS_UnmapPak( pack );
+		}
 		buildBuffer[i].next = pack->hashTable[hash];
 		pack->hashTable[hash] = &buildBuffer[i];
 		unzGoToNextFile(uf);
@@ -2202,6 +3001,7 @@ Frees a pak structure and releases all associated resources
 
 void FS_FreePak(pack_t *thepak)
 {
+	FS_UnmapPak(thepak);
 	unzClose(thepak->handle);
 	Z_Free(thepak->buildBuffer);
 	Z_Free(thepak);
@@ -2977,6 +3777,149 @@ void FS_Which_f( void ) {
 	Com_Printf( "File not found: \"%s\"\n", filename );
 }
 
+/*
+============
+FS_Benchmark_f
+
+Loads every file the paks provide, as a full precache would, three ways:
+the stock way (asking each pak, reading through minizip), through the path
+index and the mapped paks, and the same with every file prefetched up front.
+Checks all three read the same bytes and prints the time each took.  Each
+file also gets a lookup that fails, like the ones the renderer makes when it
+probes for image extensions, and a checksum standing in for the decoding the
+real loaders do after reading.
+============
+*/
+#define	FS_BENCH_MODES	3
+
+static void FS_SetBenchmarkMode( int mode ) {
+	Cvar_Set( "fs_pathIndex", mode ? "1" : "0" );
+	Cvar_Set( "fs_mapPaks", mode ? "1" : "0" );
+}
+
+void FS_Benchmark_f( void ) {
+	static const char *modeNames[FS_BENCH_MODES] = { "stock", "path index", "prefetched" };
+	const pathIndexEntry_t	*entry;
+	const char		*prefix, **names;
+	searchpath_t	*search;
+	fileHandle_t	h;
+	char			probe[MAX_QPATH], pathIndex[MAX_CVAR_VALUE_STRING], mapPaks[MAX_CVAR_VALUE_STRING];
+	void			*buf[FS_BENCH_MODES];
+	int				*referenced;
+	int				numNames, numPaks, numMapped, numBad, mode, start, msec[FS_BENCH_MODES], len[FS_BENCH_MODES], i;
+	int64_t			bytes;
+
+	if ( !fs_index.hashTable ) {
+		Com_Printf( "No paks to read\n" );
+		return;
+	}
+	prefix = Cmd_Argc() > 1 ? Cmd_Argv( 1 ) : "";
+
+	// the file each name resolves to, every name once
+	names = (const char **)Z_Malloc( fs_index.numEntries * sizeof( *names ), TAG_TEMP_WORKSPACE, qfalse );
+	numNames = 0;
+	for ( i = 0 ; i < fs_index.numEntries ; i++ ) {
+		entry = &fs_index.entries[i];
+		if ( !Q_stricmpn( entry->file->name, prefix, strlen( prefix ) ) && FS_FindInPathIndex( entry->file->name ) == entry ) {
+			names[numNames++] = entry->file->name;
+		}
+	}
+
+	// this isn't a real load, don't let it change what the server says it references
+	numPaks = numMapped = 0;
+	for ( search = fs_searchpaths ; search ; search = search->next ) {
+		if ( search->pack ) {
+			numPaks++;
+			numMapped += search->pack->mapData != NULL;
+		}
+	}
+	referenced = (int *)Z_Malloc( numPaks * sizeof( *referenced ), TAG_TEMP_WORKSPACE, qfalse );
+	for ( i = 0, search = fs_searchpaths ; search ; search = search->next ) {
+		if ( search->pack ) {
+			referenced[i++] = search->pack->referenced;
+		}
+	}
+
+	Q_strncpyz( pathIndex, fs_pathIndex->string, sizeof( pathIndex ) );
+	Q_strncpyz( mapPaks, fs_mapPaks->string, sizeof( mapPaks ) );
+
+	// all ways have to read the same thing, this also gets the paks into the
+	// OS file cache so no timing pays for the disk
+	numBad = 0;
+	bytes = 0;
+	for ( i = 0 ; i < numNames ; i++ ) {
+		for ( mode = 0 ; mode < FS_BENCH_MODES ; mode++ ) {
+			FS_SetBenchmarkMode( mode );
+			if ( mode == 2 ) {
+				FS_PrefetchFile( names[i] );
+			}
+			len[mode] = FS_ReadFile( names[i], &buf[mode] );
+		}
+		for ( mode = 1 ; mode < FS_BENCH_MODES ; mode++ ) {
+			if ( len[mode] != len[0] || ( buf[0] && buf[mode] && memcmp( buf[0], buf[mode], len[0] ) ) ) {
+				if ( numBad++ < 10 ) {
+					Com_Printf( S_COLOR_RED "fs_benchmark: %s reads differently %s\n", names[i], modeNames[mode] );
+				}
+			}
+		}
+		for ( mode = 0 ; mode < FS_BENCH_MODES ; mode++ ) {
+			if ( buf[mode] ) {
+				FS_FreeFile( buf[mode] );
+			}
+		}
+		bytes += Q_max( len[0], 0 );
+	}
+	FS_EndPrefetch();
+
+	for ( mode = 0 ; mode < FS_BENCH_MODES ; mode++ ) {
+		FS_SetBenchmarkMode( mode );
+
+		start = Sys_Milliseconds();
+		if ( mode == 2 ) {
+			for ( i = 0 ; i < numNames ; i++ ) {
+				FS_PrefetchFile( names[i] );
+			}
+		}
+		for ( i = 0 ; i < numNames ; i++ ) {
+			len[0] = FS_ReadFile( names[i], &buf[0] );
+			if ( buf[0] ) {
+				Com_BlockChecksum( buf[0], len[0] );
+				FS_FreeFile( buf[0] );
+			}
+
+			COM_StripExtension( names[i], probe, sizeof( probe ) );
+			Q_strcat( probe, sizeof( probe ), ".fs_benchmark" );
+			if ( FS_FOpenFileRead( probe, &h, qfalse ) >= 0 && h ) {
+				FS_FCloseFile( h );
+			}
+		}
+		FS_EndPrefetch();
+		msec[mode] = Sys_Milliseconds() - start;
+	}
+
+	Cvar_Set( "fs_pathIndex", pathIndex );
+	Cvar_Set( "fs_mapPaks", mapPaks );
+	for ( i = 0, search = fs_searchpaths ; search ; search = search->next ) {
+		if ( search->pack ) {
+			search->pack->referenced = referenced[i++];
+		}
+	}
+
+	Com_Printf( "%d files, %d KB and %d failed lookups in %d paks, %d of them mapped\n", numNames, (int)( bytes >> 10 ), numNames, numPaks, numMapped );
+	for ( mode = 0 ; mode < FS_BENCH_MODES ; mode++ ) {
+		Com_Printf( "%-11s %5d msec\n", va( "%s:", modeNames[mode] ), msec[mode] );
+	}
+	if ( fs_prefetchThreads->integer <= 0 ) {
+		Com_Printf( "fs_prefetchThreads is 0, nothing was prefetched\n" );
+	}
+	if ( numBad ) {
+		Com_Printf( S_COLOR_RED "%d files read differently\n", numBad );
+	}
+
+	Z_Free( referenced );
+	Z_Free( (void *)names );
+}
+
 //===========================================================================
 
 static int QDECL paksort( const void *a, const void *b ) {
@@ -3016,6 +3959,9 @@ static void FS_AddGameDirectory( const char *path, const char *dir ) {
 		}
 	}
 
+	// the caller builds it again once all the directories are in
+	FS_FreePathIndex();
+
 	Q_strncpyz( fs_gamedir, dir, sizeof( fs_gamedir ) );
 
 	// find all pak files in this directory
@@ -3249,6 +4195,9 @@ void FS_Shutdown( qboolean closemfp ) {
 	searchpath_t	*p, *next;
 	int	i;
 
+	// workers read out of the paks
+	FS_ShutdownPrefetch();
+
 #if defined(_WIN32)
 	// Delete temporary files
 	fs_temporaryFileWriteIdx = 0;
@@ -3291,12 +4240,14 @@ void FS_Shutdown( qboolean closemfp ) {
 
 	// any FS_ calls will now be an error until reinitialized
 	fs_searchpaths = NULL;
+	FS_FreePathIndex();
 
 	Cmd_RemoveCommand( "path" );
 	Cmd_RemoveCommand( "dir" );
 	Cmd_RemoveCommand( "fdir" );
 	Cmd_RemoveCommand( "touchFile" );
 	Cmd_RemoveCommand( "which" );
+	Cmd_RemoveCommand( "fs_benchmark" );
 
 #ifdef FS_MISSING
 	if (closemfp) {
@@ -3323,6 +4274,7 @@ void FS_UpdateGamedir(void)
 		{
 			FS_AddGameDirectory(fs_homepath->string, fs_gamedirvar->string);
 		}
+		FS_BuildPathIndex();
 	}
 }
 
@@ -3404,6 +4356,9 @@ void FS_Startup( const char *gameName ) {
 	fs_gamedirvar = Cvar_Get ("fs_game", "", CVAR_INIT|CVAR_SYSTEMINFO, "Mod directory" );
 
 	fs_dirbeforepak = Cvar_Get("fs_dirbeforepak", "0", CVAR_INIT|CVAR_PROTECTED, "Prioritize directories before paks if not pure" );
+	fs_pathIndex = Cvar_Get( "fs_pathIndex", "1", CVAR_ARCHIVE_ND, "Look files up in one index of all paks instead of in each pak" );
+	fs_mapPaks = Cvar_Get( "fs_mapPaks", "1", CVAR_ARCHIVE_ND, "Map paks into memory and read files straight from there, applied on filesystem restart" );
+	fs_prefetchThreads = Cvar_Get( "fs_prefetchThreads", "2", CVAR_ARCHIVE_ND, "Number of threads reading files from mapped paks ahead of level loading, 0 to read everything as it is asked for" );
 
 	// add search path elements in reverse priority order (lowest priority first)
 	if (fs_cdpath->string[0]) {
@@ -3460,10 +4415,12 @@ void FS_Startup( const char *gameName ) {
 	Cmd_AddCommand ("fdir", FS_NewDir_f, "Lists a folder with filters" );
 	Cmd_AddCommand ("touchFile", FS_TouchFile_f, "Touches a file" );
 	Cmd_AddCommand ("which", FS_Which_f, "Determines which search path a file was loaded from" );
+	Cmd_AddCommand ("fs_benchmark", FS_Benchmark_f, "Times loading every file in the paks the stock way, through the path index and prefetched" );
 
 	// https://zerowing.idsoftware.com/bugzilla/show_bug.cgi?id=506
 	// reorder the pure pk3 files according to server order
 	FS_ReorderPurePaks();
+	FS_BuildPathIndex();
 
 	// print the current search paths
 	FS_Path_f();
@@ -3706,6 +4663,9 @@ exception of .cfg and .dat files.
 void FS_PureServerSetLoadedPaks( const char *pakSums, const char *pakNames ) {
 	int		i, c, d;
 
+	// changes which paks files may come from
+	FS_EndPrefetch();
+
 	Cmd_TokenizeString( pakSums );
 
 	c = Cmd_Argc();
@@ -3931,7 +4891,10 @@ qboolean FS_ConditionalRestart( int checksumFeed ) {
 	if(checksumFeed != fs_checksumFeed)
 		FS_Restart(checksumFeed);
 	else if(fs_numServerPaks && !fs_reordered)
+	{
 		FS_ReorderPurePaks();
+		FS_BuildPathIndex();
+	}
 #endif
 	return qfalse;
 }
@@ -3990,7 +4953,7 @@ int		FS_FOpenFileByMode( const char *qpath, fileHandle_t *f, fsMode_t mode ) {
 int		FS_FTell( fileHandle_t f ) {
 	int pos;
 	if (fsh[f].zipFile == qtrue) {
-		pos = unztell(fsh[f].handleFiles.file.z);
+		pos = fsh[f].zipData ? fsh[f].zipReadPos : unztell(fsh[f].handleFiles.file.z);
 	} else {
 		pos = ftell(fsh[f].handleFiles.file.o);
 	}
@@ -29,22 +29,23 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 
 static int			bloc = 0;
 
+// the offset based functions below don't touch bloc so that
+// messages can be encoded on several threads at once
+
 void	Huff_putBit( int bit, byte *fout, int *offset) {
-	bloc = *offset;
-	if ((bloc&7) == 0) {
-		fout[(bloc>>3)] = 0;
+	int loc = *offset;
+	if ((loc&7) == 0) {
+		fout[(loc>>3)] = 0;
 	}
-	fout[(bloc>>3)] |= bit << (bloc&7);
-	bloc++;
-	*offset = bloc;
+	fout[(loc>>3)] |= bit << (loc&7);
+	*offset = loc + 1;
 }
 
 int		Huff_getBit( byte *fin, int *offset) {
 	int t;
-	bloc = *offset;
-	t = (fin[(bloc>>3)] >> (bloc&7)) & 0x1;
-	bloc++;
-	*offset = bloc;
+	int loc = *offset;
+	t = (fin[(loc>>3)] >> (loc&7)) & 0x1;
+	*offset = loc + 1;
 	return t;
 }
 
@@ -270,13 +271,14 @@ int Huff_Receive (node_t *node, int *ch, byte *fin) {
 
 /* Get a symbol */
 void Huff_offsetReceive (node_t *node, int *ch, byte *fin, int *offset) {
-	bloc = *offset;
+	int loc = *offset;
 	while (node && node->symbol == INTERNAL_NODE) {
-		if (get_bit(fin)) {
+		if ((fin[(loc>>3)] >> (loc&7)) & 0x1) {
 			node = node->right;
 		} else {
 			node = node->left;
 		}
+		loc++;
 	}
 	if (!node) {
 		*ch = 0;
@@ -284,7 +286,7 @@ void Huff_offsetReceive (node_t *node, int *ch, byte *fin, int *offset) {
 //		Com_Error(ERR_DROP, "Illegal tree!\n");
 	}
 	*ch = node->symbol;
-	*offset = bloc;
+	*offset = loc;
 }
 
 /* Send the prefix code for this node */
@@ -315,10 +317,148 @@ void Huff_transmit (huff_t *huff, int ch, byte *fout) {
 	}
 }
 
+/* Send the prefix code for this node at offset */
+static void offsetSend(node_t *node, node_t *child, byte *fout, int *offset) {
+	if (node->parent) {
+		offsetSend(node->parent, node, fout, offset);
+	}
+	if (child) {
+		Huff_putBit(node->right == child, fout, offset);
+	}
+}
+
 void Huff_offsetTransmit (huff_t *huff, int ch, byte *fout, int *offset) {
-	bloc = *offset;
-	send(huff->loc[ch], NULL, fout);
-	*offset = bloc;
+	offsetSend(huff->loc[ch], NULL, fout, offset);
+}
+
+/* Load 64 bits starting at byte p, least significant byte first */
+static QINLINE uint64_t load64(const byte *p) {
+	return (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+		((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) | ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+/* Fill in code/length for every symbol and the decoding lookup for the first
+ * HUFF_LOOKUP_BITS bits of the stream.  The tables are only valid for as long
+ * as neither tree gets another Huff_addRef. */
+void Huff_BuildTable( huffTable_t *table, huff_t *compressor, huff_t *decompressor ) {
+	int			ch, i, depth;
+	unsigned int code;
+	node_t		*node, *child;
+
+	Com_Memset(table, 0, sizeof(*table));
+
+	for (ch = 0; ch <= HMAX; ch++) {
+		if (!compressor->loc[ch]) {
+			continue;
+		}
+		// collect the path leaf to root, then reverse it so the root edge goes first
+		code = 0;
+		depth = 0;
+		child = compressor->loc[ch];
+		for (node = child->parent; node; child = node, node = node->parent) {
+			if (depth == 32) {
+				break;
+			}
+			code = (code << 1) | (node->right == child);
+			depth++;
+		}
+		if (node) {
+			continue;	// too long, Huff_tableTransmit falls back to the tree
+		}
+		table->code[ch] = code;
+		table->length[ch] = depth;
+	}
+
+	for (i = 0; i < (1 << HUFF_LOOKUP_BITS); i++) {
+		node = decompressor->tree;
+		for (depth = 0; depth < HUFF_LOOKUP_BITS && node && node->symbol == INTERNAL_NODE; depth++) {
+			node = ((i >> depth) & 1) ? node->right : node->left;
+		}
+		if (node && node->symbol != INTERNAL_NODE && depth > 0) {
+			table->lookup[i] = node->symbol | (depth << 16);
+		}
+	}
+}
+
+/* Write rawBits (at most 7) raw bits of raw followed by the codes for each
+ * symbol, accumulating whole words instead of single bits.  Only bytes that
+ * receive at least one bit are written, exactly like Huff_putBit. */
+void Huff_tableTransmit( const huffTable_t *table, huff_t *huff, int raw, int rawBits, const byte *symbols, int numSymbols, byte *fout, int *offset ) {
+	int			i, ch, len;
+	int			base = *offset >> 3;
+	int			accBits = *offset & 7;
+	uint64_t	acc = accBits ? fout[base] : 0;
+
+	acc |= (uint64_t)(raw & ((1 << rawBits) - 1)) << accBits;
+	accBits += rawBits;
+
+	for (i = 0; i < numSymbols; i++) {
+		ch = symbols[i];
+		len = table->length[ch];
+		if (!len) {
+			int loc;
+
+			// flush, let the tree handle it and pick the partial byte back up
+			for (; accBits > 0; accBits -= 8, acc >>= 8) {
+				fout[base++] = (byte)acc;
+			}
+			loc = (base << 3) + accBits;
+			Huff_offsetTransmit(huff, ch, fout, &loc);
+			base = loc >> 3;
+			accBits = loc & 7;
+			acc = accBits ? fout[base] : 0;
+			continue;
+		}
+		acc |= (uint64_t)table->code[ch] << accBits;
+		accBits += len;
+		if (accBits >= 32) {
+			fout[base] = (byte)acc;
+			fout[base+1] = (byte)(acc >> 8);
+			fout[base+2] = (byte)(acc >> 16);
+			fout[base+3] = (byte)(acc >> 24);
+			base += 4;
+			acc >>= 32;
+			accBits -= 32;
+		}
+	}
+
+	*offset = (base << 3) + accBits;
+	for (; accBits > 0; accBits -= 8, acc >>= 8) {
+		fout[base++] = (byte)acc;
+	}
+}
+
+/* Get a symbol, using the lookup whenever a full 64 bit window fits inside
+ * the buffer and the code is short enough to be in it */
+void Huff_tableReceive( const huffTable_t *table, node_t *tree, int *ch, byte *fin, int maxsize, int *offset ) {
+	int				loc = *offset;
+	unsigned int	entry;
+
+	if ((loc >> 3) + 8 <= maxsize) {
+		entry = table->lookup[(load64(fin + (loc >> 3)) >> (loc & 7)) & ((1 << HUFF_LOOKUP_BITS) - 1)];
+		if (entry >> 16) {
+			*ch = entry & 0xffff;
+			*offset = loc + (entry >> 16);
+			return;
+		}
+	}
+	Huff_offsetReceive(tree, ch, fin, offset);
+}
+
+/* Read numBits (1 to 32) raw bits */
+int Huff_tableGetBits( byte *fin, int maxsize, int numBits, int *offset ) {
+	int		loc = *offset;
+	int		i, value;
+
+	if ((loc >> 3) + 8 <= maxsize) {
+		*offset = loc + numBits;
+		return (int)((load64(fin + (loc >> 3)) >> (loc & 7)) & (0xffffffffu >> (32 - numBits)));
+	}
+	value = 0;
+	for (i = 0; i < numBits; i++) {
+		value |= Huff_getBit(fin, offset) << i;
+	}
+	return value;
 }
 
 void Huff_Decompress(msg_t *mbuf, int offset) {
@@ -373,8 +513,6 @@ void Huff_Decompress(msg_t *mbuf, int offset) {
 	Com_Memcpy(mbuf->data + offset, seq, cch);
 }
 
-extern 	int oldsize;
-
 void Huff_Compress(msg_t *mbuf, int offset) {
 	int			i, ch, size;
 	byte		seq[65536];
@@ -30,6 +30,7 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 //#define _USINGNEWHUFFTABLE_		// Build a new frequency table to cut and paste.
 
 static huffman_t		msgHuff;
+static huffTable_t		msgHuffTable;
 
 static qboolean			msgInit = qfalse;
 #ifdef _NEWHUFFTABLE_
@@ -45,12 +46,11 @@ Handles byte ordering and avoids alignment errors
 ==============================================================================
 */
 
+// snapshots are encoded on worker threads, so the debug counters are per thread
 #ifndef FINAL_BUILD
-	int gLastBitIndex = 0;
+	thread_local int gLastBitIndex = 0;
 #endif
 
-int oldsize = 0;
-
 bool g_nOverrideChecked = false;
 void MSG_CheckNETFPSFOverrides(qboolean psfOverrides);
 
@@ -131,13 +131,13 @@ bit functions
 =============================================================================
 */
 
-int	overflows;
+thread_local int	overflows;
 
 // negative bit values include signs
 void MSG_WriteBits( msg_t *msg, int value, int bits ) {
 	int	i;
 
-	oldsize += bits;
+	msg->oldsize += bits;
 
 	// this isn't an exact overflow check, but close enough
 	if ( msg->maxsize - msg->cursize < 4 ) {
@@ -193,29 +193,82 @@ void MSG_WriteBits( msg_t *msg, int value, int bits ) {
 			Com_Error(ERR_DROP, "can't write %d bits\n", bits);
 		}
 	} else {
-		value &= (0xffffffff>>(32-bits));
-		if (bits&7) {
-			int nbits;
-			nbits = bits&7;
-			for(i=0;i<nbits;i++) {
-				Huff_putBit((value&1), msg->data, &msg->bit);
-				value = (value>>1);
-			}
-			bits = bits - nbits;
-		}
-		if (bits) {
-			for(i=0;i<bits;i+=8) {
+		unsigned int	uvalue = (unsigned int)value & (0xffffffff>>(32-bits));
+		int				nbits = bits&7;
+		int				raw = uvalue & ((1<<nbits)-1);
+		byte			symbols[4];
+
+		uvalue >>= nbits;
+		bits -= nbits;
+		for(i=0;i<bits;i+=8) {
+			symbols[i>>3] = (byte)uvalue;
 #ifdef _NEWHUFFTABLE_
-				fwrite(&value, 1, 1, fp);
+			fwrite(&symbols[i>>3], 1, 1, fp);
 #endif // _NEWHUFFTABLE_
-				Huff_offsetTransmit (&msgHuff.compressor, (value&0xff), msg->data, &msg->bit);
-				value = (value>>8);
-			}
+			uvalue >>= 8;
 		}
+		Huff_tableTransmit (&msgHuffTable, &msgHuff.compressor, raw, nbits, symbols, bits>>3, msg->data, &msg->bit);
 		msg->cursize = (msg->bit>>3)+1;
 	}
 }
 
+/*
+=================
+MSG_WriteBitString
+
+Appends bits previously written with MSG_WriteBits to another message
+starting at bit 0.  Every huffman code stands on its own and the tables
+never change, so the encoded bits can be spliced in at any bit offset and
+read back exactly as if the values had been written there.
+
+Returns qfalse without writing anything if the splice could take the
+message close enough to maxsize that MSG_WriteBits might have overflowed
+partway through.  The caller should write the values normally then.
+=================
+*/
+qboolean MSG_WriteBitString( msg_t *msg, const byte *data, int bits ) {
+	int			base, accBits, i;
+	uint64_t	acc;
+
+	if ( msg->oob ) {
+		Com_Error( ERR_DROP, "MSG_WriteBitString: out of band message" );
+	}
+
+	if ( msg->maxsize - ( ( ( msg->bit + bits ) >> 3 ) + 1 ) < 4 ) {
+		return qfalse;
+	}
+
+	base = msg->bit >> 3;
+	accBits = msg->bit & 7;
+	acc = accBits ? msg->data[base] : 0;
+
+	// same accumulation as Huff_tableTransmit, only bytes receiving bits are written
+	for ( i = 0; i < ( bits >> 3 ); i++ ) {
+		acc |= (uint64_t)data[i] << accBits;
+		accBits += 8;
+		if ( accBits >= 32 ) {
+			msg->data[base] = (byte)acc;
+			msg->data[base+1] = (byte)( acc >> 8 );
+			msg->data[base+2] = (byte)( acc >> 16 );
+			msg->data[base+3] = (byte)( acc >> 24 );
+			base += 4;
+			acc >>= 32;
+			accBits -= 32;
+		}
+	}
+	if ( bits & 7 ) {
+		acc |= (uint64_t)( data[i] & ( ( 1 << ( bits & 7 ) ) - 1 ) ) << accBits;
+		accBits += bits & 7;
+	}
+	for ( ; accBits > 0; accBits -= 8, acc >>= 8 ) {
+		msg->data[base++] = (byte)acc;
+	}
+
+	msg->bit += bits;
+	msg->cursize = ( msg->bit >> 3 ) + 1;
+	return qtrue;
+}
+
 int MSG_ReadBits( msg_t *msg, int bits ) {
 	int			value;
 	int			get;
@@ -253,14 +306,12 @@ int MSG_ReadBits( msg_t *msg, int bits ) {
 		nbits = 0;
 		if (bits&7) {
 			nbits = bits&7;
-			for(i=0;i<nbits;i++) {
-				value |= (Huff_getBit(msg->data, &msg->bit)<<i);
-			}
+			value = Huff_tableGetBits(msg->data, msg->maxsize, nbits, &msg->bit);
 			bits = bits - nbits;
 		}
 		if (bits) {
 			for(i=0;i<bits;i+=8) {
-				Huff_offsetReceive (msgHuff.decompressor.tree, &get, msg->data, &msg->bit);
+				Huff_tableReceive (&msgHuffTable, msgHuff.decompressor.tree, &get, msg->data, msg->maxsize, &msg->bit);
 #ifdef _NEWHUFFTABLE_
 				fwrite(&get, 1, 1, fp);
 #endif // _NEWHUFFTABLE_
@@ -705,7 +756,7 @@ void MSG_WriteDeltaUsercmdKey( msg_t *msg, int key, usercmd_t *from, usercmd_t *
 		from->invensel == to->invensel &&
 		from->generic_cmd == to->generic_cmd) {
 			MSG_WriteBits( msg, 0, 1 );				// no change
-			oldsize += 7;
+			msg->oldsize += 7;
 			return;
 	}
 	key ^= to->serverTime;
@@ -1014,6 +1065,10 @@ void MSG_WriteDeltaEntity( msg_t *msg, struct entityState_s *from, struct entity
 	int			trunc;
 	float		fullFloat;
 	int			*fromF, *toF;
+#ifndef FINAL_BUILD
+	// the change counters are shared, leave them to the thread running the frame
+	const qboolean	countChanges = (qboolean)!Com_IsWorkerThread();
+#endif
 
 	numFields = (int)ARRAY_LEN( entityStateFields );
 
@@ -1045,7 +1100,9 @@ void MSG_WriteDeltaEntity( msg_t *msg, struct entityState_s *from, struct entity
 		if ( *fromF != *toF ) {
 			lc = i+1;
 #ifndef FINAL_BUILD
-			field->mCount++;
+			if ( countChanges ) {
+				field->mCount++;
+			}
 #endif
 		}
 	}
@@ -1068,7 +1125,7 @@ void MSG_WriteDeltaEntity( msg_t *msg, struct entityState_s *from, struct entity
 
 	MSG_WriteByte( msg, lc );	// # of changes
 
-	oldsize += numFields;
+	msg->oldsize += numFields;
 
 	for ( i = 0, field = entityStateFields ; i < lc ; i++, field++ ) {
 		fromF = (int *)( (byte *)from + field->offset );
@@ -1088,7 +1145,7 @@ void MSG_WriteDeltaEntity( msg_t *msg, struct entityState_s *from, struct entity
 
 			if (fullFloat == 0.0f) {
 					MSG_WriteBits( msg, 0, 1 );
-					oldsize += FLOAT_INT_BITS;
+					msg->oldsize += FLOAT_INT_BITS;
 			} else {
 				MSG_WriteBits( msg, 1, 1 );
 				if ( trunc == fullFloat && trunc + FLOAT_INT_BIAS >= 0 &&
@@ -2080,6 +2137,9 @@ void MSG_WriteDeltaPlayerstate( msg_t *msg, struct playerState_s *from, struct p
 	int				bitComboMask = 0;
 	int				numBitsInMask = 0;
 #endif
+#ifndef FINAL_BUILD
+	const qboolean	countChanges = (qboolean)!Com_IsWorkerThread();
+#endif
 
 	if (!from) {
 		from = &dummy;
@@ -2120,7 +2180,9 @@ void MSG_WriteDeltaPlayerstate( msg_t *msg, struct playerState_s *from, struct p
 		if ( *fromF != *toF ) {
 			lc = i+1;
 #ifndef FINAL_BUILD
-			field->mCount++;
+			if ( countChanges ) {
+				field->mCount++;
+			}
 #endif
 		}
 	}
@@ -2131,7 +2193,7 @@ void MSG_WriteDeltaPlayerstate( msg_t *msg, struct playerState_s *from, struct p
 	gLastBitIndex = lc;
 #endif
 
-	oldsize += numFields - lc;
+	msg->oldsize += numFields - lc;
 
 	for ( i = 0, field = PSFields ; i < lc ; i++, field++ ) {
 		fromF = (int *)( (byte *)from + field->offset );
@@ -2206,7 +2268,7 @@ void MSG_WriteDeltaPlayerstate( msg_t *msg, struct playerState_s *from, struct p
 
 	if (!statsbits && !persistantbits && !ammobits && !powerupbits) {
 		MSG_WriteBits( msg, 0, 1 );	// no change
-		oldsize += 4;
+		msg->oldsize += 4;
 #ifdef _ONEBIT_COMBO
 		goto sendBitMask;
 #else
@@ -3043,6 +3105,7 @@ void MSG_initHuffman() {
 			Huff_addRef(&msgHuff.decompressor,	(byte)i);			// Do update
 		}
 	}
+	Huff_BuildTable(&msgHuffTable, &msgHuff.compressor, &msgHuff.decompressor);
 }
 
 #else
@@ -3077,6 +3140,7 @@ void MSG_initHuffman() {
 		Com_Printf("%d,			// %d\n", array[i], i);
 	}
 	Com_Printf("};\n");
+	Huff_BuildTable(&msgHuffTable, &msgHuff.compressor, &msgHuff.decompressor);
 	FS_FreeFile( data );
 	Cbuf_AddText( "condump dump.txt\n" );
 }
@@ -3093,6 +3157,175 @@ void MSG_shutdownHuffman()
 #endif // _NEWHUFFTABLE_
 }
 
+/*
+=================
+MSG_HuffmanBenchmark_f
+
+Decodes and re-encodes the messages of a recorded demo with both the tree
+walk and the lookup tables, checks that the two agree bit for bit and prints
+the throughput of each
+=================
+*/
+void MSG_HuffmanBenchmark_f( void ) {
+	byte	*file, *packed, *symbols, *out[2];
+	int		*msgOffset, *msgLen, *symOffset, *symCount;
+	int		fileLen, numMsgs, numSymbols, passes;
+	int		pass, impl, i, j, n, loc, ch, pos, start;
+	int		msec[2][2];
+	double	mb;
+
+	if ( Cmd_Argc() < 2 ) {
+		Com_Printf( "usage: huffbench <demo> [passes]\n" );
+		return;
+	}
+	passes = Cmd_Argc() > 2 ? Com_Clampi( 1, 10000, atoi( Cmd_Argv( 2 ) ) ) : 20;
+
+	if ( !msgInit ) {
+		MSG_initHuffman();
+	}
+
+	fileLen = FS_ReadFile( Cmd_Argv( 1 ), (void **)&file );
+	if ( !file ) {
+		Com_Printf( "Couldn't read %s\n", Cmd_Argv( 1 ) );
+		return;
+	}
+
+	// count the messages: sequence, length, then the huffman coded payload
+	numMsgs = 0;
+	for ( pos = 0; pos + 8 <= fileLen; pos += 8 + n, numMsgs++ ) {
+		n = LittleLong( *(int *)(file + pos + 4) );
+		if ( n < 0 || n > MAX_MSGLEN || pos + 8 + n > fileLen ) {
+			break;
+		}
+	}
+	if ( !numMsgs ) {
+		Com_Printf( "%s has no messages\n", Cmd_Argv( 1 ) );
+		FS_FreeFile( file );
+		return;
+	}
+
+	// copy each payload out with enough zero padding after it for the 64 bit reads
+	msgOffset = (int *)Z_Malloc( numMsgs * 4 * sizeof( int ), TAG_TEMP_WORKSPACE, qfalse );
+	msgLen = msgOffset + numMsgs;
+	symOffset = msgLen + numMsgs;
+	symCount = symOffset + numMsgs;
+	packed = (byte *)Z_Malloc( fileLen + numMsgs * 8, TAG_TEMP_WORKSPACE, qtrue );
+	for ( i = 0, pos = 0, start = 0; i < numMsgs; i++ ) {
+		msgLen[i] = LittleLong( *(int *)(file + pos + 4) );
+		msgOffset[i] = start;
+		Com_Memcpy( packed + start, file + pos + 8, msgLen[i] );
+		pos += 8 + msgLen[i];
+		start += msgLen[i] + 8;
+	}
+	FS_FreeFile( file );
+
+	// the reference symbol stream for every message, up to anything unencodable
+	numSymbols = 0;
+	for ( pass = 0; pass < 2; pass++ ) {
+		symbols = pass ? (byte *)Z_Malloc( numSymbols + 1, TAG_TEMP_WORKSPACE, qfalse ) : NULL;
+		for ( i = 0, n = 0; i < numMsgs; i++ ) {
+			symOffset[i] = n;
+			for ( loc = 0; loc < msgLen[i] * 8; ) {
+				start = loc;
+				Huff_offsetReceive( msgHuff.decompressor.tree, &ch, packed + msgOffset[i], &loc );
+				if ( loc == start || ch > 255 ) {
+					break;
+				}
+				if ( symbols ) {
+					symbols[n] = ch;
+				}
+				n++;
+			}
+			symCount[i] = n - symOffset[i];
+		}
+		numSymbols = n;
+	}
+
+	out[0] = (byte *)Z_Malloc( MAX_MSGLEN * 8, TAG_TEMP_WORKSPACE, qtrue );
+	out[1] = (byte *)Z_Malloc( MAX_MSGLEN * 8, TAG_TEMP_WORKSPACE, qtrue );
+
+	for ( i = 0; i < numMsgs; i++ ) {
+		const byte	*in = packed + msgOffset[i];
+		const byte	*sym = symbols + symOffset[i];
+		int			bits[2];
+
+		for ( j = 0, loc = 0; j < symCount[i]; j++ ) {
+			Huff_tableReceive( &msgHuffTable, msgHuff.decompressor.tree, &ch, (byte *)in, msgLen[i] + 8, &loc );
+			if ( ch != sym[j] ) {
+				Com_Printf( S_COLOR_RED "huffbench: message %d symbol %d decodes to %d, expected %d\n", i, j, ch, sym[j] );
+				goto done;
+			}
+		}
+
+		bits[0] = bits[1] = 0;
+		for ( j = 0; j < symCount[i]; j++ ) {
+			Huff_offsetTransmit( &msgHuff.compressor, sym[j], out[0], &bits[0] );
+		}
+		for ( j = 0; j < symCount[i]; j += 4 ) {
+			Huff_tableTransmit( &msgHuffTable, &msgHuff.compressor, 0, 0, sym + j, Q_min( 4, symCount[i] - j ), out[1], &bits[1] );
+		}
+		if ( bits[0] != bits[1] || memcmp( out[0], out[1], (bits[0] + 7) >> 3 ) ) {
+			Com_Printf( S_COLOR_RED "huffbench: message %d encodes differently\n", i );
+			goto done;
+		}
+	}
+
+	// timing, tree walk first then tables
+	for ( impl = 0; impl < 2; impl++ ) {
+		start = Sys_Milliseconds();
+		for ( pass = 0; pass < passes; pass++ ) {
+			for ( i = 0; i < numMsgs; i++ ) {
+				const byte *sym = symbols + symOffset[i];
+
+				loc = 0;
+				if ( impl ) {
+					for ( j = 0; j < symCount[i]; j += 4 ) {
+						Huff_tableTransmit( &msgHuffTable, &msgHuff.compressor, 0, 0, sym + j, Q_min( 4, symCount[i] - j ), out[1], &loc );
+					}
+				} else {
+					for ( j = 0; j < symCount[i]; j++ ) {
+						Huff_offsetTransmit( &msgHuff.compressor, sym[j], out[0], &loc );
+					}
+				}
+			}
+		}
+		msec[impl][0] = Sys_Milliseconds() - start;
+
+		start = Sys_Milliseconds();
+		for ( pass = 0; pass < passes; pass++ ) {
+			for ( i = 0; i < numMsgs; i++ ) {
+				byte *in = packed + msgOffset[i];
+
+				loc = 0;
+				if ( impl ) {
+					for ( j = 0; j < symCount[i]; j++ ) {
+						Huff_tableReceive( &msgHuffTable, msgHuff.decompressor.tree, &ch, in, msgLen[i] + 8, &loc );
+					}
+				} else {
+					for ( j = 0; j < symCount[i]; j++ ) {
+						Huff_offsetReceive( msgHuff.decompressor.tree, &ch, in, &loc );
+					}
+				}
+			}
+		}
+		msec[impl][1] = Sys_Milliseconds() - start;
+	}
+
+	mb = (double)numSymbols * passes / (1024.0 * 1024.0);
+	Com_Printf( "%d messages, %d symbols, %d passes\n", numMsgs, numSymbols, passes );
+	Com_Printf( "encode: tree %8.2f MB/s  table %8.2f MB/s\n",
+		mb * 1000.0 / Q_max( 1, msec[0][0] ), mb * 1000.0 / Q_max( 1, msec[1][0] ) );
+	Com_Printf( "decode: tree %8.2f MB/s  table %8.2f MB/s\n",
+		mb * 1000.0 / Q_max( 1, msec[0][1] ), mb * 1000.0 / Q_max( 1, msec[1][1] ) );
+
+done:
+	Z_Free( out[1] );
+	Z_Free( out[0] );
+	Z_Free( symbols );
+	Z_Free( packed );
+	Z_Free( msgOffset );
+}
+
 /*
 =================
 MSG_ReportChangeVectors_f
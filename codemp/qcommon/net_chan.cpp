@@ -96,12 +96,13 @@ void Netchan_Setup( netsrc_t sock, netchan_t *chan, netadr_t adr, int qport ) {
 =================
 Netchan_TransmitNextFragment
 
-Send one fragment of the current message
+Send one fragment of the current message.  Only the header is written here,
+the payload goes out straight from unsentBuffer.
 =================
 */
 void Netchan_TransmitNextFragment( netchan_t *chan ) {
 	msg_t		send;
-	byte		send_buf[MAX_PACKETLEN];
+	byte		send_buf[PACKET_HEADER];
 	int			fragmentLength;
 
 	// write the packet header
@@ -122,15 +123,15 @@ void Netchan_TransmitNextFragment( netchan_t *chan ) {
 
 	MSG_WriteShort( &send, chan->unsentFragmentStart );
 	MSG_WriteShort( &send, fragmentLength );
-	MSG_WriteData( &send, chan->unsentBuffer + chan->unsentFragmentStart, fragmentLength );
 
 	// send the datagram
-	NET_SendPacket( chan->sock, send.cursize, send.data, chan->remoteAddress );
+	NET_SendPacketGather( chan->sock, send.cursize, send.data,
+		fragmentLength, chan->unsentBuffer + chan->unsentFragmentStart, chan->remoteAddress );
 
 	if ( showpackets->integer ) {
 		Com_Printf ("%s send %4i : s=%i fragment=%i,%i\n"
 			, netsrcString[ chan->sock ]
-			, send.cursize
+			, send.cursize + fragmentLength
 			, chan->outgoingSequence - 1
 			, chan->unsentFragmentStart, fragmentLength);
 	}
@@ -158,7 +159,7 @@ A 0 length will still generate a packet.
 */
 void Netchan_Transmit( netchan_t *chan, int length, const byte *data ) {
 	msg_t		send;
-	byte		send_buf[MAX_PACKETLEN];
+	byte		send_buf[PACKET_HEADER];
 
 	if ( length > MAX_MSGLEN ) {
 		Com_Error( ERR_DROP, "Netchan_Transmit: length = %i", length );
@@ -174,7 +175,11 @@ void Netchan_Transmit( netchan_t *chan, int length, const byte *data ) {
 	{
 		chan->unsentFragments = qtrue;
 		chan->unsentLength = length;
-		Com_Memcpy( chan->unsentBuffer, data, length );
+		// the fragments go out over the next frames, long after the
+		// caller's buffer is gone
+		if ( data != chan->unsentBuffer ) {
+			Com_Memcpy( chan->unsentBuffer, data, length );
+		}
 
 		// only send the first fragment now
 		Netchan_TransmitNextFragment( chan );
@@ -193,15 +198,13 @@ void Netchan_Transmit( netchan_t *chan, int length, const byte *data ) {
 		MSG_WriteShort( &send, qport->integer );
 	}
 
-	MSG_WriteData( &send, data, length );
-
 	// send the datagram
-	NET_SendPacket( chan->sock, send.cursize, send.data, chan->remoteAddress );
+	NET_SendPacketGather( chan->sock, send.cursize, send.data, length, data, chan->remoteAddress );
 
 	if ( showpackets->integer ) {
 		Com_Printf( "%s send %4i : s=%i ack=%i\n"
 			, netsrcString[ chan->sock ]
-			, send.cursize
+			, send.cursize + length
 			, chan->outgoingSequence - 1
 			, chan->incomingSequence );
 	}
@@ -214,9 +217,9 @@ Netchan_Process
 Returns qfalse if the message should not be processed due to being
 out of order or a fragment.
 
-Msg must be large enough to hold MAX_MSGLEN, because if this is the
-final fragment of a multi-part message, the entire thing will be
-copied out.
+If this is the final fragment of a multi-part message, msg is pointed at
+the reassembled message in chan->fragmentBuffer instead of copying it out,
+so callers must MSG_Init msg again before reading the next packet into it.
 =================
 */
 qboolean Netchan_Process( netchan_t *chan, msg_t *msg ) {
@@ -330,7 +333,7 @@ qboolean Netchan_Process( netchan_t *chan, msg_t *msg ) {
 
 		// copy the fragment to the fragment buffer
 		if ( fragmentLength < 0 || msg->readcount + fragmentLength > msg->cursize ||
-			chan->fragmentLength + fragmentLength > (int)sizeof( chan->fragmentBuffer ) ) {
+			chan->fragmentLength + fragmentLength > MAX_MSGLEN ) {
 			if ( showdrop->integer || showpackets->integer ) {
 				Com_Printf ("%s:illegal fragment length\n"
 				, NET_AdrToString (chan->remoteAddress ) );
@@ -338,7 +341,7 @@ qboolean Netchan_Process( netchan_t *chan, msg_t *msg ) {
 			return qfalse;
 		}
 
-		Com_Memcpy( chan->fragmentBuffer + chan->fragmentLength,
+		Com_Memcpy( chan->fragmentBuffer + 4 + chan->fragmentLength,
 			msg->data + msg->readcount, fragmentLength );
 
 		chan->fragmentLength += fragmentLength;
@@ -348,19 +351,12 @@ qboolean Netchan_Process( netchan_t *chan, msg_t *msg ) {
 			return qfalse;
 		}
 
-		if ( chan->fragmentLength+4 > msg->maxsize ) {
-			Com_Printf( "%s:fragmentLength %i > msg->maxsize\n"
-				, NET_AdrToString (chan->remoteAddress ),
-				chan->fragmentLength+4 );
-			return qfalse;
-		}
+		// read the full message where it was assembled, with the
+		// sequence number in front like an unfragmented packet
+		*(int *)chan->fragmentBuffer = LittleLong( sequence );
 
-		// copy the full message over the partial fragment
-
-		// make sure the sequence number is still there
-		*(int *)msg->data = LittleLong( sequence );
-
-		Com_Memcpy( msg->data + 4, chan->fragmentBuffer, chan->fragmentLength );
+		msg->data = chan->fragmentBuffer;
+		msg->maxsize = sizeof( chan->fragmentBuffer );
 		msg->cursize = chan->fragmentLength + 4;
 		chan->fragmentLength = 0;
 		msg->readcount = 4;	// past the sequence number
@@ -579,6 +575,38 @@ void NET_SendPacket( netsrc_t sock, int length, const void *data, netadr_t to )
 	Sys_SendPacket( length, data, to );
 }
 
+/*
+===============
+NET_SendPacketGather
+
+Sends header and data as a single packet
+================
+*/
+void NET_SendPacketGather( netsrc_t sock, int headerLength, const void *header, int length, const void *data, netadr_t to ) {
+	loopback_t	*loop;
+	int			i;
+
+	if ( to.type == NA_LOOPBACK ) {
+		loop = &loopbacks[sock^1];
+
+		i = loop->send & (MAX_LOOPBACK-1);
+		loop->send++;
+
+		Com_Memcpy (loop->msgs[i].data, header, headerLength);
+		Com_Memcpy (loop->msgs[i].data + headerLength, data, length);
+		loop->msgs[i].datalen = headerLength + length;
+		return;
+	}
+	if ( to.type == NA_BOT ) {
+		return;
+	}
+	if ( to.type == NA_BAD ) {
+		return;
+	}
+
+	Sys_SendPacketGather( headerLength, header, length, data, to );
+}
+
 /*
 ===============
 NET_OutOfBandPrint
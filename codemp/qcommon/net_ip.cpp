@@ -22,6 +22,12 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 ===========================================================================
 */
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 #include "qcommon/qcommon.h"
 
 #ifdef _WIN32
@@ -71,6 +77,11 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 #include <sys/filio.h>
 #endif
 
+#ifdef __linux__
+#include <sys/epoll.h>
+#define NET_BATCHED_IO		// recvmmsg, sendmmsg and epoll are available
+#endif
+
 typedef int SOCKET;
 #define INVALID_SOCKET                -1
 #define SOCKET_ERROR                        -1
@@ -97,6 +108,9 @@ static cvar_t	*net_port;
 
 static cvar_t	*net_dropsim;
 
+static cvar_t	*net_batch;
+static cvar_t	*net_recvThread;
+
 static struct sockaddr_in	socksRelayAddr;
 
 static SOCKET	ip_socket = INVALID_SOCKET;
@@ -106,6 +120,60 @@ static SOCKET	socks_socket = INVALID_SOCKET;
 static	int		numIP;
 static	byte	localIP[MAX_IPS][4];
 
+#ifdef NET_BATCHED_IO
+#define	NET_BATCH_SIZE		32			// datagrams per recvmmsg / sendmmsg
+#define	NET_BATCH_PACKETLEN	1500		// larger packets skip the send queue
+
+typedef struct netSendQueue_s {
+	qboolean			active;			// between NET_BeginPacketBatch and NET_FlushPacketBatch
+	int					numPackets;
+	struct sockaddr_in	addrs[NET_BATCH_SIZE];
+	struct iovec		iovecs[NET_BATCH_SIZE];
+	struct mmsghdr		headers[NET_BATCH_SIZE];
+	byte				data[NET_BATCH_SIZE][NET_BATCH_PACKETLEN];
+} netSendQueue_t;
+
+static int				epoll_fd = -1;	// only open while net_batch is in use
+static netSendQueue_t	netSendQueue;
+#endif
+
+// net_recvThread reads datagrams on its own thread as soon as they arrive and
+// queues them with their arrival time, the main thread dispatches them from
+// NET_Sleep and Com_EventLoop.  One producer and one consumer, so head and
+// tail are the only shared state.
+#define	NET_RECV_QUEUE_SIZE		1024		// must be a power of two
+#define	NET_RECV_PACKETLEN		2048		// larger datagrams are dropped as oversize
+
+typedef struct netRecvPacket_s {
+	struct sockaddr_in	from;
+	socklen_t			fromlen;
+	int					length;
+	int					time;			// NET_Milliseconds when it was read
+	byte				data[NET_RECV_PACKETLEN];
+} netRecvPacket_t;
+
+typedef struct netRecvQueue_s {
+	netRecvPacket_t				packets[NET_RECV_QUEUE_SIZE];
+	std::atomic<unsigned>		head;		// written by the receive thread
+	std::atomic<unsigned>		tail;		// written by the main thread
+	std::atomic<bool>			running;
+	std::atomic<bool>			sleeping;	// main thread is waiting in NET_Sleep
+	std::mutex					mutex;
+	std::condition_variable		wake;
+	std::thread					thread;
+	int							generation;	// bumped on every start
+
+	// counters for net_recvstats, dropped is written by the receive thread
+	std::atomic<int>			dropped;
+	int							dispatched;
+	int							totalWait, maxWait;	// msec from arrival to dispatch
+} netRecvQueue_t;
+
+static netRecvQueue_t	netRecvQueue;
+static int				net_packetTime;		// arrival time of the packet being dispatched
+static fileHandle_t		net_captureFile;
+static int				net_captureStart;
+
 //=============================================================================
 
 /*
@@ -247,6 +315,8 @@ Receive one packet
 int	recvfromCount;
 #endif
 
+static qboolean NET_AcceptPacket( struct sockaddr_in *from, socklen_t fromlen, int ret, netadr_t *net_from, msg_t *net_message );
+
 qboolean NET_GetPacket( netadr_t *net_from, msg_t *net_message, fd_set *fdr ) {
 	int ret, err;
 	socklen_t fromlen;
@@ -272,9 +342,20 @@ qboolean NET_GetPacket( netadr_t *net_from, msg_t *net_message, fd_set *fdr ) {
 		return qfalse;
 	}
 
-	memset( from.sin_zero, 0, 8 );
+	return NET_AcceptPacket( &from, fromlen, ret, net_from, net_message );
+}
+
+/*
+==================
+NET_AcceptPacket
+
+Unwraps a received datagram of length ret sitting in net_message->data
+==================
+*/
+static qboolean NET_AcceptPacket( struct sockaddr_in *from, socklen_t fromlen, int ret, netadr_t *net_from, msg_t *net_message ) {
+	memset( from->sin_zero, 0, 8 );
 
-	if ( usingSocks && memcmp( &from, &socksRelayAddr, fromlen ) == 0 ) {
+	if ( usingSocks && memcmp( from, &socksRelayAddr, fromlen ) == 0 ) {
 		if ( ret < 10 || net_message->data[0] != 0 || net_message->data[1] != 0 || net_message->data[2] != 0 || net_message->data[3] != 1 ) {
 			return qfalse;
 		}
@@ -287,7 +368,7 @@ qboolean NET_GetPacket( netadr_t *net_from, msg_t *net_message, fd_set *fdr ) {
 		net_message->readcount = 10;
 	}
 	else {
-		SockadrToNetadr( &from, net_from );
+		SockadrToNetadr( from, net_from );
 		net_message->readcount = 0;
 	}
 
@@ -304,12 +385,29 @@ qboolean NET_GetPacket( netadr_t *net_from, msg_t *net_message, fd_set *fdr ) {
 
 static char socksBuf[4096];
 
+static void NET_SendError( const struct sockaddr_in *addr );
+#ifdef NET_BATCHED_IO
+static void NET_FlushSendQueue( void );
+#endif
+
 /*
 ==================
 Sys_SendPacket
 ==================
 */
 void Sys_SendPacket( int length, const void *data, netadr_t to ) {
+	Sys_SendPacketGather( 0, NULL, length, data, to );
+}
+
+/*
+==================
+Sys_SendPacketGather
+
+Sends header followed by data as one datagram without joining them in a
+temporary buffer first, netchan fragments go out straight from the message
+==================
+*/
+void Sys_SendPacketGather( int headerLength, const void *header, int length, const void *data, netadr_t to ) {
 	int					ret;
 	struct sockaddr_in	addr;
 
@@ -331,27 +429,165 @@ void Sys_SendPacket( int length, const void *data, netadr_t to ) {
 		socksBuf[3] = 1;	// address type: IPV4
 		memcpy( &socksBuf[4], &addr.sin_addr, 4 );
 		memcpy( &socksBuf[8], &addr.sin_port, 2 );
-		memcpy( &socksBuf[10], data, length );
-		ret = sendto( ip_socket, socksBuf, length+10, 0, (sockaddr *)&socksRelayAddr, sizeof(socksRelayAddr) );
-	}
-	else {
-		ret = sendto( ip_socket, (const char *)data, length, 0, (sockaddr *)&addr, sizeof(addr) );
+		if ( headerLength ) {
+			memcpy( &socksBuf[10], header, headerLength );
+		}
+		memcpy( &socksBuf[10 + headerLength], data, length );
+		data = socksBuf;
+		length += 10 + headerLength;
+		headerLength = 0;
+		addr = socksRelayAddr;
 	}
-	if( ret == SOCKET_ERROR ) {
-		int err = socketError;
 
-		// wouldblock is silent
-		if( err == EAGAIN ) {
+#ifdef NET_BATCHED_IO
+	if ( netSendQueue.active ) {
+		if ( headerLength + length <= NET_BATCH_PACKETLEN ) {
+			int n = netSendQueue.numPackets++;
+
+			// the queue outlives the caller's buffers, so this is the one copy
+			if ( headerLength ) {
+				memcpy( netSendQueue.data[n], header, headerLength );
+			}
+			memcpy( netSendQueue.data[n] + headerLength, data, length );
+			netSendQueue.addrs[n] = addr;
+			netSendQueue.iovecs[n].iov_len = headerLength + length;
+			if ( netSendQueue.numPackets == NET_BATCH_SIZE ) {
+				NET_FlushSendQueue();
+			}
 			return;
 		}
 
-		// some PPP links do not allow broadcasts and return an error
-		if( err == EADDRNOTAVAIL && to.type == NA_BROADCAST ) {
+		// keep the order, the big one goes right after what is queued
+		NET_FlushSendQueue();
+	}
+#endif
+
+#ifdef _WIN32
+	// winsock 1 has no gather send
+	if ( headerLength ) {
+		byte	packet[MAX_MSGLEN + 16];
+
+		if ( headerLength + length > (int)sizeof( packet ) ) {
+			Com_Printf( "Sys_SendPacketGather: %i byte packet dropped\n", headerLength + length );
 			return;
 		}
+		memcpy( packet, header, headerLength );
+		memcpy( packet + headerLength, data, length );
+		ret = sendto( ip_socket, (const char *)packet, headerLength + length, 0, (sockaddr *)&addr, sizeof(addr) );
+	} else {
+		ret = sendto( ip_socket, (const char *)data, length, 0, (sockaddr *)&addr, sizeof(addr) );
+	}
+#else
+	if ( headerLength ) {
+		struct iovec	iov[2];
+		struct msghdr	hdr;
+
+		iov[0].iov_base = (void *)header;
+		iov[0].iov_len = headerLength;
+		iov[1].iov_base = (void *)data;
+		iov[1].iov_len = length;
+		memset( &hdr, 0, sizeof( hdr ) );
+		hdr.msg_name = &addr;
+		hdr.msg_namelen = sizeof( addr );
+		hdr.msg_iov = iov;
+		hdr.msg_iovlen = 2;
+		ret = sendmsg( ip_socket, &hdr, 0 );
+	} else {
+		ret = sendto( ip_socket, (const char *)data, length, 0, (sockaddr *)&addr, sizeof(addr) );
+	}
+#endif
+	if( ret == SOCKET_ERROR ) {
+		NET_SendError( &addr );
+	}
+}
 
-		Com_Printf( "NET_SendPacket: %s\n", NET_ErrorString() );
+/*
+==================
+NET_SendError
+==================
+*/
+static void NET_SendError( const struct sockaddr_in *addr ) {
+	int err = socketError;
+
+	// wouldblock is silent
+	if( err == EAGAIN ) {
+		return;
+	}
+
+	// some PPP links do not allow broadcasts and return an error
+	if( err == EADDRNOTAVAIL && addr->sin_addr.s_addr == INADDR_BROADCAST ) {
+		return;
 	}
+
+	Com_Printf( "NET_SendPacket: %s\n", NET_ErrorString() );
+}
+
+#ifdef NET_BATCHED_IO
+/*
+==================
+NET_FlushSendQueue
+
+Sends everything queued by Sys_SendPacket, as few sendmmsg calls as it takes
+==================
+*/
+static void NET_FlushSendQueue( void ) {
+	int		i, sent, ret;
+
+	for ( i = 0; i < netSendQueue.numPackets; i++ ) {
+		netSendQueue.iovecs[i].iov_base = netSendQueue.data[i];
+		memset( &netSendQueue.headers[i], 0, sizeof( netSendQueue.headers[i] ) );
+		netSendQueue.headers[i].msg_hdr.msg_name = &netSendQueue.addrs[i];
+		netSendQueue.headers[i].msg_hdr.msg_namelen = sizeof( netSendQueue.addrs[i] );
+		netSendQueue.headers[i].msg_hdr.msg_iov = &netSendQueue.iovecs[i];
+		netSendQueue.headers[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	for ( sent = 0; sent < netSendQueue.numPackets && ip_socket != INVALID_SOCKET; ) {
+		ret = sendmmsg( ip_socket, &netSendQueue.headers[sent], netSendQueue.numPackets - sent, 0 );
+		if ( ret == SOCKET_ERROR ) {
+			if ( socketError == EINTR ) {
+				continue;
+			}
+			// only the first datagram failed, report it like sendto would and carry on
+			NET_SendError( &netSendQueue.addrs[sent] );
+			sent++;
+			continue;
+		}
+		sent += ret;
+	}
+
+	netSendQueue.numPackets = 0;
+}
+#endif
+
+/*
+==================
+NET_BeginPacketBatch
+
+Queues the packets sent until NET_FlushPacketBatch instead of sending each
+one with its own syscall.  Does nothing unless net_batch is enabled.
+==================
+*/
+void NET_BeginPacketBatch( void ) {
+#ifdef NET_BATCHED_IO
+	if ( epoll_fd != -1 ) {
+		netSendQueue.active = qtrue;
+	}
+#endif
+}
+
+/*
+==================
+NET_FlushPacketBatch
+==================
+*/
+void NET_FlushPacketBatch( void ) {
+#ifdef NET_BATCHED_IO
+	if ( netSendQueue.numPackets ) {
+		NET_FlushSendQueue();
+	}
+	netSendQueue.active = qfalse;
+#endif
 }
 
 //=============================================================================
@@ -809,6 +1045,407 @@ void NET_GetLocalAddress( void )
 }
 #endif
 
+static void NET_DispatchPacket( netadr_t *from, msg_t *netmsg, int time );
+
+/*
+====================
+NET_Milliseconds
+
+Monotonic clock used to timestamp packets, never returns 0
+====================
+*/
+int NET_Milliseconds( void ) {
+	static const std::chrono::steady_clock::time_point base = std::chrono::steady_clock::now();
+
+	return 1 + (int)std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now() - base ).count();
+}
+
+/*
+====================
+NET_PacketTime
+
+NET_Milliseconds when the packet that is being dispatched arrived, or now
+for loopback packets
+====================
+*/
+int NET_PacketTime( void ) {
+	return net_packetTime ? net_packetTime : NET_Milliseconds();
+}
+
+/*
+====================
+NET_ReceiveThread
+
+Reads datagrams straight into the free queue slots as they arrive
+====================
+*/
+static void NET_ReceiveThread( void ) {
+	static byte			overflow[NET_RECV_PACKETLEN];
+	struct timeval		timeout;
+	fd_set				fdset;
+	netRecvPacket_t		*packet;
+	unsigned			head, space;
+	int					ret;
+#ifdef NET_BATCHED_IO
+	struct iovec		iovecs[NET_BATCH_SIZE];
+	struct mmsghdr		headers[NET_BATCH_SIZE];
+	int					i, count;
+#endif
+
+	while ( netRecvQueue.running ) {
+		// wake up every now and then to check if we should stop
+		FD_ZERO( &fdset );
+		FD_SET( ip_socket, &fdset );
+		timeout.tv_sec = 0;
+		timeout.tv_usec = 50000;
+
+		ret = select( ip_socket + 1, &fdset, NULL, NULL, &timeout );
+		if ( ret <= 0 ) {
+			continue;
+		}
+
+		while ( 1 ) {
+			head = netRecvQueue.head.load( std::memory_order_relaxed );
+			space = NET_RECV_QUEUE_SIZE - ( head - netRecvQueue.tail.load( std::memory_order_acquire ) );
+
+			if ( !space ) {
+				// the main thread is stuck, drop the newest packets rather than letting them go stale in the kernel
+				ret = recvfrom( ip_socket, (char *)overflow, sizeof( overflow ), 0, NULL, NULL );
+				if ( ret == SOCKET_ERROR ) {
+					break;
+				}
+				netRecvQueue.dropped++;
+				continue;
+			}
+
+#ifdef NET_BATCHED_IO
+			if ( net_batch->integer ) {
+				// don't wrap around the end of the queue in a single call
+				count = Q_min( (unsigned)NET_BATCH_SIZE, Q_min( space, NET_RECV_QUEUE_SIZE - ( head & ( NET_RECV_QUEUE_SIZE - 1 ) ) ) );
+				for ( i = 0; i < count; i++ ) {
+					packet = &netRecvQueue.packets[( head + i ) & ( NET_RECV_QUEUE_SIZE - 1 )];
+					iovecs[i].iov_base = packet->data;
+					iovecs[i].iov_len = sizeof( packet->data );
+					memset( &headers[i], 0, sizeof( headers[i] ) );
+					headers[i].msg_hdr.msg_name = &packet->from;
+					headers[i].msg_hdr.msg_namelen = sizeof( packet->from );
+					headers[i].msg_hdr.msg_iov = &iovecs[i];
+					headers[i].msg_hdr.msg_iovlen = 1;
+				}
+
+				ret = recvmmsg( ip_socket, headers, count, MSG_DONTWAIT, NULL );
+				if ( ret == SOCKET_ERROR ) {
+					break;
+				}
+
+				for ( i = 0; i < ret; i++ ) {
+					packet = &netRecvQueue.packets[( head + i ) & ( NET_RECV_QUEUE_SIZE - 1 )];
+					packet->fromlen = headers[i].msg_hdr.msg_namelen;
+					packet->length = headers[i].msg_len;
+					packet->time = NET_Milliseconds();
+				}
+				netRecvQueue.head.store( head + ret, std::memory_order_release );
+				continue;
+			}
+#endif
+
+			packet = &netRecvQueue.packets[head & ( NET_RECV_QUEUE_SIZE - 1 )];
+			packet->fromlen = sizeof( packet->from );
+			ret = recvfrom( ip_socket, (char *)packet->data, sizeof( packet->data ), 0, (struct sockaddr *)&packet->from, &packet->fromlen );
+			if ( ret == SOCKET_ERROR ) {
+				break;
+			}
+			packet->length = ret;
+			packet->time = NET_Milliseconds();
+			netRecvQueue.head.store( head + 1, std::memory_order_release );
+		}
+
+		// the socket is drained, wake the main thread if it's waiting for
+		// packets. head was only stored with release, which lets the load
+		// of sleeping move ahead of it, the fence pairs with the one in
+		// NET_WaitReceiveQueue so one of the two threads sees the other
+		std::atomic_thread_fence( std::memory_order_seq_cst );
+		if ( netRecvQueue.sleeping.load( std::memory_order_relaxed ) ) {
+			std::lock_guard<std::mutex> lock( netRecvQueue.mutex );
+			netRecvQueue.wake.notify_one();
+		}
+	}
+}
+
+/*
+====================
+NET_StartReceiveThread
+====================
+*/
+static void NET_StartReceiveThread( void ) {
+	if ( netRecvQueue.running || ip_socket == INVALID_SOCKET ) {
+		return;
+	}
+
+	netRecvQueue.head = 0;
+	netRecvQueue.tail = 0;
+	netRecvQueue.generation++;
+	netRecvQueue.running = true;
+	netRecvQueue.thread = std::thread( NET_ReceiveThread );
+
+	Com_Printf( "Using a network receive thread\n" );
+}
+
+/*
+====================
+NET_StopReceiveThread
+
+Must be called before the socket is closed, queued packets are discarded
+====================
+*/
+static void NET_StopReceiveThread( void ) {
+	if ( !netRecvQueue.running ) {
+		return;
+	}
+
+	netRecvQueue.running = false;
+	netRecvQueue.thread.join();
+}
+
+/*
+====================
+NET_WaitReceiveQueue
+
+Sleeps msec or until the receive thread has queued a packet
+====================
+*/
+static void NET_WaitReceiveQueue( int msec ) {
+	std::unique_lock<std::mutex> lock( netRecvQueue.mutex );
+
+	// the receive thread publishes head, fences and checks sleeping, this
+	// sets sleeping, fences and checks head, so either it sees the packet
+	// here or the receive thread sees sleeping and notifies, which waits
+	// on the mutex until this is in wait_for
+	netRecvQueue.sleeping.store( true, std::memory_order_relaxed );
+	std::atomic_thread_fence( std::memory_order_seq_cst );
+	netRecvQueue.wake.wait_for( lock, std::chrono::milliseconds( msec ), [] {
+		return netRecvQueue.head.load( std::memory_order_acquire ) != netRecvQueue.tail.load( std::memory_order_relaxed );
+	} );
+	netRecvQueue.sleeping.store( false, std::memory_order_relaxed );
+}
+
+/*
+====================
+NET_ProcessReceiveQueue
+
+Dispatches everything the receive thread has queued so far
+====================
+*/
+void NET_ProcessReceiveQueue( void ) {
+	netRecvPacket_t	*packet;
+	netadr_t		from;
+	msg_t			netmsg;
+	unsigned		tail, head;
+	int				wait, generation;
+
+	if ( !netRecvQueue.running ) {
+		return;
+	}
+
+	generation = netRecvQueue.generation;
+
+	tail = netRecvQueue.tail.load( std::memory_order_relaxed );
+	head = netRecvQueue.head.load( std::memory_order_acquire );
+
+	for ( ; tail != head; tail++ ) {
+		packet = &netRecvQueue.packets[tail & ( NET_RECV_QUEUE_SIZE - 1 )];
+
+		wait = NET_Milliseconds() - packet->time;
+		netRecvQueue.totalWait += wait;
+		netRecvQueue.maxWait = Q_max( netRecvQueue.maxWait, wait );
+		netRecvQueue.dispatched++;
+
+		// the slot stays ours until tail moves past it
+		MSG_Init( &netmsg, packet->data, sizeof( packet->data ) );
+		if ( NET_AcceptPacket( &packet->from, packet->fromlen, packet->length, &from, &netmsg ) ) {
+			NET_DispatchPacket( &from, &netmsg, packet->time );
+		}
+
+		// a packet may have restarted networking, rcon net_restart
+		if ( !netRecvQueue.running || netRecvQueue.generation != generation ) {
+			return;
+		}
+		netRecvQueue.tail.store( tail + 1, std::memory_order_release );
+	}
+}
+
+/*
+====================
+NET_RecvStats_f
+====================
+*/
+static void NET_RecvStats_f( void ) {
+	if ( !netRecvQueue.running ) {
+		Com_Printf( "net_recvThread is not enabled.\n" );
+		return;
+	}
+
+	Com_Printf( "%i packets dispatched, %i dropped with a full queue, %.2f msec average and %i msec max from arrival to dispatch\n",
+		netRecvQueue.dispatched, (int)netRecvQueue.dropped,
+		netRecvQueue.dispatched ? (float)netRecvQueue.totalWait / netRecvQueue.dispatched : 0.0f, netRecvQueue.maxWait );
+
+	netRecvQueue.dispatched = 0;
+	netRecvQueue.dropped = 0;
+	netRecvQueue.totalWait = 0;
+	netRecvQueue.maxWait = 0;
+}
+
+/*
+====================
+NET_CapturePacket
+
+Capture files are a list of packets, each one the arrival time in msec
+since the capture started, the sender's ip and port, a length and the data
+====================
+*/
+#define	NET_CAPTURE_MAGIC	"JKNC"
+
+static void NET_CapturePacket( netadr_t *from, msg_t *netmsg, int time ) {
+	int				when;
+	unsigned short	length;
+
+	if ( from->type != NA_IP ) {
+		return;
+	}
+
+	when = LittleLong( time - net_captureStart );
+	length = LittleShort( (unsigned short)netmsg->cursize );
+
+	FS_Write( &when, sizeof( when ), net_captureFile );
+	FS_Write( from->ip, sizeof( from->ip ), net_captureFile );
+	FS_Write( &from->port, sizeof( from->port ), net_captureFile );
+	FS_Write( &length, sizeof( length ), net_captureFile );
+	FS_Write( netmsg->data, netmsg->cursize, net_captureFile );
+}
+
+/*
+====================
+NET_Capture_f
+
+net_capture [file], without a file stops capturing
+====================
+*/
+static void NET_Capture_f( void ) {
+	if ( net_captureFile ) {
+		FS_FCloseFile( net_captureFile );
+		net_captureFile = 0;
+		Com_Printf( "Stopped capturing packets.\n" );
+	}
+
+	if ( Cmd_Argc() < 2 ) {
+		return;
+	}
+
+	net_captureFile = FS_FOpenFileWrite( Cmd_Argv( 1 ) );
+	if ( !net_captureFile ) {
+		Com_Printf( "Couldn't open %s for writing.\n", Cmd_Argv( 1 ) );
+		return;
+	}
+
+	FS_Write( NET_CAPTURE_MAGIC, 4, net_captureFile );
+	net_captureStart = NET_Milliseconds();
+	Com_Printf( "Capturing received packets to %s.\n", Cmd_Argv( 1 ) );
+}
+
+/*
+====================
+NET_Replay_f
+
+net_replay <file> <address> [speed]
+
+Sends the packets of a capture to address with the same spacing they
+arrived with, from a socket of its own.  Blocks until it is done, so it is
+meant to be run from a second process, e.g.
+openjkded +set dedicated 1 +net_replay capture.dat 127.0.0.1:29070 +quit
+====================
+*/
+static void NET_Replay_f( void ) {
+	union {
+		byte	*b;
+		void	*v;
+	} buffer;
+	struct sockaddr_in	to;
+	netadr_t			adr;
+	SOCKET				sock;
+	float				speed;
+	int					length, offset, sent, when, first, start, err;
+	unsigned short		packetLength;
+
+	if ( Cmd_Argc() < 3 ) {
+		Com_Printf( "usage: net_replay <file> <address> [speed]\n" );
+		return;
+	}
+
+	if ( !NET_StringToAdr( Cmd_Argv( 2 ), &adr ) || adr.type != NA_IP ) {
+		Com_Printf( "Bad address %s.\n", Cmd_Argv( 2 ) );
+		return;
+	}
+	if ( !adr.port ) {
+		adr.port = BigShort( PORT_SERVER );
+	}
+	speed = Cmd_Argc() > 3 ? atof( Cmd_Argv( 3 ) ) : 1.0f;
+	if ( speed <= 0.0f ) {
+		speed = 1.0f;
+	}
+
+	length = FS_ReadFile( Cmd_Argv( 1 ), &buffer.v );
+	if ( length < 4 || memcmp( buffer.b, NET_CAPTURE_MAGIC, 4 ) ) {
+		Com_Printf( "%s is not a packet capture.\n", Cmd_Argv( 1 ) );
+		if ( length >= 0 ) {
+			FS_FreeFile( buffer.v );
+		}
+		return;
+	}
+
+	sock = NET_IPSocket( NULL, PORT_ANY, &err );
+	if ( sock == INVALID_SOCKET ) {
+		FS_FreeFile( buffer.v );
+		return;
+	}
+
+	NetadrToSockadr( &adr, &to );
+
+	start = NET_Milliseconds();
+	sent = 0;
+	first = -1;
+	for ( offset = 4; offset + 12 <= length; offset += 12 + packetLength ) {
+		memcpy( &when, buffer.b + offset, sizeof( when ) );
+		memcpy( &packetLength, buffer.b + offset + 10, sizeof( packetLength ) );
+		when = LittleLong( when );
+		packetLength = LittleShort( packetLength );
+
+		// start right away instead of waiting for however long the capture ran before the first packet
+		if ( first == -1 ) {
+			first = when;
+		}
+		when -= first;
+		if ( offset + 12 + packetLength > length ) {
+			break;
+		}
+
+		// busy wait the last millisecond so the spacing survives
+		while ( NET_Milliseconds() - start < when / speed ) {
+			if ( when / speed - ( NET_Milliseconds() - start ) > 1 ) {
+				Sys_Sleep( 1 );
+			}
+		}
+
+		if ( sendto( sock, (const char *)buffer.b + offset + 12, packetLength, 0, (struct sockaddr *)&to, sizeof( to ) ) != SOCKET_ERROR ) {
+			sent++;
+		}
+	}
+
+	closesocket( sock );
+	FS_FreeFile( buffer.v );
+
+	Com_Printf( "Replayed %i packets to %s in %i msec.\n", sent, NET_AdrToString( adr ), NET_Milliseconds() - start );
+}
+
 /*
 ====================
 NET_OpenIP
@@ -843,6 +1480,36 @@ void NET_OpenIP( void )
 		if ( ip_socket == INVALID_SOCKET )
 			Com_Printf( "WARNING: Couldn't bind to a v4 ip address.\n");
 	}
+
+	if ( net_recvThread->integer && ip_socket != INVALID_SOCKET ) {
+		// the receive thread does its own waiting, and uses recvmmsg with net_batch
+		NET_StartReceiveThread();
+		return;
+	}
+
+#ifdef NET_BATCHED_IO
+	if ( net_batch->integer && ip_socket != INVALID_SOCKET ) {
+		struct epoll_event	event;
+
+		epoll_fd = epoll_create1( 0 );
+		if ( epoll_fd == -1 ) {
+			Com_Printf( "WARNING: NET_OpenIP: epoll_create1: %s\n", NET_ErrorString() );
+			return;
+		}
+
+		memset( &event, 0, sizeof( event ) );
+		event.events = EPOLLIN;
+		event.data.fd = ip_socket;
+		if ( epoll_ctl( epoll_fd, EPOLL_CTL_ADD, ip_socket, &event ) == -1 ) {
+			Com_Printf( "WARNING: NET_OpenIP: epoll_ctl: %s\n", NET_ErrorString() );
+			close( epoll_fd );
+			epoll_fd = -1;
+			return;
+		}
+
+		Com_Printf( "Using batched socket I/O\n" );
+	}
+#endif
 }
 
 //===================================================================
@@ -893,6 +1560,14 @@ static qboolean NET_GetCvars( void ) {
 
 	net_dropsim = Cvar_Get( "net_dropsim", "", CVAR_TEMP);
 
+	net_batch = Cvar_Get( "net_batch", "0", CVAR_LATCH | CVAR_ARCHIVE_ND );
+	modified += net_batch->modified;
+	net_batch->modified = qfalse;
+
+	net_recvThread = Cvar_Get( "net_recvThread", "0", CVAR_LATCH | CVAR_ARCHIVE_ND, "Read packets on a thread of their own and timestamp them on arrival" );
+	modified += net_recvThread->modified;
+	net_recvThread->modified = qfalse;
+
 	return modified ? qtrue : qfalse;
 }
 
@@ -939,6 +1614,16 @@ void NET_Config( qboolean enableNetworking ) {
 	}
 
 	if ( stop ) {
+		NET_StopReceiveThread();
+
+#ifdef NET_BATCHED_IO
+		NET_FlushPacketBatch();
+		if ( epoll_fd != -1 ) {
+			close( epoll_fd );
+			epoll_fd = -1;
+		}
+#endif
+
 		if ( ip_socket != INVALID_SOCKET ) {
 			closesocket( ip_socket );
 			ip_socket = INVALID_SOCKET;
@@ -956,6 +1641,101 @@ void NET_Config( qboolean enableNetworking ) {
 	}
 }
 
+#ifdef NET_BATCHED_IO
+/*
+====================
+NET_LoadTest_f
+
+Pushes packets between two sockets over loopback, first with one
+sendto / recvfrom per datagram like the default path and then with
+sendmmsg / recvmmsg like net_batch, and prints packets per second for both.
+====================
+*/
+static void NET_LoadTest_f( void ) {
+	static byte			payload[NET_BATCH_SIZE][NET_BATCH_PACKETLEN];
+	static byte			recvBufs[NET_BATCH_SIZE][NET_BATCH_PACKETLEN];
+	struct sockaddr_in	target;
+	struct iovec		sendIov[NET_BATCH_SIZE], recvIov[NET_BATCH_SIZE];
+	struct mmsghdr		sendHdr[NET_BATCH_SIZE], recvHdr[NET_BATCH_SIZE];
+	socklen_t			len;
+	SOCKET				rx, tx;
+	int					count, size, mode, i, err, ret;
+	int					sent, received, burst, start, msec[2], got[2];
+	int					bufSize = 4 * 1024 * 1024;
+
+	count = Cmd_Argc() > 1 ? atoi( Cmd_Argv( 1 ) ) : 200000;
+	size = Cmd_Argc() > 2 ? atoi( Cmd_Argv( 2 ) ) : 1000;
+	count = Q_max( count, NET_BATCH_SIZE );
+	size = Com_Clampi( 1, NET_BATCH_PACKETLEN, size );
+
+	rx = NET_IPSocket( (char *)"127.0.0.1", PORT_ANY, &err );
+	if ( rx == INVALID_SOCKET ) {
+		return;
+	}
+	tx = NET_IPSocket( (char *)"127.0.0.1", PORT_ANY, &err );
+	if ( tx == INVALID_SOCKET ) {
+		closesocket( rx );
+		return;
+	}
+	setsockopt( rx, SOL_SOCKET, SO_RCVBUF, (char *)&bufSize, sizeof( bufSize ) );
+
+	len = sizeof( target );
+	getsockname( rx, (struct sockaddr *)&target, &len );
+
+	for ( i = 0; i < NET_BATCH_SIZE; i++ ) {
+		memset( payload[i], i, size );
+		sendIov[i].iov_base = payload[i];
+		sendIov[i].iov_len = size;
+		memset( &sendHdr[i], 0, sizeof( sendHdr[i] ) );
+		sendHdr[i].msg_hdr.msg_name = &target;
+		sendHdr[i].msg_hdr.msg_namelen = sizeof( target );
+		sendHdr[i].msg_hdr.msg_iov = &sendIov[i];
+		sendHdr[i].msg_hdr.msg_iovlen = 1;
+
+		recvIov[i].iov_base = recvBufs[i];
+		recvIov[i].iov_len = sizeof( recvBufs[i] );
+		memset( &recvHdr[i], 0, sizeof( recvHdr[i] ) );
+		recvHdr[i].msg_hdr.msg_iov = &recvIov[i];
+		recvHdr[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	// send a burst, drain it, repeat; anything the kernel drops is just not counted
+	for ( mode = 0; mode < 2; mode++ ) {
+		start = Sys_Milliseconds();
+		for ( sent = received = 0; sent < count; ) {
+			burst = Q_min( NET_BATCH_SIZE, count - sent );
+			if ( mode ) {
+				ret = sendmmsg( tx, sendHdr, burst, 0 );
+				sent += ret > 0 ? ret : burst;
+			} else {
+				for ( i = 0; i < burst; i++, sent++ ) {
+					sendto( tx, (const char *)payload[i], size, 0, (struct sockaddr *)&target, sizeof( target ) );
+				}
+			}
+
+			if ( mode ) {
+				while ( ( ret = recvmmsg( rx, recvHdr, NET_BATCH_SIZE, MSG_DONTWAIT, NULL ) ) > 0 ) {
+					received += ret;
+				}
+			} else {
+				while ( recvfrom( rx, (char *)recvBufs[0], sizeof( recvBufs[0] ), 0, NULL, NULL ) > 0 ) {
+					received++;
+				}
+			}
+		}
+		msec[mode] = Q_max( 1, Sys_Milliseconds() - start );
+		got[mode] = received;
+	}
+
+	closesocket( tx );
+	closesocket( rx );
+
+	Com_Printf( "%i packets of %i bytes over loopback\n", count, size );
+	Com_Printf( "per packet: %8i packets/s (%i received)\n", (int)( got[0] * 1000.0 / msec[0] ), got[0] );
+	Com_Printf( "batched:    %8i packets/s (%i received)\n", (int)( got[1] * 1000.0 / msec[1] ), got[1] );
+}
+#endif
+
 /*
 ====================
 NET_Init
@@ -976,6 +1756,12 @@ void NET_Init( void ) {
 	NET_Config( qtrue );
 
 	Cmd_AddCommand ("net_restart", NET_Restart_f, "Restart the networking sub-system" );
+	Cmd_AddCommand ("net_recvstats", NET_RecvStats_f, "Print and reset net_recvThread queue counters" );
+	Cmd_AddCommand ("net_capture", NET_Capture_f, "Capture received packets with their arrival times to a file, no file stops" );
+	Cmd_AddCommand ("net_replay", NET_Replay_f, "Send the packets of a capture to an address with their original timing" );
+#ifdef NET_BATCHED_IO
+	Cmd_AddCommand ("net_loadtest", NET_LoadTest_f, "Compare per-packet and batched UDP throughput over loopback" );
+#endif
 }
 
 /*
@@ -1003,6 +1789,28 @@ Called from NET_Sleep which uses select() to determine which sockets have seen a
 ====================
 */
 
+static void NET_DispatchPacket(netadr_t *from, msg_t *netmsg, int time)
+{
+	if(net_dropsim->value > 0.0f && net_dropsim->value <= 100.0f)
+	{
+		// com_dropsim->value percent of incoming packets get dropped.
+		if(rand() < (int) (((double) RAND_MAX) / 100.0 * (double) net_dropsim->value))
+			return;          // drop this packet
+	}
+
+	if(net_captureFile)
+		NET_CapturePacket(from, netmsg, time);
+
+	net_packetTime = time;
+
+	if(com_sv_running->integer)
+		Com_RunAndTimeServerPacket(from, netmsg);
+	else
+		CL_PacketEvent(*from, netmsg);
+
+	net_packetTime = 0;
+}
+
 void NET_Event(fd_set *fdr)
 {
 	byte bufData[MAX_MSGLEN + 1];
@@ -1014,24 +1822,72 @@ void NET_Event(fd_set *fdr)
 		MSG_Init(&netmsg, bufData, sizeof(bufData));
 
 		if(NET_GetPacket(&from, &netmsg, fdr))
-		{
-			if(net_dropsim->value > 0.0f && net_dropsim->value <= 100.0f)
-			{
-				// com_dropsim->value percent of incoming packets get dropped.
-				if(rand() < (int) (((double) RAND_MAX) / 100.0 * (double) net_dropsim->value))
-					continue;          // drop this packet
-			}
-
-			if(com_sv_running->integer)
-				Com_RunAndTimeServerPacket(&from, &netmsg);
-			else
-				CL_PacketEvent(from, &netmsg);
-		}
+			NET_DispatchPacket(&from, &netmsg, NET_Milliseconds());
 		else
 			break;
 	}
 }
 
+#ifdef NET_BATCHED_IO
+/*
+====================
+NET_BatchEvent
+
+Called from NET_Sleep when epoll reports the socket readable.  Drains it
+NET_BATCH_SIZE datagrams per recvmmsg call.
+====================
+*/
+static byte					batchBufs[NET_BATCH_SIZE][MAX_MSGLEN + 1];
+static struct sockaddr_in	batchAddrs[NET_BATCH_SIZE];
+static struct iovec			batchIovecs[NET_BATCH_SIZE];
+static struct mmsghdr		batchHeaders[NET_BATCH_SIZE];
+
+static void NET_BatchEvent(void)
+{
+	int i, ret, time;
+	netadr_t from;
+	msg_t netmsg;
+
+	do
+	{
+		for(i = 0; i < NET_BATCH_SIZE; i++)
+		{
+			batchIovecs[i].iov_base = batchBufs[i];
+			batchIovecs[i].iov_len = sizeof(batchBufs[i]);
+			memset(&batchHeaders[i], 0, sizeof(batchHeaders[i]));
+			batchHeaders[i].msg_hdr.msg_name = &batchAddrs[i];
+			batchHeaders[i].msg_hdr.msg_namelen = sizeof(batchAddrs[i]);
+			batchHeaders[i].msg_hdr.msg_iov = &batchIovecs[i];
+			batchHeaders[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		if(ip_socket == INVALID_SOCKET)
+			return;
+
+		ret = recvmmsg(ip_socket, batchHeaders, NET_BATCH_SIZE, MSG_DONTWAIT, NULL);
+		if(ret == SOCKET_ERROR)
+		{
+			if(socketError != EAGAIN && socketError != ECONNRESET && socketError != EINTR)
+				Com_Printf("NET_GetPacket: %s\n", NET_ErrorString());
+			return;
+		}
+
+#ifdef _DEBUG
+		recvfromCount++;		// performance check
+#endif
+
+		time = NET_Milliseconds();
+		for(i = 0; i < ret; i++)
+		{
+			MSG_Init(&netmsg, batchBufs[i], sizeof(batchBufs[i]));
+
+			if(NET_AcceptPacket(&batchAddrs[i], batchHeaders[i].msg_hdr.msg_namelen, batchHeaders[i].msg_len, &from, &netmsg))
+				NET_DispatchPacket(&from, &netmsg, time);
+		}
+	} while(ret == NET_BATCH_SIZE);
+}
+#endif
+
 /*
 ====================
 NET_Sleep
@@ -1048,6 +1904,27 @@ void NET_Sleep( int msec ) {
 	if (msec < 0)
 		msec = 0;
 
+	if (netRecvQueue.running) {
+		NET_WaitReceiveQueue(msec);
+		NET_ProcessReceiveQueue();
+		return;
+	}
+
+#ifdef NET_BATCHED_IO
+	if (epoll_fd != -1) {
+		struct epoll_event event;
+
+		retval = epoll_wait(epoll_fd, &event, 1, msec);
+		if(retval == SOCKET_ERROR) {
+			if(socketError != EINTR)
+				Com_Printf("Warning: epoll_wait() syscall failed: %s\n", NET_ErrorString());
+		}
+		else if(retval > 0)
+			NET_BatchEvent();
+		return;
+	}
+#endif
+
 	FD_ZERO(&fdset);
 	if (ip_socket != INVALID_SOCKET) {
 		FD_SET(ip_socket, &fdset); // network socket
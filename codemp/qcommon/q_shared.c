@@ -1057,6 +1057,143 @@ void Info_SetValueForKey_Big( char *s, const char *key, const char *value ) {
 	strcat (s, newi);
 }
 
+/*
+==================
+Info_FindPair
+
+Finds the key/value pair for key in s. pair is where the pair starts,
+including its leading backslash, value where its value starts and the
+return value is the end of the value.
+==================
+*/
+static char *Info_FindPair( char *s, const char *key, char **pair, char **value ) {
+	char	pkey[BIG_INFO_KEY];
+	char	*o;
+
+	while ( 1 ) {
+		*pair = s;
+		if ( *s == '\\' )
+			s++;
+		o = pkey;
+		while ( *s != '\\' ) {
+			if ( !*s )
+				return NULL;
+			*o++ = *s++;
+		}
+		*o = 0;
+		s++;
+
+		*value = s;
+		while ( *s != '\\' && *s )
+			s++;
+
+		if ( !Q_stricmp( key, pkey ) )
+			return s;
+
+		if ( !*s )
+			return NULL;
+	}
+}
+
+/*
+==================
+Info_BuildDelta
+
+Writes every key of to whose value differs from the one in from into delta,
+followed by the keys to no longer has with empty values. Returns qfalse if
+delta is too small.
+==================
+*/
+qboolean Info_BuildDelta( const char *from, const char *to, char *delta, int deltaSize ) {
+	char		key[BIG_INFO_KEY], value[BIG_INFO_VALUE];
+	const char	*s;
+	int			len, pairLen;
+
+	if ( strlen( from ) >= BIG_INFO_STRING || strlen( to ) >= BIG_INFO_STRING ) {
+		return qfalse;
+	}
+
+	len = 0;
+	delta[0] = 0;
+
+	s = to;
+	while ( *s ) {
+		if ( !Info_NextPair( &s, key, value ) )
+			return qfalse;
+		if ( !key[0] )
+			break;
+		if ( !strcmp( Info_ValueForKey( from, key ), value ) )
+			continue;
+		pairLen = strlen( key ) + strlen( value ) + 2;
+		if ( len + pairLen >= deltaSize )
+			return qfalse;
+		Com_sprintf( delta + len, deltaSize - len, "\\%s\\%s", key, value );
+		len += pairLen;
+	}
+
+	s = from;
+	while ( *s ) {
+		if ( !Info_NextPair( &s, key, value ) )
+			return qfalse;
+		if ( !key[0] )
+			break;
+		if ( !value[0] || Info_ValueForKey( to, key )[0] )
+			continue;
+		pairLen = strlen( key ) + 2;
+		if ( len + pairLen >= deltaSize )
+			return qfalse;
+		Com_sprintf( delta + len, deltaSize - len, "\\%s\\", key );
+		len += pairLen;
+	}
+
+	return qtrue;
+}
+
+/*
+==================
+Info_ApplyDelta
+
+Applies a delta from Info_BuildDelta to s. Changed keys keep their place,
+new keys are appended and keys with empty values are removed. Returns qfalse
+if s would outgrow size.
+==================
+*/
+qboolean Info_ApplyDelta( char *s, const char *delta, int size ) {
+	char	key[BIG_INFO_KEY], value[BIG_INFO_VALUE];
+	char	*pair, *oldValue, *end;
+	int		len, valueLen;
+
+	len = strlen( s );
+	while ( *delta ) {
+		if ( !Info_NextPair( &delta, key, value ) )
+			return qfalse;
+		if ( !key[0] )
+			break;
+
+		valueLen = strlen( value );
+		end = Info_FindPair( s, key, &pair, &oldValue );
+		if ( !end ) {
+			if ( !valueLen )
+				continue;
+			if ( len + (int)strlen( key ) + valueLen + 2 >= size )
+				return qfalse;
+			Com_sprintf( s + len, size - len, "\\%s\\%s", key, value );
+			len += strlen( key ) + valueLen + 2;
+		} else if ( !valueLen ) {
+			memmove( pair, end, strlen( end ) + 1 );
+			len -= end - pair;
+		} else {
+			if ( len - (end - oldValue) + valueLen >= size )
+				return qfalse;
+			memmove( oldValue + valueLen, end, strlen( end ) + 1 );
+			memcpy( oldValue, value, valueLen );
+			len += valueLen - (end - oldValue);
+		}
+	}
+
+	return qtrue;
+}
+
 /*
 ==================
 Com_CharIsOneOfCharset
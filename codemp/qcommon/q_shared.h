@@ -684,6 +684,8 @@ void Info_SetValueForKey( char *s, const char *key, const char *value );
 void Info_SetValueForKey_Big( char *s, const char *key, const char *value );
 qboolean Info_Validate( const char *s );
 qboolean Info_NextPair( const char **s, char *key, char *value );
+qboolean Info_BuildDelta( const char *from, const char *to, char *delta, int deltaSize );
+qboolean Info_ApplyDelta( char *s, const char *delta, int size );
 
 // this is only here so the functions in q_shared.c and bg_*.c can link
 #if defined( _GAME ) || defined( _CGAME ) || defined( UI_BUILD )
@@ -750,8 +752,6 @@ typedef struct cvar_s {
 	float			min, max;
 
 	struct cvar_s	*next, *prev;
-	struct cvar_s	*hashNext, *hashPrev;
-	int				hashIndex;
 } cvar_t;
 
 #define	MAX_CVAR_VALUE_STRING	256
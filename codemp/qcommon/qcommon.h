@@ -43,6 +43,7 @@ typedef struct msg_s {
 	int		cursize;
 	int		readcount;
 	int		bit;				// for bitwise reads and writes
+	int		oldsize;			// bits the writes would have taken without delta compression
 } msg_t;
 
 void MSG_Init (msg_t *buf, byte *data, int length);
@@ -56,6 +57,7 @@ struct entityState_s;
 struct playerState_s;
 
 void MSG_WriteBits( msg_t *msg, int value, int bits );
+qboolean MSG_WriteBitString( msg_t *msg, const byte *data, int bits );
 
 void MSG_WriteChar (msg_t *sb, int c);
 void MSG_WriteByte (msg_t *sb, int c);
@@ -98,6 +100,8 @@ void MSG_WriteDeltaPlayerstate( msg_t *msg, struct playerState_s *from, struct p
 #endif
 void MSG_ReadDeltaPlayerstate( msg_t *msg, struct playerState_s *from, struct playerState_s *to, qboolean isVehiclePS = qfalse );
 
+void MSG_HuffmanBenchmark_f( void );
+
 #ifndef FINAL_BUILD
 void MSG_ReportChangeVectors_f( void );
 #endif
@@ -137,6 +141,7 @@ void		NET_Restart_f( void );
 void		NET_Config( qboolean enableNetworking );
 
 void		NET_SendPacket (netsrc_t sock, int length, const void *data, netadr_t to);
+void		NET_SendPacketGather( netsrc_t sock, int headerLength, const void *header, int length, const void *data, netadr_t to );
 void		NET_OutOfBandPrint( netsrc_t net_socket, netadr_t adr, const char *format, ...);
 void		NET_OutOfBandData( netsrc_t sock, netadr_t adr, byte *format, int len );
 
@@ -148,8 +153,14 @@ const char	*NET_AdrToString (netadr_t a);
 qboolean	NET_StringToAdr ( const char *s, netadr_t *a);
 qboolean	NET_GetLoopPacket (netsrc_t sock, netadr_t *net_from, msg_t *net_message);
 void		NET_Sleep(int msec);
+void		NET_ProcessReceiveQueue( void );	// dispatches packets queued by net_recvThread
+int			NET_Milliseconds( void );			// monotonic clock used to timestamp packets
+int			NET_PacketTime( void );				// NET_Milliseconds when the packet being dispatched arrived
+void		NET_BeginPacketBatch( void );
+void		NET_FlushPacketBatch( void );
 
 void		Sys_SendPacket( int length, const void *data, netadr_t to );
+void		Sys_SendPacketGather( int headerLength, const void *header, int length, const void *data, netadr_t to );
 //Does NOT parse port numbers, only base addresses.
 qboolean	Sys_StringToAdr( const char *s, netadr_t *a );
 qboolean	Sys_IsLANAddress (netadr_t adr);
@@ -181,10 +192,11 @@ typedef struct netchan_s {
 	int			incomingSequence;
 	int			outgoingSequence;
 
-	// incoming fragment assembly buffer
+	// incoming fragment assembly buffer, the first four bytes are left for
+	// the sequence number so the finished message can be read in place
 	int			fragmentSequence;
 	int			fragmentLength;
-	byte		fragmentBuffer[MAX_MSGLEN];
+	byte		fragmentBuffer[4 + MAX_MSGLEN];
 
 	// outgoing fragment buffer
 	// we need to space out the sending of large fragmented messages
@@ -503,6 +515,15 @@ char	*Cvar_VariableString( const char *var_name );
 void	Cvar_VariableStringBuffer( const char *var_name, char *buffer, int bufsize );
 // returns an empty string if not defined
 
+cvarHandle_t	Cvar_FindHandle( const char *var_name );
+// returns a handle that names var_name for as long as the program runs, even
+// before the cvar exists or after it is unset, or -1 for an invalid name
+
+float	Cvar_HandleValue( cvarHandle_t handle );
+int		Cvar_HandleIntegerValue( cvarHandle_t handle );
+void	Cvar_HandleStringBuffer( cvarHandle_t handle, char *buffer, int bufsize );
+// same as the Cvar_Variable* functions without hashing the name
+
 uint32_t	Cvar_Flags(const char *var_name);
 // returns CVAR_NONEXISTENT if cvar doesn't exist or the flags of that particular CVAR.
 
@@ -647,6 +668,13 @@ void	FS_ForceFlush( fileHandle_t f );
 void	FS_FreeFile( void *buffer );
 // frees the memory returned by FS_ReadFile
 
+qboolean	FS_PrefetchFile( const char *qpath );
+// starts reading a file from a pak in the background, a later FS_ReadFile
+// of it gets the buffer without waiting. Returns qfalse if it doesn't exist
+
+void	FS_EndPrefetch( void );
+// frees everything prefetched that wasn't read
+
 void	FS_WriteFile( const char *qpath, const void *buffer, int size );
 // writes a complete file, creating any subdirectories needed
 
@@ -878,6 +906,7 @@ void *S_Malloc	( int iSize );					// NOT 0 filled memory only for small allocati
 void  Z_MorphMallocTag( void *pvBuffer, memtag_t eDesiredTag );
 void  Z_Validate( void );
 int   Z_MemSize	( memtag_t eTag );
+int64_t Z_HeapAllocs( void );	// mallocs and operator news so far, every thread
 void  Z_TagFree	( memtag_t eTag );
 void  Z_Free	( void *ptr );
 int	  Z_Size	( void *pvAddress);
@@ -900,11 +929,62 @@ void Hunk_Trash( void );
 
 void Com_TouchMemory( void );
 
+/*
+==============================================================
+
+FRAME ARENAS
+
+Scratch memory that only has to last until the same side starts its
+next frame.  Allocation is a pointer bump, nothing is freed one by one.
+Main thread only.
+
+==============================================================
+*/
+
+typedef enum {
+	FRAME_ARENA_SERVER,		// reset at the start of SV_Frame
+	FRAME_ARENA_CLIENT,		// reset at the start of CL_Frame
+	FRAME_ARENA_COUNT
+} frameArena_t;
+
+void *Frame_Alloc( frameArena_t arena, int size );
+// 16 byte aligned, not zero filled, never fails
+int   Frame_Mark( frameArena_t arena );
+void  Frame_Release( frameArena_t arena, int mark );
+// hands back everything allocated since the mark, for scratch that is done before the frame is
+void  Frame_Reset( frameArena_t arena );
+
+class IHeapAllocator;
+IHeapAllocator *Frame_HeapAllocator( frameArena_t arena );
+// ghoul2's vertex space, carved out of the arena
+
+/*
+==============================================================
+
+WORKER THREADS
+
+==============================================================
+*/
+
+#define	MAX_WORKER_THREADS	31		// in addition to the calling thread
+
+typedef void (*parallelJob_t)( void *data, int index );
+
+void Com_ParallelFor( int numThreads, int count, parallelJob_t job, void *data );
+// runs job( data, 0 .. count-1 ) on up to numThreads threads and waits for all of them
+qboolean Com_IsWorkerThread( void );
+// true on the pool's worker threads, false on the thread that called Com_ParallelFor
+void Com_ShutdownWorkers( void );
+
 // commandLine should not include the executable name (argv[0])
 void Com_Init( char *commandLine );
 void Com_Frame( void );
 void Com_Shutdown( void );
 
+#ifdef DEDICATED_BENCH
+void SV_BenchMain( int argc, char **argv );	// sv_bench.cpp, runs the benchmark then quits
+#endif
+
 
 /*
 ==============================================================
@@ -1040,6 +1120,23 @@ void	Huff_offsetTransmit (huff_t *huff, int ch, byte *fout, int *offset);
 void	Huff_putBit( int bit, byte *fout, int *offset);
 int		Huff_getBit( byte *fout, int *offset);
 
+/* Static lookup tables for a tree that is no longer being updated, so that
+ * codes can be emitted and read without walking the tree one bit at a time.
+ * The bitstream is identical to Huff_offsetTransmit / Huff_offsetReceive. */
+
+#define HUFF_LOOKUP_BITS	11
+
+typedef struct huffTable_s {
+	unsigned int	code[HMAX+1];					// prefix code, first bit sent in bit 0
+	byte			length[HMAX+1];					// 0 if not in the tree or longer than 32 bits
+	unsigned int	lookup[1<<HUFF_LOOKUP_BITS];	// symbol | (bits << 16), 0 bits if the code is longer
+} huffTable_t;
+
+void	Huff_BuildTable( huffTable_t *table, huff_t *compressor, huff_t *decompressor );
+void	Huff_tableTransmit( const huffTable_t *table, huff_t *huff, int raw, int rawBits, const byte *symbols, int numSymbols, byte *fout, int *offset );
+void	Huff_tableReceive( const huffTable_t *table, node_t *tree, int *ch, byte *fin, int maxsize, int *offset );
+int		Huff_tableGetBits( byte *fin, int maxsize, int numBits, int *offset );
+
 extern huffman_t clientHuffTables;
 
 #define	SV_ENCODE_START		4
@@ -0,0 +1,217 @@
+/*
+===========================================================================
+Copyright (C) 2013 - 2015, OpenJK contributors
+
+This file is part of the OpenJK source code.
+
+OpenJK is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see <http://www.gnu.org/licenses/>.
+===========================================================================
+*/
+
+// threads.cpp -- worker thread pool for parallel loops
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "qcommon/qcommon.h"
+
+/*
+==============================================================================
+
+Workers are started lazily the first time a loop asks for them and then
+sleep on a condition variable between jobs. Only one loop runs at a time;
+a loop started while another one is running (including from inside a job)
+runs on the calling thread.
+
+The pool is never freed so that a worker still parked on the condition
+variable can't outlive it when the process exits without Com_Shutdown.
+
+==============================================================================
+*/
+
+typedef struct workerPool_s {
+	std::mutex				mutex;
+	std::condition_variable	wake;
+	std::condition_variable	idle;
+	std::thread				threads[MAX_WORKER_THREADS];
+	int						numThreads;
+	bool					shutdown;
+
+	// current job, protected by mutex except for next
+	parallelJob_t			job;
+	void					*data;
+	int						count;
+	int						generation;
+	int						wanted;			// workers that may still join the job
+	int						active;			// workers inside the job
+	std::atomic<int>		next;			// next index to run
+} workerPool_t;
+
+static workerPool_t		*workers;
+static std::atomic<bool>	workersBusy( false );
+static thread_local bool	workerThread;
+
+static void Com_RunParallelJob( workerPool_t *pool ) {
+	int		index;
+
+	while ( ( index = pool->next.fetch_add( 1 ) ) < pool->count ) {
+		pool->job( pool->data, index );
+	}
+}
+
+static void Com_WorkerThread( workerPool_t *pool ) {
+	int		generation = 0;
+
+	workerThread = true;
+
+	std::unique_lock<std::mutex> lock( pool->mutex );
+	for ( ;; ) {
+		while ( !pool->shutdown && ( pool->generation == generation || !pool->wanted ) ) {
+			pool->wake.wait( lock );
+		}
+		if ( pool->shutdown ) {
+			return;
+		}
+
+		generation = pool->generation;
+		pool->wanted--;
+		pool->active++;
+
+		lock.unlock();
+		Com_RunParallelJob( pool );
+		lock.lock();
+
+		if ( !--pool->active ) {
+			pool->idle.notify_one();
+		}
+	}
+}
+
+/*
+=================
+Com_StartWorkers
+
+Makes sure at least numThreads workers are running.
+=================
+*/
+static void Com_StartWorkers( int numThreads ) {
+	if ( !workers ) {
+		workers = new workerPool_t;
+		workers->numThreads = 0;
+		workers->shutdown = false;
+		workers->job = NULL;
+		workers->data = NULL;
+		workers->count = 0;
+		workers->generation = 0;
+		workers->wanted = 0;
+		workers->active = 0;
+		workers->next = 0;
+	}
+
+	while ( workers->numThreads < numThreads ) {
+		workers->threads[workers->numThreads] = std::thread( Com_WorkerThread, workers );
+		workers->numThreads++;
+	}
+}
+
+/*
+=================
+Com_ParallelFor
+
+Calls job( data, i ) for every i in [0, count) using up to numThreads
+threads, including the calling one. Returns once every index has run.
+The order in which indices run is undefined.
+=================
+*/
+void Com_ParallelFor( int numThreads, int count, parallelJob_t job, void *data ) {
+	int		i;
+
+	if ( count <= 0 ) {
+		return;
+	}
+
+	numThreads = Com_Clampi( 1, MAX_WORKER_THREADS + 1, numThreads );
+	if ( numThreads > count ) {
+		numThreads = count;
+	}
+
+	if ( numThreads == 1 || workersBusy.exchange( true ) ) {
+		for ( i = 0 ; i < count ; i++ ) {
+			job( data, i );
+		}
+		return;
+	}
+
+	Com_StartWorkers( numThreads - 1 );
+
+	{
+		std::lock_guard<std::mutex> lock( workers->mutex );
+		workers->job = job;
+		workers->data = data;
+		workers->count = count;
+		workers->next = 0;
+		workers->wanted = numThreads - 1;
+		workers->generation++;
+	}
+	workers->wake.notify_all();
+
+	Com_RunParallelJob( workers );
+
+	{
+		// close the job to workers that haven't woken up yet and
+		// wait for the ones that did to run out of indices
+		std::unique_lock<std::mutex> lock( workers->mutex );
+		workers->wanted = 0;
+		while ( workers->active ) {
+			workers->idle.wait( lock );
+		}
+	}
+
+	workersBusy = false;
+}
+
+/*
+=================
+Com_IsWorkerThread
+=================
+*/
+qboolean Com_IsWorkerThread( void ) {
+	return (qboolean)workerThread;
+}
+
+/*
+=================
+Com_ShutdownWorkers
+=================
+*/
+void Com_ShutdownWorkers( void ) {
+	int		i;
+
+	if ( !workers ) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock( workers->mutex );
+		workers->shutdown = true;
+	}
+	workers->wake.notify_all();
+
+	for ( i = 0 ; i < workers->numThreads ; i++ ) {
+		workers->threads[i].join();
+	}
+	workers->numThreads = 0;
+	workers->shutdown = false;
+}
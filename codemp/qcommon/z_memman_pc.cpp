@@ -24,6 +24,9 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 
 #include "client/client.h" // hi i'm bad
 
+#include <atomic>
+#include <new>
+
 ////////////////////////////////////////////////
 //
 #ifdef TAGDEF	// itu?
@@ -42,17 +45,28 @@ void CIN_CloseAllVideos();
 
 
 // This handles zone memory allocation.
-// It is a wrapper around malloc with a tag id and a magic number at the start
+// It is a wrapper around malloc with a tag id and a magic number at the start.
+// Small blocks are carved out of slabs instead, each slab holding blocks of one
+// size class for one tag, so they skip malloc and a tag can be freed a slab at a time.
 
 #define ZONE_MAGIC			0x21436587
+#define ZONE_SLAB_MAGIC		0x21436588	// live block in a slab
+#define ZONE_FREE_MAGIC		0x21436589	// freed block in a slab
 
-typedef struct zoneHeader_s
+// what sits right in front of every block handed out, wherever it came from
+typedef struct zoneBlock_s
 {
 		int					iMagic;
 		memtag_t			eTag;
 		int					iSize;
+		int					iSlabOffset;	// slab blocks only, how far in from the start of their slab
+} zoneBlock_t;
+
+typedef struct zoneHeader_s
+{
 struct	zoneHeader_s		*pNext;
 struct	zoneHeader_s		*pPrev;
+		zoneBlock_t			Block;
 } zoneHeader_t;
 
 typedef struct
@@ -63,7 +77,17 @@ typedef struct
 
 static inline zoneTail_t *ZoneTailFromHeader(zoneHeader_t *pHeader)
 {
-	return (zoneTail_t*) ( (char*)pHeader + sizeof(*pHeader) + pHeader->iSize );
+	return (zoneTail_t*) ( (char*)pHeader + sizeof(*pHeader) + pHeader->Block.iSize );
+}
+
+static inline zoneBlock_t *ZoneBlockFromAddress(void *pvAddress)
+{
+	return ((zoneBlock_t *)pvAddress) - 1;
+}
+
+static inline zoneHeader_t *ZoneHeaderFromBlock(zoneBlock_t *pBlock)
+{
+	return (zoneHeader_t *) ( (char*)pBlock - offsetof(zoneHeader_t, Block) );
 }
 
 #ifdef DETAILED_ZONE_DEBUG_CODE
@@ -83,6 +107,9 @@ typedef struct zoneStats_s
 	int		iSizesPerTag [TAG_COUNT];
 	int		iCountsPerTag[TAG_COUNT];
 
+	int		iSlabs;
+	int		iSlabsPerTag [TAG_COUNT];
+
 } zoneStats_t;
 
 typedef struct zone_s
@@ -92,11 +119,419 @@ typedef struct zone_s
 } zone_t;
 
 cvar_t	*com_validateZone;
+cvar_t	*com_zoneSlabs;
 
 zone_t	TheZone = {};
 
+/*
+====================
+Heap counting
+
+Every malloc the zone makes and every operator new in the process are
+counted, so a loop that should stay off the heap can be checked to
+(g2poolstress does).  operator new is replaced here for that, and hands
+straight on to malloc like the library one.
+====================
+*/
+static std::atomic<int64_t>	ziHeapAllocs;
+
+static inline void Z_CountHeapAlloc(void)
+{
+	ziHeapAllocs.fetch_add(1, std::memory_order_relaxed);
+}
+
+int64_t Z_HeapAllocs(void)
+{
+	return ziHeapAllocs.load(std::memory_order_relaxed);
+}
+
+void *operator new(size_t size)
+{
+	void	*pvMem;
+
+	Z_CountHeapAlloc();
+	pvMem = malloc(size ? size : 1);
+	if (!pvMem)
+	{
+		throw std::bad_alloc();
+	}
+	return pvMem;
+}
+
+void operator delete(void *pvMem) noexcept
+{
+	free(pvMem);
+}
+
+static inline void Zone_CountAlloc(int iSize, memtag_t eTag)
+{
+	TheZone.Stats.iCurrent += iSize;
+	TheZone.Stats.iCount++;
+	TheZone.Stats.iSizesPerTag	[eTag] += iSize;
+	TheZone.Stats.iCountsPerTag	[eTag]++;
 
-// Scans through the linked list of mallocs and makes sure no data has been overwritten
+	if (TheZone.Stats.iCurrent > TheZone.Stats.iPeak)
+	{
+		TheZone.Stats.iPeak	= TheZone.Stats.iCurrent;
+	}
+}
+
+static inline void Zone_CountFree(int iCount, int iSize, memtag_t eTag)
+{
+	TheZone.Stats.iCount -= iCount;
+	TheZone.Stats.iCurrent -= iSize;
+	TheZone.Stats.iSizesPerTag	[eTag] -= iSize;
+	TheZone.Stats.iCountsPerTag	[eTag] -= iCount;
+}
+
+
+/*
+====================
+SLABS
+
+A slab is one malloc holding a run of equal sized blocks for a single tag.
+Freed blocks go on the slab's own free list, a slab that empties goes back
+to a small pool for any tag and size class to reuse, and Z_TagFree hands a
+tag's slabs back whole instead of freeing their blocks one by one.
+
+Z_MorphMallocTag can leave a block in a slab that belongs to another tag,
+those slabs are counted so Z_TagFree knows when it has to look inside.
+
+Slab blocks carry no tail, set com_zoneSlabs to 0 to give every block its
+own guarded allocation again when hunting memory stomps.
+====================
+*/
+
+#define ZONE_SLAB_SIZE		(16*1024)
+#define ZONE_SLAB_MAX_SIZE	512			// bigger blocks get their own malloc
+#define ZONE_SLAB_CLASSES	16
+#define ZONE_SLAB_POOL		64			// empty slabs kept around instead of freed
+
+static const int ziSlabClassSizes[ZONE_SLAB_CLASSES] =
+{
+	16, 32, 48, 64, 80, 96, 112, 128,
+	160, 192, 224, 256,
+	320, 384, 448, 512
+};
+
+typedef struct zoneSlab_s
+{
+struct	zoneSlab_s		*pNext;			// every slab of this tag and class
+struct	zoneSlab_s		*pPrev;
+struct	zoneSlab_s		*pNextAvail;	// the ones with room left
+struct	zoneSlab_s		*pPrevAvail;
+		zoneBlock_t		*pFree;			// freed blocks, linked through their first bytes
+		memtag_t		eTag;
+		int				iClass;
+		int				iBlockSize;		// header included
+		int				iCapacity;
+		int				iUsed;
+		int				iFresh;			// blocks from the start that have been handed out at least once
+		int				iBytes;			// what the live blocks asked for
+		int				iMorphed;		// live blocks whose tag isn't the slab's any more
+} zoneSlab_t;
+
+#define ZONE_SLAB_HEADER	((sizeof(zoneSlab_t) + 15) & ~15)
+
+typedef struct zoneSlabList_s
+{
+	zoneSlab_t				*pAll;
+	zoneSlab_t				*pAvail;
+} zoneSlabList_t;
+
+static zoneSlabList_t	zoneSlabs[TAG_COUNT][ZONE_SLAB_CLASSES];
+static zoneSlab_t		*zoneSlabPool;
+static int				ziSlabPoolCount;
+static int				ziMorphedSlabBlocks;
+
+static inline qboolean Zone_UseSlabs(void)
+{
+#ifdef DETAILED_ZONE_DEBUG_CODE
+	return qfalse;	// the allocation map wants to see every block
+#else
+	return (qboolean)(!com_zoneSlabs || com_zoneSlabs->integer);
+#endif
+}
+
+static inline int Zone_SlabClass(int iSize)
+{
+	if (iSize <= 128)
+	{
+		return (iSize - 1) >> 4;
+	}
+	if (iSize <= 256)
+	{
+		return 8 + ((iSize - 129) >> 5);
+	}
+	return 12 + ((iSize - 257) >> 6);
+}
+
+static inline zoneSlab_t *Zone_SlabFromBlock(zoneBlock_t *pBlock)
+{
+	return (zoneSlab_t *) ( (byte*)pBlock - pBlock->iSlabOffset );
+}
+
+static inline zoneBlock_t *Zone_SlabBlock(zoneSlab_t *pSlab, int iIndex)
+{
+	return (zoneBlock_t *) ( (byte*)pSlab + ZONE_SLAB_HEADER + iIndex * pSlab->iBlockSize );
+}
+
+static void Zone_LinkAvail(zoneSlabList_t *pList, zoneSlab_t *pSlab)
+{
+	pSlab->pPrevAvail = NULL;
+	pSlab->pNextAvail = pList->pAvail;
+	if (pList->pAvail)
+	{
+		pList->pAvail->pPrevAvail = pSlab;
+	}
+	pList->pAvail = pSlab;
+}
+
+static void Zone_UnlinkAvail(zoneSlabList_t *pList, zoneSlab_t *pSlab)
+{
+	if (pSlab->pPrevAvail)
+	{
+		pSlab->pPrevAvail->pNextAvail = pSlab->pNextAvail;
+	}
+	else
+	{
+		pList->pAvail = pSlab->pNextAvail;
+	}
+	if (pSlab->pNextAvail)
+	{
+		pSlab->pNextAvail->pPrevAvail = pSlab->pPrevAvail;
+	}
+}
+
+static zoneSlab_t *Zone_NewSlab(memtag_t eTag, int iClass)
+{
+	zoneSlabList_t	*pList = &zoneSlabs[eTag][iClass];
+	zoneSlab_t		*pSlab;
+
+	if (zoneSlabPool)
+	{
+		pSlab = zoneSlabPool;
+		zoneSlabPool = pSlab->pNext;
+		ziSlabPoolCount--;
+	}
+	else
+	{
+		pSlab = (zoneSlab_t *) malloc(ZONE_SLAB_SIZE);
+		if (!pSlab)
+		{
+			return NULL;
+		}
+		Z_CountHeapAlloc();
+	}
+
+	pSlab->pFree		= NULL;
+	pSlab->eTag			= eTag;
+	pSlab->iClass		= iClass;
+	pSlab->iBlockSize	= sizeof(zoneBlock_t) + ziSlabClassSizes[iClass];
+	pSlab->iCapacity	= (ZONE_SLAB_SIZE - ZONE_SLAB_HEADER) / pSlab->iBlockSize;
+	pSlab->iUsed		= 0;
+	pSlab->iFresh		= 0;
+	pSlab->iBytes		= 0;
+	pSlab->iMorphed		= 0;
+
+	pSlab->pPrev = NULL;
+	pSlab->pNext = pList->pAll;
+	if (pList->pAll)
+	{
+		pList->pAll->pPrev = pSlab;
+	}
+	pList->pAll = pSlab;
+	Zone_LinkAvail(pList, pSlab);
+
+	TheZone.Stats.iSlabs++;
+	TheZone.Stats.iSlabsPerTag[eTag]++;
+
+	return pSlab;
+}
+
+static void Zone_ReleaseSlab(zoneSlab_t *pSlab)
+{
+	zoneSlabList_t *pList = &zoneSlabs[pSlab->eTag][pSlab->iClass];
+
+	if (pSlab->iUsed < pSlab->iCapacity)
+	{
+		Zone_UnlinkAvail(pList, pSlab);
+	}
+	if (pSlab->pPrev)
+	{
+		pSlab->pPrev->pNext = pSlab->pNext;
+	}
+	else
+	{
+		pList->pAll = pSlab->pNext;
+	}
+	if (pSlab->pNext)
+	{
+		pSlab->pNext->pPrev = pSlab->pPrev;
+	}
+
+	TheZone.Stats.iSlabs--;
+	TheZone.Stats.iSlabsPerTag[pSlab->eTag]--;
+
+	if (ziSlabPoolCount < ZONE_SLAB_POOL)
+	{
+		pSlab->pNext = zoneSlabPool;
+		zoneSlabPool = pSlab;
+		ziSlabPoolCount++;
+	}
+	else
+	{
+		free(pSlab);
+	}
+}
+
+// returns NULL only when a new slab couldn't be malloc'd
+static void *Zone_SlabAlloc(int iSize, memtag_t eTag, qboolean bZeroit)
+{
+	int				iClass = Zone_SlabClass(iSize);
+	zoneSlabList_t	*pList = &zoneSlabs[eTag][iClass];
+	zoneSlab_t		*pSlab = pList->pAvail;
+	zoneBlock_t		*pBlock;
+
+	if (!pSlab)
+	{
+		pSlab = Zone_NewSlab(eTag, iClass);
+		if (!pSlab)
+		{
+			return NULL;
+		}
+	}
+
+	if (pSlab->pFree)
+	{
+		pBlock = pSlab->pFree;
+		pSlab->pFree = *(zoneBlock_t **)&pBlock[1];
+	}
+	else
+	{
+		pBlock = Zone_SlabBlock(pSlab, pSlab->iFresh++);
+		pBlock->iSlabOffset = (byte*)pBlock - (byte*)pSlab;
+	}
+
+	pBlock->iMagic	= ZONE_SLAB_MAGIC;
+	pBlock->eTag	= eTag;
+	pBlock->iSize	= iSize;
+
+	if (++pSlab->iUsed == pSlab->iCapacity)
+	{
+		Zone_UnlinkAvail(pList, pSlab);
+	}
+	pSlab->iBytes += iSize;
+
+	Zone_CountAlloc(iSize, eTag);
+
+	if (bZeroit)
+	{
+		memset(&pBlock[1], 0, iSize);
+	}
+
+	return &pBlock[1];
+}
+
+// returns qtrue if that emptied the slab and it went away
+static qboolean Zone_SlabFree(zoneBlock_t *pBlock)
+{
+	zoneSlab_t *pSlab = Zone_SlabFromBlock(pBlock);
+
+	Zone_CountFree(1, pBlock->iSize, pBlock->eTag);
+	if (pBlock->eTag != pSlab->eTag)
+	{
+		pSlab->iMorphed--;
+		ziMorphedSlabBlocks--;
+	}
+	pSlab->iBytes -= pBlock->iSize;
+
+	pBlock->iMagic = ZONE_FREE_MAGIC;
+	*(zoneBlock_t **)&pBlock[1] = pSlab->pFree;
+	pSlab->pFree = pBlock;
+
+	if (pSlab->iUsed-- == pSlab->iCapacity)
+	{
+		Zone_LinkAvail(&zoneSlabs[pSlab->eTag][pSlab->iClass], pSlab);
+	}
+	if (!pSlab->iUsed)
+	{
+		Zone_ReleaseSlab(pSlab);
+		return qtrue;
+	}
+	return qfalse;
+}
+
+// frees the live blocks in a slab that carry eTag, one at a time
+static void Zone_SlabFreeTagged(zoneSlab_t *pSlab, memtag_t eTag)
+{
+	for (int i = 0; i < pSlab->iFresh; i++)
+	{
+		zoneBlock_t *pBlock = Zone_SlabBlock(pSlab, i);
+
+		if (pBlock->iMagic == ZONE_SLAB_MAGIC && (eTag == TAG_ALL || pBlock->eTag == eTag))
+		{
+			if (Zone_SlabFree(pBlock))
+			{
+				return;
+			}
+		}
+	}
+}
+
+static void Zone_SlabTagFree(memtag_t eTag)
+{
+	for (int iTag = 0; iTag < TAG_COUNT; iTag++)
+	{
+		if (eTag != TAG_ALL && iTag != (int)eTag)
+		{
+			continue;
+		}
+
+		for (int iClass = 0; iClass < ZONE_SLAB_CLASSES; iClass++)
+		{
+			zoneSlab_t *pSlab = zoneSlabs[iTag][iClass].pAll;
+			while (pSlab)
+			{
+				zoneSlab_t *pNext = pSlab->pNext;
+				if (pSlab->iMorphed)
+				{
+					Zone_SlabFreeTagged(pSlab, eTag);
+				}
+				else
+				{
+					Zone_CountFree(pSlab->iUsed, pSlab->iBytes, pSlab->eTag);
+					Zone_ReleaseSlab(pSlab);
+				}
+				pSlab = pNext;
+			}
+		}
+	}
+
+	// blocks that were morphed to this tag are still sitting in other tags' slabs
+	if (eTag != TAG_ALL && ziMorphedSlabBlocks)
+	{
+		for (int iTag = 0; iTag < TAG_COUNT; iTag++)
+		{
+			for (int iClass = 0; iClass < ZONE_SLAB_CLASSES; iClass++)
+			{
+				zoneSlab_t *pSlab = zoneSlabs[iTag][iClass].pAll;
+				while (pSlab)
+				{
+					zoneSlab_t *pNext = pSlab->pNext;
+					if (pSlab->iMorphed)
+					{
+						Zone_SlabFreeTagged(pSlab, eTag);
+					}
+					pSlab = pNext;
+				}
+			}
+		}
+	}
+}
+
+
+// Scans through the linked list of mallocs and the slabs and makes sure no data has been overwritten
 
 void Z_Validate(void)
 {
@@ -118,7 +553,7 @@ void Z_Validate(void)
 		}
 		#endif
 
-		if(pMemory->iMagic != ZONE_MAGIC)
+		if(pMemory->Block.iMagic != ZONE_MAGIC)
 		{
 			Com_Error(ERR_FATAL, "Z_Validate(): Corrupt zone header!");
 			return;
@@ -132,6 +567,32 @@ void Z_Validate(void)
 
 		pMemory = pMemory->pNext;
 	}
+
+	for (int iTag = 0; iTag < TAG_COUNT; iTag++)
+	{
+		for (int iClass = 0; iClass < ZONE_SLAB_CLASSES; iClass++)
+		{
+			for (zoneSlab_t *pSlab = zoneSlabs[iTag][iClass].pAll; pSlab; pSlab = pSlab->pNext)
+			{
+				int iUsed = 0;
+				for (int i = 0; i < pSlab->iFresh; i++)
+				{
+					zoneBlock_t *pBlock = Zone_SlabBlock(pSlab, i);
+					if ((pBlock->iMagic != ZONE_SLAB_MAGIC && pBlock->iMagic != ZONE_FREE_MAGIC) || Zone_SlabFromBlock(pBlock) != pSlab)
+					{
+						Com_Error(ERR_FATAL, "Z_Validate(): Corrupt slab block header!");
+						return;
+					}
+					iUsed += pBlock->iMagic == ZONE_SLAB_MAGIC;
+				}
+				if (iUsed != pSlab->iUsed)
+				{
+					Com_Error(ERR_FATAL, "Z_Validate(): Slab block count is off!");
+					return;
+				}
+			}
+		}
+	}
 }
 
 
@@ -154,20 +615,20 @@ typedef struct StaticMem_s {
 #pragma pack(pop)
 
 StaticZeroMem_t gZeroMalloc  =
-	{ {ZONE_MAGIC, TAG_STATIC,0,NULL,NULL},{ZONE_MAGIC}};
+	{ {NULL,NULL,{ZONE_MAGIC, TAG_STATIC,0,0}},{ZONE_MAGIC}};
 StaticMem_t gEmptyString =
-	{ {ZONE_MAGIC, TAG_STATIC,2,NULL,NULL},{'\0','\0'},{ZONE_MAGIC}};
+	{ {NULL,NULL,{ZONE_MAGIC, TAG_STATIC,2,0}},{'\0','\0'},{ZONE_MAGIC}};
 StaticMem_t gNumberString[] = {
-	{ {ZONE_MAGIC, TAG_STATIC,2,NULL,NULL},{'0','\0'},{ZONE_MAGIC}},
-	{ {ZONE_MAGIC, TAG_STATIC,2,NULL,NULL},{'1','\0'},{ZONE_MAGIC}},
-	{ {ZONE_MAGIC, TAG_STATIC,2,NULL,NULL},{'2','\0'},{ZONE_MAGIC}},
-	{ {ZONE_MAGIC, TAG_STATIC,2,NULL,NULL},{'3','\0'},{ZONE_MAGIC}},
-	{ {ZONE_MAGIC, TAG_STATIC,2,NULL,NULL},{'4','\0'},{ZONE_MAGIC}},
-	{ {ZONE_MAGIC, TAG_STATIC,2,NULL,NULL},{'5','\0'},{ZONE_MAGIC}},
-	{ {ZONE_MAGIC, TAG_STATIC,2,NULL,NULL},{'6','\0'},{ZONE_MAGIC}},
-	{ {ZONE_MAGIC, TAG_STATIC,2,NULL,NULL},{'7','\0'},{ZONE_MAGIC}},
-	{ {ZONE_MAGIC, TAG_STATIC,2,NULL,NULL},{'8','\0'},{ZONE_MAGIC}},
-	{ {ZONE_MAGIC, TAG_STATIC,2,NULL,NULL},{'9','\0'},{ZONE_MAGIC}},
+	{ {NULL,NULL,{ZONE_MAGIC, TAG_STATIC,2,0}},{'0','\0'},{ZONE_MAGIC}},
+	{ {NULL,NULL,{ZONE_MAGIC, TAG_STATIC,2,0}},{'1','\0'},{ZONE_MAGIC}},
+	{ {NULL,NULL,{ZONE_MAGIC, TAG_STATIC,2,0}},{'2','\0'},{ZONE_MAGIC}},
+	{ {NULL,NULL,{ZONE_MAGIC, TAG_STATIC,2,0}},{'3','\0'},{ZONE_MAGIC}},
+	{ {NULL,NULL,{ZONE_MAGIC, TAG_STATIC,2,0}},{'4','\0'},{ZONE_MAGIC}},
+	{ {NULL,NULL,{ZONE_MAGIC, TAG_STATIC,2,0}},{'5','\0'},{ZONE_MAGIC}},
+	{ {NULL,NULL,{ZONE_MAGIC, TAG_STATIC,2,0}},{'6','\0'},{ZONE_MAGIC}},
+	{ {NULL,NULL,{ZONE_MAGIC, TAG_STATIC,2,0}},{'7','\0'},{ZONE_MAGIC}},
+	{ {NULL,NULL,{ZONE_MAGIC, TAG_STATIC,2,0}},{'8','\0'},{ZONE_MAGIC}},
+	{ {NULL,NULL,{ZONE_MAGIC, TAG_STATIC,2,0}},{'9','\0'},{ZONE_MAGIC}},
 };
 
 qboolean gbMemFreeupOccured = qfalse;
@@ -181,6 +642,17 @@ void *Z_Malloc(int iSize, memtag_t eTag, qboolean bZeroit /* = qfalse */, int iU
 		return &pMemory[1];
 	}
 
+	if (iSize <= ZONE_SLAB_MAX_SIZE && Zone_UseSlabs())
+	{
+		void *pvSlabMem = Zone_SlabAlloc(iSize, eTag, bZeroit);
+		if (pvSlabMem)
+		{
+			Z_Validate();	// check for corruption
+			return pvSlabMem;
+		}
+		// couldn't get a new slab, fall through so the loop below can free up some memory
+	}
+
 	// Add in tracking info
 	//
 	int iRealSize = (iSize + sizeof(zoneHeader_t) + sizeof(zoneTail_t));
@@ -200,6 +672,7 @@ void *Z_Malloc(int iSize, memtag_t eTag, qboolean bZeroit /* = qfalse */, int iU
 		} else {
 			pMemory = (zoneHeader_t *) malloc ( iRealSize );
 		}
+		Z_CountHeapAlloc();
 		if (!pMemory)
 		{
 			// new bit, if we fail to malloc memory, try dumping some of the cached stuff that's non-vital and try again...
@@ -283,9 +756,10 @@ void *Z_Malloc(int iSize, memtag_t eTag, qboolean bZeroit /* = qfalse */, int iU
 	}
 
 	// Link in
-	pMemory->iMagic	= ZONE_MAGIC;
-	pMemory->eTag	= eTag;
-	pMemory->iSize	= iSize;
+	pMemory->Block.iMagic		= ZONE_MAGIC;
+	pMemory->Block.eTag			= eTag;
+	pMemory->Block.iSize		= iSize;
+	pMemory->Block.iSlabOffset	= 0;
 	pMemory->pNext  = TheZone.Header.pNext;
 	TheZone.Header.pNext = pMemory;
 	if (pMemory->pNext)
@@ -300,15 +774,7 @@ void *Z_Malloc(int iSize, memtag_t eTag, qboolean bZeroit /* = qfalse */, int iU
 
 	// Update stats...
 	//
-	TheZone.Stats.iCurrent += iSize;
-	TheZone.Stats.iCount++;
-	TheZone.Stats.iSizesPerTag	[eTag] += iSize;
-	TheZone.Stats.iCountsPerTag	[eTag]++;
-
-	if (TheZone.Stats.iCurrent > TheZone.Stats.iPeak)
-	{
-		TheZone.Stats.iPeak	= TheZone.Stats.iCurrent;
-	}
+	Zone_CountAlloc(iSize, eTag);
 
 #ifdef DETAILED_ZONE_DEBUG_CODE
 	mapAllocatedZones[pMemory]++;
@@ -341,9 +807,25 @@ void openjk_minizip_free(void *to_free)
 //
 void Z_MorphMallocTag( void *pvAddress, memtag_t eDesiredTag )
 {
-	zoneHeader_t *pMemory = ((zoneHeader_t *)pvAddress) - 1;
+	zoneBlock_t *pBlock = ZoneBlockFromAddress(pvAddress);
 
-	if (pMemory->iMagic != ZONE_MAGIC)
+	if (pBlock->iMagic == ZONE_SLAB_MAGIC)
+	{
+		// the block can't move, so its slab has to remember it holds a stranger
+		//
+		zoneSlab_t *pSlab = Zone_SlabFromBlock(pBlock);
+		if (pBlock->eTag == pSlab->eTag)
+		{
+			pSlab->iMorphed++;
+			ziMorphedSlabBlocks++;
+		}
+		if (eDesiredTag == pSlab->eTag)
+		{
+			pSlab->iMorphed--;
+			ziMorphedSlabBlocks--;
+		}
+	}
+	else if (pBlock->iMagic != ZONE_MAGIC)
 	{
 		Com_Error(ERR_FATAL, "Z_MorphMallocTag(): Not a valid zone header!");
 		return;	// won't get here
@@ -353,31 +835,28 @@ void Z_MorphMallocTag( void *pvAddress, memtag_t eDesiredTag )
 	//
 //	TheZone.Stats.iCurrent	- unchanged
 //	TheZone.Stats.iCount	- unchanged
-	TheZone.Stats.iSizesPerTag	[pMemory->eTag] -= pMemory->iSize;
-	TheZone.Stats.iCountsPerTag	[pMemory->eTag]--;
+	TheZone.Stats.iSizesPerTag	[pBlock->eTag] -= pBlock->iSize;
+	TheZone.Stats.iCountsPerTag	[pBlock->eTag]--;
 
 	// morph...
 	//
-	pMemory->eTag = eDesiredTag;
+	pBlock->eTag = eDesiredTag;
 
 	// INC new tag stats...
 	//
 //	TheZone.Stats.iCurrent	- unchanged
 //	TheZone.Stats.iCount	- unchanged
-	TheZone.Stats.iSizesPerTag	[pMemory->eTag] += pMemory->iSize;
-	TheZone.Stats.iCountsPerTag	[pMemory->eTag]++;
+	TheZone.Stats.iSizesPerTag	[pBlock->eTag] += pBlock->iSize;
+	TheZone.Stats.iCountsPerTag	[pBlock->eTag]++;
 }
 
 static void Zone_FreeBlock(zoneHeader_t *pMemory)
 {
-	if (pMemory->eTag != TAG_STATIC)	// belt and braces, should never hit this though
+	if (pMemory->Block.eTag != TAG_STATIC)	// belt and braces, should never hit this though
 	{
 		// Update stats...
 		//
-		TheZone.Stats.iCount--;
-		TheZone.Stats.iCurrent -= pMemory->iSize;
-		TheZone.Stats.iSizesPerTag	[pMemory->eTag] -= pMemory->iSize;
-		TheZone.Stats.iCountsPerTag	[pMemory->eTag]--;
+		Zone_CountFree(1, pMemory->Block.iSize, pMemory->Block.eTag);
 
 		// Sanity checks...
 		//
@@ -411,20 +890,20 @@ static void Zone_FreeBlock(zoneHeader_t *pMemory)
 //
 int Z_Size(void *pvAddress)
 {
-	zoneHeader_t *pMemory = ((zoneHeader_t *)pvAddress) - 1;
+	zoneBlock_t *pBlock = ZoneBlockFromAddress(pvAddress);
 
-	if (pMemory->eTag == TAG_STATIC)
+	if (pBlock->eTag == TAG_STATIC)
 	{
 		return 0;	// kind of
 	}
 
-	if (pMemory->iMagic != ZONE_MAGIC)
+	if (pBlock->iMagic != ZONE_MAGIC && pBlock->iMagic != ZONE_SLAB_MAGIC)
 	{
 		Com_Error(ERR_FATAL, "Z_Size(): Not a valid zone header!");
 		return 0;	// won't get here
 	}
 
-	return pMemory->iSize;
+	return pBlock->iSize;
 }
 
 
@@ -438,13 +917,21 @@ void Z_Free(void *pvAddress)
 		return;
 	}
 
-	zoneHeader_t *pMemory = ((zoneHeader_t *)pvAddress) - 1;
+	zoneBlock_t *pBlock = ZoneBlockFromAddress(pvAddress);
+
+	if (pBlock->eTag == TAG_STATIC)
+	{
+		return;
+	}
 
-	if (pMemory->eTag == TAG_STATIC)
+	if (pBlock->iMagic == ZONE_SLAB_MAGIC)
 	{
+		Zone_SlabFree(pBlock);
 		return;
 	}
 
+	zoneHeader_t *pMemory = ZoneHeaderFromBlock(pBlock);
+
 	#ifdef DETAILED_ZONE_DEBUG_CODE
 	//
 	// check this error *before* barfing on bad magics...
@@ -457,7 +944,7 @@ void Z_Free(void *pvAddress)
 	}
 	#endif
 
-	if (pMemory->iMagic != ZONE_MAGIC)
+	if (pMemory->Block.iMagic != ZONE_MAGIC)
 	{
 		Com_Error(ERR_FATAL, "Z_Free(): Corrupt zone header!");
 		return;
@@ -485,11 +972,13 @@ void Z_TagFree(memtag_t eTag)
 //	int iZoneBlocks = TheZone.Stats.iCount;
 //#endif
 
+	Zone_SlabTagFree(eTag);
+
 	zoneHeader_t *pMemory = TheZone.Header.pNext;
 	while (pMemory)
 	{
 		zoneHeader_t *pNext = pMemory->pNext;
-		if ( (eTag == TAG_ALL) || (pMemory->eTag == eTag))
+		if ( (eTag == TAG_ALL) || (pMemory->Block.eTag == eTag))
 		{
 			Zone_FreeBlock(pMemory);
 		}
@@ -511,6 +1000,237 @@ void *S_Malloc( int iSize ) {
 }
 
 
+/*
+====================
+FRAME ARENAS
+
+One malloc'd block per side, bumped through during a frame and rewound
+when that side starts its next one.  Whatever doesn't fit spills into
+mallocs of its own that are freed at the reset, so a frame never fails,
+and the high-water mark says how big com_frameArenaSize should be to
+avoid that.
+====================
+*/
+
+#define FRAME_ARENA_ALIGN	16
+
+typedef struct frameSpill_s
+{
+struct	frameSpill_s	*pNext;
+		int				iSize;
+		int				iPad[ (FRAME_ARENA_ALIGN - sizeof(void *) - sizeof(int)) / sizeof(int) ];
+} frameSpill_t;
+
+typedef struct frameArenaData_s
+{
+	const char		*psName;
+	byte			*pbBase;
+	int				iSize;
+	int				iUsed;
+	int				iFrames;		// resets so far
+
+	frameSpill_t	*pSpills;
+	int				iSpillBytes;
+	int				iPeak;			// this frame, spills included
+
+	int				iHighWater;
+	int				iSpillFrames;
+} frameArenaData_t;
+
+static frameArenaData_t frameArenas[FRAME_ARENA_COUNT] =
+{
+	{ "server" },
+	{ "client" },
+};
+
+cvar_t	*com_frameArenaSize;
+
+static void Frame_InitArena(frameArenaData_t *pArena)
+{
+	// read once, the block can't move under the frame that's using it
+	pArena->iSize = (com_frameArenaSize ? com_frameArenaSize->integer : 4096) * 1024;
+	pArena->iSize = Q_max(pArena->iSize, 64*1024) & ~(FRAME_ARENA_ALIGN - 1);
+	pArena->pbBase = (byte *) malloc(pArena->iSize);
+	Z_CountHeapAlloc();
+	if (!pArena->pbBase)
+	{
+		Com_Error(ERR_FATAL, "Frame_Alloc(): Failed to alloc %d bytes for the %s arena", pArena->iSize, pArena->psName);
+	}
+}
+
+void *Frame_Alloc(frameArena_t eArena, int iSize)
+{
+	frameArenaData_t *pArena = &frameArenas[eArena];
+
+	if (!pArena->pbBase)
+	{
+		Frame_InitArena(pArena);
+	}
+
+	iSize = (iSize + FRAME_ARENA_ALIGN - 1) & ~(FRAME_ARENA_ALIGN - 1);
+
+	void *pvMem;
+	if (iSize <= pArena->iSize - pArena->iUsed)
+	{
+		pvMem = pArena->pbBase + pArena->iUsed;
+		pArena->iUsed += iSize;
+	}
+	else
+	{
+		frameSpill_t *pSpill = (frameSpill_t *) malloc(sizeof(frameSpill_t) + iSize);
+		Z_CountHeapAlloc();
+		if (!pSpill)
+		{
+			Com_Error(ERR_FATAL, "Frame_Alloc(): Failed to alloc %d bytes (%s arena)", iSize, pArena->psName);
+		}
+		pSpill->iSize = iSize;
+		pSpill->pNext = pArena->pSpills;
+		pArena->pSpills = pSpill;
+		pArena->iSpillBytes += iSize;
+		pvMem = &pSpill[1];
+	}
+
+	if (pArena->iUsed + pArena->iSpillBytes > pArena->iPeak)
+	{
+		pArena->iPeak = pArena->iUsed + pArena->iSpillBytes;
+	}
+
+	return pvMem;
+}
+
+int Frame_Mark(frameArena_t eArena)
+{
+	return frameArenas[eArena].iUsed;
+}
+
+void Frame_Release(frameArena_t eArena, int iMark)
+{
+	frameArenaData_t *pArena = &frameArenas[eArena];
+
+	assert(iMark >= 0 && iMark <= pArena->iUsed);
+	pArena->iUsed = iMark;
+}
+
+static void Frame_FreeSpills(frameArenaData_t *pArena)
+{
+	while (pArena->pSpills)
+	{
+		frameSpill_t *pSpill = pArena->pSpills;
+		pArena->pSpills = pSpill->pNext;
+		free(pSpill);
+	}
+	pArena->iSpillBytes = 0;
+}
+
+void Frame_Reset(frameArena_t eArena)
+{
+	frameArenaData_t *pArena = &frameArenas[eArena];
+
+	if (pArena->iPeak > pArena->iHighWater)
+	{
+		pArena->iHighWater = pArena->iPeak;
+	}
+	if (pArena->pSpills)
+	{
+		Com_DPrintf(S_COLOR_YELLOW "Frame_Reset(): %s arena spilled %d bytes, raise com_frameArenaSize\n", pArena->psName, pArena->iSpillBytes);
+		pArena->iSpillFrames++;
+		Frame_FreeSpills(pArena);
+	}
+
+	pArena->iUsed = 0;
+	pArena->iPeak = 0;
+	pArena->iFrames++;
+}
+
+static void Frame_Shutdown(void)
+{
+	for (int i = 0; i < FRAME_ARENA_COUNT; i++)
+	{
+		frameArenaData_t *pArena = &frameArenas[i];
+
+		Frame_FreeSpills(pArena);
+		free(pArena->pbBase);
+		pArena->pbBase = NULL;
+		pArena->iUsed = 0;
+		pArena->iPeak = 0;
+	}
+}
+
+// ghoul2 resets its vertex space before every model it transforms, so this
+// rewinds over its last model as long as nothing else was allocated on top
+class CFrameArenaHeap : public IHeapAllocator
+{
+private:
+	frameArena_t	mArena;
+	int				mFrame;		// arena frame mStart and mEnd belong to
+	int				mStart;
+	int				mEnd;
+public:
+	CFrameArenaHeap(frameArena_t eArena) : mArena(eArena), mFrame(-1), mStart(0), mEnd(0) {}
+
+	void ResetHeap()
+	{
+		frameArenaData_t *pArena = &frameArenas[mArena];
+
+		if (mFrame == pArena->iFrames && pArena->iUsed == mEnd)
+		{
+			Frame_Release(mArena, mStart);
+		}
+		mFrame = pArena->iFrames;
+		mStart = mEnd = pArena->iUsed;
+	}
+
+	char *MiniHeapAlloc(int size)
+	{
+		frameArenaData_t *pArena = &frameArenas[mArena];
+
+		if (mFrame != pArena->iFrames || pArena->iUsed != mEnd)
+		{
+			// a new frame, or someone else got in since, leave what's below alone
+			mFrame = pArena->iFrames;
+			mStart = pArena->iUsed;
+		}
+		char *pMem = (char *) Frame_Alloc(mArena, size);
+		mEnd = pArena->iUsed;
+		return pMem;
+	}
+};
+
+static CFrameArenaHeap frameArenaHeaps[FRAME_ARENA_COUNT] =
+{
+	CFrameArenaHeap(FRAME_ARENA_SERVER),
+	CFrameArenaHeap(FRAME_ARENA_CLIENT),
+};
+
+IHeapAllocator *Frame_HeapAllocator(frameArena_t eArena)
+{
+	return &frameArenaHeaps[eArena];
+}
+
+// Gives the size and high-water mark of each frame arena
+
+static void Z_FrameStats_f(void)
+{
+	for (int i = 0; i < FRAME_ARENA_COUNT; i++)
+	{
+		frameArenaData_t *pArena = &frameArenas[i];
+
+		if (!pArena->pbBase)
+		{
+			Com_Printf("%s arena: unused\n", pArena->psName);
+			continue;
+		}
+		Com_Printf("%s arena: %d KB, %d KB used this frame, %d KB high-water, spilled in %d of %d frames\n",
+						pArena->psName,
+						pArena->iSize >> 10,
+						Q_max(pArena->iPeak, pArena->iUsed) >> 10,
+						Q_max(pArena->iHighWater, pArena->iPeak) >> 10,
+						pArena->iSpillFrames, pArena->iFrames
+				);
+	}
+}
+
+
 #ifdef _DEBUG
 static void Z_MemRecoverTest_f(void)
 {
@@ -548,6 +1268,12 @@ static void Z_Stats_f(void)
 									TheZone.Stats.iPeak,
 									         (float)TheZone.Stats.iPeak / 1024.0f / 1024.0f
 				);
+
+	Com_Printf("Small blocks take up %d slabs (%.2fMB), with %d empty ones kept for reuse\n",
+									TheZone.Stats.iSlabs,
+										  (float)TheZone.Stats.iSlabs * ZONE_SLAB_SIZE / 1024.0f / 1024.0f,
+																	 ziSlabPoolCount
+				);
 }
 
 // Gives a detailed breakdown of the memory blocks in the zone
@@ -570,11 +1296,12 @@ static void Z_Details_f(void)
 			float	fSize		= (float)(iThisSize) / 1024.0f / 1024.0f;
 			int		iSize		= fSize;
 			int		iRemainder 	= 100.0f * (fSize - floor(fSize));
-			Com_Printf("%20s %9d (%2d.%02dMB) in %6d blocks (%9d average)\n",
+			Com_Printf("%20s %9d (%2d.%02dMB) in %6d blocks (%9d average) %5d slabs\n",
 					    psTagStrings[i],
 							  iThisSize,
 								iSize,iRemainder,
-								           iThisCount, iThisSize / iThisCount
+								           iThisCount, iThisSize / iThisCount,
+														 TheZone.Stats.iSlabsPerTag[i]
 					   );
 		}
 	}
@@ -583,6 +1310,90 @@ static void Z_Details_f(void)
 	Z_Stats_f();
 }
 
+/*
+====================
+Z_Benchmark_f
+
+Churns a working set of mostly small blocks the way the game, ghoul2 and FX
+code do, then frees a level's worth of them with one Z_TagFree, once from
+slabs and once with every block malloc'd on its own.
+====================
+*/
+#define ZONE_BENCH_SLOTS	4096
+#define ZONE_BENCH_STEPS	1000000
+#define ZONE_BENCH_BULK		200000
+
+static int Z_BenchmarkSize(unsigned int iRand)
+{
+	// mostly small, now and then something that won't fit a slab
+	if ((iRand & 31) == 0)
+	{
+		return ZONE_SLAB_MAX_SIZE + 1 + ((iRand >> 8) & 4095);
+	}
+	return 1 + ((iRand >> 8) % (((iRand >> 5) & 3) == 0 ? ZONE_SLAB_MAX_SIZE : 64));
+}
+
+static void Z_Benchmark_f(void)
+{
+	char			savedSlabs[MAX_CVAR_VALUE_STRING];
+	void			**ppvSlots;
+	unsigned int	iRand;
+	int				iMode, iStep, iSlot, iStart, iChurn[2], iBulk[2];
+
+	if (Z_MemSize(TAG_SPECIAL_MEM_TEST))
+	{
+		Com_Printf("Something else is using TAG_SPECIAL_MEM_TEST\n");
+		return;
+	}
+
+	Q_strncpyz(savedSlabs, com_zoneSlabs->string, sizeof(savedSlabs));
+	ppvSlots = (void **) Z_Malloc(ZONE_BENCH_SLOTS * sizeof(*ppvSlots), TAG_TEMP_WORKSPACE, qfalse);
+
+	for (iMode = 0; iMode < 2; iMode++)
+	{
+		Cvar_Set("com_zoneSlabs", iMode ? "0" : "1");
+		memset(ppvSlots, 0, ZONE_BENCH_SLOTS * sizeof(*ppvSlots));
+		iRand = 0x1234567;
+
+		iStart = Sys_Milliseconds();
+		for (iStep = 0; iStep < ZONE_BENCH_STEPS; iStep++)
+		{
+			iRand = iRand * 1664525 + 1013904223;
+			iSlot = (iRand >> 12) & (ZONE_BENCH_SLOTS - 1);
+			if (ppvSlots[iSlot])
+			{
+				Z_Free(ppvSlots[iSlot]);
+				ppvSlots[iSlot] = NULL;
+			}
+			else
+			{
+				ppvSlots[iSlot] = Z_Malloc(Z_BenchmarkSize(iRand), TAG_SPECIAL_MEM_TEST, qfalse);
+			}
+		}
+		for (iSlot = 0; iSlot < ZONE_BENCH_SLOTS; iSlot++)
+		{
+			Z_Free(ppvSlots[iSlot]);
+		}
+		iChurn[iMode] = Sys_Milliseconds() - iStart;
+
+		iStart = Sys_Milliseconds();
+		for (iStep = 0; iStep < ZONE_BENCH_BULK; iStep++)
+		{
+			iRand = iRand * 1664525 + 1013904223;
+			Z_Malloc(Z_BenchmarkSize(iRand), TAG_SPECIAL_MEM_TEST, qtrue);
+		}
+		Z_TagFree(TAG_SPECIAL_MEM_TEST);
+		iBulk[iMode] = Sys_Milliseconds() - iStart;
+	}
+
+	Cvar_Set("com_zoneSlabs", savedSlabs);
+	Z_Free(ppvSlots);
+
+	Com_Printf("%d alloc/free steps over %d slots, %d allocs freed by tag\n", ZONE_BENCH_STEPS, ZONE_BENCH_SLOTS, ZONE_BENCH_BULK);
+	Com_Printf("slabs:  %5d msec churn, %5d msec bulk\n", iChurn[0], iBulk[0]);
+	Com_Printf("malloc: %5d msec churn, %5d msec bulk\n", iChurn[1], iBulk[1]);
+}
+
 // Shuts down the zone memory system and frees up all memory
 void Com_ShutdownZoneMemory(void)
 {
@@ -590,6 +1401,10 @@ void Com_ShutdownZoneMemory(void)
 
 	Cmd_RemoveCommand("zone_stats");
 	Cmd_RemoveCommand("zone_details");
+	Cmd_RemoveCommand("zone_benchmark");
+	Cmd_RemoveCommand("zone_frames");
+
+	Frame_Shutdown();
 
 	if(TheZone.Stats.iCount)
 	{
@@ -599,6 +1414,14 @@ void Com_ShutdownZoneMemory(void)
 		assert(!TheZone.Stats.iCount);
 		assert(!TheZone.Stats.iCurrent);
 	}
+
+	while (zoneSlabPool)
+	{
+		zoneSlab_t *pSlab = zoneSlabPool;
+		zoneSlabPool = pSlab->pNext;
+		free(pSlab);
+	}
+	ziSlabPoolCount = 0;
 }
 
 // Initialises the zone memory system
@@ -606,7 +1429,7 @@ void Com_ShutdownZoneMemory(void)
 void Com_InitZoneMemory( void )
 {
 	memset(&TheZone, 0, sizeof(TheZone));
-	TheZone.Header.iMagic = ZONE_MAGIC;
+	TheZone.Header.Block.iMagic = ZONE_MAGIC;
 }
 
 void Com_InitZoneMemoryVars( void ) {
@@ -615,9 +1438,13 @@ void Com_InitZoneMemoryVars( void ) {
 //#else
 	com_validateZone = Cvar_Get("com_validateZone", "0", 0);
 //#endif
+	com_zoneSlabs = Cvar_Get("com_zoneSlabs", "1", 0, "Serve small zone blocks from per-tag slabs, 0 gives every block its own allocation with a guard tail" );
+	com_frameArenaSize = Cvar_Get("com_frameArenaSize", "4096", CVAR_ARCHIVE_ND, "Size in KB of the server and client frame arenas, read when an arena is first used" );
 
 	Cmd_AddCommand("zone_stats", Z_Stats_f, "Prints out zone memory stats" );
 	Cmd_AddCommand("zone_details", Z_Details_f, "Prints out full detailed zone memory info" );
+	Cmd_AddCommand("zone_benchmark", Z_Benchmark_f, "Times small zone allocations with and without slabs" );
+	Cmd_AddCommand("zone_frames", Z_FrameStats_f, "Prints frame arena usage and high-water marks" );
 
 #ifdef _DEBUG
 	Cmd_AddCommand("zone_memrecovertest", Z_MemRecoverTest_f);
@@ -677,7 +1504,7 @@ void Com_TouchMemory( void ) {
 	while (pMemory)
 	{
 		byte *pMem = (byte *) &pMemory[1];
-		j = pMemory->iSize >> 2;
+		j = pMemory->Block.iSize >> 2;
 		for (i=0; i<j; i+=64){
 			sum += ((int*)pMem)[i];
 		}
@@ -685,6 +1512,20 @@ void Com_TouchMemory( void ) {
 		pMemory = pMemory->pNext;
 	}
 
+	for (int iTag = 0; iTag < TAG_COUNT; iTag++)
+	{
+		for (int iClass = 0; iClass < ZONE_SLAB_CLASSES; iClass++)
+		{
+			for (zoneSlab_t *pSlab = zoneSlabs[iTag][iClass].pAll; pSlab; pSlab = pSlab->pNext)
+			{
+				j = (ZONE_SLAB_HEADER + pSlab->iFresh * pSlab->iBlockSize) >> 2;
+				for (i=0; i<j; i+=64){
+					sum += ((int*)pSlab)[i];
+				}
+			}
+		}
+	}
+
 //	end = Sys_Milliseconds();
 //	Com_Printf( "Com_TouchMemory: %i msec\n", end - start );
 }
@@ -60,6 +60,9 @@ qboolean R_ImageLoader_Add( const char *extension, ImageLoaderFn imageLoader );
 // Load an image from file.
 void R_LoadImage( const char *shortname, byte **pic, int *width, int *height );
 
+// Start reading the file R_LoadImage would load, ahead of loading it.
+void R_PrefetchImage( const char *shortname );
+
 // Load raw image data from TGA image.
 void LoadTGA( const char *name, byte **pic, int *width, int *height );
 
@@ -138,3 +138,34 @@ void R_LoadImage( const char *shortname, byte **pic, int *width, int *height ) {
 		}
 	}
 }
+
+/*
+=================
+Starts reading the file R_LoadImage would load, trying the extensions
+in the same order.
+=================
+*/
+void R_PrefetchImage( const char *shortname ) {
+	const char *extension = COM_GetExtension (shortname);
+	const ImageLoaderMap *imageLoader = FindImageLoader (extension);
+	if ( imageLoader != NULL && ri.FS_PrefetchFile (shortname) )
+	{
+		return;
+	}
+
+	char extensionlessName[MAX_QPATH];
+	COM_StripExtension(shortname, extensionlessName, sizeof( extensionlessName ));
+	for ( int i = 0; i < numImageLoaders; i++ )
+	{
+		const ImageLoaderMap *tryLoader = &imageLoaders[i];
+		if ( tryLoader == imageLoader )
+		{
+			continue;
+		}
+
+		if ( ri.FS_PrefetchFile (va ("%s.%s", extensionlessName, tryLoader->extension)) )
+		{
+			return;
+		}
+	}
+}
@@ -30,7 +30,7 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 #include "../qcommon/qcommon.h"
 #include "../ghoul2/ghoul2_shared.h"
 
-#define	REF_API_VERSION 9
+#define	REF_API_VERSION 10
 
 //
 // these are the functions exported by the refresh module
@@ -346,6 +346,15 @@ typedef struct refimport_s {
 	// Persistent data store
 	bool			(*PD_Store)							( const char *name, const void *data, size_t size );
 	const void *	(*PD_Load)							( const char *name, size_t *size );
+
+	// worker threads
+	void			(*ParallelFor)						( int numThreads, int count, parallelJob_t job, void *data );
+
+	// reading files ahead
+	qboolean		(*FS_PrefetchFile)					( const char *qpath );
+
+	// heap allocations made so far by the whole process
+	int64_t			(*Z_HeapAllocs)						( void );
 } refimport_t;
 
 // this is the only function actually exported at the linker level
@@ -26,6 +26,9 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 #include "server/server.h"
 #include "ghoul2/g2_local.h"
 
+#include <algorithm>
+#include <chrono>
+
 #ifdef _G2_GORE
 #include "ghoul2/G2_gore.h"
 
@@ -176,6 +179,10 @@ CGoreSet::~CGoreSet()
 #endif // _SOF2
 
 const mdxaBone_t &EvalBoneCache(int index,CBoneCache *boneCache);
+void EvalBoneCacheAll(CBoneCache *boneCache);
+class CSkinCache;
+CSkinCache *&BoneCacheSkin(CBoneCache *boneCache);
+struct SSkinnedLod;
 class CTraceSurface
 {
 public:
@@ -194,6 +201,8 @@ public:
 	int					traceFlags;
 	bool				hitOne;
 	float				m_fRadius;
+	const SSkinnedLod	*cull;		// boxes of the skinned surfaces, NULL to trace them all
+	vec3_t				radiusAxes[3];	// s, t and u axes of a radius trace
 
 #ifdef _G2_GORE
 	//gore application thing
@@ -259,6 +268,7 @@ public:
 		VectorCopy(initrayStart, rayStart);
 		VectorCopy(initrayEnd, rayEnd);
 		hitOne = false;
+		cull = NULL;
 	}
 
 };
@@ -386,119 +396,292 @@ int G2_DecideTraceLod(CGhoul2Info &ghoul2, int useLod)
 	return returnLod;
 }
 
-void R_TransformEachSurface( const mdxmSurface_t *surface, vec3_t scale, IHeapAllocator *G2VertSpace, size_t *TransformedVertsArray,CBoneCache *boneCache)
+/*
+==============
+Skinning
+
+G2_TransformModel gathers the surfaces that are on and skins them a
+surface per task on the worker pool. The verts are kept in the CSkinCache
+of the instance, one per LOD, along with the bones, scale and surfaces
+they were built from, so a model that is traced again without having
+moved doesn't get skinned again. The kernels add up the weights in the
+same order as the old per vertex loop, so the verts come out the same.
+
+Skinning also boxes each surface and every G2_TRACE_RUN triangles of it,
+and every subtree of the surface hierarchy, for G2_TraceSurfaces to skip
+what a trace can't reach.
+==============
+*/
+#if defined(__SSE2__) || defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 )
+	#define G2_SIMD
+	#include <xmmintrin.h>
+#endif
+
+#define SKIN_PARALLEL_VERTS	2048	// don't wake the workers for less than this
+#define G2_TRACE_RUN		16		// triangles under one box
+#define G2_BOUNDS_EPSILON	0.01f	// boxes grow by this, and a bit with distance, to cover rounding
+
+typedef struct g2Bounds_s
+{
+	vec3_t		mins;
+	vec3_t		maxs;
+} g2Bounds_t;
+
+// everything in a skin cache comes out of the ghoul2 pool
+typedef std::vector<mdxaBone_t, CG2PoolAllocator<mdxaBone_t> >	g2BoneMatrix_v;
+typedef std::vector<const mdxmSurface_t *, CG2PoolAllocator<const mdxmSurface_t *> >	g2Surface_v;
+typedef std::vector<int, CG2PoolAllocator<int> >	g2Int_v;
+typedef std::vector<float, CG2PoolAllocator<float> >	g2Float_v;
+typedef std::vector<g2Bounds_t, CG2PoolAllocator<g2Bounds_t> >	g2Bounds_v;
+
+struct SSkinnedLod
 {
-	int				 j, k;
-	mdxmVertex_t 	*v;
-	float			*TransformedVerts;
+	const model_t				*mod;
+	vec3_t						scale;
+	g2BoneMatrix_v				bones;		// the bones the verts were skinned with
+	g2Surface_v					surfaces;
+	g2Int_v						offsets;	// where the verts of each surface start
+	g2Float_v					verts;
+
+	g2Int_v						slots;		// by surface index, where the surface is in surfaces or -1
+	g2Bounds_v					bounds;		// box of each surface
+	g2Int_v						firstRun;	// first of each surface's boxes in runs
+	g2Bounds_v					runs;
+	g2Bounds_v					subtrees;	// by surface index, box of the surfaces on at and under it
+	const size_t				*vertsArray;	// the array the verts were last handed out in
+};
 
-	//
-	// deform the vertexes by the lerped bones
-	//
-	int *piBoneReferences = (int*) ((byte*)surface + surface->ofsBoneReferences);
+class CSkinCache
+{
+public:
+	std::vector<SSkinnedLod, CG2PoolAllocator<SSkinnedLod> >	mLods;
 
-	// alloc some space for the transformed verts to get put in
-	TransformedVerts = (float *)G2VertSpace->MiniHeapAlloc(surface->numVerts * 5 * 4);
-	TransformedVertsArray[surface->thisSurfaceIndex] = (size_t)TransformedVerts;
-	if (!TransformedVerts)
+	static void *operator new(size_t size)
+	{
+		return G2_PoolAlloc(size);
+	}
+	static void operator delete(void *ptr, size_t size)
 	{
-		Com_Error(ERR_DROP, "Ran out of transform space for Ghoul2 Models. Adjust MiniHeapSize in SV_SpawnServer.\n");
+		G2_PoolFree(ptr, size);
 	}
+};
 
-	// whip through and actually transform each vertex
-	const int numVerts = surface->numVerts;
-	v = (mdxmVertex_t *) ((byte *)surface + surface->ofsVerts);
-	mdxmVertexTexCoord_t *pTexCoords = (mdxmVertexTexCoord_t *) &v[numVerts];
+void FreeSkinCache(CSkinCache *skin)
+{
+	delete skin;
+}
 
-	// optimisation issue
-	if ((scale[0] != 1.0) || (scale[1] != 1.0) || (scale[2] != 1.0))
+/*
+==============
+G2_ReserveSkinnedLod
+
+Sizes the lists of a LOD for every surface of the model being on, so
+skinning it again with other surfaces or bones never has to grow them
+==============
+*/
+static void G2_ReserveSkinnedLod(SSkinnedLod &skin, const model_t *mod, int numBones, int lod)
+{
+	int		i, numVerts = 0, numRuns = 0;
+	const int	numSurfaces = mod->mdxm->numSurfaces;
+
+	for (i=0;i<numSurfaces;i++)
 	{
-		for ( j = 0; j < numVerts; j++ )
-		{
-			vec3_t			tempVert, tempNormal;
-//			mdxmWeight_t	*w;
+		const mdxmSurface_t *surface = (const mdxmSurface_t *)G2_FindSurface((void *)mod, i, lod);
+
+		numVerts += surface->numVerts;
+		numRuns += (surface->numTriangles + G2_TRACE_RUN - 1) / G2_TRACE_RUN;
+	}
+	skin.bones.reserve(numBones);
+	skin.surfaces.reserve(numSurfaces);
+	skin.offsets.reserve(numSurfaces);
+	skin.verts.reserve(numVerts * 5);
+	skin.slots.reserve(numSurfaces);
+	skin.bounds.reserve(numSurfaces);
+	skin.firstRun.reserve(numSurfaces);
+	skin.runs.reserve(numRuns);
+	skin.subtrees.reserve(numSurfaces);
+}
 
-			VectorClear( tempVert );
-			VectorClear( tempNormal );
-//			w = v->weights;
+typedef struct g2SkinKernel_s
+{
+	const char	*name;
+	void		(*skin)(const mdxmSurface_t *surface, const mdxaBone_t *bones, const float *scale, float *out);
+} g2SkinKernel_t;
 
-			const int iNumWeights = G2_GetVertWeights( v );
+static void G2_SkinSurface_Scalar(const mdxmSurface_t *surface, const mdxaBone_t *bones, const float *scale, float *out)
+{
+	const int					*piBoneReferences = (const int *)((const byte *)surface + surface->ofsBoneReferences);
+	const int					numVerts = surface->numVerts;
+	const mdxmVertex_t			*v = (const mdxmVertex_t *)((const byte *)surface + surface->ofsVerts);
+	const mdxmVertexTexCoord_t	*pTexCoords = (const mdxmVertexTexCoord_t *)&v[numVerts];
+	int							j, k;
 
-			float fTotalWeight = 0.0f;
-			for ( k = 0 ; k < iNumWeights ; k++ )
-			{
-				int		iBoneIndex	= G2_GetVertBoneIndex( v, k );
-				float	fBoneWeight	= G2_GetVertBoneWeight( v, k, fTotalWeight, iNumWeights );
+	for ( j = 0; j < numVerts; j++, v++ )
+	{
+		vec3_t	tempVert;
 
-				const mdxaBone_t &bone=EvalBoneCache(piBoneReferences[iBoneIndex],boneCache);
+		VectorClear( tempVert );
 
-				tempVert[0] += fBoneWeight * ( DotProduct( bone.matrix[0], v->vertCoords ) + bone.matrix[0][3] );
-				tempVert[1] += fBoneWeight * ( DotProduct( bone.matrix[1], v->vertCoords ) + bone.matrix[1][3] );
-				tempVert[2] += fBoneWeight * ( DotProduct( bone.matrix[2], v->vertCoords ) + bone.matrix[2][3] );
+		const int iNumWeights = G2_GetVertWeights( v );
 
-				tempNormal[0] += fBoneWeight * DotProduct( bone.matrix[0], v->normal );
-				tempNormal[1] += fBoneWeight * DotProduct( bone.matrix[1], v->normal );
-				tempNormal[2] += fBoneWeight * DotProduct( bone.matrix[2], v->normal );
-			}
-			int pos = j * 5;
+		float fTotalWeight = 0.0f;
+		for ( k = 0 ; k < iNumWeights ; k++ )
+		{
+			int		iBoneIndex	= G2_GetVertBoneIndex( v, k );
+			float	fBoneWeight	= G2_GetVertBoneWeight( v, k, fTotalWeight, iNumWeights );
+
+			const mdxaBone_t &bone=bones[piBoneReferences[iBoneIndex]];
 
-			// copy tranformed verts into temp space
-			TransformedVerts[pos++] = tempVert[0] * scale[0];
-			TransformedVerts[pos++] = tempVert[1] * scale[1];
-			TransformedVerts[pos++] = tempVert[2] * scale[2];
-			// we will need the S & T coors too for hitlocation and hitmaterial stuff
-			TransformedVerts[pos++] = pTexCoords[j].texCoords[0];
-			TransformedVerts[pos] = pTexCoords[j].texCoords[1];
+			tempVert[0] += fBoneWeight * ( DotProduct( bone.matrix[0], v->vertCoords ) + bone.matrix[0][3] );
+			tempVert[1] += fBoneWeight * ( DotProduct( bone.matrix[1], v->vertCoords ) + bone.matrix[1][3] );
+			tempVert[2] += fBoneWeight * ( DotProduct( bone.matrix[2], v->vertCoords ) + bone.matrix[2][3] );
+		}
 
-			v++;// = (mdxmVertex_t *)&v->weights[/*v->numWeights*/surface->maxVertBoneWeights];
+		// we will need the S & T coors too for hitlocation and hitmaterial stuff
+		*out++ = tempVert[0] * scale[0];
+		*out++ = tempVert[1] * scale[1];
+		*out++ = tempVert[2] * scale[2];
+		*out++ = pTexCoords[j].texCoords[0];
+		*out++ = pTexCoords[j].texCoords[1];
+	}
+}
+
+#ifdef G2_SIMD
+static void G2_SkinSurface_SSE(const mdxmSurface_t *surface, const mdxaBone_t *bones, const float *scale, float *out)
+{
+	const int					*piBoneReferences = (const int *)((const byte *)surface + surface->ofsBoneReferences);
+	const int					numVerts = surface->numVerts;
+	const mdxmVertex_t			*v = (const mdxmVertex_t *)((const byte *)surface + surface->ofsVerts);
+	const mdxmVertexTexCoord_t	*pTexCoords = (const mdxmVertexTexCoord_t *)&v[numVerts];
+	const int					numRefs = Q_min( surface->numBoneReferences, iMAX_G2_BONEREFS_PER_SURFACE );
+	const __m128				vScale = _mm_setr_ps( scale[0], scale[1], scale[2], 0.0f );
+	__m128						columns[iMAX_G2_BONEREFS_PER_SURFACE][4];
+	int							j, k;
+
+	// the columns of the bones this surface uses, so a lane does a row
+	for ( k = 0 ; k < numRefs ; k++ )
+	{
+		const mdxaBone_t &bone=bones[piBoneReferences[k]];
+		for ( j = 0 ; j < 4 ; j++ )
+		{
+			columns[k][j] = _mm_setr_ps( bone.matrix[0][j], bone.matrix[1][j], bone.matrix[2][j], 0.0f );
 		}
 	}
-	else
+
+	for ( j = 0; j < numVerts; j++, v++ )
 	{
-		int pos = 0;
-	  	for ( j = 0; j < numVerts; j++ )
+		const __m128	x = _mm_set1_ps( v->vertCoords[0] );
+		const __m128	y = _mm_set1_ps( v->vertCoords[1] );
+		const __m128	z = _mm_set1_ps( v->vertCoords[2] );
+		__m128			tempVert = _mm_setzero_ps();
+
+		const int iNumWeights = G2_GetVertWeights( v );
+
+		float fTotalWeight = 0.0f;
+		for ( k = 0 ; k < iNumWeights ; k++ )
 		{
-			vec3_t			tempVert, tempNormal;
-//			const mdxmWeight_t	*w;
+			int		iBoneIndex	= G2_GetVertBoneIndex( v, k );
+			float	fBoneWeight	= G2_GetVertBoneWeight( v, k, fTotalWeight, iNumWeights );
 
-			VectorClear( tempVert );
-			VectorClear( tempNormal );
-//			w = v->weights;
+			const __m128 *bone = columns[iBoneIndex];
+			const __m128 point = _mm_add_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( bone[0], x ), _mm_mul_ps( bone[1], y ) ), _mm_mul_ps( bone[2], z ) ), bone[3] );
 
-			const int iNumWeights = G2_GetVertWeights( v );
+			tempVert = _mm_add_ps( tempVert, _mm_mul_ps( _mm_set1_ps( fBoneWeight ), point ) );
+		}
 
-			float fTotalWeight = 0.0f;
-			for ( k = 0 ; k < iNumWeights ; k++ )
-			{
-				int		iBoneIndex	= G2_GetVertBoneIndex( v, k );
-				float	fBoneWeight	= G2_GetVertBoneWeight( v, k, fTotalWeight, iNumWeights );
+		// the fourth lane lands where S goes and is written over
+		_mm_storeu_ps( out, _mm_mul_ps( tempVert, vScale ) );
+		out[3] = pTexCoords[j].texCoords[0];
+		out[4] = pTexCoords[j].texCoords[1];
+		out += 5;
+	}
+}
+#endif // G2_SIMD
 
-				const mdxaBone_t &bone=EvalBoneCache(piBoneReferences[iBoneIndex],boneCache);
+static const g2SkinKernel_t g2SkinKernels[] =
+{
+	{ "scalar", G2_SkinSurface_Scalar },
+#ifdef G2_SIMD
+	{ "sse", G2_SkinSurface_SSE },
+#endif
+};
 
-				tempVert[0] += fBoneWeight * ( DotProduct( bone.matrix[0], v->vertCoords ) + bone.matrix[0][3] );
-				tempVert[1] += fBoneWeight * ( DotProduct( bone.matrix[1], v->vertCoords ) + bone.matrix[1][3] );
-				tempVert[2] += fBoneWeight * ( DotProduct( bone.matrix[2], v->vertCoords ) + bone.matrix[2][3] );
+typedef struct g2SkinJob_s
+{
+	const g2SkinKernel_t	*kernel;
+	SSkinnedLod				*skin;
+} g2SkinJob_t;
 
-				tempNormal[0] += fBoneWeight * DotProduct( bone.matrix[0], v->normal );
-				tempNormal[1] += fBoneWeight * DotProduct( bone.matrix[1], v->normal );
-				tempNormal[2] += fBoneWeight * DotProduct( bone.matrix[2], v->normal );
-			}
+static void G2_ClearBounds(g2Bounds_t &bounds)
+{
+	VectorSet(bounds.mins, 999999.0f, 999999.0f, 999999.0f);
+	VectorSet(bounds.maxs, -999999.0f, -999999.0f, -999999.0f);
+}
+
+static void G2_AddBounds(g2Bounds_t &bounds, const g2Bounds_t &add)
+{
+	AddPointToBounds(add.mins, bounds.mins, bounds.maxs);
+	AddPointToBounds(add.maxs, bounds.mins, bounds.maxs);
+}
+
+static void G2_InflateBounds(g2Bounds_t &bounds)
+{
+	int		i;
+
+	for (i=0;i<3;i++)
+	{
+		const float	epsilon = G2_BOUNDS_EPSILON + 0.0001f * Q_max(fabs(bounds.mins[i]), fabs(bounds.maxs[i]));
+
+		bounds.mins[i] -= epsilon;
+		bounds.maxs[i] += epsilon;
+	}
+}
+
+static void R_TransformEachSurface( void *data, int index )
+{
+	const g2SkinJob_t	*job = (const g2SkinJob_t *)data;
+	SSkinnedLod			*skin = job->skin;
+	const mdxmSurface_t	*surface = skin->surfaces[index];
+	const float			*verts = skin->verts.data() + skin->offsets[index];
+	const mdxmTriangle_t *tris = (const mdxmTriangle_t *)((const byte *)surface + surface->ofsTriangles);
+	g2Bounds_t			*run = skin->runs.data() + skin->firstRun[index];
+	int					j, k;
 
-			// copy tranformed verts into temp space
-			TransformedVerts[pos++] = tempVert[0];
-			TransformedVerts[pos++] = tempVert[1];
-			TransformedVerts[pos++] = tempVert[2];
-			// we will need the S & T coors too for hitlocation and hitmaterial stuff
-			TransformedVerts[pos++] = pTexCoords[j].texCoords[0];
-			TransformedVerts[pos++] = pTexCoords[j].texCoords[1];
+	job->kernel->skin( surface, skin->bones.data(), skin->scale, skin->verts.data() + skin->offsets[index] );
 
-			v++;// = (mdxmVertex_t *)&v->weights[/*v->numWeights*/surface->maxVertBoneWeights];
+	G2_ClearBounds(skin->bounds[index]);
+	for ( j = 0; j < surface->numTriangles; j++ )
+	{
+		if (!(j % G2_TRACE_RUN))
+		{
+			if (j)
+			{
+				G2_AddBounds(skin->bounds[index], *run);
+				G2_InflateBounds(*run++);
+			}
+			G2_ClearBounds(*run);
 		}
+		for ( k = 0; k < 3; k++ )
+		{
+			AddPointToBounds(&verts[tris[j].indexes[k] * 5], run->mins, run->maxs);
+		}
+	}
+	if (j)
+	{
+		G2_AddBounds(skin->bounds[index], *run);
+		G2_InflateBounds(*run);
 	}
+	G2_InflateBounds(skin->bounds[index]);
 }
 
-void G2_TransformSurfaces(int surfaceNum, surfaceInfo_v &rootSList,
-					CBoneCache *boneCache, const model_t *currentModel, int lod, vec3_t scale, IHeapAllocator *G2VertSpace, size_t *TransformedVertArray, bool secondTimeAround)
+typedef struct g2SurfaceWalk_s
+{
+	int		surfaceNum;
+	int		slot;		// where the surface is in the list, -1 when it is off
+	int		end;		// one past the last surface under this one
+} g2SurfaceWalk_t;
+
+static void G2_TransformSurfaces(int surfaceNum, surfaceInfo_v &rootSList, const model_t *currentModel, int lod, std::vector<const mdxmSurface_t *> &surfaces, std::vector<g2SurfaceWalk_t> &walk)
 {
 	int	i;
 	assert(currentModel);
@@ -518,23 +701,132 @@ void G2_TransformSurfaces(int surfaceNum, surfaceInfo_v &rootSList,
 	{
 		offFlags = surfOverride->offFlags;
 	}
-	// if this surface is not off, add it to the shader render list
+	// if this surface is not off, add it to the list to transform
 	if (!offFlags)
 	{
-
-		R_TransformEachSurface(surface, scale, G2VertSpace, TransformedVertArray, boneCache);
+		surfaces.push_back(surface);
 	}
 
+	const int w = (int)walk.size();
+	walk.push_back(g2SurfaceWalk_t());
+	walk[w].surfaceNum = surfaceNum;
+	walk[w].slot = offFlags ? -1 : (int)surfaces.size() - 1;
+
 	// if we are turning off all descendants, then stop this recursion now
-	if (offFlags & G2SURFACEFLAG_NODESCENDANTS)
+	if (!(offFlags & G2SURFACEFLAG_NODESCENDANTS))
 	{
-		return;
+		// now recursively call for the children
+		for (i=0; i< surfInfo->numChildren; i++)
+		{
+			G2_TransformSurfaces(surfInfo->childIndexes[i], rootSList, currentModel, lod, surfaces, walk);
+		}
 	}
+	walk[w].end = (int)walk.size();
+}
 
-	// now recursively call for the children
-	for (i=0; i< surfInfo->numChildren; i++)
+/*
+==============
+G2_SkinModel
+
+Skins the surfaces of one instance at a LOD, unless its skin cache already
+holds them for the same bones, scale and surfaces
+==============
+*/
+static void G2_SkinModel(CGhoul2Info &g, int lod, const vec3_t scale, size_t *TransformedVertsArray)
+{
+	static std::vector<const mdxmSurface_t *>	surfaces;
+	static std::vector<g2SurfaceWalk_t>			walk;
+	static std::vector<mdxaBone_t>				bones;
+	CSkinCache		*&cache = BoneCacheSkin(g.mBoneCache);
+	int				i, j, numVerts, numRuns;
+
+	surfaces.clear();
+	walk.clear();
+	G2_TransformSurfaces(g.mSurfaceRoot, g.mSlist, g.currentModel, lod, surfaces, walk);
+
+	// bring every bone up to date here, the workers only read them
+	EvalBoneCacheAll(g.mBoneCache);
+	bones.resize(g.aHeader->numBones);
+	for (i=0;i<(int)bones.size();i++)
+	{
+		bones[i]=EvalBoneCache(i, g.mBoneCache);
+	}
+
+	if (!cache)
+	{
+		cache = new CSkinCache;
+		cache->mLods.resize(Q_max(g.currentModel->mdxm->numLODs, lod+1));
+	}
+	if ((int)cache->mLods.size()<=lod)
 	{
-		G2_TransformSurfaces(surfInfo->childIndexes[i], rootSList, boneCache, currentModel, lod, scale, G2VertSpace, TransformedVertArray, secondTimeAround);
+		cache->mLods.resize(lod+1);
+	}
+	SSkinnedLod &skin = cache->mLods[lod];
+	if (!skin.mod)
+	{
+		// first time at this LOD
+		G2_ReserveSkinnedLod(skin, g.currentModel, g.aHeader->numBones, lod);
+	}
+
+	if (!r_ghoul2SkinCache || !r_ghoul2SkinCache->integer
+		|| skin.mod != g.currentModel
+		|| memcmp(skin.scale, scale, sizeof(vec3_t))
+		|| skin.surfaces.size() != surfaces.size()
+		|| !std::equal(surfaces.begin(), surfaces.end(), skin.surfaces.begin())
+		|| skin.bones.size() != bones.size()
+		|| memcmp(skin.bones.data(), bones.data(), bones.size() * sizeof(mdxaBone_t)))
+	{
+		skin.mod = g.currentModel;
+		VectorCopy(scale, skin.scale);
+		skin.bones.assign(bones.begin(), bones.end());
+		skin.surfaces.assign(surfaces.begin(), surfaces.end());
+
+		skin.offsets.resize(skin.surfaces.size());
+		skin.firstRun.resize(skin.surfaces.size());
+		skin.slots.assign(g.currentModel->mdxm->numSurfaces, -1);
+		for (i=0, numVerts=0, numRuns=0;i<(int)skin.surfaces.size();i++)
+		{
+			skin.offsets[i] = numVerts * 5;
+			numVerts += skin.surfaces[i]->numVerts;
+			skin.firstRun[i] = numRuns;
+			numRuns += (skin.surfaces[i]->numTriangles + G2_TRACE_RUN - 1) / G2_TRACE_RUN;
+			skin.slots[skin.surfaces[i]->thisSurfaceIndex] = i;
+		}
+		skin.verts.resize(numVerts * 5);
+		skin.bounds.resize(skin.surfaces.size());
+		skin.runs.resize(numRuns);
+
+		g2SkinJob_t job;
+		job.kernel = &g2SkinKernels[ARRAY_LEN(g2SkinKernels)-1];
+		job.skin = &skin;
+		ri.ParallelFor( numVerts >= SKIN_PARALLEL_VERTS && r_ghoul2SkinThreads ? r_ghoul2SkinThreads->integer : 1,
+			(int)skin.surfaces.size(), R_TransformEachSurface, &job );
+	}
+
+	for (i=0;i<(int)skin.surfaces.size();i++)
+	{
+		TransformedVertsArray[skin.surfaces[i]->thisSurfaceIndex] = (size_t)(skin.verts.data() + skin.offsets[i]);
+	}
+	skin.vertsArray = TransformedVertsArray;
+
+	// the walk can differ with the same surfaces on, so these are redone every time
+	skin.subtrees.resize(g.currentModel->mdxm->numSurfaces);
+	for (i=0;i<(int)skin.subtrees.size();i++)
+	{
+		G2_ClearBounds(skin.subtrees[i]);
+	}
+	for (i=0;i<(int)walk.size();i++)
+	{
+		g2Bounds_t &subtree = skin.subtrees[walk[i].surfaceNum];
+
+		G2_ClearBounds(subtree);
+		for (j=i;j<walk[i].end;j++)
+		{
+			if (walk[j].slot != -1)
+			{
+				G2_AddBounds(subtree, skin.bounds[walk[j].slot]);
+			}
+		}
 	}
 }
 
@@ -629,9 +921,8 @@ void G2_TransformModel(CGhoul2Info_v &ghoul2, const int frameNum, vec3_t scale,
 		memset(g.mTransformedVertsArray, 0, g.currentModel->mdxm->numSurfaces * sizeof (size_t));
 
 		G2_FindOverrideSurface(-1,g.mSlist); //reset the quick surface override lookup;
-		// recursively call the model surface transform
-
-		G2_TransformSurfaces(g.mSurfaceRoot, g.mSlist, g.mBoneCache,  g.currentModel, lod, correctScale, G2VertSpace, g.mTransformedVertsArray, false);
+		// skin the surfaces that are on, or pick them up from the skin cache
+		G2_SkinModel(g, lod, correctScale, g.mTransformedVertsArray);
 
 #ifdef _G2_GORE
 		if (ApplyGore && firstModelOnly)
@@ -1064,6 +1355,144 @@ struct SVertexTemp
 static SVertexTemp GoreVerts[MAX_GORE_VERTS];
 #endif
 
+/*
+==============
+Trace culling
+
+A point trace can only hit a triangle its segment goes through, so
+nothing in a box the segment misses can be hit. A radius trace drops a
+triangle when all three verts are outside the same side of the box around
+the ray, so a box that is all outside one side can be skipped.
+==============
+*/
+static int		g2TraceTris;		// triangles tested, for g2tracebench
+
+static bool G2_SegmentHitsBounds(const vec3_t start, const vec3_t end, const g2Bounds_t &bounds)
+{
+	float	tmin = 0.0f, tmax = 1.0f;
+	int		i;
+
+	for (i=0;i<3;i++)
+	{
+		const float d = end[i] - start[i];
+
+		if (fabs(d) < 1E-10f)
+		{
+			if (start[i] < bounds.mins[i] || start[i] > bounds.maxs[i])
+			{
+				return false;
+			}
+			continue;
+		}
+
+		float t0 = (bounds.mins[i] - start[i]) / d;
+		float t1 = (bounds.maxs[i] - start[i]) / d;
+		if (t0 > t1)
+		{
+			const float t = t0;
+			t0 = t1;
+			t1 = t;
+		}
+		if (t0 > tmin)
+		{
+			tmin = t0;
+		}
+		if (t1 < tmax)
+		{
+			tmax = t1;
+		}
+		if (tmin > tmax)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool G2_RadiusHitsBounds(const CTraceSurface &TS, const g2Bounds_t &bounds)
+{
+	vec3_t	center, extents;
+	int		i;
+
+	for (i=0;i<3;i++)
+	{
+		center[i] = (bounds.mins[i] + bounds.maxs[i]) * 0.5f - TS.rayStart[i];
+		extents[i] = (bounds.maxs[i] - bounds.mins[i]) * 0.5f;
+	}
+	for (i=0;i<3;i++)
+	{
+		const float *axis = TS.radiusAxes[i];
+		const float mid = DotProduct(center, axis) + (i < 2 ? 0.5f : 0.0f);
+		const float radius = fabs(axis[0]) * extents[0] + fabs(axis[1]) * extents[1] + fabs(axis[2]) * extents[2];
+
+		// every vert in here would fail the same test
+		if (mid + radius <= 0.0f || mid - radius >= 1.0f)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool G2_TraceHitsBounds(const CTraceSurface &TS, const g2Bounds_t &bounds)
+{
+	if (bounds.mins[0] > bounds.maxs[0])
+	{
+		return false;
+	}
+	if (!(fabs(TS.m_fRadius) < 0.1))
+	{
+		return G2_RadiusHitsBounds(TS, bounds);
+	}
+	return G2_SegmentHitsBounds(TS.rayStart, TS.rayEnd, bounds);
+}
+
+// the boxes of the runs of triangles of a surface, NULL to test them all
+static const g2Bounds_t *G2_TraceRuns(const mdxmSurface_t *surface, const CTraceSurface &TS)
+{
+	if (!TS.cull)
+	{
+		return NULL;
+	}
+	return TS.cull->runs.data() + TS.cull->firstRun[TS.cull->slots[surface->thisSurfaceIndex]];
+}
+
+/*
+==============
+G2_TraceSkin
+
+The skinned LOD whose boxes go with the verts the instance is about to
+be traced against, or NULL if they can't be trusted
+==============
+*/
+static const SSkinnedLod *G2_TraceSkin(CGhoul2Info &g, int lod)
+{
+	int		i;
+
+	if (!r_ghoul2TraceCull || !r_ghoul2TraceCull->integer || !g.mBoneCache || !g.mTransformedVertsArray)
+	{
+		return NULL;
+	}
+	const CSkinCache *cache = BoneCacheSkin(g.mBoneCache);
+	if (!cache || lod < 0 || lod >= (int)cache->mLods.size())
+	{
+		return NULL;
+	}
+	const SSkinnedLod &skin = cache->mLods[lod];
+	if (skin.vertsArray != g.mTransformedVertsArray || skin.mod != g.currentModel || skin.surfaces.empty())
+	{
+		return NULL;
+	}
+	for (i=0;i<(int)skin.surfaces.size();i++)
+	{
+		if (g.mTransformedVertsArray[skin.surfaces[i]->thisSurfaceIndex] != (size_t)(skin.verts.data() + skin.offsets[i]))
+		{
+			return NULL;
+		}
+	}
+	return &skin;
+}
+
 // now we're at poly level, check each model space transformed poly against the model world transfomed ray
 static bool G2_TracePolys(const mdxmSurface_t *surface, const mdxmSurfHierarchy_t *surfInfo, CTraceSurface &TS)
 {
@@ -1072,9 +1501,18 @@ static bool G2_TracePolys(const mdxmSurface_t *surface, const mdxmSurfHierarchy_
 	// whip through and actually transform each vertex
 	const mdxmTriangle_t *tris = (mdxmTriangle_t *) ((byte *)surface + surface->ofsTriangles);
 	const float *verts = (float *)TS.TransformedVertsArray[surface->thisSurfaceIndex];
+	const g2Bounds_t *runs = G2_TraceRuns(surface, TS);
 	numTris = surface->numTriangles;
 	for ( j = 0; j < numTris; j++ )
 	{
+		// skip the runs of triangles the ray doesn't go near
+		if (runs && !(j % G2_TRACE_RUN) && !G2_SegmentHitsBounds(TS.rayStart, TS.rayEnd, runs[j / G2_TRACE_RUN]))
+		{
+			j += G2_TRACE_RUN - 1;
+			continue;
+		}
+		g2TraceTris++;
+
 		float			face;
 		vec3_t	hitPoint, normal;
 		// determine actual coords for this triangle
@@ -1195,22 +1633,27 @@ static bool G2_TracePolys(const mdxmSurface_t *surface, const mdxmSurfHierarchy_
 }
 
 // now we're at poly level, check each model space transformed poly against the model world transfomed ray
-static bool G2_RadiusTracePolys(
-								const mdxmSurface_t *surface,
-								CTraceSurface &TS
-								)
+/*
+==============
+G2_RadiusTraceAxes
+
+Sets up the axes G2_RadiusTracePolys classifies the verts along. The
+first two span the sides of the box around the ray, the third runs along
+it, scaled so the box is 0 to 1 on each of them
+==============
+*/
+static void G2_RadiusTraceAxes(CTraceSurface &TS)
 {
-	int		j;
 	vec3_t basis1;
 	vec3_t basis2;
-	vec3_t taxis;
-	vec3_t saxis;
+	float *saxis = TS.radiusAxes[0];
+	float *taxis = TS.radiusAxes[1];
+	float *v3RayDir = TS.radiusAxes[2];
 
 	basis2[0]=0.0f;
 	basis2[1]=0.0f;
 	basis2[2]=1.0f;
 
-	vec3_t v3RayDir;
 	VectorSubtract(TS.rayEnd, TS.rayStart, v3RayDir);
 
 	CrossProduct(v3RayDir,basis2,basis1);
@@ -1240,15 +1683,27 @@ static bool G2_RadiusTracePolys(
 	VectorScale(basis1,-0.5f * s /TS.m_fRadius,saxis);
 	VectorMA(    saxis, 0.5f * c /TS.m_fRadius,basis2,saxis);
 
-	const float * const verts = (float *)TS.TransformedVertsArray[surface->thisSurfaceIndex];
-	const int numVerts = surface->numVerts;
-
-	int flags=63;
 	//rayDir/=lengthSquared(raydir);
 	const float f = VectorLengthSquared(v3RayDir);
 	v3RayDir[0]/=f;
 	v3RayDir[1]/=f;
 	v3RayDir[2]/=f;
+}
+
+static bool G2_RadiusTracePolys(
+								const mdxmSurface_t *surface,
+								CTraceSurface &TS
+								)
+{
+	int		j;
+	const float *saxis = TS.radiusAxes[0];
+	const float *taxis = TS.radiusAxes[1];
+	const float *v3RayDir = TS.radiusAxes[2];
+
+	const float * const verts = (float *)TS.TransformedVertsArray[surface->thisSurfaceIndex];
+	const int numVerts = surface->numVerts;
+
+	int flags=63;
 
 	for ( j = 0; j < numVerts; j++ )
 	{
@@ -1298,9 +1753,18 @@ static bool G2_RadiusTracePolys(
 	}
 	const int numTris = surface->numTriangles;
 	const mdxmTriangle_t * const tris = (mdxmTriangle_t *) ((byte *)surface + surface->ofsTriangles);
+	const g2Bounds_t *runs = G2_TraceRuns(surface, TS);
 
 	for ( j = 0; j < numTris; j++ )
 	{
+		// skip the runs of triangles that are all outside the same side
+		if (runs && !(j % G2_TRACE_RUN) && !G2_RadiusHitsBounds(TS, runs[j / G2_TRACE_RUN]))
+		{
+			j += G2_TRACE_RUN - 1;
+			continue;
+		}
+		g2TraceTris++;
+
 		assert(tris[j].indexes[0]>=0&&tris[j].indexes[0]<numVerts);
 		assert(tris[j].indexes[1]>=0&&tris[j].indexes[1]<numVerts);
 		assert(tris[j].indexes[2]>=0&&tris[j].indexes[2]<numVerts);
@@ -1420,6 +1884,12 @@ static void G2_TraceSurfaces(CTraceSurface &TS)
 		return;
 	}
 
+	// nothing that is on here or further down is in reach
+	if (TS.cull && !G2_TraceHitsBounds(TS, TS.cull->subtrees[TS.surfaceNum]))
+	{
+		return;
+	}
+
 	// really, we should use the default flags for this surface unless it's been overriden
 	int offFlags = surfInfo->flags;
 
@@ -1430,7 +1900,7 @@ static void G2_TraceSurfaces(CTraceSurface &TS)
 	}
 
 	// if this surface is not off, try to hit it
-	if (!offFlags)
+	if (!offFlags && (!TS.cull || G2_TraceHitsBounds(TS, TS.cull->bounds[TS.cull->slots[surface->thisSurfaceIndex]])))
 	{
 #ifdef _G2_GORE
 		if (TS.collRecMap)
@@ -1568,6 +2038,14 @@ void G2_TraceModels(CGhoul2Info_v &ghoul2, vec3_t rayStart, vec3_t rayEnd, Colli
 #else
 		CTraceSurface TS(ghoul2[i].mSurfaceRoot, ghoul2[i].mSlist,  (model_t *)ghoul2[i].currentModel, lod, rayStart, rayEnd, collRecMap, entNum, i, skin, cust_shader, ghoul2[i].mTransformedVertsArray, eG2TraceType, fRadius);
 #endif
+		if (!(fabs(fRadius) < 0.1))
+		{
+			G2_RadiusTraceAxes(TS);
+		}
+		if (collRecMap)
+		{
+			TS.cull = G2_TraceSkin(ghoul2[i], lod);
+		}
 		// start the surface recursion loop
 		G2_TraceSurfaces(TS);
 
@@ -1586,6 +2064,133 @@ void G2_TraceModels(CGhoul2Info_v &ghoul2, vec3_t rayStart, vec3_t rayEnd, Colli
 	}
 }
 
+/*
+==============
+G2_TraceBenchmark_f
+
+Fires random rays and swept spheres at a model while it animates, first
+testing every triangle and then with the boxes, and checks that both give
+the same collision records
+==============
+*/
+#define TRACEBENCH_FRAMES	16
+#define TRACEBENCH_RADIUS	4.0f
+
+typedef struct g2BenchTrace_s
+{
+	vec3_t		start;
+	vec3_t		end;
+	float		radius;
+	int			traceFlags;
+	int			time;
+} g2BenchTrace_t;
+
+static int64_t G2_TraceBenchmarkClock(void)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+void G2_TraceBenchmark_f(void)
+{
+	const char		*name = ri.Cmd_Argc() > 1 ? ri.Cmd_Argv(1) : "models/players/kyle/model.glm";
+	const int		numTraces = ri.Cmd_Argc() > 2 ? Com_Clampi(1, 1000000, atoi(ri.Cmd_Argv(2))) : 10000;
+	CGhoul2Info_v	*ghoul2 = NULL;
+	vec3_t			angles, origin, scale, center, size;
+	CollisionRecord_t	records[MAX_G2_COLLISIONS];
+	int64_t			nsec[2], tris[2];
+	char			oldCull[MAX_CVAR_VALUE_STRING];
+	int				pass, i, j, numHits = 0, numBad = 0;
+
+	if (G2API_InitGhoul2Model(&ghoul2, name, 0, 0, -20, 0, 0) < 0 || !ghoul2 || !ghoul2->IsValid())
+	{
+		ri.Printf( PRINT_ALL, "g2tracebench: couldn't load model %s\n", name);
+		G2API_CleanGhoul2Models(&ghoul2);
+		return;
+	}
+	CGhoul2Info &g = (*ghoul2)[0];
+	G2API_SetBoneAnim(*ghoul2, 0, "model_root", 0, g.aHeader->numFrames, BONE_ANIM_OVERRIDE_LOOP, 1.0f, 0);
+
+	VectorClear(angles);
+	VectorClear(origin);
+	VectorClear(scale);
+
+	// aim at the box around the whole model
+	memset(records, 0, sizeof(records));
+	vec3_t probe = { 0.0f, 0.0f, 0.0f };
+	G2API_CollisionDetect(records, *ghoul2, angles, origin, 0, 0, probe, probe, scale, ri.GetG2VertSpaceServer(), G2_COLLIDE, 0, 0.0f);
+	const g2Bounds_t &bounds = BoneCacheSkin(g.mBoneCache)->mLods[G2_DecideTraceLod(g, 0)].subtrees[g.mSurfaceRoot];
+	VectorAdd(bounds.mins, bounds.maxs, center);
+	VectorScale(center, 0.5f, center);
+	VectorSubtract(bounds.maxs, bounds.mins, size);
+	if (size[0] < 0.0f)
+	{
+		ri.Printf( PRINT_ALL, "g2tracebench: %s has no surfaces to hit\n", name);
+		G2API_CleanGhoul2Models(&ghoul2);
+		return;
+	}
+
+	std::vector<g2BenchTrace_t> traces(numTraces);
+	std::vector<CollisionRecord_t> expected(numTraces * MAX_G2_COLLISIONS);
+	srand(numTraces);
+	for (i=0;i<numTraces;i++)
+	{
+		g2BenchTrace_t &t = traces[i];
+		vec3_t target, dir;
+
+		for (j=0;j<3;j++)
+		{
+			target[j] = center[j] + size[j] * (rand() / (float)RAND_MAX - 0.5f);
+			dir[j] = rand() / (float)RAND_MAX - 0.5f;
+		}
+		VectorNormalize(dir);
+		VectorMA(target, VectorLength(size), dir, t.start);
+		VectorMA(target, -VectorLength(size), dir, t.end);
+		t.radius = (i & 1) ? TRACEBENCH_RADIUS : 0.0f;
+		t.traceFlags = (i & 2) ? G2_RETURNONHIT : G2_COLLIDE;
+		t.time = (i * TRACEBENCH_FRAMES / numTraces) * 250;
+	}
+
+	Q_strncpyz(oldCull, r_ghoul2TraceCull->string, sizeof(oldCull));
+	for (pass=0;pass<2;pass++)
+	{
+		ri.Cvar_Set("r_ghoul2tracecull", pass ? "1" : "0");
+		g2TraceTris = 0;
+
+		const int64_t start = G2_TraceBenchmarkClock();
+		for (i=0;i<numTraces;i++)
+		{
+			g2BenchTrace_t &t = traces[i];
+			CollisionRecord_t *collRecMap = pass ? records : &expected[i * MAX_G2_COLLISIONS];
+
+			memset(collRecMap, 0, sizeof(records));
+			for (j=0;j<MAX_G2_COLLISIONS;j++)
+			{
+				collRecMap[j].mEntityNum = -1;
+			}
+			G2API_CollisionDetect(collRecMap, *ghoul2, angles, origin, t.time, 0, t.start, t.end, scale, ri.GetG2VertSpaceServer(), t.traceFlags, 0, t.radius);
+			if (pass)
+			{
+				numHits += records[0].mEntityNum != -1;
+				numBad += memcmp(records, &expected[i * MAX_G2_COLLISIONS], sizeof(records)) != 0;
+			}
+		}
+		nsec[pass] = G2_TraceBenchmarkClock() - start;
+		tris[pass] = g2TraceTris;
+	}
+	ri.Cvar_Set("r_ghoul2tracecull", oldCull);
+
+	ri.Printf( PRINT_ALL, "%s: %d traces, %d hit\n", name, numTraces, numHits);
+	for (pass=0;pass<2;pass++)
+	{
+		ri.Printf( PRINT_ALL, "%-9s: %8.1f triangles per trace, %8.2f usec per trace\n", pass ? "culled" : "unculled",
+			(double)tris[pass] / numTraces, nsec[pass] / 1000.0 / numTraces);
+	}
+	ri.Printf( PRINT_ALL, "%d traces with different collision records %s\n", numBad, numBad ? S_COLOR_RED "FAILED" : "ok");
+
+	G2API_CleanGhoul2Models(&ghoul2);
+}
+
 void TransformPoint (const vec3_t in, vec3_t out, mdxaBone_t *mat) {
 	for (int i=0;i<3;i++)
 	{
@@ -183,6 +183,10 @@ cvar_t	*r_noPrecacheGLA;
 #endif
 
 cvar_t	*r_noServerGhoul2;
+cvar_t	*r_ghoul2BatchBones;
+cvar_t	*r_ghoul2SkinCache;
+cvar_t	*r_ghoul2SkinThreads;
+cvar_t	*r_ghoul2TraceCull;
 cvar_t	*r_Ghoul2AnimSmooth=0;
 cvar_t	*r_Ghoul2UnSqashAfterSmooth=0;
 //cvar_t	*r_Ghoul2UnSqash;
@@ -1226,6 +1226,10 @@ extern	cvar_t	*r_noPrecacheGLA;
 #endif
 
 extern	cvar_t	*r_noServerGhoul2;
+extern	cvar_t	*r_ghoul2BatchBones;
+extern	cvar_t	*r_ghoul2SkinCache;
+extern	cvar_t	*r_ghoul2SkinThreads;
+extern	cvar_t	*r_ghoul2TraceCull;
 /*
 Ghoul2 Insert End
 */
@@ -1334,6 +1338,9 @@ qboolean	RE_RegisterModels_LevelLoadEnd(qboolean bDeleteEverythingNotUsedThisLev
 void*		RE_RegisterModels_Malloc(int iSize, void *pvDiskBufferIfJustLoaded, const char *psModelFileName, qboolean *pqbAlreadyFound, memtag_t eTag);
 void		RE_RegisterModels_StoreShaderRequest(const char *psModelFileName, const char *psShaderName, int *piShaderIndexPoke);
 void		RE_RegisterModels_Info_f(void);
+void		G2_BoneBenchmark_f(void);
+void		G2_TraceBenchmark_f(void);
+void		G2_PoolStress_f(void);
 //
 qboolean	RE_RegisterImages_LevelLoadEnd(void);
 void		RE_RegisterImages_Info_f(void);
@@ -1549,6 +1549,17 @@ static qboolean R_LoadMD3 (model_t *mod, int lod, void *buffer, const char *mod_
 
 void R_SVModelInit()
 {
+	if (!r_ghoul2BatchBones)
+	{ //the server never runs R_Register, but it is the one doing most of the bone work
+		r_ghoul2BatchBones = ri.Cvar_Get( "r_ghoul2batchbones", "1", CVAR_ARCHIVE_ND, "" );
+		r_ghoul2SkinCache = ri.Cvar_Get( "r_ghoul2skincache", "1", CVAR_ARCHIVE_ND, "" );
+		r_ghoul2SkinThreads = ri.Cvar_Get( "r_ghoul2skinthreads", "1", CVAR_ARCHIVE_ND, "" );
+		r_ghoul2TraceCull = ri.Cvar_Get( "r_ghoul2tracecull", "1", CVAR_ARCHIVE_ND, "" );
+		ri.Cmd_AddCommand( "g2bonebench", G2_BoneBenchmark_f, "Time and check the ghoul2 bone level kernels on a GLA" );
+		ri.Cmd_AddCommand( "g2tracebench", G2_TraceBenchmark_f, "Time and check ghoul2 collision traces with and without box culling" );
+		ri.Cmd_AddCommand( "g2poolstress", G2_PoolStress_f, "Spawn and free ghoul2 instances to time the instance pool" );
+	}
+
 	R_ModelInit();
 }
 
@@ -28,7 +28,7 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 #include "tr_local.h"
 
 #include <set>
-#include <list>
+#include <chrono>
 
 #ifdef _FULL_G2_LEAK_CHECKING
 int g_Ghoul2Allocations = 0;
@@ -293,6 +293,157 @@ qboolean G2API_OverrideServerWithClientData(CGhoul2Info_v& ghoul2, int modelInde
 #endif
 }
 
+/*
+==============
+Ghoul2 pool
+
+The bone, bolt and surface override lists of every instance, the model
+lists of the instance slots and the instance handles are carved out of a
+few big chunks instead of each getting its own heap block. A block is
+rounded up to a power of two and goes back on the free list of its size
+when the vector lets go of it, so once the pool has seen the high water
+mark spawning and freeing instances doesn't touch the heap, and the lists
+of live instances sit side by side. Lists bigger than the biggest size
+get their own allocation.
+==============
+*/
+#define G2_POOL_CHUNK		(1024*1024)
+#define G2_POOL_MIN_SHIFT	4			// 16 bytes
+#define G2_POOL_MAX_SHIFT	17			// 128KB
+#define G2_POOL_CLASSES		(G2_POOL_MAX_SHIFT-G2_POOL_MIN_SHIFT+1)
+
+typedef struct g2PoolBlock_s
+{
+	struct g2PoolBlock_s	*next;
+} g2PoolBlock_t;
+
+typedef struct g2Pool_s
+{
+	g2PoolBlock_t	*chunks;					// linked through their first bytes
+	byte			*top;						// what's left of the newest chunk
+	byte			*end;
+	g2PoolBlock_t	*free[G2_POOL_CLASSES];
+	int				numChunks;
+	int				numLive[G2_POOL_CLASSES];
+	int				numBig;						// live blocks too big for a class
+	int				numHeapAllocs;				// every allocation the pool made, chunks and big blocks
+	size_t			liveBytes;					// what the live blocks asked for
+} g2Pool_t;
+
+static g2Pool_t g2Pool;
+
+static int G2_PoolClass(size_t size)
+{
+	int		c = 0;
+
+	while (((size_t)1 << (G2_POOL_MIN_SHIFT + c)) < size)
+	{
+		c++;
+	}
+	return c;
+}
+
+void *G2_PoolAlloc(size_t size)
+{
+	g2PoolBlock_t	*block;
+	int				c;
+
+	g2Pool.liveBytes += size;
+	if (size > ((size_t)1 << G2_POOL_MAX_SHIFT))
+	{
+		g2Pool.numBig++;
+		g2Pool.numHeapAllocs++;
+		return Z_Malloc((int)size, TAG_GHOUL2, qfalse);
+	}
+
+	c = G2_PoolClass(size);
+	g2Pool.numLive[c]++;
+	block = g2Pool.free[c];
+	if (block)
+	{
+		g2Pool.free[c] = block->next;
+		return block;
+	}
+
+	const size_t blockSize = (size_t)1 << (G2_POOL_MIN_SHIFT + c);
+	if ((size_t)(g2Pool.end - g2Pool.top) < blockSize)
+	{
+		int		i;
+
+		// hand out the tail of the old chunk before starting a new one
+		for (i=G2_POOL_CLASSES-1;i>=0;i--)
+		{
+			const size_t tailSize = (size_t)1 << (G2_POOL_MIN_SHIFT + i);
+			while ((size_t)(g2Pool.end - g2Pool.top) >= tailSize)
+			{
+				block = (g2PoolBlock_t *)g2Pool.top;
+				block->next = g2Pool.free[i];
+				g2Pool.free[i] = block;
+				g2Pool.top += tailSize;
+			}
+		}
+
+		block = (g2PoolBlock_t *)Z_Malloc(G2_POOL_CHUNK, TAG_GHOUL2, qfalse);
+		block->next = g2Pool.chunks;
+		g2Pool.chunks = block;
+		g2Pool.numChunks++;
+		g2Pool.numHeapAllocs++;
+		// keep the blocks 16 byte aligned past the link
+		g2Pool.top = (byte *)block + (1 << G2_POOL_MIN_SHIFT);
+		g2Pool.end = (byte *)block + G2_POOL_CHUNK;
+	}
+	block = (g2PoolBlock_t *)g2Pool.top;
+	g2Pool.top += blockSize;
+	return block;
+}
+
+void G2_PoolFree(void *ptr, size_t size)
+{
+	g2PoolBlock_t	*block = (g2PoolBlock_t *)ptr;
+	int				c;
+
+	if (!ptr)
+	{
+		return;
+	}
+	g2Pool.liveBytes -= size;
+	if (size > ((size_t)1 << G2_POOL_MAX_SHIFT))
+	{
+		g2Pool.numBig--;
+		Z_Free(ptr);
+		return;
+	}
+
+	c = G2_PoolClass(size);
+	assert(g2Pool.numLive[c] > 0);
+	g2Pool.numLive[c]--;
+	block->next = g2Pool.free[c];
+	g2Pool.free[c] = block;
+}
+
+// the chunks can only go once nothing in them is in use any more
+static void G2_PoolRelease(void)
+{
+	int		i;
+
+	for (i=0;i<G2_POOL_CLASSES;i++)
+	{
+		if (g2Pool.numLive[i])
+		{
+			return;
+		}
+	}
+	while (g2Pool.chunks)
+	{
+		g2PoolBlock_t *next = g2Pool.chunks->next;
+		Z_Free(g2Pool.chunks);
+		g2Pool.chunks = next;
+	}
+	g2Pool.top = g2Pool.end = NULL;
+	g2Pool.numChunks = 0;
+	memset(g2Pool.free, 0, sizeof(g2Pool.free));
+}
+
 // must be a power of two
 #define MAX_G2_MODELS (1024)
 #define G2_MODEL_BITS (10)
@@ -393,9 +544,24 @@ static size_t DeserializeGhoul2Info ( const char *buffer, CGhoul2Info& g2Info )
 
 class Ghoul2InfoArray : public IGhoul2InfoArray
 {
-	std::vector<CGhoul2Info>	mInfos[MAX_G2_MODELS];
-	int					mIds[MAX_G2_MODELS];
-	std::list<int>			mFreeIndecies;
+	ghoul2Info_v		mInfos[MAX_G2_MODELS];
+	int					mIds[MAX_G2_MODELS];		// slot index in the low bits, generation above them
+	int					mFreeIndecies[MAX_G2_MODELS];	// ring of the free slots, New takes the front one
+	int					mFreeFront;
+	int					mNumFree;
+	void PushFreeFront(int idx)
+	{
+		assert(mNumFree<MAX_G2_MODELS);
+		mFreeFront=(mFreeFront-1)&G2_INDEX_MASK;
+		mFreeIndecies[mFreeFront]=idx;
+		mNumFree++;
+	}
+	void PushFreeBack(int idx)
+	{
+		assert(mNumFree<MAX_G2_MODELS);
+		mFreeIndecies[(mFreeFront+mNumFree)&G2_INDEX_MASK]=idx;
+		mNumFree++;
+	}
 	void DeleteLow(int idx)
 	{
 		for (size_t model=0; model< mInfos[idx].size(); model++)
@@ -412,22 +578,24 @@ class Ghoul2InfoArray : public IGhoul2InfoArray
 		if ((mIds[idx]>>G2_MODEL_BITS)>(1<<(31-G2_MODEL_BITS)))
 		{
 			mIds[idx]=MAX_G2_MODELS+idx; //rollover reset id to minimum value
-			mFreeIndecies.push_back(idx);
+			PushFreeBack(idx);
 		}
 		else
 		{
 			mIds[idx]+=MAX_G2_MODELS;
-			mFreeIndecies.push_front(idx);
+			PushFreeFront(idx);
 		}
 	}
 public:
 	Ghoul2InfoArray()
 	{
 		int i;
+		mFreeFront=0;
+		mNumFree=0;
 		for (i=0;i<MAX_G2_MODELS;i++)
 		{
 			mIds[i]=MAX_G2_MODELS+i;
-			mFreeIndecies.push_back(i);
+			PushFreeBack(i);
 		}
 	}
 
@@ -435,8 +603,8 @@ public:
 	{
 		size_t size = 0;
 
-		size += sizeof (int); // size of mFreeIndecies linked list
-		size += mFreeIndecies.size() * sizeof (int);
+		size += sizeof (int); // size of mFreeIndecies ring
+		size += mNumFree * sizeof (int);
 
 		size += sizeof (mIds);
 
@@ -458,11 +626,14 @@ public:
 		char *base = buffer;
 
 		// Free indices
-		*(int *)buffer = mFreeIndecies.size();
+		*(int *)buffer = mNumFree;
 		buffer += sizeof (int);
 
-		std::copy (mFreeIndecies.begin(), mFreeIndecies.end(), (int *)buffer);
-		buffer += sizeof (int) * mFreeIndecies.size();
+		for ( int i = 0; i < mNumFree; i++ )
+		{
+			((int *)buffer)[i] = mFreeIndecies[(mFreeFront + i) & G2_INDEX_MASK];
+		}
+		buffer += sizeof (int) * mNumFree;
 
 		// IDs
 		memcpy (buffer, mIds, sizeof (mIds));
@@ -492,7 +663,10 @@ public:
 		count = *(int *)buffer;
 		buffer += sizeof (int);
 
-		mFreeIndecies.assign ((int *)buffer, (int *)buffer + count);
+		assert (count <= MAX_G2_MODELS);
+		memcpy (mFreeIndecies, buffer, sizeof (int) * count);
+		mFreeFront = 0;
+		mNumFree = count;
 		buffer += sizeof (int) * count;
 
 		// IDs
@@ -522,20 +696,20 @@ public:
 	~Ghoul2InfoArray()
 	{
 		char mess[1000];
-		if (mFreeIndecies.size()<MAX_G2_MODELS)
+		if (mNumFree<MAX_G2_MODELS)
 		{
-			sprintf(mess,"************************\nLeaked %d ghoul2info slots\n", MAX_G2_MODELS - mFreeIndecies.size());
+			sprintf(mess,"************************\nLeaked %d ghoul2info slots\n", MAX_G2_MODELS - mNumFree);
 			OutputDebugString(mess);
 			int i;
 			for (i=0;i<MAX_G2_MODELS;i++)
 			{
-				list<int>::iterator j;
-				for (j=mFreeIndecies.begin();j!=mFreeIndecies.end();++j)
+				int j;
+				for (j=0;j<mNumFree;j++)
 				{
-					if (*j==i)
+					if (mFreeIndecies[(mFreeFront+j)&G2_INDEX_MASK]==i)
 						break;
 				}
-				if (j==mFreeIndecies.end())
+				if (j==mNumFree)
 				{
 					sprintf(mess,"Leaked Info idx=%d id=%d sz=%d\n", i, mIds[i], mInfos[i].size());
 					OutputDebugString(mess);
@@ -555,17 +729,22 @@ public:
 #endif
 	int New()
 	{
-		if (mFreeIndecies.empty())
+		if (!mNumFree)
 		{
 			assert(0);
 			Com_Error(ERR_FATAL, "Out of ghoul2 info slots");
 
 		}
 		// gonna pull from the front, doing a
-		int idx=*mFreeIndecies.begin();
-		mFreeIndecies.erase(mFreeIndecies.begin());
+		int idx=mFreeIndecies[mFreeFront];
+		mFreeFront=(mFreeFront+1)&G2_INDEX_MASK;
+		mNumFree--;
 		return mIds[idx];
 	}
+	int NumFree() const
+	{
+		return mNumFree;
+	}
 	bool IsValid(int handle) const
 	{
 		if ( handle <= 0 )
@@ -592,7 +771,7 @@ public:
 			DeleteLow(handle&G2_INDEX_MASK);
 		}
 	}
-	std::vector<CGhoul2Info> &Get(int handle)
+	ghoul2Info_v &Get(int handle)
 	{
 		assert(handle>0); //null handle
 		assert((handle&G2_INDEX_MASK)>=0&&(handle&G2_INDEX_MASK)<MAX_G2_MODELS); //junk handle
@@ -601,7 +780,7 @@ public:
 
 		return mInfos[handle&G2_INDEX_MASK];
 	}
-	const std::vector<CGhoul2Info> &Get(int handle) const
+	const ghoul2Info_v &Get(int handle) const
 	{
 		assert(handle>0);
 		assert(mIds[handle&G2_INDEX_MASK]==handle); // not a valid handle, could be old or garbage
@@ -609,12 +788,12 @@ public:
 	}
 
 #if G2API_DEBUG
-	vector<CGhoul2Info> &GetDebug(int handle)
+	ghoul2Info_v &GetDebug(int handle)
 	{
-		static vector<CGhoul2Info> null;
+		static ghoul2Info_v null;
 		if (handle<=0||(handle&G2_INDEX_MASK)<0||(handle&G2_INDEX_MASK)>=MAX_G2_MODELS||mIds[handle&G2_INDEX_MASK]!=handle)
 		{
-			return *(vector<CGhoul2Info> *)0; // null reference, intentional
+			return *(ghoul2Info_v *)0; // null reference, intentional
 		}
 		return mInfos[handle&G2_INDEX_MASK];
 	}
@@ -623,7 +802,7 @@ public:
 		int j;
 		for (j=0;j<MAX_G2_MODELS;j++)
 		{
-			vector<CGhoul2Info> &ghoul2=mInfos[j];
+			ghoul2Info_v &ghoul2=mInfos[j];
 			int i;
 			for (i=0; i<ghoul2.size(); i++)
 			{
@@ -697,6 +876,168 @@ void Ghoul2InfoArray_Free(void)
 		delete singleton;
 		singleton = NULL;
 	}
+	G2_PoolRelease();
+}
+
+/*
+==============
+G2_PoolStress_f
+
+Keeps a few hundred instances of a model alive, each with bone overrides,
+bolts and surfaces switched off, and frees and respawns random ones until
+the requested number of spawns is done. Every new instance and one other
+live one get their bolts evaluated and a trace skinned against them, so
+bone and skin caches are built and thrown away too. Handles of freed
+instances must stop resolving, and once every instance has been spawned
+and used the first time nothing may go to the heap again, counted by the
+process rather than the pool. Only slots nobody else holds are used, so
+the instances of a running game are left alone
+==============
+*/
+#define POOLSTRESS_LIVE		768		// at most, fewer when the game holds more than the rest
+#define POOLSTRESS_MIN_LIVE	64
+
+static int64_t G2_PoolStressClock(void)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+static qboolean G2_PoolStressSpawn(CGhoul2Info_v **ghoul2, const char *name, CGhoul2Info_v *from, int n)
+{
+	int		i;
+
+	// copy an existing instance, the way the game does for corpses
+	if (from)
+	{
+		G2API_DuplicateGhoul2Instance(*from, ghoul2);
+		return (qboolean)(*ghoul2 && (*ghoul2)->size());
+	}
+	if (G2API_InitGhoul2Model(ghoul2, name, 0, 0, 0, 0, 0) < 0)
+	{
+		return qfalse;
+	}
+
+	CGhoul2Info_v &ghoul2Ref = **ghoul2;
+	CGhoul2Info &g = ghoul2Ref[0];
+	const mdxaSkelOffsets_t *offsets = (const mdxaSkelOffsets_t *)((const byte *)g.aHeader + sizeof(mdxaHeader_t));
+	const int numBones = g.aHeader->numBones;
+	const int numSurfaces = g.currentModel->mdxm->numSurfaces;
+
+	G2API_SetBoneAnim(ghoul2Ref, 0, "model_root", 0, g.aHeader->numFrames, BONE_ANIM_OVERRIDE_LOOP, 1.0f, n);
+	for (i=0;i<4;i++)
+	{
+		const mdxaSkel_t *skel = (const mdxaSkel_t *)((const byte *)g.aHeader + sizeof(mdxaHeader_t) + offsets->offsets[(n + i * 7) % numBones]);
+		const vec3_t angles = { 10.0f * i, (float)(n % 90), 0.0f };
+
+		G2API_SetBoneAngles(ghoul2Ref, 0, skel->name, angles, BONE_ANGLES_POSTMULT, POSITIVE_X, NEGATIVE_Y, NEGATIVE_Z, NULL, 0, n);
+		G2API_AddBolt(ghoul2Ref, 0, skel->name);
+	}
+	for (i=1;i<=2&&i<numSurfaces;i++)
+	{
+		G2API_SetSurfaceOnOff(ghoul2Ref, G2API_GetSurfaceName(ghoul2Ref, 0, (n + i * 5) % numSurfaces), G2SURFACEFLAG_OFF);
+	}
+	return qtrue;
+}
+
+// what a game does with an instance every frame, where it's at and whether a shot hits it
+static void G2_PoolStressUse(CGhoul2Info_v &ghoul2, int time)
+{
+	CGhoul2Info			&g = ghoul2[0];
+	CollisionRecord_t	records[MAX_G2_COLLISIONS];
+	mdxaBone_t			matrix;
+	vec3_t				angles, origin, scale, start, end;
+	int					i;
+
+	VectorSet(angles, 0.0f, (float)(time % 360), 0.0f);
+	VectorClear(origin);
+	VectorClear(scale);
+	for (i=0;i<(int)g.mBltlist.size();i++)
+	{
+		if (g.mBltlist[i].boneNumber != -1 || g.mBltlist[i].surfaceNumber != -1)
+		{
+			G2API_GetBoltMatrix(ghoul2, 0, i, &matrix, angles, origin, time, NULL, scale);
+		}
+	}
+
+	memset(records, 0, sizeof(records));
+	for (i=0;i<MAX_G2_COLLISIONS;i++)
+	{
+		records[i].mEntityNum = -1;
+	}
+	VectorSet(start, 64.0f, (float)(time % 32) - 16.0f, 32.0f);
+	VectorSet(end, -64.0f, 16.0f - (float)(time % 32), 24.0f);
+	G2API_CollisionDetect(records, ghoul2, angles, origin, time, 0, start, end, scale, ri.GetG2VertSpaceServer(), G2_COLLIDE, 0, 0.0f);
+}
+
+void G2_PoolStress_f(void)
+{
+	const char		*name = ri.Cmd_Argc() > 1 ? ri.Cmd_Argv(1) : "models/players/kyle/model.glm";
+	const int		numLive = Q_min(POOLSTRESS_LIVE, singleton ? singleton->NumFree() : MAX_G2_MODELS);
+	const int		numSpawns = ri.Cmd_Argc() > 2 ? Com_Clampi(numLive, 10000000, atoi(ri.Cmd_Argv(2))) : 100000;
+	CGhoul2Info_v	*live[POOLSTRESS_LIVE];
+	int				i, n, numStale = 0, warmPoolAllocs = 0;
+	int64_t			start = 0, nsec, warmAllocs = 0;
+
+	if (numLive < POOLSTRESS_MIN_LIVE)
+	{
+		ri.Printf( PRINT_ALL, "g2poolstress: only %d free ghoul2 slots, need %d\n", numLive, POOLSTRESS_MIN_LIVE);
+		return;
+	}
+
+	memset(live, 0, sizeof(live));
+	srand(numSpawns);
+	for (n=0;n<numSpawns;n++)
+	{
+		// the first instance stays for the others to copy, and every fourth
+		// slot always holds a copy, so what's live is the same mix throughout
+		const int k = n < numLive ? n : 1 + rand() % (numLive - 1);
+
+		if (n == numLive)
+		{
+			// warmed up, from here on the pool should have it all
+			warmAllocs = ri.Z_HeapAllocs();
+			warmPoolAllocs = g2Pool.numHeapAllocs;
+			start = G2_PoolStressClock();
+		}
+		if (live[k])
+		{
+			const int stale = live[k]->mItem;
+
+			G2API_CleanGhoul2Models(&live[k]);
+			numStale += TheGhoul2InfoArray().IsValid(stale);
+		}
+		if (!G2_PoolStressSpawn(&live[k], name, k && !(k & 3) ? live[0] : NULL, n))
+		{
+			ri.Printf( PRINT_ALL, "g2poolstress: couldn't spawn %s\n", name);
+			break;
+		}
+
+		G2_PoolStressUse(*live[k], n * 50);
+		if (n >= numLive)
+		{
+			G2_PoolStressUse(*live[rand() % numLive], n * 50);
+		}
+	}
+	nsec = G2_PoolStressClock() - start;
+
+	const int64_t heapAllocs = ri.Z_HeapAllocs() - warmAllocs;
+	const int poolAllocs = g2Pool.numHeapAllocs - warmPoolAllocs;
+	for (i=0;i<numLive;i++)
+	{
+		G2API_CleanGhoul2Models(&live[i]);
+	}
+
+	if (n > numLive)
+	{
+		ri.Printf( PRINT_ALL, "%s: %d spawns, %d live, %.2f usec per free, spawn and two uses\n", name, n, numLive,
+			nsec / 1000.0 / (n - numLive));
+		ri.Printf( PRINT_ALL, "pool: %d chunks (%d KB), %d of its own heap allocations after warming up\n", g2Pool.numChunks,
+			g2Pool.numChunks * (G2_POOL_CHUNK / 1024), poolAllocs);
+		ri.Printf( PRINT_ALL, "%lld heap allocations in the process after warming up %s\n", (long long)heapAllocs,
+			heapAllocs ? S_COLOR_RED "FAILED" : "ok");
+	}
+	ri.Printf( PRINT_ALL, "%d freed handles still valid %s\n", numStale, numStale ? S_COLOR_RED "FAILED" : "ok");
 }
 
 // this is the ONLY function to read entity states directly
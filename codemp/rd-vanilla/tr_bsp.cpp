@@ -1582,6 +1582,11 @@ static	void R_LoadShaders( lump_t *l, world_t &worldData ) {
 		out[i].surfaceFlags = LittleLong( out[i].surfaceFlags );
 		out[i].contentFlags = LittleLong( out[i].contentFlags );
 	}
+
+	// the surfaces register these in a moment, start reading their images
+	for ( i=0 ; i<count ; i++ ) {
+		R_PrefetchShader( out[i].shader );
+	}
 }
 
 
@@ -32,6 +32,8 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 
 #include "qcommon/disablewarnings.h"
 
+#include <chrono>
+
 #define	LL(x) x=LittleLong(x)
 #define	LS(x) x=LittleShort(x)
 #define	LF(x) x=LittleFloat(x)
@@ -174,6 +176,7 @@ public:
 	//rww - RAGDOLL_BEGIN
 	int				touchRender;
 	//rww - RAGDOLL_END
+	int				touchBatch; // evaluated ahead by EvalAll and not yet asked for by EvalRender
 	mdxaBone_t		boneMatrix; //final matrix
 	int				parent; // only set once
 
@@ -183,6 +186,7 @@ public:
 	//rww - RAGDOLL_BEGIN
 		touchRender = 0;
 	//rww - RAGDOLL_END
+		touchBatch = 0;
 	}
 
 };
@@ -199,7 +203,10 @@ struct SBoneCalc
 };
 
 class CBoneCache;
+class CSkinCache;
 void G2_TransformBone(int index,CBoneCache &CB);
+void FreeSkinCache(CSkinCache *skin);
+void G2_TransformBoneLevels(CBoneCache &CB);
 
 class CBoneCache
 {
@@ -318,10 +325,10 @@ public:
 	const model_t		*mod;
 
 	// these are split for better cpu cache behavior
-	std::vector<SBoneCalc> mBones;
-	std::vector<CTransformBone> mFinalBones;
+	std::vector<SBoneCalc, CG2PoolAllocator<SBoneCalc> > mBones;
+	std::vector<CTransformBone, CG2PoolAllocator<CTransformBone> > mFinalBones;
 
-	std::vector<CTransformBone> mSmoothBones; // for render smoothing
+	std::vector<CTransformBone, CG2PoolAllocator<CTransformBone> > mSmoothBones; // for render smoothing
 	//vector<mdxaSkel_t *>   mSkels;
 
 	boneInfo_v		*rootBoneList;
@@ -340,6 +347,26 @@ public:
 	bool			mUnsquash;
 	float			mSmoothFactor;
 
+	// the bones breadth first, so every parent comes before its children,
+	// and where each level of the hierarchy starts in mOrder
+	std::vector<int, CG2PoolAllocator<int> > mOrder;
+	std::vector<int, CG2PoolAllocator<int> > mLevels;
+	int				mBatchTouch;
+
+	// the skinned verts G2_TransformModel keeps for collision
+	CSkinCache		*mSkinCache;
+
+	// the caches come out of the ghoul2 pool like the lists of the instance,
+	// and everything in them is sized here once, so they never grow
+	static void *operator new(size_t size)
+	{
+		return G2_PoolAlloc(size);
+	}
+	static void operator delete(void *ptr, size_t size)
+	{
+		G2_PoolFree(ptr, size);
+	}
+
 	CBoneCache(const model_t *amod,const mdxaHeader_t *aheader) :
 		header(aheader),
 		mod(amod)
@@ -368,6 +395,41 @@ public:
 			//ditto
 			mFinalBones[i].parent=skel->parent;
 		}
+
+		// counting sort of the bones by depth
+		std::vector<int, CG2PoolAllocator<int> > depth(numBones);
+		int maxDepth=0;
+		for (i=0;i<numBones;i++)
+		{
+			int d=0;
+			for (int p=mFinalBones[i].parent;p>=0&&d<numBones;p=mFinalBones[p].parent)
+			{
+				d++;
+			}
+			depth[i]=d;
+			if (d>maxDepth)
+			{
+				maxDepth=d;
+			}
+		}
+		mLevels.assign(maxDepth+2,0);
+		for (i=0;i<numBones;i++)
+		{
+			mLevels[depth[i]+1]++;
+		}
+		for (i=1;i<(int)mLevels.size();i++)
+		{
+			mLevels[i]+=mLevels[i-1];
+		}
+		mOrder.resize(numBones);
+		std::vector<int, CG2PoolAllocator<int> > fill(mLevels.begin(),mLevels.end()-1);
+		for (i=0;i<numBones;i++)
+		{
+			mOrder[fill[depth[i]]++]=i;
+		}
+		mBatchTouch=0;
+		mSkinCache=0;
+
 		mCurrentTouch=3;
 //rww - RAGDOLL_BEGIN
 		mLastTouch=2;
@@ -453,6 +515,15 @@ public:
 		}
 		return mFinalBones[index].boneMatrix;
 	}
+	// evaluate every bone not already done for this touch, a whole level of the hierarchy at a time
+	void EvalAll()
+	{
+		if (mBatchTouch!=mCurrentTouch)
+		{
+			mBatchTouch=mCurrentTouch;
+			G2_TransformBoneLevels(*this);
+		}
+	}
 	//rww - RAGDOLL_BEGIN
 	const inline mdxaBone_t &EvalRender(int index)
 	{
@@ -462,6 +533,12 @@ public:
 			mFinalBones[index].touchRender=mCurrentTouchRender;
 			EvalLow(index);
 		}
+		else if (mFinalBones[index].touchBatch==mCurrentTouch)
+		{
+			// EvalAll got here first, but this is still the render asking for it
+			mFinalBones[index].touchBatch=0;
+			mFinalBones[index].touchRender=mCurrentTouchRender;
+		}
 		if (mSmoothingActive)
 		{
 			if (mSmoothBones[index].touch!=mCurrentTouch)
@@ -497,6 +574,7 @@ void RemoveBoneCache(CBoneCache *boneCache)
 	g_Ghoul2Allocations -= sizeof(*boneCache);
 #endif
 
+	FreeSkinCache(boneCache->mSkinCache);
 	delete boneCache;
 }
 
@@ -513,6 +591,18 @@ const mdxaBone_t &EvalBoneCache(int index,CBoneCache *boneCache)
 	return boneCache->Eval(index);
 }
 
+void EvalBoneCacheAll(CBoneCache *boneCache)
+{
+	assert(boneCache);
+	boneCache->EvalAll();
+}
+
+CSkinCache *&BoneCacheSkin(CBoneCache *boneCache)
+{
+	assert(boneCache);
+	return boneCache->mSkinCache;
+}
+
 //rww - RAGDOLL_BEGIN
 const mdxaHeader_t *G2_GetModA(CGhoul2Info &ghoul2)
 {
@@ -1459,35 +1549,24 @@ void G2_RagGetAnimMatrix(CGhoul2Info &ghoul2, const int boneNum, mdxaBone_t &mat
 	matrix = bone.animFrameMatrix;
 }
 
-void G2_TransformBone (int child,CBoneCache &BC)
+/*
+==============
+G2_PrepareBone
+
+Applies the animation overrides in the bone list to the frames the bone
+inherited from its parent, and clamps them to the animation
+==============
+*/
+static void G2_PrepareBone(int child, CBoneCache &BC, int boneListIndex)
 {
 	SBoneCalc &TB=BC.mBones[child];
-	static mdxaBone_t		tbone[6];
-// 	mdxaFrame_t		*aFrame=0;
-//	mdxaFrame_t		*bFrame=0;
-//	mdxaFrame_t		*aoldFrame=0;
-//	mdxaFrame_t		*boldFrame=0;
-	static mdxaSkel_t		*skel;
-	static mdxaSkelOffsets_t *offsets;
 	boneInfo_v		&boneList = *BC.rootBoneList;
-	static int				j, boneListIndex;
-	int				angleOverride = 0;
-
 #if DEBUG_G2_TIMING
 	bool printTiming=false;
 #endif
-	// should this bone be overridden by a bone in the bone list?
-	boneListIndex = G2_Find_Bone_In_List(boneList, child);
+
 	if (boneListIndex != -1)
 	{
-		// we found a bone in the list - we need to override something here.
-
-		// do we override the rotational angles?
-		if ((boneList[boneListIndex].flags) & (BONE_ANGLES_TOTAL))
-		{
-			angleOverride = (boneList[boneListIndex].flags) & (BONE_ANGLES_TOTAL);
-		}
-
 		// set blending stuff if we need to
 		if (boneList[boneListIndex].flags & BONE_ANIM_BLEND)
 		{
@@ -1605,6 +1684,36 @@ void G2_TransformBone (int child,CBoneCache &BC)
 //		Com_OPrintf("%s",mess);
 	}
 #endif
+}
+
+void G2_TransformBone (int child,CBoneCache &BC)
+{
+	SBoneCalc &TB=BC.mBones[child];
+	static mdxaBone_t		tbone[6];
+// 	mdxaFrame_t		*aFrame=0;
+//	mdxaFrame_t		*bFrame=0;
+//	mdxaFrame_t		*aoldFrame=0;
+//	mdxaFrame_t		*boldFrame=0;
+	static mdxaSkel_t		*skel;
+	static mdxaSkelOffsets_t *offsets;
+	boneInfo_v		&boneList = *BC.rootBoneList;
+	static int				j, boneListIndex;
+	int				angleOverride = 0;
+
+	// should this bone be overridden by a bone in the bone list?
+	boneListIndex = G2_Find_Bone_In_List(boneList, child);
+	if (boneListIndex != -1)
+	{
+		// we found a bone in the list - we need to override something here.
+
+		// do we override the rotational angles?
+		if ((boneList[boneListIndex].flags) & (BONE_ANGLES_TOTAL))
+		{
+			angleOverride = (boneList[boneListIndex].flags) & (BONE_ANGLES_TOTAL);
+		}
+	}
+	G2_PrepareBone(child, BC, boneListIndex);
+
 //	boldFrame = (mdxaFrame_t *)((byte *)BC.header + BC.header->ofsFrames + TB.blendOldFrame * BC.frameSize );
 
 //	mdxaCompBone_t	*compBonePointer = (mdxaCompBone_t *)((byte *)BC.header + BC.header->ofsCompBonePool);
@@ -1973,6 +2082,444 @@ void G2_TransformBone (int child,CBoneCache &BC)
 
 }
 
+/*
+==============
+Bone hierarchy levels
+
+G2_TransformBoneLevels walks the skeleton breadth first. A level only
+depends on the levels above it, so the plain animated bones of a level are
+gathered into structure of arrays rows, and then blended and multiplied by
+their parents together. The root and the bones with angle overrides still
+go through G2_TransformBone one at a time. The kernels use the same
+multiplies and adds, in the same order, as G2_TransformBone and
+Multiply_3x4Matrix, so they only differ from the per bone path in the sign
+of a zero.
+==============
+*/
+#if defined(__SSE2__) || defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 )
+	#define G2_SIMD
+	#include <xmmintrin.h>
+#endif
+
+// rows of the level scratch, each one stride floats wide
+enum
+{
+	LEVEL_NEW		= 0,		// newFrame
+	LEVEL_CURRENT	= 12,		// currentFrame
+	LEVEL_BLEND		= 24,		// blendFrame
+	LEVEL_BLENDOLD	= 36,		// blendOldFrame
+	LEVEL_PARENT	= 48,		// final matrix of the parent
+	LEVEL_OUT		= 60,		// final matrix
+	LEVEL_BACKLERP	= 72,		// weights of newFrame and currentFrame
+	LEVEL_FRONTLERP,
+	LEVEL_BLENDBACK,			// weights of blendFrame and blendOldFrame
+	LEVEL_BLENDFRONT,
+	LEVEL_BLENDLERP,			// weights of the anim and the blend
+	LEVEL_BLENDLERPFRONT,
+	LEVEL_ROWS
+};
+
+typedef struct g2LevelKernel_s
+{
+	const char	*name;
+	void		(*transform)(float *rows, int stride);
+} g2LevelKernel_t;
+
+static void G2_TransformLevel_Scalar(float *rows, int stride)
+{
+	int		lane, e, r;
+	float	local[12];
+
+	for (lane=0;lane<stride;lane++)
+	{
+		const float *w=rows+LEVEL_BACKLERP*stride+lane;
+		for (e=0;e<12;e++)
+		{
+			const float blend=(w[(LEVEL_BLENDBACK-LEVEL_BACKLERP)*stride] * rows[(LEVEL_BLEND+e)*stride+lane])
+				+ (w[(LEVEL_BLENDFRONT-LEVEL_BACKLERP)*stride] * rows[(LEVEL_BLENDOLD+e)*stride+lane]);
+			const float anim=(w[0] * rows[(LEVEL_NEW+e)*stride+lane])
+				+ (w[(LEVEL_FRONTLERP-LEVEL_BACKLERP)*stride] * rows[(LEVEL_CURRENT+e)*stride+lane]);
+			local[e]=(w[(LEVEL_BLENDLERP-LEVEL_BACKLERP)*stride] * anim)
+				+ (w[(LEVEL_BLENDLERPFRONT-LEVEL_BACKLERP)*stride] * blend);
+		}
+		for (r=0;r<3;r++)
+		{
+			const float p0=rows[(LEVEL_PARENT+r*4+0)*stride+lane];
+			const float p1=rows[(LEVEL_PARENT+r*4+1)*stride+lane];
+			const float p2=rows[(LEVEL_PARENT+r*4+2)*stride+lane];
+			const float p3=rows[(LEVEL_PARENT+r*4+3)*stride+lane];
+			float *out=rows+(LEVEL_OUT+r*4)*stride+lane;
+
+			out[0*stride] = (p0 * local[0]) + (p1 * local[4]) + (p2 * local[8]);
+			out[1*stride] = (p0 * local[1]) + (p1 * local[5]) + (p2 * local[9]);
+			out[2*stride] = (p0 * local[2]) + (p1 * local[6]) + (p2 * local[10]);
+			out[3*stride] = (p0 * local[3]) + (p1 * local[7]) + (p2 * local[11]) + p3;
+		}
+	}
+}
+
+#ifdef G2_SIMD
+static void G2_TransformLevel_SSE(float *rows, int stride)
+{
+	int		lane, e, r;
+	__m128	local[12];
+
+	for (lane=0;lane<stride;lane+=4)
+	{
+		const float *w=rows+LEVEL_BACKLERP*stride+lane;
+		const __m128 backlerp=_mm_loadu_ps(w);
+		const __m128 frontlerp=_mm_loadu_ps(w+(LEVEL_FRONTLERP-LEVEL_BACKLERP)*stride);
+		const __m128 blendBack=_mm_loadu_ps(w+(LEVEL_BLENDBACK-LEVEL_BACKLERP)*stride);
+		const __m128 blendFront=_mm_loadu_ps(w+(LEVEL_BLENDFRONT-LEVEL_BACKLERP)*stride);
+		const __m128 blendLerp=_mm_loadu_ps(w+(LEVEL_BLENDLERP-LEVEL_BACKLERP)*stride);
+		const __m128 blendLerpFront=_mm_loadu_ps(w+(LEVEL_BLENDLERPFRONT-LEVEL_BACKLERP)*stride);
+
+		for (e=0;e<12;e++)
+		{
+			const __m128 blend=_mm_add_ps(_mm_mul_ps(blendBack, _mm_loadu_ps(rows+(LEVEL_BLEND+e)*stride+lane)),
+				_mm_mul_ps(blendFront, _mm_loadu_ps(rows+(LEVEL_BLENDOLD+e)*stride+lane)));
+			const __m128 anim=_mm_add_ps(_mm_mul_ps(backlerp, _mm_loadu_ps(rows+(LEVEL_NEW+e)*stride+lane)),
+				_mm_mul_ps(frontlerp, _mm_loadu_ps(rows+(LEVEL_CURRENT+e)*stride+lane)));
+			local[e]=_mm_add_ps(_mm_mul_ps(blendLerp, anim), _mm_mul_ps(blendLerpFront, blend));
+		}
+		for (r=0;r<3;r++)
+		{
+			const __m128 p0=_mm_loadu_ps(rows+(LEVEL_PARENT+r*4+0)*stride+lane);
+			const __m128 p1=_mm_loadu_ps(rows+(LEVEL_PARENT+r*4+1)*stride+lane);
+			const __m128 p2=_mm_loadu_ps(rows+(LEVEL_PARENT+r*4+2)*stride+lane);
+			const __m128 p3=_mm_loadu_ps(rows+(LEVEL_PARENT+r*4+3)*stride+lane);
+			float *out=rows+(LEVEL_OUT+r*4)*stride+lane;
+
+			for (e=0;e<3;e++)
+			{
+				_mm_storeu_ps(out+e*stride, _mm_add_ps(_mm_add_ps(_mm_mul_ps(p0, local[e]), _mm_mul_ps(p1, local[4+e])), _mm_mul_ps(p2, local[8+e])));
+			}
+			_mm_storeu_ps(out+3*stride, _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(p0, local[3]), _mm_mul_ps(p1, local[7])), _mm_mul_ps(p2, local[11])), p3));
+		}
+	}
+}
+#endif // G2_SIMD
+
+static const g2LevelKernel_t g2LevelKernels[] =
+{
+	{ "scalar", G2_TransformLevel_Scalar },
+#ifdef G2_SIMD
+	{ "sse", G2_TransformLevel_SSE },
+#endif
+};
+
+static const int g2NumLevelKernels = ARRAY_LEN( g2LevelKernels );
+
+static std::vector<float>	g2LevelRows;
+static std::vector<int>		g2LevelBones;
+
+/*
+==============
+G2_GatherBone
+
+Decompresses the frames of a plain animated bone into a lane of the level
+rows, with the weights G2_TransformBone would blend them with. Frames the
+bone doesn't use get a weight of zero and a copy of currentFrame.
+==============
+*/
+static void G2_GatherBone(float *rows, int stride, int lane, int child, CBoneCache &BC)
+{
+	const SBoneCalc &TB=BC.mBones[child];
+	mdxaBone_t	frames[4];
+	float		weights[6];
+	int			m, e;
+
+	UnCompressBone(frames[1].matrix, child, BC.header, TB.currentFrame);
+	if (TB.backlerp)
+	{
+		UnCompressBone(frames[0].matrix, child, BC.header, TB.newFrame);
+		weights[0] = TB.backlerp;
+		weights[1] = 1.0 - TB.backlerp;
+	}
+	else
+	{
+		frames[0] = frames[1];
+		weights[0] = 0.0f;
+		weights[1] = 1.0f;
+	}
+	if (TB.blendMode)
+	{
+		float backlerp = TB.blendFrame - (int)TB.blendFrame;
+		UnCompressBone(frames[2].matrix, child, BC.header, (int)TB.blendFrame);
+		UnCompressBone(frames[3].matrix, child, BC.header, TB.blendOldFrame);
+		weights[2] = backlerp;
+		weights[3] = 1.0 - backlerp;
+		weights[4] = TB.blendLerp;
+		weights[5] = 1.0 - TB.blendLerp;
+	}
+	else
+	{
+		frames[2] = frames[3] = frames[1];
+		weights[2] = 0.0f;
+		weights[3] = 1.0f;
+		weights[4] = 1.0f;
+		weights[5] = 0.0f;
+	}
+
+	for (m=0;m<4;m++)
+	{
+		const float *src=&frames[m].matrix[0][0];
+		for (e=0;e<12;e++)
+		{
+			rows[(m*12+e)*stride+lane]=src[e];
+		}
+	}
+	const float *parent=&BC.mFinalBones[BC.mFinalBones[child].parent].boneMatrix.matrix[0][0];
+	for (e=0;e<12;e++)
+	{
+		rows[(LEVEL_PARENT+e)*stride+lane]=parent[e];
+	}
+	for (e=0;e<6;e++)
+	{
+		rows[(LEVEL_BACKLERP+e)*stride+lane]=weights[e];
+	}
+}
+
+static void G2_TransformLevels(CBoneCache &BC, const g2LevelKernel_t *kernel)
+{
+	boneInfo_v	&boneList = *BC.rootBoneList;
+	const int	numLevels = (int)BC.mLevels.size() - 1;
+	int			level, k, e;
+
+	for (level=0;level<numLevels;level++)
+	{
+		const int	first=BC.mLevels[level];
+		const int	last=BC.mLevels[level+1];
+		const int	stride=(last-first+3)&~3;
+		int			numLanes=0;
+
+		if ((int)g2LevelRows.size()<LEVEL_ROWS*stride)
+		{
+			g2LevelRows.resize(LEVEL_ROWS*stride);
+			g2LevelBones.resize(stride);
+		}
+		float *rows=&g2LevelRows[0];
+
+		for (k=first;k<last;k++)
+		{
+			const int		child=BC.mOrder[k];
+			CTransformBone	&bone=BC.mFinalBones[child];
+
+			if (bone.touch==BC.mCurrentTouch)
+			{
+				continue;
+			}
+
+			// same as EvalLow, the frames come down from the parent
+			if (bone.parent>=0)
+			{
+				SBoneCalc &par=BC.mBones[bone.parent];
+				SBoneCalc &TB=BC.mBones[child];
+				TB.newFrame=par.newFrame;
+				TB.currentFrame=par.currentFrame;
+				TB.backlerp=par.backlerp;
+				TB.blendFrame=par.blendFrame;
+				TB.blendOldFrame=par.blendOldFrame;
+				TB.blendMode=par.blendMode;
+				TB.blendLerp=par.blendLerp;
+			}
+
+			const int boneListIndex=G2_Find_Bone_In_List(boneList, child);
+			if (bone.parent<0 || (boneListIndex!=-1 && (boneList[boneListIndex].flags & BONE_ANGLES_TOTAL)))
+			{
+				G2_TransformBone(child, BC);
+			}
+			else
+			{
+				G2_PrepareBone(child, BC, boneListIndex);
+				G2_GatherBone(rows, stride, numLanes, child, BC);
+				g2LevelBones[numLanes++]=child;
+			}
+			bone.touch=BC.mCurrentTouch;
+			bone.touchBatch=BC.mCurrentTouch;
+		}
+
+		if (!numLanes)
+		{
+			continue;
+		}
+		if (numLanes<stride)
+		{
+			for (e=0;e<LEVEL_ROWS;e++)
+			{
+				memset(rows+e*stride+numLanes, 0, (stride-numLanes)*sizeof(float));
+			}
+		}
+
+		kernel->transform(rows, stride);
+
+		for (k=0;k<numLanes;k++)
+		{
+			float *dest=&BC.mFinalBones[g2LevelBones[k]].boneMatrix.matrix[0][0];
+			for (e=0;e<12;e++)
+			{
+				dest[e]=rows[(LEVEL_OUT+e)*stride+k];
+			}
+		}
+	}
+}
+
+void G2_TransformBoneLevels(CBoneCache &BC)
+{
+	if (r_ghoul2BatchBones && r_ghoul2BatchBones->integer)
+	{
+		G2_TransformLevels(BC, &g2LevelKernels[g2NumLevelKernels-1]);
+	}
+}
+
+/*
+==============
+G2_BoneBenchmark_f
+
+Evaluates the whole skeleton of a GLA for every frame of its animation,
+once bone by bone the way Eval does and once with each level kernel, and
+compares the kernels' matrices against the per bone ones
+==============
+*/
+#define BONEBENCH_TOLERANCE	0.0001f
+
+static void G2_BoneBenchmarkSetup(CBoneCache &BC, int frame, int pass)
+{
+	const int numFrames=BC.header->numFrames;
+	SBoneCalc &TB=BC.Root();
+
+	BC.mCurrentTouch++;
+	TB.currentFrame=frame;
+	TB.newFrame=(frame+1)%numFrames;
+	TB.backlerp=(pass&1)?0.0f:0.25f+0.125f*(frame&3);
+	TB.blendMode=(frame&1)!=0;
+	TB.blendFrame=(float)((frame+7)%numFrames)+0.5f;
+	TB.blendOldFrame=(frame+3)%numFrames;
+	TB.blendLerp=0.3f;
+}
+
+static int64_t G2_BoneBenchmarkClock(void)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+void G2_BoneBenchmark_f(void)
+{
+	const char	*name = ri.Cmd_Argc() > 1 ? ri.Cmd_Argv(1) : "models/players/_humanoid/_humanoid.gla";
+	const int	passes = ri.Cmd_Argc() > 2 ? Com_Clampi(1, 1000, atoi(ri.Cmd_Argv(2))) : 4;
+	int64_t		nsec[1+ARRAY_LEN(g2LevelKernels)];
+	float		maxError[ARRAY_LEN(g2LevelKernels)];
+	int			numBad[ARRAY_LEN(g2LevelKernels)];
+	int			pass, frame, i, k, e;
+
+	const model_t *mod = R_GetModelByHandle(RE_RegisterServerModel(name));
+	if (!mod || mod->type != MOD_MDXA || !mod->mdxa)
+	{
+		ri.Printf( PRINT_ALL, "g2bonebench: couldn't load animation %s\n", name);
+		return;
+	}
+	const mdxaHeader_t *header = mod->mdxa;
+	const int numBones = header->numBones;
+
+	// a couple of angle overrides, so the per bone path gets mixed in too
+	boneInfo_v boneList;
+	for (i=1;i<=2&&i*numBones/3<numBones;i++)
+	{
+		boneInfo_t override;
+		const float angle = 0.3f * i;
+
+		memset(&override.matrix, 0, sizeof(override.matrix));
+		override.matrix.matrix[0][0] = override.matrix.matrix[1][1] = cos(angle);
+		override.matrix.matrix[0][1] = -sin(angle);
+		override.matrix.matrix[1][0] = sin(angle);
+		override.matrix.matrix[2][2] = 1.0f;
+		override.newMatrix = override.matrix;
+		override.boneNumber = i*numBones/3;
+		override.flags = (i&1) ? BONE_ANGLES_POSTMULT : BONE_ANGLES_PREMULT;
+		boneList.push_back(override);
+	}
+
+	CBoneCache BC(mod, header);
+	BC.rootBoneList = &boneList;
+	BC.rootMatrix = identityMatrix;
+	BC.incomingTime = 0;
+
+	std::vector<mdxaBone_t> reference(numBones);
+	memset(nsec, 0, sizeof(nsec));
+	memset(maxError, 0, sizeof(maxError));
+	memset(numBad, 0, sizeof(numBad));
+
+	for (pass=0;pass<passes;pass++)
+	{
+		for (frame=0;frame<header->numFrames;frame++)
+		{
+			int64_t start;
+
+			for (k=0;k<=g2NumLevelKernels;k++)
+			{
+				const int path=(k+frame)%(g2NumLevelKernels+1);
+
+				G2_BoneBenchmarkSetup(BC, frame, pass);
+				start=G2_BoneBenchmarkClock();
+				if (!path)
+				{
+					for (i=0;i<numBones;i++)
+					{
+						BC.Eval(i);
+					}
+					nsec[0]+=G2_BoneBenchmarkClock()-start;
+					for (i=0;i<numBones;i++)
+					{
+						reference[i]=BC.mFinalBones[i].boneMatrix;
+					}
+				}
+				else
+				{
+					G2_TransformLevels(BC, &g2LevelKernels[path-1]);
+					nsec[path]+=G2_BoneBenchmarkClock()-start;
+				}
+			}
+
+			// compare against this frame's per bone matrices, which the
+			// rotation may have computed last
+			for (k=0;k<g2NumLevelKernels;k++)
+			{
+				G2_BoneBenchmarkSetup(BC, frame, pass);
+				G2_TransformLevels(BC, &g2LevelKernels[k]);
+				for (i=0;i<numBones;i++)
+				{
+					const float *a=&BC.mFinalBones[i].boneMatrix.matrix[0][0];
+					const float *b=&reference[i].matrix[0][0];
+					bool bad=false;
+					for (e=0;e<12;e++)
+					{
+						const float error=fabs(a[e]-b[e]);
+						if (error>maxError[k])
+						{
+							maxError[k]=error;
+						}
+						if (!(error<=BONEBENCH_TOLERANCE*Q_max(1.0f,fabs(b[e]))))
+						{
+							bad=true;
+						}
+					}
+					numBad[k]+=bad;
+				}
+			}
+		}
+	}
+
+	const int numEvals=passes*header->numFrames;
+	ri.Printf( PRINT_ALL, "%s: %d bones, %d levels, %d frames, %d passes\n", name, numBones, (int)BC.mLevels.size()-1, header->numFrames, passes);
+	ri.Printf( PRINT_ALL, "per bone: %8.2f usec per skeleton\n", nsec[0]/1000.0/numEvals);
+	for (k=0;k<g2NumLevelKernels;k++)
+	{
+		ri.Printf( PRINT_ALL, "%-8s: %8.2f usec per skeleton, max error %g, %d bones off %s\n", g2LevelKernels[k].name,
+			nsec[k+1]/1000.0/numEvals, maxError[k], numBad[k], numBad[k]?S_COLOR_RED "FAILED":"ok");
+	}
+}
+
 void G2_SetUpBolts( mdxaHeader_t *header, CGhoul2Info &ghoul2, mdxaBone_v &bonePtr, boltInfo_v &boltList)
 {
 	mdxaSkel_t		*skel;
@@ -3595,6 +4142,7 @@ void RB_SurfaceGhoul( CRenderableSurface *surf )
 	mdxmSurface_t	*surface = surf->surfaceData;
 
 	CBoneCache *bones = surf->boneCache;
+	bones->EvalAll();
 
 #ifndef _G2_GORE //we use this later, for gore
 	delete surf;
@@ -1125,6 +1125,25 @@ image_t	*R_FindImageFile( const char *name, qboolean mipmap, qboolean allowPicmi
 }
 
 
+/*
+===============
+R_PrefetchImageFile
+
+Starts reading the file R_FindImageFile would load, unless the image is
+loaded already
+==============
+*/
+void R_PrefetchImageFile( const char *name ) {
+	if ( !name || !name[0] || name[0] == '$' || name[0] == '*' ) {
+		return;
+	}
+	if ( AllocatedImages.find( GenerateImageMappingName( name ) ) != AllocatedImages.end() ) {
+		return;
+	}
+	R_PrefetchImage( name );
+}
+
+
 /*
 ================
 R_CreateDlightImage
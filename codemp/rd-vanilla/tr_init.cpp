@@ -185,6 +185,10 @@ cvar_t	*r_noPrecacheGLA;
 #endif
 
 cvar_t	*r_noServerGhoul2;
+cvar_t	*r_ghoul2BatchBones;
+cvar_t	*r_ghoul2SkinCache;
+cvar_t	*r_ghoul2SkinThreads;
+cvar_t	*r_ghoul2TraceCull;
 cvar_t	*r_Ghoul2AnimSmooth=0;
 cvar_t	*r_Ghoul2UnSqashAfterSmooth=0;
 //cvar_t	*r_Ghoul2UnSqash;
@@ -1538,6 +1542,9 @@ static consoleCommand_t	commands[] = {
 	{ "imagecacheinfo",		RE_RegisterImages_Info_f },
 	{ "modellist",			R_Modellist_f },
 	{ "modelcacheinfo",		RE_RegisterModels_Info_f },
+	{ "g2bonebench",		G2_BoneBenchmark_f },
+	{ "g2tracebench",		G2_TraceBenchmark_f },
+	{ "g2poolstress",		G2_PoolStress_f },
 };
 
 static const size_t numCommands = ARRAY_LEN( commands );
@@ -1678,6 +1685,10 @@ Ghoul2 Insert Start
 	r_noPrecacheGLA						= ri.Cvar_Get( "r_noPrecacheGLA",					"0",						CVAR_CHEAT, "" );
 #endif
 	r_noServerGhoul2					= ri.Cvar_Get( "r_noserverghoul2",					"0",						CVAR_CHEAT, "" );
+	r_ghoul2BatchBones					= ri.Cvar_Get( "r_ghoul2batchbones",				"1",						CVAR_ARCHIVE_ND, "" );
+	r_ghoul2SkinCache					= ri.Cvar_Get( "r_ghoul2skincache",				"1",						CVAR_ARCHIVE_ND, "" );
+	r_ghoul2SkinThreads					= ri.Cvar_Get( "r_ghoul2skinthreads",				"1",						CVAR_ARCHIVE_ND, "" );
+	r_ghoul2TraceCull					= ri.Cvar_Get( "r_ghoul2tracecull",				"1",						CVAR_ARCHIVE_ND, "" );
 	r_Ghoul2AnimSmooth					= ri.Cvar_Get( "r_ghoul2animsmooth",				"0.3",						CVAR_NONE, "" );
 	r_Ghoul2UnSqashAfterSmooth			= ri.Cvar_Get( "r_ghoul2unsqashaftersmooth",		"1",						CVAR_NONE, "" );
 	broadsword							= ri.Cvar_Get( "broadsword",						"0",						CVAR_ARCHIVE_ND, "" );
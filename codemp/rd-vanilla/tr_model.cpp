@@ -132,6 +132,24 @@ static const byte FakeGLAFile[] =
 
 void RE_LoadWorldMap_Actual( const char *name, world_t &worldData, int index );
 
+// starts reading a file RE_RegisterModels_GetDiskFile will be asked for, unless it has it cached
+//
+static void RE_RegisterModels_PrefetchDiskFile( const char *psModelFileName )
+{
+	char sModelName[MAX_QPATH];
+
+	assert(CachedModels);
+
+	Q_strncpyz(sModelName,psModelFileName,sizeof(sModelName));
+	Q_strlwr  (sModelName);
+
+	CachedModels_t::iterator itModel = CachedModels->find(sModelName);
+	if (itModel == CachedModels->end() || (*itModel).second.pModelDiskImage == NULL)
+	{
+		ri.FS_PrefetchFile( sModelName );
+	}
+}
+
 // returns qtrue if loaded, and sets the supplied qbool to true if it was from cache (instead of disk)
 //   (which we need to know to avoid LittleLong()ing everything again (well, the Mac needs to know anyway)...
 //
@@ -1168,6 +1186,24 @@ fail:
 }
 
 
+/*
+====================
+R_ModelLodFileName
+
+The file a level of detail of a model is in, name_1.md3 for lod 1 of name.md3
+====================
+*/
+static void R_ModelLodFileName( char *filename, int size, const char *name, int lod ) {
+	Q_strncpyz( filename, name, size );
+
+	if ( lod != 0 ) {
+		if ( strrchr( filename, '.' ) ) {
+			*strrchr( filename, '.' ) = 0;
+		}
+		Q_strcat( filename, size, va( "_%d.md3", lod ) );
+	}
+}
+
 /*
 ====================
 RE_RegisterModel
@@ -1288,6 +1324,15 @@ Ghoul2 Insert End
 	}
 	mod->numLods = 0;
 
+	// start reading the lods after the first one, the loop below stops at
+	// the biased one
+	for ( lod = iLODStart - 1; lod >= 0 && lod >= r_lodbias->integer ; lod-- ) {
+		char filename[1024];
+
+		R_ModelLodFileName( filename, sizeof( filename ), name, lod );
+		RE_RegisterModels_PrefetchDiskFile( filename );
+	}
+
 	//
 	// load the files
 	//
@@ -1296,17 +1341,7 @@ Ghoul2 Insert End
 	for ( lod = iLODStart; lod >= 0 ; lod-- ) {
 		char filename[1024];
 
-		strcpy( filename, name );
-
-		if ( lod != 0 ) {
-			char namebuf[80];
-
-			if ( strrchr( filename, '.' ) ) {
-				*strrchr( filename, '.' ) = 0;
-			}
-			sprintf( namebuf, "_%d.md3", lod );
-			strcat( filename, namebuf );
-		}
+		R_ModelLodFileName( filename, sizeof( filename ), name, lod );
 
 		qboolean bAlreadyCached = qfalse;
 		if (!RE_RegisterModels_GetDiskFile(filename, (void **)&buf, &bAlreadyCached))
@@ -1652,6 +1687,14 @@ void RE_BeginRegistration( glconfig_t *glconfigOut ) {
 
 void R_SVModelInit()
 {
+	if (!r_ghoul2BatchBones)
+	{ //the server can load models before the client has registered the renderer cvars
+		r_ghoul2BatchBones = ri.Cvar_Get( "r_ghoul2batchbones", "1", CVAR_ARCHIVE_ND, "" );
+		r_ghoul2SkinCache = ri.Cvar_Get( "r_ghoul2skincache", "1", CVAR_ARCHIVE_ND, "" );
+		r_ghoul2SkinThreads = ri.Cvar_Get( "r_ghoul2skinthreads", "1", CVAR_ARCHIVE_ND, "" );
+		r_ghoul2TraceCull = ri.Cvar_Get( "r_ghoul2tracecull", "1", CVAR_ARCHIVE_ND, "" );
+	}
+
 	R_ModelInit();
 }
 
@@ -3299,6 +3299,53 @@ shader_t *R_FindShaderByName( const char *name ) {
 }
 
 
+/*
+===============
+R_PrefetchShaderImages
+
+Starts reading the images the stages of a shader text map, so ParseStage
+finds the later ones read while it loads the first
+===============
+*/
+static void R_PrefetchShaderImages( const char *shaderText )
+{
+	const char	*text = shaderText;
+	char		*token;
+	int			depth = 0;
+
+	while ( 1 )
+	{
+		token = COM_ParseExt( &text, qtrue );
+		if ( !token[0] )
+		{
+			return;
+		}
+		if ( token[0] == '{' )
+		{
+			depth++;
+		}
+		else if ( token[0] == '}' )
+		{
+			if ( --depth <= 0 )
+			{
+				return;
+			}
+		}
+		else if ( depth == 2 && ( !Q_stricmp( token, "map" ) || !Q_stricmp( token, "clampmap" ) ) )
+		{
+			R_PrefetchImageFile( COM_ParseExt( &text, qfalse ) );
+		}
+		else if ( depth == 2 && ( !Q_stricmp( token, "animMap" ) || !Q_stricmp( token, "clampanimMap" ) || !Q_stricmp( token, "oneshotanimMap" ) ) )
+		{
+			COM_ParseExt( &text, qfalse );	// frequency
+			while ( ( token = COM_ParseExt( &text, qfalse ) )[0] )
+			{
+				R_PrefetchImageFile( token );
+			}
+		}
+	}
+}
+
 inline qboolean IsShader(shader_t *sh, const char *name, const int *lightmapIndex, const byte *styles)
 {
 	int	i;
@@ -3457,6 +3504,7 @@ shader_t *R_FindShader( const char *name, const int *lightmapIndex, const byte *
 	//
 	shaderText = FindShaderInShaderText( strippedName );
 	if ( shaderText ) {
+		R_PrefetchShaderImages( shaderText );
 		if ( !ParseShader( &shaderText ) ) {
 			// had errors, so use default shader
 			shader.defaultShader = true;
@@ -3531,6 +3579,40 @@ shader_t *R_FindShader( const char *name, const int *lightmapIndex, const byte *
 	return FinishShader();
 }
 
+/*
+===============
+R_PrefetchShader
+
+Starts reading the images R_FindShader would load for a shader that isn't
+loaded yet with any lightmap, so registering a list of shaders overlaps the
+reads of the later ones with the first
+===============
+*/
+void R_PrefetchShader( const char *name )
+{
+	char		strippedName[MAX_QPATH];
+	const char	*shaderText;
+	shader_t	*sh;
+
+	if ( !name[0] ) {
+		return;
+	}
+
+	COM_StripExtension( name, strippedName, sizeof( strippedName ) );
+	for ( sh = hashTable[generateHashValue( strippedName, FILE_HASH_SIZE )] ; sh ; sh = sh->next ) {
+		if ( !Q_stricmp( sh->name, strippedName ) ) {
+			return;
+		}
+	}
+
+	shaderText = FindShaderInShaderText( strippedName );
+	if ( shaderText ) {
+		R_PrefetchShaderImages( shaderText );
+	} else {
+		R_PrefetchImageFile( strippedName );
+	}
+}
+
 shader_t *R_FindServerShader( const char *name, const int *lightmapIndex, const byte *styles, qboolean mipRawImage )
 {
 	char		strippedName[MAX_QPATH];
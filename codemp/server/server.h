@@ -45,7 +45,6 @@ typedef struct svEntity_s {
 	int			clusternums[MAX_ENT_CLUSTERS];
 	int			lastCluster;		// if all the clusters don't fit in clusternums
 	int			areanum, areanum2;
-	int			snapshotCounter;	// used to prevent double adding from portal views
 } svEntity_t;
 
 typedef enum {
@@ -60,10 +59,13 @@ typedef struct server_s {
 	int				serverId;			// changes each server start
 	int				restartedServerId;	// serverId before a map_restart
 	int				checksumFeed;		//
-	int				snapshotCounter;	// incremented for each snapshot built
 	int				timeResidual;		// <= 1000 / sv_frame->value
 	int				nextFrameTime;		// when time > nextFrameTime, process world
 	char			*configstrings[MAX_CONFIGSTRINGS];
+	char			*configstringBases[MAX_CONFIGSTRINGS];	// what delta clients have, until SV_FlushConfigstrings
+	char			*configstringDeltas[MAX_CONFIGSTRINGS];	// csd from the base to the string, "" if it goes whole
+	int				pendingConfigstrings[MAX_CONFIGSTRINGS];
+	int				numPendingConfigstrings;
 	svEntity_t		svEntities[MAX_GENTITIES];
 
 	char			*entityParsePoint;	// used during game VM init
@@ -105,8 +107,8 @@ typedef struct clientSnapshot_s {
 	int				first_entity;		// into the circular sv_packet_entities[]
 										// the entities MUST be in increasing state number
 										// order, otherwise the delta compression will fail
-	int				messageSent;		// time the message was transmitted
-	int				messageAcked;		// time the message was acked
+	int				messageSent;		// NET_Milliseconds when the message was transmitted
+	int				messageAcked;		// NET_PacketTime of the packet that acked it
 	int				messageSize;		// used to rate drop packets
 } clientSnapshot_t;
 
@@ -188,6 +190,9 @@ typedef struct client_s {
 
 	int				oldServerTime;
 	qboolean		csUpdated[MAX_CONFIGSTRINGS];
+	qboolean		csFlushed[MAX_CONFIGSTRINGS];	// already got the pending change, ahead of the other clients
+	qboolean		csDeltas;			// said at connect it understands csd configstring deltas
+	qboolean		csDeltasHeld;		// asked for whole strings for now, e.g. while recording a demo
 
 	demoInfo_t		demo;
 } client_t;
@@ -276,6 +281,13 @@ extern	cvar_t	*sv_banFile;
 extern	cvar_t	*sv_maxOOBRate;
 extern	cvar_t	*sv_maxOOBRateIP;
 extern	cvar_t	*sv_autoWhitelist;
+extern	cvar_t	*sv_snapshotStats;
+extern	cvar_t	*sv_snapshotThreads;
+extern	cvar_t	*sv_snapshotDeltaCache;
+extern	cvar_t	*sv_adaptiveSectors;
+extern	cvar_t	*sv_fragmentsPerFrame;
+extern	cvar_t	*sv_traceThreads;
+extern	cvar_t	*sv_configstringDeltas;
 
 extern	serverBan_t serverBans[SERVER_MAXBANS];
 extern	int serverBansCount;
@@ -317,6 +329,8 @@ void SV_MasterShutdown (void);
 void SV_SetConfigstring( int index, const char *val );
 void SV_GetConfigstring( int index, char *buffer, int bufferSize );
 void SV_UpdateConfigstrings( client_t *client );
+void SV_FlushConfigstrings( void );
+void SV_FlushClientConfigstrings( client_t *client );
 
 void SV_SetUserinfo( int index, const char *val );
 void SV_GetUserinfo( int index, char *buffer, int bufferSize );
@@ -426,6 +440,8 @@ clipHandle_t SV_ClipHandleForEntity( const sharedEntity_t *ent );
 
 
 void SV_SectorList_f( void );
+void SV_TraceBench_f( void );
+void SV_TraceStress_f( void );
 
 
 int SV_AreaEntities( const vec3_t mins, const vec3_t maxs, int *entityList, int maxcount );
@@ -442,6 +458,8 @@ int SV_PointContents( const vec3_t p, int passEntityNum );
 
 
 void SV_Trace( trace_t *results, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask, int capsule, int traceFlags, int useLod );
+void SV_TraceBatch( trace_t *results, const traceRequest_t *requests, int numRequests );
+// SV_TraceBatch gives the same results as calling SV_Trace for every request
 // mins and maxs are relative
 
 // if the entire move stays in a solid volume, trace.allsolid will be set,
@@ -462,3 +480,33 @@ void SV_ClipToEntity( trace_t *trace, const vec3_t start, const vec3_t mins, con
 void SV_Netchan_Transmit( client_t *client, msg_t *msg);	//int length, const byte *data );
 void SV_Netchan_TransmitNextFragment( netchan_t *chan );
 qboolean SV_Netchan_Process( client_t *client, msg_t *msg );
+
+//
+// sv_bench.cpp, only in the openjkded-bench build
+//
+#ifdef DEDICATED_BENCH
+typedef enum benchPhase_e {
+	BENCH_GAME,			// GVM_RunFrame
+	BENCH_BOTS,			// SV_BotFrame
+	BENCH_SNAPSHOT,		// building client snapshots
+	BENCH_ENCODE,		// writing and sending snapshot messages
+	BENCH_TRACE,		// SV_Trace, overlaps the game and bot frames
+	BENCH_NUM_PHASES
+} benchPhase_t;
+
+extern int sv_benchSeed;
+
+int64_t	SV_BenchTime( void );
+void	SV_BenchAdd( benchPhase_t phase, int64_t start );
+void	SV_BenchAddTraces( int64_t start, int numTraces );
+
+#define SV_BENCH_BEGIN( var )		int64_t var = SV_BenchTime()
+#define SV_BENCH_END( phase, var )	SV_BenchAdd( phase, var )
+#define SV_BENCH_END_TRACES( var, num )	SV_BenchAddTraces( var, num )
+#define SV_RANDOM_SEED()			sv_benchSeed
+#else
+#define SV_BENCH_BEGIN( var )
+#define SV_BENCH_END( phase, var )
+#define SV_BENCH_END_TRACES( var, num )
+#define SV_RANDOM_SEED()			Com_Milliseconds()
+#endif
@@ -0,0 +1,325 @@
+/*
+===========================================================================
+Copyright (C) 2013 - 2016, OpenJK contributors
+
+This file is part of the OpenJK source code.
+
+OpenJK is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License version 2 as
+published by the Free Software Foundation.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, see <http://www.gnu.org/licenses/>.
+===========================================================================
+*/
+
+// sv_bench.cpp -- headless server benchmark, only built into openjkded-bench
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "server.h"
+
+/*
+=============================================================================
+
+openjkded-bench [--map <name>] [--bots <count>] [--frames <count>]
+                [--warmup <count>] [--seed <seed>] [--json] [+set ...]
+
+Loads the map, adds the bots and then calls SV_Frame directly with a fixed
+msec for every frame, so a run does not depend on the wall clock or on
+network traffic.  The time spent in each phase is summed over a frame and
+every measured frame adds one sample per phase.  Bots never get snapshots
+sent, so the encode phase is what delta compressing each bot's snapshot
+would cost (see SV_BenchEncodeBotSnapshot).
+
+=============================================================================
+*/
+
+#define	BENCH_BUCKETS		24		// power of two microsecond buckets, the last one is open ended
+#define	BENCH_FRAME			BENCH_NUM_PHASES	// whole SV_Frame, reported with the phases
+
+static const char *benchPhaseNames[BENCH_NUM_PHASES + 1] = {
+	"game",
+	"bots",
+	"snapshot",
+	"encode",
+	"trace",
+	"frame",
+};
+
+// stock bots, cycled through to fill --bots
+static const char *benchBotNames[] = {
+	"kyle", "jan", "luke", "lando", "tavion", "desann",
+	"reborn", "stormtrooper", "rosh", "chewbacca", "bobafett", "reelo",
+};
+
+int sv_benchSeed = 1;
+
+static std::atomic<int64_t>	benchPhaseTime[BENCH_NUM_PHASES];	// this frame, nanoseconds
+static std::atomic<int>		benchTraces;						// every measured frame
+
+/*
+===============
+SV_BenchTime
+
+Nanoseconds on a monotonic clock
+===============
+*/
+int64_t SV_BenchTime( void ) {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+/*
+===============
+SV_BenchAdd
+
+Adds the time since start to the phase, may be called from any thread
+===============
+*/
+void SV_BenchAdd( benchPhase_t phase, int64_t start ) {
+	benchPhaseTime[phase] += SV_BenchTime() - start;
+	if ( phase == BENCH_TRACE ) {
+		benchTraces++;
+	}
+}
+
+/*
+===============
+SV_BenchAddTraces
+
+Adds the time since start to the trace phase for a whole batch of traces
+===============
+*/
+void SV_BenchAddTraces( int64_t start, int numTraces ) {
+	benchPhaseTime[BENCH_TRACE] += SV_BenchTime() - start;
+	benchTraces += numTraces;
+}
+
+/*
+===============
+SV_BenchBucket
+===============
+*/
+static int SV_BenchBucket( int64_t usec ) {
+	int		bucket;
+
+	for ( bucket = 0 ; bucket < BENCH_BUCKETS - 1 && usec >= ( 2LL << bucket ) ; bucket++ ) {
+	}
+
+	return bucket;
+}
+
+/*
+===============
+SV_BenchPercentile
+
+samples must be sorted
+===============
+*/
+static double SV_BenchPercentile( const std::vector<int64_t> &samples, double fraction ) {
+	size_t	index;
+
+	if ( samples.empty() ) {
+		return 0.0;
+	}
+	index = (size_t)( fraction * ( samples.size() - 1 ) + 0.5 );
+	return samples[index] / 1000.0;
+}
+
+/*
+===============
+SV_BenchReport
+===============
+*/
+static void SV_BenchReport( std::vector<int64_t> *samples, const char *map, int bots, int connected,
+							int frames, int warmup, int fps, qboolean json ) {
+	std::string	out;
+	int			phase, i, bucket, maxCount;
+	int			histogram[BENCH_BUCKETS];
+	int64_t		total;
+	char		line[256];
+
+	if ( json ) {
+		Com_sprintf( line, sizeof( line ), "{\"map\":\"%s\",\"bots\":%i,\"connected\":%i,\"frames\":%i,\"warmup\":%i,"
+			"\"seed\":%i,\"fps\":%i,\"snapshotThreads\":%i,\"traces\":%i,\"phases\":{",
+			map, bots, connected, frames, warmup, sv_benchSeed, fps, sv_snapshotThreads->integer, (int)benchTraces );
+		out += line;
+	} else {
+		Com_Printf( "\nmap %s, %i/%i bots connected, %i frames at %i fps after %i warmup, seed %i\n",
+			map, connected, bots, frames, fps, warmup, sv_benchSeed );
+		Com_Printf( "%-10s %10s %10s %10s %10s %10s   usec per frame\n", "phase", "mean", "p50", "p95", "p99", "max" );
+	}
+
+	for ( phase = 0 ; phase <= BENCH_NUM_PHASES ; phase++ ) {
+		std::vector<int64_t> &s = samples[phase];
+
+		std::sort( s.begin(), s.end() );
+		total = 0;
+		memset( histogram, 0, sizeof( histogram ) );
+		for ( i = 0 ; i < (int)s.size() ; i++ ) {
+			total += s[i];
+			histogram[SV_BenchBucket( s[i] / 1000 )]++;
+		}
+
+		const double mean = s.empty() ? 0.0 : total / 1000.0 / s.size();
+		const double p50 = SV_BenchPercentile( s, 0.50 );
+		const double p95 = SV_BenchPercentile( s, 0.95 );
+		const double p99 = SV_BenchPercentile( s, 0.99 );
+		const double max = s.empty() ? 0.0 : s.back() / 1000.0;
+
+		if ( json ) {
+			Com_sprintf( line, sizeof( line ), "%s\"%s\":{\"mean\":%.3f,\"p50\":%.3f,\"p95\":%.3f,\"p99\":%.3f,\"max\":%.3f,\"histogram\":[",
+				phase ? "," : "", benchPhaseNames[phase], mean, p50, p95, p99, max );
+			out += line;
+			for ( bucket = 0 ; bucket < BENCH_BUCKETS ; bucket++ ) {
+				Com_sprintf( line, sizeof( line ), "%s%i", bucket ? "," : "", histogram[bucket] );
+				out += line;
+			}
+			out += "]}";
+			continue;
+		}
+
+		Com_Printf( "%-10s %10.1f %10.1f %10.1f %10.1f %10.1f\n", benchPhaseNames[phase], mean, p50, p95, p99, max );
+	}
+
+	if ( json ) {
+		// histogram bucket n counts frames taking [2^n, 2^(n+1)) usec, bucket 0 also has [0, 1)
+		out += "}}\n";
+		for ( i = 0 ; i < (int)out.size() ; i += 1024 ) {
+			Com_Printf( "%s", out.substr( i, 1024 ).c_str() );
+		}
+		return;
+	}
+
+	Com_Printf( "%i traces\n", (int)benchTraces );
+
+	for ( phase = 0 ; phase <= BENCH_NUM_PHASES ; phase++ ) {
+		memset( histogram, 0, sizeof( histogram ) );
+		maxCount = 1;
+		for ( i = 0 ; i < (int)samples[phase].size() ; i++ ) {
+			bucket = SV_BenchBucket( samples[phase][i] / 1000 );
+			histogram[bucket]++;
+			maxCount = Q_max( maxCount, histogram[bucket] );
+		}
+
+		Com_Printf( "\n%s:\n", benchPhaseNames[phase] );
+		for ( bucket = 0 ; bucket < BENCH_BUCKETS ; bucket++ ) {
+			if ( !histogram[bucket] ) {
+				continue;
+			}
+			Com_sprintf( line, sizeof( line ), "%8lld usec %-40s %i\n", bucket ? 1LL << bucket : 0LL,
+				std::string( (size_t)( 40LL * histogram[bucket] / maxCount ), '#' ).c_str(), histogram[bucket] );
+			Com_Printf( "%s", line );
+		}
+	}
+}
+
+/*
+===============
+SV_BenchMain
+
+Runs the benchmark described by the command line and quits
+===============
+*/
+void SV_BenchMain( int argc, char **argv ) {
+	const char				*map = "mp/ffa3";
+	int						bots = 8, frames = 1000, warmup = 100;
+	qboolean				json = qfalse;
+	int						i, frame, phase, frameMsec, connected;
+	int64_t					start;
+	std::vector<int64_t>	samples[BENCH_NUM_PHASES + 1];
+	client_t				*cl;
+
+	for ( i = 1 ; i < argc ; i++ ) {
+		const char *arg = argv[i];
+		const char *value = i + 1 < argc ? argv[i + 1] : "";
+
+		if ( !Q_stricmp( arg, "--json" ) ) {
+			json = qtrue;
+		} else if ( !Q_stricmp( arg, "--map" ) ) {
+			map = value; i++;
+		} else if ( !Q_stricmp( arg, "--bots" ) ) {
+			bots = Com_Clampi( 0, MAX_CLIENTS, atoi( value ) ); i++;
+		} else if ( !Q_stricmp( arg, "--frames" ) ) {
+			frames = Q_max( 1, atoi( value ) ); i++;
+		} else if ( !Q_stricmp( arg, "--warmup" ) ) {
+			warmup = Q_max( 0, atoi( value ) ); i++;
+		} else if ( !Q_stricmp( arg, "--seed" ) ) {
+			sv_benchSeed = atoi( value ); i++;
+		} else if ( arg[0] == '-' && arg[1] == '-' ) {
+			Sys_Error( "Unknown benchmark option %s\n"
+				"usage: openjkded-bench [--map <name>] [--bots <count>] [--frames <count>] [--warmup <count>] [--seed <seed>] [--json] [+set ...]", arg );
+		}
+	}
+
+	for ( phase = 0 ; phase <= BENCH_NUM_PHASES ; phase++ ) {
+		samples[phase].reserve( frames );
+	}
+
+	try {
+		srand( sv_benchSeed );
+
+		if ( sv_maxclients->integer < bots ) {
+			Cvar_Set( "sv_maxclients", va( "%i", bots ) );
+		}
+		Cbuf_ExecuteText( EXEC_NOW, va( "map %s\n", map ) );
+		if ( !com_sv_running->integer ) {
+			Sys_Error( "Couldn't load map %s", map );
+		}
+
+		for ( i = 0 ; i < bots ; i++ ) {
+			Cbuf_ExecuteText( EXEC_NOW, va( "addbot %s 4 free 0\n", benchBotNames[i % ARRAY_LEN( benchBotNames )] ) );
+		}
+
+		frameMsec = 1000 / Q_max( 1, sv_fps->integer );
+		for ( frame = 0 ; frame < warmup + frames ; frame++ ) {
+			Cbuf_Execute();
+
+			if ( frame == warmup ) {
+				benchTraces = 0;
+			}
+			for ( phase = 0 ; phase < BENCH_NUM_PHASES ; phase++ ) {
+				benchPhaseTime[phase] = 0;
+			}
+
+			start = SV_BenchTime();
+			SV_Frame( frameMsec );
+			start = SV_BenchTime() - start;
+
+			if ( !com_sv_running->integer ) {
+				Sys_Error( "Server stopped during the benchmark" );
+			}
+			if ( frame < warmup ) {
+				continue;
+			}
+			for ( phase = 0 ; phase < BENCH_NUM_PHASES ; phase++ ) {
+				samples[phase].push_back( benchPhaseTime[phase] );
+			}
+			samples[BENCH_FRAME].push_back( start );
+		}
+	}
+	catch ( int code ) {
+		Sys_Error( "Benchmark aborted (%i): %s", code, Cvar_VariableString( "com_errorMessage" ) );
+	}
+
+	connected = 0;
+	for ( i = 0, cl = svs.clients ; i < sv_maxclients->integer ; i++, cl++ ) {
+		if ( cl->state == CS_ACTIVE && cl->netchan.remoteAddress.type == NA_BOT ) {
+			connected++;
+		}
+	}
+
+	SV_BenchReport( samples, map, bots, connected, frames, warmup, sv_fps->integer, json );
+
+	Cbuf_ExecuteText( EXEC_NOW, "quit\n" );
+}
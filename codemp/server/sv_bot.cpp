@@ -604,7 +604,9 @@ void SV_BotFrame( int time ) {
 	//NOTE: maybe the game is already shutdown
 	if (!svs.gameStarted)
 		return;
+	SV_BENCH_BEGIN( benchStart );
 	GVM_BotAIStartFrame( time );
+	SV_BENCH_END( BENCH_BOTS, benchStart );
 }
 
 /*
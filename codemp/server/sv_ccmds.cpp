@@ -1966,6 +1966,8 @@ void SV_AddOperatorCommands( void ) {
 	Cmd_AddCommand ("dumpuser", SV_DumpUser_f, "Prints the userinfo for a given userid" );
 	Cmd_AddCommand ("map_restart", SV_MapRestart_f, "Restart the current map" );
 	Cmd_AddCommand ("sectorlist", SV_SectorList_f);
+	Cmd_AddCommand ("tracebench", SV_TraceBench_f, "Times random traces out of every entity, optionally batched, and counts the entities each area query checked" );
+	Cmd_AddCommand ("tracestress", SV_TraceStress_f, "Runs random collision traces on several threads at once and compares them with the same traces run one at a time" );
 	Cmd_AddCommand ("map", SV_Map_f, "Load a new map with cheats disabled" );
 	Cmd_SetCommandCompletionFunc( "map", SV_CompleteMapName );
 	Cmd_AddCommand ("devmap", SV_Map_f, "Load a new map with cheats enabled" );
@@ -309,6 +309,8 @@ gotnewcl:
 	// save the challenge
 	newcl->challenge = challenge;
 
+	newcl->csDeltas = (qboolean)( atoi( Info_ValueForKey( userinfo, "csdelta" ) ) != 0 );
+
 	// save the address
 	Netchan_Setup (NS_SERVER, &newcl->netchan , from, qport);
 
@@ -550,6 +552,9 @@ void SV_ClientEnterWorld( client_t *client, usercmd_t *cmd ) {
 	sharedEntity_t *ent;
 
 	Com_DPrintf( "Going from CS_PRIMED to CS_ACTIVE for %s\n", client->name );
+
+	// the deltas held back start from strings this client may not have
+	SV_FlushConfigstrings();
 	client->state = CS_ACTIVE;
 
 	if (sv_autoWhitelist->integer) {
@@ -1212,6 +1217,9 @@ static void SV_UpdateUserinfo_f( client_t *cl ) {
 
 	Q_strncpyz( cl->userinfo, arg, sizeof(cl->userinfo) );
 
+	// read before the change limit, a client starting a demo waits on this
+	cl->csDeltasHeld = (qboolean)( atoi( Info_ValueForKey( cl->userinfo, "csdelta" ) ) == 0 );
+
 #ifdef FINAL_BUILD
 	if (cl->lastUserInfoChange > svs.time)
 	{
@@ -1437,8 +1445,9 @@ static void SV_UserMove( client_t *cl, msg_t *msg, qboolean delta ) {
 		oldcmd = cmd;
 	}
 
-	// save time for ping calculation
-	cl->frames[ cl->messageAcknowledge & PACKET_MASK ].messageAcked = svs.time;
+	// save time for ping calculation, from when the packet arrived rather than
+	// when the server got around to it
+	cl->frames[ cl->messageAcknowledge & PACKET_MASK ].messageAcked = NET_PacketTime();
 
 	// TTimo
 	// catch the no-cp-yet situation before SV_ClientEnterWorld
@@ -2796,7 +2796,7 @@ void SV_InitGame( qboolean restart ) {
 	for ( i=0, cl=svs.clients; i<sv_maxclients->integer; i++, cl++ )
 		cl->gentity = NULL;
 
-	GVM_InitGame( sv.time, Com_Milliseconds(), restart );
+	GVM_InitGame( sv.time, SV_RANDOM_SEED(), restart );
 }
 
 void SV_BindGame( void ) {
@@ -3118,9 +3118,19 @@ void SV_BindGame( void ) {
 		gi.G2API_CleanEntAttachments			= SV_G2API_CleanEntAttachments;
 		gi.G2API_OverrideServer					= SV_G2API_OverrideServer;
 		gi.G2API_GetSurfaceName					= SV_G2API_GetSurfaceName;
+		gi.TraceBatch							= SV_TraceBatch;
+		gi.Cvar_FindHandle						= Cvar_FindHandle;
+		gi.Cvar_HandleValue						= Cvar_HandleValue;
+		gi.Cvar_HandleIntegerValue				= Cvar_HandleIntegerValue;
+		gi.Cvar_HandleStringBuffer				= Cvar_HandleStringBuffer;
 
 		GetGameAPI = (GetGameAPI_t)gvm->GetModuleAPI;
 		ret = GetGameAPI( GAME_API_VERSION, &gi );
+		if ( !ret ) {
+			// modules from before the appended imports only take the original
+			// table, which ours starts with
+			ret = GetGameAPI( GAME_API_VERSION_1, &gi );
+		}
 		if ( !ret ) {
 			//free VM?
 			svs.gameStarted = qfalse;
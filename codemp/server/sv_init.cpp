@@ -103,6 +103,177 @@ void SV_UpdateConfigstrings(client_t *client)
 	}
 }
 
+/*
+===============
+SV_TakesConfigstringDeltas
+
+Whether SV_SetConfigstring leaves the client's updates to SV_FlushConfigstrings.
+Clients recording a demo, on either side, get whole strings so the demo
+plays anywhere.
+===============
+*/
+static qboolean SV_TakesConfigstringDeltas( const client_t *client ) {
+	return (qboolean)( client->csDeltas && !client->csDeltasHeld && sv_configstringDeltas->integer && !client->demo.demorecording );
+}
+
+/*
+===============
+SV_BuildConfigstringDelta
+
+Builds the csd payload that turns from into to on the client, if it's
+shorter than to and fits in one command
+===============
+*/
+static qboolean SV_BuildConfigstringDelta( const char *from, const char *to, char *delta, int deltaSize ) {
+	char	check[BIG_INFO_STRING];
+
+	if ( !Info_BuildDelta( from, to, delta, deltaSize ) ) {
+		return qfalse;
+	}
+	if ( strlen( delta ) >= strlen( to ) || strchr( delta, '\"' ) ) {
+		return qfalse;
+	}
+
+	// the client applies it to the string it has, which must give back
+	// exactly this one
+	Q_strncpyz( check, from, sizeof( check ) );
+	if ( !Info_ApplyDelta( check, delta, sizeof( check ) ) || strcmp( check, to ) ) {
+		return qfalse;
+	}
+	return qtrue;
+}
+
+// set while a flush sends, so the commands it queues don't start another
+static qboolean flushingConfigstrings = qfalse;
+
+/*
+===============
+SV_PendingConfigstringDelta
+
+The csd payload for a configstring changed this frame, built from its base
+the first time a client needs it and kept until the string changes again.
+NULL when the client has to get the whole string.
+===============
+*/
+static const char *SV_PendingConfigstringDelta( int index ) {
+	char	delta[MAX_STRING_CHARS - 24];
+
+	if ( !sv.configstringDeltas[index] ) {
+		if ( SV_BuildConfigstringDelta( sv.configstringBases[index], sv.configstrings[index], delta, sizeof( delta ) ) ) {
+			sv.configstringDeltas[index] = CopyString( delta );
+		} else {
+			sv.configstringDeltas[index] = CopyString( "" );
+		}
+	}
+	return sv.configstringDeltas[index][0] ? sv.configstringDeltas[index] : NULL;
+}
+
+/*
+===============
+SV_SendPendingConfigstring
+
+Sends a configstring changed this frame to one active client, as a csd if
+it takes them and one could be built, else as a whole cs
+===============
+*/
+static void SV_SendPendingConfigstring( client_t *client, int index ) {
+	const char	*delta;
+
+	if ( index == CS_SERVERINFO && client->gentity && (client->gentity->r.svFlags & SVF_NOSERVERINFO) ) {
+		return;
+	}
+
+	// clients that stopped taking deltas meanwhile still missed the
+	// change, just not as a delta
+	delta = SV_TakesConfigstringDeltas( client ) ? SV_PendingConfigstringDelta( index ) : NULL;
+	if ( delta ) {
+		SV_SendServerCommand( client, "csd %i \"%s\"\n", index, delta );
+	} else {
+		SV_SendConfigstring( client, index );
+	}
+}
+
+/*
+===============
+SV_FlushConfigstrings
+
+Sends the configstrings changed since the last flush to the active clients
+that take deltas, once per string however often it changed. Info strings
+go as a "csd" of the changed keys, anything else as a whole "cs". Clients
+that already got a string from SV_FlushClientConfigstrings are skipped.
+===============
+*/
+void SV_FlushConfigstrings( void ) {
+	client_t	*client;
+	int			i, j, index;
+
+	if ( flushingConfigstrings || !sv.numPendingConfigstrings ) {
+		return;
+	}
+	flushingConfigstrings = qtrue;
+
+	for ( i = 0 ; i < sv.numPendingConfigstrings ; i++ ) {
+		index = sv.pendingConfigstrings[i];
+
+		for ( j = 0, client = svs.clients ; j < sv_maxclients->integer ; j++, client++ ) {
+			if ( client->csFlushed[index] ) {
+				client->csFlushed[index] = qfalse;
+				continue;
+			}
+			if ( client->state < CS_ACTIVE || !client->csDeltas ) {
+				continue;
+			}
+			if ( strcmp( sv.configstringBases[index], sv.configstrings[index] ) ) {
+				SV_SendPendingConfigstring( client, index );
+			}
+		}
+
+		Z_Free( sv.configstringBases[index] );
+		sv.configstringBases[index] = NULL;
+		if ( sv.configstringDeltas[index] ) {
+			Z_Free( sv.configstringDeltas[index] );
+			sv.configstringDeltas[index] = NULL;
+		}
+	}
+
+	sv.numPendingConfigstrings = 0;
+	flushingConfigstrings = qfalse;
+}
+
+/*
+===============
+SV_FlushClientConfigstrings
+
+Sends one client that takes deltas the configstrings changed this frame it
+hasn't had yet, so a command queued for it doesn't overtake them. The rest
+of the clients still get them at the end of the frame. If a string changes
+again after this, the client gets it whole, since it no longer has the base
+the other clients' delta starts from.
+===============
+*/
+void SV_FlushClientConfigstrings( client_t *client ) {
+	int		i, index;
+
+	if ( flushingConfigstrings || client->state < CS_ACTIVE || !SV_TakesConfigstringDeltas( client ) ) {
+		return;
+	}
+	flushingConfigstrings = qtrue;
+
+	for ( i = 0 ; i < sv.numPendingConfigstrings ; i++ ) {
+		index = sv.pendingConfigstrings[i];
+		if ( client->csFlushed[index] ) {
+			continue;
+		}
+
+		client->csFlushed[index] = qtrue;
+		if ( strcmp( sv.configstringBases[index], sv.configstrings[index] ) ) {
+			SV_SendPendingConfigstring( client, index );
+		}
+	}
+
+	flushingConfigstrings = qfalse;
+}
+
 /*
 ===============
 SV_SetConfigstring
@@ -112,6 +283,7 @@ SV_SetConfigstring
 void SV_SetConfigstring (int index, const char *val) {
 	int		i;
 	client_t	*client;
+	qboolean	broadcast;
 
 	if ( index < 0 || index >= MAX_CONFIGSTRINGS ) {
 		Com_Error (ERR_DROP, "SV_SetConfigstring: bad index %i\n", index);
@@ -126,13 +298,25 @@ void SV_SetConfigstring (int index, const char *val) {
 		return;
 	}
 
-	// change the string in sv
-	Z_Free( sv.configstrings[index] );
+	broadcast = (qboolean)( sv.state == SS_GAME || sv.restarting );
+
+	// change the string in sv, keeping the first old one of this frame as
+	// the base for the delta clients
+	if ( broadcast && sv_configstringDeltas->integer && !sv.configstringBases[index] ) {
+		sv.configstringBases[index] = sv.configstrings[index];
+		sv.pendingConfigstrings[sv.numPendingConfigstrings++] = index;
+	} else {
+		Z_Free( sv.configstrings[index] );
+	}
 	sv.configstrings[index] = CopyString( val );
+	if ( sv.configstringDeltas[index] ) {
+		Z_Free( sv.configstringDeltas[index] );
+		sv.configstringDeltas[index] = NULL;
+	}
 
 	// send it to all the clients if we aren't
 	// spawning a new server
-	if ( sv.state == SS_GAME || sv.restarting ) {
+	if ( broadcast ) {
 
 		// send the data to all relevent clients
 		for (i = 0, client = svs.clients; i < sv_maxclients->integer ; i++, client++) {
@@ -145,6 +329,11 @@ void SV_SetConfigstring (int index, const char *val) {
 			if ( index == CS_SERVERINFO && client->gentity && (client->gentity->r.svFlags & SVF_NOSERVERINFO) ) {
 				continue;
 			}
+			// unless it already got this frame's change early, and with it
+			// lost the base of the delta
+			if ( SV_TakesConfigstringDeltas( client ) && !client->csFlushed[index] ) {
+				continue;
+			}
 
 			SV_SendConfigstring(client, index);
 		}
@@ -382,6 +571,12 @@ void SV_ClearServer(void) {
 		if ( sv.configstrings[i] ) {
 			Z_Free( sv.configstrings[i] );
 		}
+		if ( sv.configstringBases[i] ) {
+			Z_Free( sv.configstringBases[i] );
+		}
+		if ( sv.configstringDeltas[i] ) {
+			Z_Free( sv.configstringDeltas[i] );
+		}
 	}
 
 //	CM_ClearMap();
@@ -586,7 +781,7 @@ Ghoul2 Insert End
 	Cvar_Set("cl_paused", "0");
 
 	// get a new checksum feed and restart the file system
-	srand(Com_Milliseconds());
+	srand(SV_RANDOM_SEED());
 	sv.checksumFeed = ( ((int) rand() << 16) ^ rand() ) ^ Com_Milliseconds();
 	FS_Restart( sv.checksumFeed );
 
@@ -771,9 +966,7 @@ void SV_BotInitBotLib(void);
 
 #ifdef DEDICATED
 
-#define G2_VERT_SPACE_SERVER_SIZE 256
 IHeapAllocator *G2VertSpaceServer = NULL;
-CMiniHeap IHeapAllocator_singleton(G2_VERT_SPACE_SERVER_SIZE * 1024);
 
 
 /*
@@ -907,7 +1100,13 @@ static void SV_InitRef( void ) {
 
 	//FIXME: Might have to do something about this...
 	ri.GetG2VertSpaceServer = GetG2VertSpaceServer;
-	G2VertSpaceServer = &IHeapAllocator_singleton;
+	G2VertSpaceServer = Frame_HeapAllocator( FRAME_ARENA_SERVER );
+
+	ri.ParallelFor = Com_ParallelFor;
+
+	ri.FS_PrefetchFile = FS_PrefetchFile;
+
+	ri.Z_HeapAllocs = Z_HeapAllocs;
 
 	ret = GetRefAPI( REF_API_VERSION, &ri );
 
@@ -1014,6 +1213,14 @@ void SV_Init (void) {
 	sv_maxOOBRateIP = Cvar_Get("sv_maxOOBRateIP", "1", CVAR_ARCHIVE, "Maximum rate of handling incoming server commands per IP address" );
 	sv_autoWhitelist = Cvar_Get("sv_autoWhitelist", "1", CVAR_ARCHIVE, "Save player IPs to allow them using server during DOS attack" );
 
+	sv_snapshotStats = Cvar_Get( "sv_snapshotStats", "0", 0, "Print snapshot visibility cache counters once a second" );
+	sv_snapshotThreads = Cvar_Get( "sv_snapshotThreads", "1", CVAR_ARCHIVE_ND, "Number of threads used to build and encode client snapshots" );
+	sv_snapshotDeltaCache = Cvar_Get( "sv_snapshotDeltaCache", "1", CVAR_ARCHIVE_ND, "Encode identical entity deltas once per frame and share them between clients" );
+	sv_adaptiveSectors = Cvar_Get( "sv_adaptiveSectors", "1", CVAR_ARCHIVE_ND, "Subdivide the entity sector tree where entities are dense instead of using a fixed depth, applied on map load" );
+	sv_fragmentsPerFrame = Cvar_Get( "sv_fragmentsPerFrame", "4", CVAR_ARCHIVE_ND, "Most fragments of a large message sent to one client per server frame, rate permitting" );
+	sv_traceThreads = Cvar_Get( "sv_traceThreads", "1", CVAR_ARCHIVE_ND, "Number of threads used to trace batched traces through the world" );
+	sv_configstringDeltas = Cvar_Get( "sv_configstringDeltas", "0", CVAR_ARCHIVE_ND, "Send configstring changes to clients that support it as info key deltas, merged per frame" );
+
 	// initialize bot cvars so they are listed and can be set before loading the botlib
 	SV_BotInitCvars();
 
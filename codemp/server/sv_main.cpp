@@ -72,6 +72,13 @@ cvar_t	*sv_banFile;
 cvar_t	*sv_maxOOBRate;
 cvar_t	*sv_maxOOBRateIP;
 cvar_t	*sv_autoWhitelist;
+cvar_t	*sv_snapshotStats;		// print snapshot visibility cache counters
+cvar_t	*sv_snapshotThreads;	// threads used to build and encode snapshots
+cvar_t	*sv_snapshotDeltaCache;	// share encoded entity deltas between clients
+cvar_t	*sv_adaptiveSectors;	// split entity sectors where entities are dense
+cvar_t	*sv_fragmentsPerFrame;	// fragments of large messages sent to a client per frame
+cvar_t	*sv_traceThreads;		// threads used for the world part of batched traces
+cvar_t	*sv_configstringDeltas;	// send info configstring changes as key deltas once per frame
 
 serverBan_t serverBans[SERVER_MAXBANS];
 int serverBansCount = 0;
@@ -121,6 +128,12 @@ not have future snapshot_t executed before it is executed
 void SV_AddServerCommand( client_t *client, const char *cmd ) {
 	int		index, i;
 
+	// configstring changes held back for deltas go out to this client
+	// before anything sent after them
+	if ( sv.numPendingConfigstrings ) {
+		SV_FlushClientConfigstrings( client );
+	}
+
 	// do not send commands until the gamestate has been sent
 	if ( client->state < CS_PRIMED ) {
 		return;
@@ -1146,6 +1159,8 @@ void SV_Frame( int msec ) {
 	int		frameMsec;
 	int		startTime;
 
+	Frame_Reset( FRAME_ARENA_SERVER );
+
 	// the menu kills the server with this cvar
 	if ( sv_killserver->integer ) {
 		SV_Shutdown ("Server was killed.\n");
@@ -1228,7 +1243,9 @@ void SV_Frame( int msec ) {
 		sv.time += frameMsec;
 
 		// let everything in the world think and move
+		SV_BENCH_BEGIN( benchStart );
 		GVM_RunFrame( sv.time );
+		SV_BENCH_END( BENCH_GAME, benchStart );
 	}
 
 	//rww - RAGDOLL_BEGIN
@@ -1242,6 +1259,9 @@ void SV_Frame( int msec ) {
 	// check timeouts
 	SV_CheckTimeouts();
 
+	// merge this frame's configstring changes into deltas
+	SV_FlushConfigstrings();
+
 	// send messages back to the clients
 	SV_SendClientMessages();
 
@@ -21,6 +21,9 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 ===========================================================================
 */
 
+#include <atomic>
+#include <mutex>
+
 #include "server.h"
 #include "qcommon/cm_public.h"
 
@@ -46,6 +49,188 @@ A normal server packet will look like:
 =============================================================================
 */
 
+/*
+=============================================================================
+
+Entity delta cache
+
+Clients looking at the same part of the map mostly get the same entity
+deltas, from the same old state to the same new one.  Each distinct delta
+is encoded once per frame and the bits are spliced into the other clients'
+messages with MSG_WriteBitString.
+
+=============================================================================
+*/
+
+#define	DELTA_CACHE_ENTRIES		4096
+#define	DELTA_CACHE_HASH		8192		// must be a power of two
+#define	DELTA_CACHE_LOCKS		32			// must divide DELTA_CACHE_HASH
+#define	DELTA_CACHE_DATA		(1024*1024)
+#define	MAX_DELTA_BYTES			1024		// well above the largest entityState_t delta
+
+typedef struct deltaCacheEntry_s {
+	struct deltaCacheEntry_s	*next;
+	unsigned int				hash;
+	qboolean					force;
+	entityState_t				from;
+	entityState_t				to;
+	int							bits;
+	int							oldsize;	// the scratch message's msg_t oldsize, added on every splice
+	const byte					*data;
+} deltaCacheEntry_t;
+
+typedef struct deltaCache_s {
+	qboolean			active;
+
+	deltaCacheEntry_t	*hashTable[DELTA_CACHE_HASH];
+	std::mutex			locks[DELTA_CACHE_LOCKS];		// protect the hash chains
+	deltaCacheEntry_t	entries[DELTA_CACHE_ENTRIES];
+	std::atomic<int>	numEntries;
+	byte				data[DELTA_CACHE_DATA];
+	std::atomic<int>	dataUsed;
+
+	// sv_snapshotStats counters
+	std::atomic<int>	numHits;
+	std::atomic<int>	numMisses;
+} deltaCache_t;
+
+static deltaCache_t svDeltaCache;
+
+/*
+===============
+SV_BeginDeltaCache
+===============
+*/
+static void SV_BeginDeltaCache( void ) {
+	svDeltaCache.active = (qboolean)( sv_snapshotDeltaCache->integer != 0 );
+	if ( !svDeltaCache.active ) {
+		return;
+	}
+
+	Com_Memset( svDeltaCache.hashTable, 0, sizeof( svDeltaCache.hashTable ) );
+	svDeltaCache.numEntries = 0;
+	svDeltaCache.dataUsed = 0;
+}
+
+/*
+===============
+SV_EndDeltaCache
+===============
+*/
+static void SV_EndDeltaCache( void ) {
+	svDeltaCache.active = qfalse;
+}
+
+/*
+===============
+SV_DeltaCacheHash
+===============
+*/
+static unsigned int SV_DeltaCacheHash( const entityState_t *from, const entityState_t *to, qboolean force ) {
+	const int		*f = (const int *)from;
+	const int		*t = (const int *)to;
+	unsigned int	hash;
+	size_t			i;
+
+	hash = force ? 0x9e3779b9u : 2166136261u;
+	for ( i = 0 ; i < sizeof( entityState_t ) / 4 ; i++ ) {
+		hash = ( hash ^ (unsigned int)f[i] ) * 16777619u;
+		hash = ( hash ^ (unsigned int)t[i] ) * 16777619u;
+	}
+
+	return hash;
+}
+
+/*
+===============
+SV_WriteDeltaEntity
+
+MSG_WriteDeltaEntity through the delta cache. Safe to call from
+several snapshot encoding threads at once.
+===============
+*/
+static void SV_WriteDeltaEntity( msg_t *msg, entityState_t *from, entityState_t *to, qboolean force ) {
+	unsigned int		hash;
+	int					slot, offset, bytes;
+	deltaCacheEntry_t	*entry;
+	msg_t				scratch;
+	byte				scratchBuf[MAX_DELTA_BYTES];
+
+	if ( !svDeltaCache.active ) {
+		MSG_WriteDeltaEntity( msg, from, to, force );
+		return;
+	}
+
+	// unchanged entities don't write anything, no point hashing them
+	if ( !force && !memcmp( from, to, sizeof( *to ) ) ) {
+		return;
+	}
+
+	hash = SV_DeltaCacheHash( from, to, force );
+	std::mutex &lock = svDeltaCache.locks[hash & (DELTA_CACHE_LOCKS-1)];
+	deltaCacheEntry_t **chain = &svDeltaCache.hashTable[hash & (DELTA_CACHE_HASH-1)];
+
+	{
+		std::lock_guard<std::mutex> guard( lock );
+
+		for ( entry = *chain ; entry ; entry = entry->next ) {
+			if ( entry->hash == hash && entry->force == force
+				&& !memcmp( &entry->to, to, sizeof( *to ) )
+				&& !memcmp( &entry->from, from, sizeof( *from ) ) ) {
+				break;
+			}
+		}
+	}
+
+	// entries are never changed once they are in a chain
+	if ( entry ) {
+		svDeltaCache.numHits++;
+		if ( !MSG_WriteBitString( msg, entry->data, entry->bits ) ) {
+			MSG_WriteDeltaEntity( msg, from, to, force );
+		} else {
+			msg->oldsize += entry->oldsize;
+		}
+		return;
+	}
+
+	svDeltaCache.numMisses++;
+
+	MSG_Init( &scratch, scratchBuf, sizeof( scratchBuf ) );
+	MSG_WriteDeltaEntity( &scratch, from, to, force );
+	if ( scratch.overflowed || !MSG_WriteBitString( msg, scratchBuf, scratch.bit ) ) {
+		MSG_WriteDeltaEntity( msg, from, to, force );
+		return;
+	}
+	msg->oldsize += scratch.oldsize;
+
+	// a miss is only kept while there are entries and data left this frame.
+	// The counters keep counting past the end, so once either runs out no
+	// later delta is kept either, and until SV_BeginDeltaCache empties it
+	// every miss still probes its chain, encodes into scratch and copies
+	// the bits over
+	bytes = ( scratch.bit + 7 ) >> 3;
+	slot = svDeltaCache.numEntries++;
+	offset = svDeltaCache.dataUsed.fetch_add( bytes );
+	if ( slot >= DELTA_CACHE_ENTRIES || offset + bytes > DELTA_CACHE_DATA ) {
+		return;
+	}
+
+	entry = &svDeltaCache.entries[slot];
+	entry->hash = hash;
+	entry->force = force;
+	entry->from = *from;
+	entry->to = *to;
+	entry->bits = scratch.bit;
+	entry->oldsize = scratch.oldsize;
+	entry->data = svDeltaCache.data + offset;
+	Com_Memcpy( svDeltaCache.data + offset, scratchBuf, bytes );
+
+	// a duplicate from another thread racing on the same delta is harmless
+	std::lock_guard<std::mutex> guard( lock );
+	entry->next = *chain;
+	*chain = entry;
+}
+
 /*
 =============
 SV_EmitPacketEntities
@@ -89,7 +274,7 @@ static void SV_EmitPacketEntities( clientSnapshot_t *from, clientSnapshot_t *to,
 			// delta update from old position
 			// because the force parm is qfalse, this will not result
 			// in any bytes being emited if the entity has not changed at all
-			MSG_WriteDeltaEntity (msg, oldent, newent, qfalse );
+			SV_WriteDeltaEntity (msg, oldent, newent, qfalse );
 			oldindex++;
 			newindex++;
 			continue;
@@ -97,7 +282,7 @@ static void SV_EmitPacketEntities( clientSnapshot_t *from, clientSnapshot_t *to,
 
 		if ( newnum < oldnum ) {
 			// this is a new entity, send it from the baseline
-			MSG_WriteDeltaEntity (msg, &sv.svEntities[newnum].baseline, newent, qtrue );
+			SV_WriteDeltaEntity (msg, &sv.svEntities[newnum].baseline, newent, qtrue );
 			newindex++;
 			continue;
 		}
@@ -117,19 +302,17 @@ static void SV_EmitPacketEntities( clientSnapshot_t *from, clientSnapshot_t *to,
 
 /*
 ==================
-SV_WriteSnapshotToClient
+SV_SnapshotDeltaFrame
+
+Picks the frame the snapshot about to be sent will be delta compressed
+against, or NULL if it has to be sent in full.
 ==================
 */
-static void SV_WriteSnapshotToClient( client_t *client, msg_t *msg ) {
-	clientSnapshot_t	*frame, *oldframe;
+static clientSnapshot_t *SV_SnapshotDeltaFrame( client_t *client, int *deltaFrame ) {
+	clientSnapshot_t	*oldframe;
 	int					lastframe;
-	int					i;
-	int					snapFlags;
 	int					deltaMessage;
 
-	// this is the snapshot we are creating
-	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
-
 	// bots never acknowledge, but it doesn't matter since the only use case is for serverside demos
 	// in which case we can delta against the very last message every time
 	deltaMessage = client->deltaMessage;
@@ -179,6 +362,26 @@ static void SV_WriteSnapshotToClient( client_t *client, msg_t *msg ) {
 		client->demo.demowaiting = qfalse;
 	}
 
+	*deltaFrame = lastframe;
+	return oldframe;
+}
+
+/*
+==================
+SV_WriteSnapshotToClient
+
+Only touches the client itself, so snapshots for different clients
+may be written on different threads.
+==================
+*/
+static void SV_WriteSnapshotToClient( client_t *client, clientSnapshot_t *oldframe, int lastframe, msg_t *msg ) {
+	clientSnapshot_t	*frame;
+	int					i;
+	int					snapFlags;
+
+	// this is the snapshot we are creating
+	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
+
 	MSG_WriteByte (msg, svc_snapshot);
 
 	// NOTE, MRE: now sent at the start of every message from server to client
@@ -307,8 +510,9 @@ Build a client snapshot structure
 */
 
 typedef struct snapshotEntityNumbers_s {
-	int		numSnapshotEntities;
-	int		snapshotEntities[MAX_SNAPSHOT_ENTITIES];
+	int			numSnapshotEntities;
+	int			snapshotEntities[MAX_SNAPSHOT_ENTITIES];
+	uint32_t	added[MAX_GENTITIES/32];	// prevents double adding from portal views
 } snapshotEntityNumbers_t;
 
 /*
@@ -339,12 +543,14 @@ static int QDECL SV_QsortEntityNumbers( const void *a, const void *b ) {
 SV_AddEntToSnapshot
 ===============
 */
-static void SV_AddEntToSnapshot( svEntity_t *svEnt, sharedEntity_t *gEnt, snapshotEntityNumbers_t *eNums ) {
+static void SV_AddEntToSnapshot( sharedEntity_t *gEnt, snapshotEntityNumbers_t *eNums ) {
+	int		e = gEnt->s.number;
+
 	// if we have already added this entity to this snapshot, don't add again
-	if ( svEnt->snapshotCounter == sv.snapshotCounter ) {
+	if ( eNums->added[e >> 5] & (1u << (e & 31)) ) {
 		return;
 	}
-	svEnt->snapshotCounter = sv.snapshotCounter;
+	eNums->added[e >> 5] |= 1u << (e & 31);
 
 	// if we are full, silently discard entities
 	if ( eNums->numSnapshotEntities == MAX_SNAPSHOT_ENTITIES ) {
@@ -355,40 +561,110 @@ static void SV_AddEntToSnapshot( svEntity_t *svEnt, sharedEntity_t *gEnt, snapsh
 	eNums->numSnapshotEntities++;
 }
 
+/*
+=============================================================================
+
+Per-frame visibility cache
+
+Everything that decides whether an entity is potentially visible from a
+viewpoint, apart from the per-client SVF_* filters, only depends on the
+viewpoint's area and cluster. Clients standing in the same cluster share
+one view, so the area and PVS tests are done once per distinct viewpoint
+instead of once per client.
+
+=============================================================================
+*/
+
+#define	MAX_SNAPSHOT_VIEWS		64		// distinct (area, cluster) pairs cached per frame
+#define	SNAPSHOT_ENTITY_WORDS	(MAX_GENTITIES/32)
+
+typedef struct snapshotView_s {
+	int			area;
+	int			cluster;
+	int			areabytes;
+	byte		areabits[MAX_MAP_AREA_BYTES];
+	uint32_t	visible[SNAPSHOT_ENTITY_WORDS];		// candidates in a connected area and the PVS
+} snapshotView_t;
+
+typedef struct snapshotVisibility_s {
+	qboolean		valid;
+
+	uint32_t		candidates[SNAPSHOT_ENTITY_WORDS];	// linked entities that may be sent at all
+	uint32_t		forced[SNAPSHOT_ENTITY_WORDS];		// candidates that can bypass the PVS
+	int				numViews;
+	snapshotView_t	views[MAX_SNAPSHOT_VIEWS];
+	std::mutex		lock;								// protects views and the counters
+
+	// sv_snapshotStats counters
+	int				statsTime;
+	int				numSnapshots;
+	int				numViewpoints;
+	int				numViewsBuilt;
+	int				numEntityTests;
+	int				numNaiveTests;
+} snapshotVisibility_t;
+
+static snapshotVisibility_t svVis;
+
 /*
 ===============
-SV_AddEntitiesVisibleFromPoint
+SV_EntityInPVS
+
+Returns qtrue if any of the entity's clusters is set in the bitvector.
 ===============
 */
-float g_svCullDist = -1.0f;
-static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *frame,
-									snapshotEntityNumbers_t *eNums, qboolean portal ) {
-	int		e, i;
-	sharedEntity_t *ent;
-	svEntity_t	*svEnt;
-	int		l;
-	int		clientarea, clientcluster;
-	int		leafnum;
-	byte	*clientpvs;
-	byte	*bitvector;
-	vec3_t	difference;
-	float	length, radius;
+static qboolean SV_EntityInPVS( const svEntity_t *svEnt, const byte *bitvector ) {
+	int		i, l;
 
-	// during an error shutdown message we may need to transmit
-	// the shutdown message after the server has shutdown, so
-	// specfically check for it
-	if ( !sv.state ) {
-		return;
+	if ( !svEnt->numClusters ) {
+		return qfalse;
+	}
+	l = 0;
+	for ( i=0 ; i < svEnt->numClusters ; i++ ) {
+		l = svEnt->clusternums[i];
+		if ( bitvector[l >> 3] & (1 << (l&7) ) ) {
+			return qtrue;
+		}
+	}
+
+	// if we haven't found it to be visible,
+	// check overflow clusters that coudln't be stored
+	if ( svEnt->lastCluster ) {
+		for ( ; l <= svEnt->lastCluster ; l++ ) {
+			if ( bitvector[l >> 3] & (1 << (l&7) ) ) {
+				break;
+			}
+		}
+		if ( l == svEnt->lastCluster ) {
+			return qfalse;	// not visible
+		}
+		return qtrue;
 	}
 
-	leafnum = CM_PointLeafnum (origin);
-	clientarea = CM_LeafArea (leafnum);
-	clientcluster = CM_LeafCluster (leafnum);
+	return qfalse;
+}
 
-	// calculate the visible areas
-	frame->areabytes = CM_WriteAreaBits( frame->areabits, clientarea );
+/*
+===============
+SV_BeginSnapshotVisibility
+
+Collects the entities that can be sent this frame. Must be called after
+the game has run, and the cache must be dropped with
+SV_EndSnapshotVisibility before the game touches its entities again.
+===============
+*/
+static void SV_BeginSnapshotVisibility( void ) {
+	int				e;
+	sharedEntity_t	*ent;
+
+	Com_Memset( svVis.candidates, 0, sizeof( svVis.candidates ) );
+	Com_Memset( svVis.forced, 0, sizeof( svVis.forced ) );
+	svVis.numViews = 0;
+	svVis.valid = qtrue;
 
-	clientpvs = CM_ClusterPVS (clientcluster);
+	if ( !sv.state ) {
+		return;
+	}
 
 	for ( e = 0 ; e < sv.num_entities ; e++ ) {
 		ent = SV_GentityNum(e);
@@ -413,178 +689,368 @@ static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *fra
 			continue;
 		}
 
-		// entities can be flagged to be sent to only one client
-		if ( ent->r.svFlags & SVF_SINGLECLIENT ) {
-			if ( ent->r.singleClient != frame->ps.clientNum ) {
-				continue;
-			}
-		}
-		// entities can be flagged to be sent to everyone but one client
-		if ( ent->r.svFlags & SVF_NOTSINGLECLIENT ) {
-			if ( ent->r.singleClient == frame->ps.clientNum ) {
-				continue;
-			}
+		svVis.candidates[e >> 5] |= 1u << (e & 31);
+
+		// broadcast and portal entities skip the area and PVS tests, and so
+		// may entities broadcast to specific clients or a client's own entity
+		if ( (ent->r.svFlags & SVF_BROADCAST) || ent->s.isPortalEnt || e < MAX_CLIENTS
+			|| ent->r.broadcastClients[0] || ent->r.broadcastClients[1] )
+		{
+			svVis.forced[e >> 5] |= 1u << (e & 31);
 		}
+	}
+}
 
-		svEnt = SV_SvEntityForGentity( ent );
+/*
+===============
+SV_EndSnapshotVisibility
+===============
+*/
+static void SV_EndSnapshotVisibility( void ) {
+	svVis.valid = qfalse;
+}
 
-		// don't double add an entity through portals
-		if ( svEnt->snapshotCounter == sv.snapshotCounter ) {
-			continue;
-		}
+/*
+===============
+SV_FindSnapshotView
 
-		// entities can request not to be sent to certain clients (NOTE: always send to ourselves)
-		if ( e != frame->ps.clientNum && (ent->r.svFlags & SVF_BROADCASTCLIENTS)
-			&& !(ent->r.broadcastClients[frame->ps.clientNum/32] & (1 << (frame->ps.clientNum % 32))) )
-		{
-			continue;
-		}
-		// broadcast entities are always sent, and so is the main player so we don't see noclip weirdness
-		if ( (ent->r.svFlags & SVF_BROADCAST) || e == frame->ps.clientNum
-			|| (ent->r.broadcastClients[frame->ps.clientNum/32] & (1 << (frame->ps.clientNum % 32))) )
-		{
-			SV_AddEntToSnapshot( svEnt, ent, eNums );
-			continue;
-		}
+Must be called with the visibility lock held.
+===============
+*/
+static snapshotView_t *SV_FindSnapshotView( int area, int cluster ) {
+	int				i;
+	snapshotView_t	*view;
 
-		if (ent->s.isPortalEnt)
-		{ //rww - portal entities are always sent as well
-			SV_AddEntToSnapshot( svEnt, ent, eNums );
-			continue;
+	for ( i = 0, view = svVis.views ; i < svVis.numViews ; i++, view++ ) {
+		if ( view->area == area && view->cluster == cluster ) {
+			return view;
 		}
+	}
 
-		// ignore if not touching a PV leaf
-		// check area
-		if ( !CM_AreasConnected( clientarea, svEnt->areanum ) ) {
-			// doors can legally straddle two areas, so
-			// we may need to check another one
-			if ( !CM_AreasConnected( clientarea, svEnt->areanum2 ) ) {
-				continue;		// blocked by a door
-			}
-		}
+	return NULL;
+}
 
-		bitvector = clientpvs;
+/*
+===============
+SV_SnapshotViewForPoint
 
-		// check individual leafs
-		if ( !svEnt->numClusters ) {
-			continue;
-		}
-		l = 0;
-		for ( i=0 ; i < svEnt->numClusters ; i++ ) {
-			l = svEnt->clusternums[i];
-			if ( bitvector[l >> 3] & (1 << (l&7) ) ) {
-				break;
-			}
-		}
+Returns the cached view for the area and cluster containing origin,
+building it if this is the first client to look from there this frame.
+If the cache is full the view is built into scratch instead.
 
-		// if we haven't found it to be visible,
-		// check overflow clusters that coudln't be stored
-		if ( i == svEnt->numClusters ) {
-			if ( svEnt->lastCluster ) {
-				for ( ; l <= svEnt->lastCluster ; l++ ) {
-					if ( bitvector[l >> 3] & (1 << (l&7) ) ) {
-						break;
-					}
-				}
-				if ( l == svEnt->lastCluster ) {
-					continue;	// not visible
-				}
-			} else {
-				continue;
-			}
-		}
+Snapshots may be gathered on several threads at once, so views are
+built outside the lock and only inserted under it.
+===============
+*/
+static const snapshotView_t *SV_SnapshotViewForPoint( const vec3_t origin, snapshotView_t *scratch ) {
+	int				w, e;
+	int				leafnum, area, cluster;
+	int				numTests;
+	uint32_t		bits, visible;
+	snapshotView_t	*view;
+	svEntity_t		*svEnt;
+	byte			*clientpvs;
 
-		if (g_svCullDist != -1.0f)
-		{ //do a distance cull check
-			VectorAdd(ent->r.absmax, ent->r.absmin, difference);
-			VectorScale(difference, 0.5f, difference);
-			VectorSubtract(origin, difference, difference);
-			length = VectorLength(difference);
+	{
+		std::lock_guard<std::mutex> lock( svVis.lock );
 
-			// calculate the diameter
-			VectorSubtract(ent->r.absmax, ent->r.absmin, difference);
-			radius = VectorLength(difference);
-			if (length-radius >= g_svCullDist)
-			{ //then don't add it
-				continue;
-			}
+		leafnum = CM_PointLeafnum (origin);
+		area = CM_LeafArea (leafnum);
+		cluster = CM_LeafCluster (leafnum);
+
+		svVis.numViewpoints++;
+		svVis.numNaiveTests += sv.num_entities;
+
+		view = SV_FindSnapshotView( area, cluster );
+		if ( view ) {
+			return view;
 		}
+	}
 
-		// add it
-		SV_AddEntToSnapshot( svEnt, ent, eNums );
+	scratch->area = area;
+	scratch->cluster = cluster;
 
-		// if its a portal entity, add everything visible from its camera position
-		if ( ent->r.svFlags & SVF_PORTAL ) {
-			if ( ent->s.generic1 ) {
-				vec3_t dir;
-				VectorSubtract(ent->s.origin, origin, dir);
-				if ( VectorLengthSquared(dir) > (float) ent->s.generic1 * ent->s.generic1 ) {
-					continue;
+	// calculate the visible areas
+	Com_Memset( scratch->areabits, 0, sizeof( scratch->areabits ) );
+	scratch->areabytes = CM_WriteAreaBits( scratch->areabits, area );
+
+	clientpvs = CM_ClusterPVS (cluster);
+
+	numTests = 0;
+	for ( w = 0 ; w < SNAPSHOT_ENTITY_WORDS ; w++ ) {
+		visible = 0;
+		for ( bits = svVis.candidates[w] ; bits ; bits &= bits - 1 ) {
+			e = (w << 5) + Q_ctz32( bits );
+			svEnt = &sv.svEntities[e];
+			numTests++;
+
+			// ignore if not touching a PV leaf
+			// check area
+			if ( !CM_AreasConnected( area, svEnt->areanum ) ) {
+				// doors can legally straddle two areas, so
+				// we may need to check another one
+				if ( !CM_AreasConnected( area, svEnt->areanum2 ) ) {
+					continue;		// blocked by a door
 				}
 			}
-			SV_AddEntitiesVisibleFromPoint( ent->s.origin2, frame, eNums, qtrue );
+
+			if ( SV_EntityInPVS( svEnt, clientpvs ) ) {
+				visible |= 1u << (e & 31);
+			}
 		}
+		scratch->visible[w] = visible;
 	}
-}
 
-/*
-=============
-SV_BuildClientSnapshot
+	std::lock_guard<std::mutex> lock( svVis.lock );
 
-Decides which entities are going to be visible to the client, and
-copies off the playerstate and areabits.
+	svVis.numViewsBuilt++;
+	svVis.numEntityTests += numTests;
 
-This properly handles multiple recursive portals, but the render
-currently doesn't.
+	// another thread may have got here first
+	view = SV_FindSnapshotView( area, cluster );
+	if ( view ) {
+		return view;
+	}
 
-For viewing through other player's eyes, client can be something other than client->gentity
-=============
-*/
-static void SV_BuildClientSnapshot( client_t *client ) {
-	vec3_t						org;
-	clientSnapshot_t			*frame;
-	snapshotEntityNumbers_t		entityNumbers;
-	int							i;
-	sharedEntity_t				*ent;
-	entityState_t				*state;
-	svEntity_t					*svEnt;
-	sharedEntity_t				*clent;
-	playerState_t				*ps;
+	if ( svVis.numViews == MAX_SNAPSHOT_VIEWS ) {
+		return scratch;
+	}
+
+	view = &svVis.views[svVis.numViews++];
+	*view = *scratch;
+	return view;
+}
 
-	// bump the counter used to prevent double adding
-	sv.snapshotCounter++;
+/*
+===============
+SV_SnapshotStats
 
-	// this is the frame we are creating
-	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
+Prints the visibility cache counters once a second when sv_snapshotStats is set.
+===============
+*/
+static void SV_SnapshotStats( void ) {
+	if ( !sv_snapshotStats->integer ) {
+		svVis.statsTime = 0;
+		return;
+	}
 
-	// clear everything in this snapshot
-	entityNumbers.numSnapshotEntities = 0;
-	Com_Memset( frame->areabits, 0, sizeof( frame->areabits ) );
+	if ( !svVis.statsTime ) {
+		svVis.statsTime = svs.time;
+	}
+	if ( svs.time - svVis.statsTime < 1000 ) {
+		return;
+	}
 
-	frame->num_entities = 0;
+	Com_Printf( "snapshots: %i viewpoints: %i views: %i entity tests: %i (%i uncached)\n",
+		svVis.numSnapshots, svVis.numViewpoints, svVis.numViewsBuilt,
+		svVis.numEntityTests, svVis.numNaiveTests );
+	Com_Printf( "entity deltas: %i cached: %i\n",
+		svDeltaCache.numHits + svDeltaCache.numMisses, (int)svDeltaCache.numHits );
+
+	svVis.statsTime = svs.time;
+	svVis.numSnapshots = 0;
+	svVis.numViewpoints = 0;
+	svVis.numViewsBuilt = 0;
+	svVis.numEntityTests = 0;
+	svVis.numNaiveTests = 0;
+	svDeltaCache.numHits = 0;
+	svDeltaCache.numMisses = 0;
+}
 
-	clent = client->gentity;
-	if ( !clent || client->state == CS_ZOMBIE ) {
+/*
+===============
+SV_AddEntitiesVisibleFromPoint
+===============
+*/
+float g_svCullDist = -1.0f;
+static void SV_AddEntitiesVisibleFromPoint( vec3_t origin, clientSnapshot_t *frame,
+									snapshotEntityNumbers_t *eNums, qboolean portal ) {
+	int		w, e, i;
+	uint32_t	bits;
+	sharedEntity_t *ent;
+	const snapshotView_t *view;
+	snapshotView_t	scratchView;
+	vec3_t	difference;
+	float	length, radius;
+
+	// during an error shutdown message we may need to transmit
+	// the shutdown message after the server has shutdown, so
+	// specfically check for it
+	if ( !sv.state ) {
 		return;
 	}
 
-	// grab the current playerState_t
-	ps = SV_GameClientNum( client - svs.clients );
-	frame->ps = *ps;
-#ifdef _ONEBIT_COMBO
-	frame->pDeltaOneBit = &ps->deltaOneBits;
-	frame->pDeltaNumBit = &ps->deltaNumBits;
-#endif
+	view = SV_SnapshotViewForPoint( origin, &scratchView );
 
-	if (ps->m_iVehicleNum)
-	{ //get the vehicle's playerstate too then
-		sharedEntity_t *veh = SV_GentityNum(ps->m_iVehicleNum);
+	// calculate the visible areas
+	frame->areabytes = view->areabytes;
+	for ( i = 0 ; i < view->areabytes ; i++ ) {
+		frame->areabits[i] |= view->areabits[i];
+	}
 
-		if (veh && veh->playerState)
-		{ //Now VMA it and we've got ourselves a playerState
-			playerState_t *vps = ((playerState_t *)VM_ArgPtr((intptr_t)veh->playerState));
+	for ( w = 0 ; w < SNAPSHOT_ENTITY_WORDS ; w++ ) {
+		bits = svVis.candidates[w] & ( svVis.forced[w] | view->visible[w] );
 
-            frame->vps = *vps;
+		for ( ; bits ; bits &= bits - 1 ) {
+			e = (w << 5) + Q_ctz32( bits );
+			ent = SV_GentityNum(e);
+
+			// entities can be flagged to be sent to only one client
+			if ( ent->r.svFlags & SVF_SINGLECLIENT ) {
+				if ( ent->r.singleClient != frame->ps.clientNum ) {
+					continue;
+				}
+			}
+			// entities can be flagged to be sent to everyone but one client
+			if ( ent->r.svFlags & SVF_NOTSINGLECLIENT ) {
+				if ( ent->r.singleClient == frame->ps.clientNum ) {
+					continue;
+				}
+			}
+
+			// don't double add an entity through portals
+			if ( eNums->added[w] & (1u << (e & 31)) ) {
+				continue;
+			}
+
+			// entities can request not to be sent to certain clients (NOTE: always send to ourselves)
+			if ( e != frame->ps.clientNum && (ent->r.svFlags & SVF_BROADCASTCLIENTS)
+				&& !(ent->r.broadcastClients[frame->ps.clientNum/32] & (1 << (frame->ps.clientNum % 32))) )
+			{
+				continue;
+			}
+			// broadcast entities are always sent, and so is the main player so we don't see noclip weirdness
+			if ( (ent->r.svFlags & SVF_BROADCAST) || e == frame->ps.clientNum
+				|| (ent->r.broadcastClients[frame->ps.clientNum/32] & (1 << (frame->ps.clientNum % 32))) )
+			{
+				SV_AddEntToSnapshot( ent, eNums );
+				continue;
+			}
+
+			if (ent->s.isPortalEnt)
+			{ //rww - portal entities are always sent as well
+				SV_AddEntToSnapshot( ent, eNums );
+				continue;
+			}
+
+			// forced entities that turned out not to be for this
+			// client still have to be in the view
+			if ( !(view->visible[w] & (1u << (e & 31))) ) {
+				continue;
+			}
+
+			if (g_svCullDist != -1.0f)
+			{ //do a distance cull check
+				VectorAdd(ent->r.absmax, ent->r.absmin, difference);
+				VectorScale(difference, 0.5f, difference);
+				VectorSubtract(origin, difference, difference);
+				length = VectorLength(difference);
+
+				// calculate the diameter
+				VectorSubtract(ent->r.absmax, ent->r.absmin, difference);
+				radius = VectorLength(difference);
+				if (length-radius >= g_svCullDist)
+				{ //then don't add it
+					continue;
+				}
+			}
+
+			// add it
+			SV_AddEntToSnapshot( ent, eNums );
+
+			// if its a portal entity, add everything visible from its camera position
+			if ( ent->r.svFlags & SVF_PORTAL ) {
+				if ( ent->s.generic1 ) {
+					vec3_t dir;
+					VectorSubtract(ent->s.origin, origin, dir);
+					if ( VectorLengthSquared(dir) > (float) ent->s.generic1 * ent->s.generic1 ) {
+						continue;
+					}
+				}
+				SV_AddEntitiesVisibleFromPoint( ent->s.origin2, frame, eNums, qtrue );
+			}
+		}
+	}
+}
+
+/*
+=============
+SV_SnapshotClientReady
+
+Returns qfalse if the client has nothing to build a snapshot from.
+The client number is checked here rather than while gathering so
+that a bad one is reported from the main thread.
+=============
+*/
+static qboolean SV_SnapshotClientReady( client_t *client ) {
+	int		clientNum;
+
+	if ( !client->gentity || client->state == CS_ZOMBIE ) {
+		return qfalse;
+	}
+
+	clientNum = SV_GameClientNum( client - svs.clients )->clientNum;
+	if ( clientNum < 0 || clientNum >= MAX_GENTITIES ) {
+		Com_Error( ERR_DROP, "SV_SvEntityForGentity: bad gEnt" );
+	}
+
+	return qtrue;
+}
+
+/*
+=============
+SV_GatherSnapshotEntities
+
+Decides which entities are going to be visible to the client, and
+copies off the playerstate and areabits.
+
+This properly handles multiple recursive portals, but the render
+currently doesn't.
+
+For viewing through other player's eyes, client can be something other than client->gentity
+
+Only reads game state, so snapshots for different clients may be
+gathered on different threads.
+=============
+*/
+static void SV_GatherSnapshotEntities( client_t *client, qboolean ready, snapshotEntityNumbers_t *entityNumbers ) {
+	vec3_t						org;
+	clientSnapshot_t			*frame;
+	int							i;
+	playerState_t				*ps;
+	int							clientNum;
+
+	// this is the frame we are creating
+	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
+
+	// clear everything in this snapshot
+	entityNumbers->numSnapshotEntities = 0;
+	Com_Memset( entityNumbers->added, 0, sizeof( entityNumbers->added ) );
+	Com_Memset( frame->areabits, 0, sizeof( frame->areabits ) );
+
+	frame->num_entities = 0;
+
+	if ( !ready ) {
+		return;
+	}
+
+	// grab the current playerState_t
+	ps = SV_GameClientNum( client - svs.clients );
+	frame->ps = *ps;
+#ifdef _ONEBIT_COMBO
+	frame->pDeltaOneBit = &ps->deltaOneBits;
+	frame->pDeltaNumBit = &ps->deltaNumBits;
+#endif
+
+	if (ps->m_iVehicleNum)
+	{ //get the vehicle's playerstate too then
+		sharedEntity_t *veh = SV_GentityNum(ps->m_iVehicleNum);
+
+		if (veh && veh->playerState)
+		{ //Now VMA it and we've got ourselves a playerState
+			playerState_t *vps = ((playerState_t *)VM_ArgPtr((intptr_t)veh->playerState));
+
+            frame->vps = *vps;
 #ifdef _ONEBIT_COMBO
 			frame->pDeltaOneBitVeh = &vps->deltaOneBits;
 			frame->pDeltaNumBitVeh = &vps->deltaNumBits;
@@ -592,16 +1058,10 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 		}
 	}
 
-	int							clientNum;
 	// never send client's own entity, because it can
 	// be regenerated from the playerstate
 	clientNum = frame->ps.clientNum;
-	if ( clientNum < 0 || clientNum >= MAX_GENTITIES ) {
-		Com_Error( ERR_DROP, "SV_SvEntityForGentity: bad gEnt" );
-	}
-	svEnt = &sv.svEntities[ clientNum ];
-	svEnt->snapshotCounter = sv.snapshotCounter;
-
+	entityNumbers->added[clientNum >> 5] |= 1u << (clientNum & 31);
 
 	// find the client's viewpoint
 	VectorCopy( ps->origin, org );
@@ -609,26 +1069,46 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 
 	// add all the entities directly visible to the eye, which
 	// may include portal entities that merge other viewpoints
-	SV_AddEntitiesVisibleFromPoint( org, frame, &entityNumbers, qfalse );
+	SV_AddEntitiesVisibleFromPoint( org, frame, entityNumbers, qfalse );
 
 	// if there were portals visible, there may be out of order entities
 	// in the list which will need to be resorted for the delta compression
 	// to work correctly.  This also catches the error condition
 	// of an entity being included twice.
-	qsort( entityNumbers.snapshotEntities, entityNumbers.numSnapshotEntities,
-		sizeof( entityNumbers.snapshotEntities[0] ), SV_QsortEntityNumbers );
+	qsort( entityNumbers->snapshotEntities, entityNumbers->numSnapshotEntities,
+		sizeof( entityNumbers->snapshotEntities[0] ), SV_QsortEntityNumbers );
 
 	// now that all viewpoint's areabits have been OR'd together, invert
 	// all of them to make it a mask vector, which is what the renderer wants
 	for ( i = 0 ; i < MAX_MAP_AREA_BYTES/4 ; i++ ) {
 		((int *)frame->areabits)[i] = ((int *)frame->areabits)[i] ^ -1;
 	}
+}
+
+/*
+=============
+SV_StoreSnapshotEntities
+
+Copies the gathered entity states into the shared snapshot entity ring.
+Has to be done for every client in order, as delta compression depends
+on where in the ring each snapshot ends up.
+=============
+*/
+static void SV_StoreSnapshotEntities( client_t *client, const snapshotEntityNumbers_t *entityNumbers ) {
+	clientSnapshot_t			*frame;
+	int							i;
+	sharedEntity_t				*ent;
+	entityState_t				*state;
+
+	svVis.numSnapshots++;
+
+	frame = &client->frames[ client->netchan.outgoingSequence & PACKET_MASK ];
 
 	// copy the entity states out
 	frame->num_entities = 0;
 	frame->first_entity = svs.nextSnapshotEntities;
-	for ( i = 0 ; i < entityNumbers.numSnapshotEntities ; i++ ) {
-		ent = SV_GentityNum(entityNumbers.snapshotEntities[i]);
+	for ( i = 0 ; i < entityNumbers->numSnapshotEntities ; i++ ) {
+		ent = SV_GentityNum(entityNumbers->snapshotEntities[i]);
 		state = &svs.snapshotEntities[svs.nextSnapshotEntities % svs.numSnapshotEntities];
 		*state = ent->s;
 		svs.nextSnapshotEntities++;
@@ -640,6 +1120,36 @@ static void SV_BuildClientSnapshot( client_t *client ) {
 	}
 }
 
+/*
+=============
+SV_BuildClientSnapshot
+=============
+*/
+static void SV_BuildClientSnapshot( client_t *client ) {
+	snapshotEntityNumbers_t		entityNumbers;
+	qboolean					ready;
+	qboolean					transientVisibility;
+
+	ready = SV_SnapshotClientReady( client );
+
+	// snapshots sent outside of SV_SendClientMessages don't get to
+	// share the frame's visibility cache
+	transientVisibility = (qboolean)!svVis.valid;
+	if ( transientVisibility ) {
+		SV_BeginSnapshotVisibility();
+	}
+
+	SV_GatherSnapshotEntities( client, ready, &entityNumbers );
+
+	if ( transientVisibility ) {
+		SV_EndSnapshotVisibility();
+	}
+
+	if ( ready ) {
+		SV_StoreSnapshotEntities( client, &entityNumbers );
+	}
+}
+
 
 /*
 ====================
@@ -704,7 +1214,7 @@ void SV_SendMessageToClient( msg_t *msg, client_t *client ) {
 
 	// record information about the message
 	client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageSize = msg->cursize;
-	client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageSent = svs.time;
+	client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageSent = NET_Milliseconds();
 	client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageAcked = -1;
 
 	// save the message to demo.  this must happen before sending over network as that encodes the backing databuf
@@ -762,100 +1272,419 @@ void SV_SendMessageToClient( msg_t *msg, client_t *client ) {
 
 /*
 =======================
-SV_SendClientSnapshot
-
-Also called by SV_FinalMessage
+SV_SendClientGamedir
 
+rww - make sure there is an svc_setgame sent before the first snapshot
 =======================
 */
 extern cvar_t	*fs_gamedirvar;
-void SV_SendClientSnapshot( client_t *client ) {
+static void SV_SendClientGamedir( client_t *client ) {
 	byte		msg_buf[MAX_MSGLEN];
 	msg_t		msg;
+	int			i = 0;
 
-	if (!client->sentGamedir)
-	{ //rww - if this is the case then make sure there is an svc_setgame sent before this snap
-		int i = 0;
-
-		MSG_Init (&msg, msg_buf, sizeof(msg_buf));
+	MSG_Init (&msg, msg_buf, sizeof(msg_buf));
 
-		//have to include this for each message.
-		MSG_WriteLong( &msg, client->lastClientCommand );
+	//have to include this for each message.
+	MSG_WriteLong( &msg, client->lastClientCommand );
 
-		MSG_WriteByte (&msg, svc_setgame);
+	MSG_WriteByte (&msg, svc_setgame);
 
-		const char *gamedir = FS_GetCurrentGameDir(true);
+	const char *gamedir = FS_GetCurrentGameDir(true);
 
-		while (gamedir[i])
-		{
-			MSG_WriteByte(&msg, gamedir[i]);
-			i++;
-		}
-		MSG_WriteByte(&msg, 0);
+	while (gamedir[i])
+	{
+		MSG_WriteByte(&msg, gamedir[i]);
+		i++;
+	}
+	MSG_WriteByte(&msg, 0);
 
-		// MW - my attempt to fix illegible server message errors caused by
-		// packet fragmentation of initial snapshot.
-		//rww - reusing this code here
-		while(client->state&&client->netchan.unsentFragments)
-		{
-			// send additional message fragments if the last message
-			// was too large to send at once
-			Com_Printf ("[ISM]SV_SendClientGameState() [1] for %s, writing out old fragments\n", client->name);
-			SV_Netchan_TransmitNextFragment(&client->netchan);
-		}
+	// MW - my attempt to fix illegible server message errors caused by
+	// packet fragmentation of initial snapshot.
+	//rww - reusing this code here
+	while(client->state&&client->netchan.unsentFragments)
+	{
+		// send additional message fragments if the last message
+		// was too large to send at once
+		Com_Printf ("[ISM]SV_SendClientGameState() [1] for %s, writing out old fragments\n", client->name);
+		SV_Netchan_TransmitNextFragment(&client->netchan);
+	}
 
-		// record information about the message
-		client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageSize = msg.cursize;
-		client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageSent = svs.time;
-		client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageAcked = -1;
+	// record information about the message
+	client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageSize = msg.cursize;
+	client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageSent = NET_Milliseconds();
+	client->frames[client->netchan.outgoingSequence & PACKET_MASK].messageAcked = -1;
 
-		// send the datagram
-		SV_Netchan_Transmit( client, &msg );	//msg->cursize, msg->data );
+	// send the datagram
+	SV_Netchan_Transmit( client, &msg );	//msg->cursize, msg->data );
 
-		client->sentGamedir = qtrue;
-	}
+	client->sentGamedir = qtrue;
+}
 
-	// build the snapshot
-	SV_BuildClientSnapshot( client );
+/*
+=======================
+SV_AutoRecordClientDemo
 
+Returns qtrue if sending this client a snapshot starts the automatic demos
+=======================
+*/
+static qboolean SV_AutoRecordClientDemo( client_t *client ) {
 	if ( sv_autoDemo->integer && !client->demo.demorecording ) {
 		if ( client->netchan.remoteAddress.type != NA_BOT || sv_autoDemoBots->integer ) {
-			SV_BeginAutoRecordDemos();
+			return qtrue;
 		}
 	}
+	return qfalse;
+}
 
-	// bots need to have their snapshots built, but
-	// they query them directly without needing to be sent
-	if ( client->netchan.remoteAddress.type == NA_BOT && !client->demo.demorecording ) {
-		return;
-	}
+/*
+=======================
+SV_BeginSnapshotMessage
 
-	MSG_Init (&msg, msg_buf, sizeof(msg_buf));
-	msg.allowoverflow = qtrue;
+Writes everything up to and including the snapshot itself
+=======================
+*/
+static void SV_BeginSnapshotMessage( client_t *client, clientSnapshot_t *oldframe, int lastframe, msg_t *msg, byte *msg_buf ) {
+	MSG_Init (msg, msg_buf, MAX_MSGLEN);
+	msg->allowoverflow = qtrue;
 
 	// NOTE, MRE: all server->client messages now acknowledge
 	// let the client know which reliable clientCommands we have received
-	MSG_WriteLong( &msg, client->lastClientCommand );
+	MSG_WriteLong( msg, client->lastClientCommand );
 
 	// (re)send any reliable server commands
-	SV_UpdateServerCommandsToClient( client, &msg );
+	SV_UpdateServerCommandsToClient( client, msg );
 
 	// send over all the relevant entityState_t
 	// and the playerState_t
-	SV_WriteSnapshotToClient( client, &msg );
+	SV_WriteSnapshotToClient( client, oldframe, lastframe, msg );
+}
 
+/*
+=======================
+SV_FinishSnapshotMessage
+=======================
+*/
+static void SV_FinishSnapshotMessage( client_t *client, msg_t *msg ) {
 	// Add any download data if the client is downloading
-	SV_WriteDownloadToClient( client, &msg );
+	SV_WriteDownloadToClient( client, msg );
 
 	// check for overflow
-	if ( msg.overflowed ) {
+	if ( msg->overflowed ) {
 		Com_Printf ("WARNING: msg overflowed for %s\n", client->name);
-		MSG_Clear (&msg);
+		MSG_Clear (msg);
 	}
 
-	SV_SendMessageToClient( &msg, client );
+	SV_SendMessageToClient( msg, client );
 }
 
+#ifdef DEDICATED_BENCH
+/*
+=============================================================================
+
+The benchmark only has bots, which never have their snapshots sent. To
+still measure the encoding, each bot's snapshot is also written into a
+throwaway message, delta compressed against the one it got last frame as
+a client acknowledging every snapshot would have it.
+
+=============================================================================
+*/
+
+static clientSnapshot_t svBenchOldframes[MAX_CLIENTS];
+
+/*
+=======================
+SV_BenchSaveBotFrame
+
+Keeps the bot's last snapshot before building the next one overwrites it,
+bots never advance their outgoing sequence.
+=======================
+*/
+static void SV_BenchSaveBotFrame( client_t *client ) {
+	if ( client->netchan.remoteAddress.type != NA_BOT ) {
+		return;
+	}
+	svBenchOldframes[client - svs.clients] = client->frames[client->netchan.outgoingSequence & PACKET_MASK];
+}
+
+/*
+=======================
+SV_BenchEncodeBotSnapshot
+=======================
+*/
+static void SV_BenchEncodeBotSnapshot( client_t *client ) {
+	byte				msg_buf[MAX_MSGLEN];
+	msg_t				msg;
+	clientSnapshot_t	*oldframe;
+	SV_BENCH_BEGIN( benchStart );
+
+	// full snapshot the first time, or if the ring has moved past the old entities
+	oldframe = &svBenchOldframes[client - svs.clients];
+	if ( !oldframe->num_entities
+		|| oldframe->first_entity < svs.nextSnapshotEntities - svs.numSnapshotEntities ) {
+		oldframe = NULL;
+	}
+
+	MSG_Init( &msg, msg_buf, sizeof( msg_buf ) );
+	msg.allowoverflow = qtrue;
+	MSG_WriteLong( &msg, client->lastClientCommand );
+	SV_WriteSnapshotToClient( client, oldframe, oldframe ? 1 : 0, &msg );
+
+	SV_BENCH_END( BENCH_ENCODE, benchStart );
+}
+#endif
+
+/*
+=======================
+SV_SendClientSnapshot
+
+Also called by SV_FinalMessage
+
+=======================
+*/
+void SV_SendClientSnapshot( client_t *client ) {
+	byte				msg_buf[MAX_MSGLEN];
+	msg_t				msg;
+	clientSnapshot_t	*oldframe;
+	int					lastframe;
+
+	if (!client->sentGamedir)
+	{ //rww - if this is the case then make sure there is an svc_setgame sent before this snap
+		SV_SendClientGamedir( client );
+	}
+
+	// build the snapshot
+#ifdef DEDICATED_BENCH
+	SV_BenchSaveBotFrame( client );
+#endif
+	SV_BENCH_BEGIN( benchStart );
+	SV_BuildClientSnapshot( client );
+	SV_BENCH_END( BENCH_SNAPSHOT, benchStart );
+
+	if ( SV_AutoRecordClientDemo( client ) ) {
+		SV_BeginAutoRecordDemos();
+	}
+
+	// bots need to have their snapshots built, but
+	// they query them directly without needing to be sent
+	if ( client->netchan.remoteAddress.type == NA_BOT && !client->demo.demorecording ) {
+#ifdef DEDICATED_BENCH
+		SV_BenchEncodeBotSnapshot( client );
+#endif
+		return;
+	}
+
+	SV_BENCH_BEGIN( benchEncode );
+	oldframe = SV_SnapshotDeltaFrame( client, &lastframe );
+	SV_BeginSnapshotMessage( client, oldframe, lastframe, &msg, msg_buf );
+	SV_FinishSnapshotMessage( client, &msg );
+	SV_BENCH_END( BENCH_ENCODE, benchEncode );
+}
+
+/*
+=============================================================================
+
+Parallel snapshots
+
+With sv_snapshotThreads above 1, gathering the visible entities and
+encoding the messages is spread over worker threads. Everything that
+touches state shared between clients (the snapshot entity ring, demos,
+downloads and the network) still happens on the main thread in client
+order, so the packets are byte for byte the same as with one thread.
+
+=============================================================================
+*/
+
+typedef struct snapshotJob_s {
+	client_t				*client;
+	qboolean				ready;
+	snapshotEntityNumbers_t	entityNumbers;
+	clientSnapshot_t		*oldframe;
+	int						lastframe;
+	msg_t					msg;
+	byte					msgBuf[MAX_MSGLEN];
+} snapshotJob_t;
+
+static void SV_GatherSnapshotJob( void *data, int index ) {
+	snapshotJob_t *job = ((snapshotJob_t **)data)[index];
+
+	SV_GatherSnapshotEntities( job->client, job->ready, &job->entityNumbers );
+}
+
+static void SV_EncodeSnapshotJob( void *data, int index ) {
+	snapshotJob_t *job = ((snapshotJob_t **)data)[index];
+
+	SV_BeginSnapshotMessage( job->client, job->oldframe, job->lastframe, &job->msg, job->msgBuf );
+}
+
+/*
+=======================
+SV_FlushSnapshotJobs
+
+Encodes the pending messages and sends them in client order
+=======================
+*/
+static void SV_FlushSnapshotJobs( snapshotJob_t **pending, int *numPending ) {
+	int		i;
+	SV_BENCH_BEGIN( benchStart );
+
+	Com_ParallelFor( sv_snapshotThreads->integer, *numPending, SV_EncodeSnapshotJob, pending );
+
+	for ( i = 0 ; i < *numPending ; i++ ) {
+		SV_FinishSnapshotMessage( pending[i]->client, &pending[i]->msg );
+	}
+	*numPending = 0;
+	SV_BENCH_END( BENCH_ENCODE, benchStart );
+}
+
+/*
+=======================
+SV_SendClientSnapshotsParallel
+
+clients are the ones SV_SendClientMessages would have sent a snapshot to,
+in the same order.  The jobs are scratch on the server frame arena.
+=======================
+*/
+static void SV_SendClientSnapshotsParallel( client_t **clients, int numClients ) {
+	snapshotJob_t	*jobs;
+	snapshotJob_t	*gather[MAX_CLIENTS];
+	snapshotJob_t	*pending[MAX_CLIENTS];
+	int				numGather, numPending;
+	int				i, numSerial, lastEntity, mark;
+	client_t		*client;
+	snapshotJob_t	*job;
+
+	mark = Frame_Mark( FRAME_ARENA_SERVER );
+	jobs = (snapshotJob_t *)Frame_Alloc( FRAME_ARENA_SERVER, numClients * sizeof( *jobs ) );
+
+	// clients that still need their svc_setgame go down the serial path
+	// when their turn comes, everyone else is gathered up front
+	numGather = 0;
+	numSerial = 0;
+	for ( i = 0 ; i < numClients ; i++ ) {
+		job = &jobs[i];
+		job->client = clients[i];
+		if ( !job->client->sentGamedir ) {
+			numSerial++;
+			continue;
+		}
+		job->ready = SV_SnapshotClientReady( job->client );
+		gather[numGather++] = job;
+#ifdef DEDICATED_BENCH
+		SV_BenchSaveBotFrame( job->client );
+#endif
+	}
+
+	SV_BENCH_BEGIN( benchStart );
+	Com_ParallelFor( sv_snapshotThreads->integer, numGather, SV_GatherSnapshotJob, gather );
+	SV_BENCH_END( BENCH_SNAPSHOT, benchStart );
+
+	// the ring position right after every snapshot this frame has been
+	// stored, assuming the worst for the serial clients
+	lastEntity = svs.nextSnapshotEntities + numSerial * MAX_SNAPSHOT_ENTITIES;
+	for ( i = 0 ; i < numGather ; i++ ) {
+		lastEntity += gather[i]->entityNumbers.numSnapshotEntities;
+	}
+
+	numPending = 0;
+	for ( i = 0 ; i < numClients ; i++ ) {
+		job = &jobs[i];
+		client = job->client;
+
+		if ( !client->sentGamedir ) {
+			SV_FlushSnapshotJobs( pending, &numPending );
+			SV_SendClientSnapshot( client );
+			continue;
+		}
+
+		if ( job->ready ) {
+			SV_BENCH_BEGIN( benchStore );
+			SV_StoreSnapshotEntities( client, &job->entityNumbers );
+			SV_BENCH_END( BENCH_SNAPSHOT, benchStore );
+		}
+
+		if ( SV_AutoRecordClientDemo( client ) ) {
+			// the demos record the reliable and message sequences
+			// of every client, so get everyone before us out first
+			SV_FlushSnapshotJobs( pending, &numPending );
+			SV_BeginAutoRecordDemos();
+		}
+
+		// bots need to have their snapshots built, but
+		// they query them directly without needing to be sent
+		if ( client->netchan.remoteAddress.type == NA_BOT && !client->demo.demorecording ) {
+#ifdef DEDICATED_BENCH
+			SV_BenchEncodeBotSnapshot( client );
+#endif
+			continue;
+		}
+
+		job->oldframe = SV_SnapshotDeltaFrame( client, &job->lastframe );
+		pending[numPending++] = job;
+
+		// if a later snapshot this frame could overwrite the entities we
+		// delta from, encode now while the ring still holds them
+		if ( job->oldframe && job->oldframe->first_entity < lastEntity - svs.numSnapshotEntities ) {
+			SV_FlushSnapshotJobs( pending, &numPending );
+		}
+	}
+
+	SV_FlushSnapshotJobs( pending, &numPending );
+
+	Frame_Release( FRAME_ARENA_SERVER, mark );
+}
+
+/*
+=======================
+SV_SendClientFragments
+
+Sends the rest of the messages that were too large to go out at once.
+This runs after every snapshot of the frame has been sent, one fragment per
+client per pass, so a burst of gamestates after a map change can't hold up
+anyone's snapshots.  Each client gets up to sv_fragmentsPerFrame fragments
+a frame while its rate allows.
+=======================
+*/
+static void SV_SendClientFragments( client_t **clients, int numClients ) {
+	int			rateMsec[MAX_CLIENTS];
+	int			i, pass, numPasses, numSent, frameMsec;
+	client_t	*c;
+
+	frameMsec = (int)( 1000.0f / sv_fps->integer );
+	numPasses = Q_max( 1, sv_fragmentsPerFrame->integer );
+
+	for ( i = 0 ; i < numClients ; i++ ) {
+		rateMsec[i] = 0;
+	}
+
+	for ( pass = 0 ; pass < numPasses ; pass++ ) {
+		numSent = 0;
+		for ( i = 0 ; i < numClients ; i++ ) {
+			c = clients[i];
+			if ( !c->state || !c->netchan.unsentFragments ) {
+				continue;
+			}
+
+			// the first fragment always goes, more only while they fit
+			// in the time the client's rate gives us this frame
+			if ( pass && rateMsec[i] >= frameMsec ) {
+				continue;
+			}
+
+			rateMsec[i] += SV_RateMsec( c, c->netchan.unsentLength - c->netchan.unsentFragmentStart );
+			SV_Netchan_TransmitNextFragment( &c->netchan );
+			numSent++;
+		}
+
+		if ( !numSent ) {
+			break;
+		}
+	}
+
+	for ( i = 0 ; i < numClients ; i++ ) {
+		clients[i]->nextSnapshotTime = svs.time + rateMsec[i];
+	}
+}
 
 /*
 =======================
@@ -865,8 +1694,21 @@ SV_SendClientMessages
 void SV_SendClientMessages( void ) {
 	int			i;
 	client_t	*c;
+	client_t	*snapshotClients[MAX_CLIENTS];
+	client_t	*fragmentClients[MAX_CLIENTS];
+	int			numSnapshotClients, numFragmentClients;
+
+	// the game can't move anything until the next frame, so all
+	// snapshots built below share one visibility cache
+	SV_BeginSnapshotVisibility();
+	SV_BeginDeltaCache();
+
+	// with net_batch everything sent below goes out in one sendmmsg burst
+	NET_BeginPacketBatch();
 
 	// send a message to each connected client
+	numSnapshotClients = 0;
+	numFragmentClients = 0;
 	for (i=0, c = svs.clients ; i < sv_maxclients->integer ; i++, c++) {
 		if (!c->state) {
 			continue;		// not connected
@@ -877,16 +1719,30 @@ void SV_SendClientMessages( void ) {
 		}
 
 		// send additional message fragments if the last message
-		// was too large to send at once
+		// was too large to send at once, after everyone's snapshots
 		if ( c->netchan.unsentFragments ) {
-			c->nextSnapshotTime = svs.time +
-				SV_RateMsec( c, c->netchan.unsentLength - c->netchan.unsentFragmentStart );
-			SV_Netchan_TransmitNextFragment( &c->netchan );
+			fragmentClients[numFragmentClients++] = c;
 			continue;
 		}
 
 		// generate and send a new message
-		SV_SendClientSnapshot( c );
+		if ( sv_snapshotThreads->integer > 1 ) {
+			snapshotClients[numSnapshotClients++] = c;
+		} else {
+			SV_SendClientSnapshot( c );
+		}
 	}
-}
 
+	if ( numSnapshotClients ) {
+		SV_SendClientSnapshotsParallel( snapshotClients, numSnapshotClients );
+	}
+
+	if ( numFragmentClients ) {
+		SV_SendClientFragments( fragmentClients, numFragmentClients );
+	}
+
+	NET_FlushPacketBatch();
+	SV_EndDeltaCache();
+	SV_EndSnapshotVisibility();
+	SV_SnapshotStats();
+}
@@ -58,9 +58,20 @@ clipHandle_t SV_ClipHandleForEntity( const sharedEntity_t *ent ) {
 ENTITY CHECKING
 
 To avoid linearly searching through lists of entities during environment testing,
-the world is carved up with an evenly spaced, axially aligned bsp tree.  Entities
-are kept in chains either at the final leafs, or at the first node that splits
-them, which prevents having to deal with multiple fragments of a single entity.
+the world is carved up with an axially aligned bsp tree.  Entities are kept in
+chains either at the final leafs, or at the first node that splits them, which
+prevents having to deal with multiple fragments of a single entity.
+
+The tree starts as a single node covering the world bounds and a leaf is split
+in half along its longest axis once it holds more than AREA_SPLIT_COUNT
+entities, so it only gets deep where entities are dense.  When entities leave,
+a node whose children are both leaves is folded back into a leaf once it and
+its children hold no more than AREA_MERGE_COUNT, and the children go back on a
+free list, so the tree follows crowds around the map.  The children of a
+node are loose: each one reaches past the split plane by a fraction of the
+node size, so an entity that barely crosses the plane still moves down instead
+of piling up in the upper nodes.  sv_adaptiveSectors 0 builds the old fixed
+AREA_DEPTH tree instead.
 
 ===============================================================================
 */
@@ -68,15 +79,33 @@ them, which prevents having to deal with multiple fragments of a single entity.
 typedef struct worldSector_s {
 	int		axis;		// -1 = leaf node
 	float	dist;
-	struct worldSector_s	*children[2];
+	float	loose;		// how far each child reaches past dist
+	vec3_t	mins, maxs;	// the part of the world this sector covers, halved by its split
+	int		depth;
+	int		numEntities;
+	struct worldSector_s	*parent;
+	struct worldSector_s	*children[2];	// children[0] links the free list
 	svEntity_t	*entities;
 } worldSector_t;
 
-#define	AREA_DEPTH	4
-#define	AREA_NODES	64
+#define	AREA_DEPTH			4		// depth of the fixed tree
+#define	AREA_NODES			2048
+#define	AREA_SPLIT_COUNT	8		// split leafs holding more entities than this
+#define	AREA_MERGE_COUNT	4		// fold nodes back into a leaf at this many, below the split so they don't flip
+#define	AREA_MIN_SIZE		192		// don't split leafs smaller than twice this
+#define	AREA_LOOSENESS		0.125f	// child overlap as a fraction of the node size
 
 worldSector_t	sv_worldSectors[AREA_NODES];
 int			sv_numworldSectors;
+static qboolean	sv_adaptiveSectorTree;
+static worldSector_t	*sv_freeWorldSectors;	// merged away, axis -2
+static int		sv_numFreeWorldSectors;
+
+static struct {
+	int		queries;
+	int		tested;		// entity boxes checked against the query
+	int		returned;
+} sv_areaStats;
 
 
 /*
@@ -85,61 +114,124 @@ SV_SectorList_f
 ===============
 */
 void SV_SectorList_f( void ) {
-	int				i, c;
+	int				i, c, leafs, maxDepth, maxEntities;
 	worldSector_t	*sec;
 	svEntity_t		*ent;
 
-	for ( i = 0 ; i < AREA_NODES ; i++ ) {
+	leafs = maxDepth = maxEntities = 0;
+	for ( i = 0 ; i < sv_numworldSectors ; i++ ) {
 		sec = &sv_worldSectors[i];
+		if ( sec->axis == -2 ) {
+			continue;
+		}
 
 		c = 0;
 		for ( ent = sec->entities ; ent ; ent = ent->nextEntityInWorldSector ) {
 			c++;
 		}
-		Com_Printf( "sector %i: %i entities\n", i, c );
+		if ( sec->axis == -1 ) {
+			leafs++;
+		}
+		maxDepth = Q_max( maxDepth, sec->depth );
+		maxEntities = Q_max( maxEntities, c );
+		if ( c ) {
+			Com_Printf( "sector %i: depth %i, %i entities\n", i, sec->depth, c );
+		}
 	}
+	Com_Printf( "%i sectors (%s), %i leafs, depth %i, at most %i entities in a sector\n", sv_numworldSectors - sv_numFreeWorldSectors,
+		sv_adaptiveSectorTree ? "adaptive" : "fixed", leafs, maxDepth, maxEntities );
 }
 
 /*
 ===============
-SV_CreateworldSector
-
-Builds a uniformly subdivided tree for the given world size
+SV_AllocWorldSector
 ===============
 */
-worldSector_t *SV_CreateworldSector( int depth, vec3_t mins, vec3_t maxs ) {
+static worldSector_t *SV_AllocWorldSector( worldSector_t *parent, const vec3_t mins, const vec3_t maxs ) {
 	worldSector_t	*anode;
+
+	if ( sv_freeWorldSectors ) {
+		anode = sv_freeWorldSectors;
+		sv_freeWorldSectors = anode->children[0];
+		sv_numFreeWorldSectors--;
+		Com_Memset( anode, 0, sizeof( *anode ) );
+	} else if ( sv_numworldSectors == AREA_NODES ) {
+		return NULL;
+	} else {
+		anode = &sv_worldSectors[sv_numworldSectors];
+		sv_numworldSectors++;
+	}
+
+	anode->axis = -1;
+	anode->depth = parent ? parent->depth + 1 : 0;
+	anode->parent = parent;
+	VectorCopy( mins, anode->mins );
+	VectorCopy( maxs, anode->maxs );
+
+	return anode;
+}
+
+/*
+===============
+SV_SplitWorldSector
+
+Turns a leaf into a node with two empty leaf children, the caller
+moves the entities down
+===============
+*/
+static qboolean SV_SplitWorldSector( worldSector_t *anode ) {
 	vec3_t		size;
 	vec3_t		mins1, maxs1, mins2, maxs2;
+	int			axis;
 
-	anode = &sv_worldSectors[sv_numworldSectors];
-	sv_numworldSectors++;
-
-	if (depth == AREA_DEPTH) {
-		anode->axis = -1;
-		anode->children[0] = anode->children[1] = NULL;
-		return anode;
+	VectorSubtract( anode->maxs, anode->mins, size );
+	if ( sv_adaptiveSectorTree ) {
+		axis = size[0] > size[1] ? 0 : 1;
+		if ( size[2] > size[axis] ) {
+			axis = 2;
+		}
+		if ( size[axis] < 2 * AREA_MIN_SIZE ) {
+			return qfalse;
+		}
+	} else {
+		axis = size[0] > size[1] ? 0 : 1;
 	}
 
-	VectorSubtract (maxs, mins, size);
-	if (size[0] > size[1]) {
-		anode->axis = 0;
-	} else {
-		anode->axis = 1;
+	if ( AREA_NODES - sv_numworldSectors + sv_numFreeWorldSectors < 2 ) {
+		return qfalse;
 	}
 
-	anode->dist = 0.5 * (maxs[anode->axis] + mins[anode->axis]);
-	VectorCopy (mins, mins1);
-	VectorCopy (mins, mins2);
-	VectorCopy (maxs, maxs1);
-	VectorCopy (maxs, maxs2);
+	anode->axis = axis;
+	anode->dist = 0.5 * ( anode->maxs[axis] + anode->mins[axis] );
+	anode->loose = sv_adaptiveSectorTree ? AREA_LOOSENESS * size[axis] : 0.0f;
 
-	maxs1[anode->axis] = mins2[anode->axis] = anode->dist;
+	VectorCopy( anode->mins, mins1 );
+	VectorCopy( anode->mins, mins2 );
+	VectorCopy( anode->maxs, maxs1 );
+	VectorCopy( anode->maxs, maxs2 );
 
-	anode->children[0] = SV_CreateworldSector (depth+1, mins2, maxs2);
-	anode->children[1] = SV_CreateworldSector (depth+1, mins1, maxs1);
+	maxs1[axis] = mins2[axis] = anode->dist;
 
-	return anode;
+	anode->children[0] = SV_AllocWorldSector( anode, mins2, maxs2 );
+	anode->children[1] = SV_AllocWorldSector( anode, mins1, maxs1 );
+
+	return qtrue;
+}
+
+/*
+===============
+SV_CreateworldSector
+
+Builds a uniformly subdivided tree for the given world size
+===============
+*/
+void SV_CreateworldSector( worldSector_t *anode ) {
+	if ( anode->depth == AREA_DEPTH || !SV_SplitWorldSector( anode ) ) {
+		return;
+	}
+
+	SV_CreateworldSector( anode->children[0] );
+	SV_CreateworldSector( anode->children[1] );
 }
 
 /*
@@ -154,11 +246,130 @@ void SV_ClearWorld( void ) {
 
 	Com_Memset( sv_worldSectors, 0, sizeof(sv_worldSectors) );
 	sv_numworldSectors = 0;
+	sv_freeWorldSectors = NULL;
+	sv_numFreeWorldSectors = 0;
+	sv_adaptiveSectorTree = (qboolean)( sv_adaptiveSectors->integer != 0 );
 
 	// get world map bounds
 	h = CM_InlineModel( 0 );
 	CM_ModelBounds( h, mins, maxs );
-	SV_CreateworldSector( 0, mins, maxs );
+	SV_AllocWorldSector( NULL, mins, maxs );
+
+	if ( !sv_adaptiveSectorTree ) {
+		SV_CreateworldSector( sv_worldSectors );
+	}
+}
+
+/*
+===============
+SV_LinkToWorldSector
+
+Links the entity into the deepest sector below node that holds its box
+===============
+*/
+static worldSector_t *SV_LinkToWorldSector( worldSector_t *node, svEntity_t *ent ) {
+	const sharedEntity_t *gEnt = SV_GEntityForSvEntity( ent );
+
+	while (1)
+	{
+		if (node->axis == -1)
+			break;
+		if ( gEnt->r.absmin[node->axis] > node->dist - node->loose )
+			node = node->children[0];
+		else if ( gEnt->r.absmax[node->axis] < node->dist + node->loose )
+			node = node->children[1];
+		else
+			break;		// crosses the node
+	}
+
+	ent->worldSector = node;
+	ent->nextEntityInWorldSector = node->entities;
+	node->entities = ent;
+	node->numEntities++;
+
+	return node;
+}
+
+/*
+===============
+SV_SubdivideWorldSector
+
+Splits a crowded leaf and moves its entities down, recursing while the
+children are still crowded
+===============
+*/
+static void SV_SubdivideWorldSector( worldSector_t *node ) {
+	svEntity_t		*ent, *next;
+
+	if ( !sv_adaptiveSectorTree || node->axis != -1 || node->numEntities <= AREA_SPLIT_COUNT ) {
+		return;
+	}
+
+	if ( !SV_SplitWorldSector( node ) ) {
+		return;
+	}
+
+	ent = node->entities;
+	node->entities = NULL;
+	node->numEntities = 0;
+
+	for ( ; ent ; ent = next ) {
+		next = ent->nextEntityInWorldSector;
+		SV_LinkToWorldSector( node, ent );
+	}
+
+	SV_SubdivideWorldSector( node->children[0] );
+	SV_SubdivideWorldSector( node->children[1] );
+}
+
+/*
+===============
+SV_MergeWorldSector
+
+After an entity left node, folds the node above it back into a leaf if it
+and its two leaf children hold few enough entities now, and goes on up
+while that keeps being true
+===============
+*/
+static void SV_MergeWorldSector( worldSector_t *node ) {
+	worldSector_t	*child;
+	svEntity_t		*ent, *next;
+	int				i;
+
+	if ( !sv_adaptiveSectorTree ) {
+		return;
+	}
+	if ( node->axis == -1 ) {
+		node = node->parent;
+	}
+
+	for ( ; node ; node = node->parent ) {
+		if ( node->children[0]->axis != -1 || node->children[1]->axis != -1
+			|| node->numEntities + node->children[0]->numEntities + node->children[1]->numEntities > AREA_MERGE_COUNT ) {
+			return;
+		}
+
+		for ( i = 0 ; i < 2 ; i++ ) {
+			child = node->children[i];
+			for ( ent = child->entities ; ent ; ent = next ) {
+				next = ent->nextEntityInWorldSector;
+				ent->worldSector = node;
+				ent->nextEntityInWorldSector = node->entities;
+				node->entities = ent;
+				node->numEntities++;
+			}
+
+			child->axis = -2;
+			child->entities = NULL;
+			child->numEntities = 0;
+			child->children[0] = sv_freeWorldSectors;
+			sv_freeWorldSectors = child;
+			sv_numFreeWorldSectors++;
+		}
+
+		node->axis = -1;
+		node->children[0] = node->children[1] = NULL;
+	}
 }
 
 
@@ -185,12 +396,16 @@ void SV_UnlinkEntity( sharedEntity_t *gEnt ) {
 
 	if ( ws->entities == ent ) {
 		ws->entities = ent->nextEntityInWorldSector;
+		ws->numEntities--;
+		SV_MergeWorldSector( ws );
 		return;
 	}
 
 	for ( scan = ws->entities ; scan ; scan = scan->nextEntityInWorldSector ) {
 		if ( scan->nextEntityInWorldSector == ent ) {
 			scan->nextEntityInWorldSector = ent->nextEntityInWorldSector;
+			ws->numEntities--;
+			SV_MergeWorldSector( ws );
 			return;
 		}
 	}
@@ -207,7 +422,6 @@ SV_LinkEntity
 */
 #define MAX_TOTAL_ENT_LEAFS		128
 void SV_LinkEntity( sharedEntity_t *gEnt ) {
-	worldSector_t	*node;
 	int			leafs[MAX_TOTAL_ENT_LEAFS];
 	int			cluster;
 	int			num_leafs;
@@ -343,24 +557,9 @@ void SV_LinkEntity( sharedEntity_t *gEnt ) {
 
 	gEnt->r.linkcount++;
 
-	// find the first world sector node that the ent's box crosses
-	node = sv_worldSectors;
-	while (1)
-	{
-		if (node->axis == -1)
-			break;
-		if ( gEnt->r.absmin[node->axis] > node->dist)
-			node = node->children[0];
-		else if ( gEnt->r.absmax[node->axis] < node->dist)
-			node = node->children[1];
-		else
-			break;		// crosses the node
-	}
-
-	// link it in
-	ent->worldSector = node;
-	ent->nextEntityInWorldSector = node->entities;
-	node->entities = ent;
+	// find the first world sector node that the ent's box crosses and
+	// split it if that made it too crowded
+	SV_SubdivideWorldSector( SV_LinkToWorldSector( sv_worldSectors, ent ) );
 
 	gEnt->r.linked = qtrue;
 }
@@ -380,6 +579,7 @@ typedef struct areaParms_s {
 	const float	*maxs;
 	int			*list;
 	int			count, maxcount;
+	int			tested;
 } areaParms_t;
 
 
@@ -395,6 +595,7 @@ void SV_AreaEntities_r( worldSector_t *node, areaParms_t *ap ) {
 
 	for ( check = node->entities  ; check ; check = next ) {
 		next = check->nextEntityInWorldSector;
+		ap->tested++;
 
 		gcheck = SV_GEntityForSvEntity( check );
 
@@ -421,10 +622,10 @@ void SV_AreaEntities_r( worldSector_t *node, areaParms_t *ap ) {
 	}
 
 	// recurse down both sides
-	if ( ap->maxs[node->axis] > node->dist ) {
+	if ( ap->maxs[node->axis] > node->dist - node->loose ) {
 		SV_AreaEntities_r ( node->children[0], ap );
 	}
-	if ( ap->mins[node->axis] < node->dist ) {
+	if ( ap->mins[node->axis] < node->dist + node->loose ) {
 		SV_AreaEntities_r ( node->children[1], ap );
 	}
 }
@@ -442,9 +643,14 @@ int SV_AreaEntities( const vec3_t mins, const vec3_t maxs, int *entityList, int
 	ap.list = entityList;
 	ap.count = 0;
 	ap.maxcount = maxcount;
+	ap.tested = 0;
 
 	SV_AreaEntities_r( sv_worldSectors, &ap );
 
+	sv_areaStats.queries++;
+	sv_areaStats.tested += ap.tested;
+	sv_areaStats.returned += ap.count;
+
 	return ap.count;
 }
 
@@ -535,9 +741,8 @@ static float VectorDistance(vec3_t p1, vec3_t p2)
 }
 #endif
 
-static void SV_ClipMoveToEntities( moveclip_t *clip ) {
-	static int	touchlist[MAX_GENTITIES];
-	int			i, num;
+static void SV_ClipMoveToEntityList( moveclip_t *clip, const int *touchlist, int num ) {
+	int			i;
 	sharedEntity_t *touch;
 	int			passOwnerNum;
 	trace_t		trace, oldTrace= {0};
@@ -545,8 +750,6 @@ static void SV_ClipMoveToEntities( moveclip_t *clip ) {
 	float		*origin, *angles;
 	int			thisOwnerShared = 1;
 
-	num = SV_AreaEntities( clip->boxmins, clip->boxmaxs, touchlist, MAX_GENTITIES);
-
 	if ( clip->passEntityNum != ENTITYNUM_NONE ) {
 		passOwnerNum = ( SV_GentityNum( clip->passEntityNum ) )->r.ownerNum;
 		if ( passOwnerNum == ENTITYNUM_NONE ) {
@@ -804,6 +1007,67 @@ Ghoul2 Insert End
 	}
 }
 
+static void SV_ClipMoveToEntities( moveclip_t *clip ) {
+	static int	touchlist[MAX_GENTITIES];
+	int			num;
+
+	num = SV_AreaEntities( clip->boxmins, clip->boxmaxs, touchlist, MAX_GENTITIES);
+
+	SV_ClipMoveToEntityList( clip, touchlist, num );
+}
+
+/*
+==================
+SV_MoveBounds
+
+The bounding box of the entire move
+==================
+*/
+static void SV_MoveBounds( const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, vec3_t boxmins, vec3_t boxmaxs ) {
+	int			i;
+
+	// we can limit it to the part of the move not
+	// already clipped off by the world, which can be
+	// a significant savings for line of sight and shot traces
+	for ( i=0 ; i<3 ; i++ ) {
+		if ( end[i] > start[i] ) {
+			boxmins[i] = start[i] + mins[i] - 1;
+			boxmaxs[i] = end[i] + maxs[i] + 1;
+		} else {
+			boxmins[i] = end[i] + mins[i] - 1;
+			boxmaxs[i] = start[i] + maxs[i] + 1;
+		}
+	}
+}
+
+/*
+==================
+SV_InitMoveClip
+
+Sets up everything but the trace for clipping a move against entities
+==================
+*/
+static void SV_InitMoveClip( moveclip_t *clip, const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, int passEntityNum, int contentmask, int capsule, int traceFlags, int useLod ) {
+	clip->contentmask = contentmask;
+/*
+Ghoul2 Insert Start
+*/
+	VectorCopy( start, clip->start );
+	clip->traceFlags = traceFlags;
+	clip->useLod = useLod;
+/*
+Ghoul2 Insert End
+*/
+//	VectorCopy( clip->trace.endpos, clip->end );
+	VectorCopy( end, clip->end );
+	clip->mins = mins;
+	clip->maxs = maxs;
+	clip->passEntityNum = passEntityNum;
+	clip->capsule = capsule;
+
+	SV_MoveBounds( start, mins, maxs, end, clip->boxmins, clip->boxmaxs );
+}
+
 /*
 ==================
 SV_Trace
@@ -820,7 +1084,7 @@ void SV_Trace( trace_t *results, const vec3_t start, const vec3_t mins, const ve
 Ghoul2 Insert End
 */
 	moveclip_t	clip;
-	int			i;
+	SV_BENCH_BEGIN( benchStart );
 
 	if ( !mins ) {
 		mins = vec3_origin;
@@ -836,44 +1100,155 @@ Ghoul2 Insert End
 	clip.trace.entityNum = clip.trace.fraction != 1.0 ? ENTITYNUM_WORLD : ENTITYNUM_NONE;
 	if ( clip.trace.fraction == 0 ) {
 		*results = clip.trace;
+		SV_BENCH_END( BENCH_TRACE, benchStart );
 		return;		// blocked immediately by the world
 	}
 
-	clip.contentmask = contentmask;
-/*
-Ghoul2 Insert Start
-*/
-	VectorCopy( start, clip.start );
-	clip.traceFlags = traceFlags;
-	clip.useLod = useLod;
+	SV_InitMoveClip( &clip, start, mins, maxs, end, passEntityNum, contentmask, capsule, traceFlags, useLod );
+
+	// clip to other solid entities
+	SV_ClipMoveToEntities ( &clip );
+
+	*results = clip.trace;
+	SV_BENCH_END( BENCH_TRACE, benchStart );
+}
+
+
+
 /*
-Ghoul2 Insert End
+==================
+SV_TraceBatch
+
+Same as calling SV_Trace for each request, but the world is traced for the
+whole batch first and then traces whose move bounds overlap share a single
+SV_AreaEntities query, which each of them filters down to its own bounds.
+The filtered list keeps the order SV_AreaEntities would have returned, so
+the results are identical to SV_Trace.
+==================
 */
-//	VectorCopy( clip.trace.endpos, clip.end );
-	VectorCopy( end, clip.end );
-	clip.mins = mins;
-	clip.maxs = maxs;
-	clip.passEntityNum = passEntityNum;
-	clip.capsule = capsule;
+#define	TRACE_BATCH_CHUNK	128
+#define	TRACE_BATCH_MERGE	2.0f	// a group's bounds may not grow past this many times the volume of its traces
 
-	// create the bounding box of the entire move
-	// we can limit it to the part of the move not
-	// already clipped off by the world, which can be
-	// a significant savings for line of sight and shot traces
-	for ( i=0 ; i<3 ; i++ ) {
-		if ( end[i] > start[i] ) {
-			clip.boxmins[i] = clip.start[i] + clip.mins[i] - 1;
-			clip.boxmaxs[i] = clip.end[i] + clip.maxs[i] + 1;
-		} else {
-			clip.boxmins[i] = clip.end[i] + clip.mins[i] - 1;
-			clip.boxmaxs[i] = clip.start[i] + clip.maxs[i] + 1;
+typedef struct traceBatchJob_s {
+	trace_t					*results;
+	const traceRequest_t	*requests;
+} traceBatchJob_t;
+
+static void SV_TraceBatchWorld( void *data, int index ) {
+	const traceBatchJob_t	*job = (const traceBatchJob_t *)data;
+	const traceRequest_t	*req = &job->requests[index];
+	trace_t					*trace = &job->results[index];
+
+	CM_BoxTrace( trace, req->start, req->end, req->mins, req->maxs, 0, req->contentmask, req->capsule );
+	trace->entityNum = trace->fraction != 1.0 ? ENTITYNUM_WORLD : ENTITYNUM_NONE;
+}
+
+static float SV_BoxVolume( const vec3_t mins, const vec3_t maxs ) {
+	return ( maxs[0] - mins[0] ) * ( maxs[1] - mins[1] ) * ( maxs[2] - mins[2] );
+}
+
+void SV_TraceBatch( trace_t *results, const traceRequest_t *requests, int numRequests ) {
+	static moveclip_t	clip;
+	static int			grouplist[MAX_GENTITIES], touchlist[MAX_GENTITIES];
+	vec3_t				boxmins[TRACE_BATCH_CHUNK], boxmaxs[TRACE_BATCH_CHUNK];
+	vec3_t				groupmins[TRACE_BATCH_CHUNK], groupmaxs[TRACE_BATCH_CHUNK];
+	float				groupVolume[TRACE_BATCH_CHUNK];
+	int					group[TRACE_BATCH_CHUNK];
+	int					first, count, numGroups, num, touched;
+	int					i, j, g;
+	vec3_t				mins, maxs;
+	float				volume;
+	traceBatchJob_t		job;
+	const traceRequest_t *req;
+	sharedEntity_t		*check;
+	SV_BENCH_BEGIN( benchStart );
+
+	for ( first = 0 ; first < numRequests ; first += TRACE_BATCH_CHUNK ) {
+		count = Q_min( TRACE_BATCH_CHUNK, numRequests - first );
+
+		// clip to world, the collision code keeps everything a trace
+		// writes per thread so these can run side by side
+		job.results = results + first;
+		job.requests = requests + first;
+		Com_ParallelFor( sv_traceThreads->integer, count, SV_TraceBatchWorld, &job );
+
+		// group the traces that weren't blocked immediately by the world
+		numGroups = 0;
+		for ( i = 0 ; i < count ; i++ ) {
+			req = &job.requests[i];
+
+			group[i] = -1;
+			if ( job.results[i].fraction == 0 ) {
+				continue;
+			}
+
+			SV_MoveBounds( req->start, req->mins, req->maxs, req->end, boxmins[i], boxmaxs[i] );
+			volume = SV_BoxVolume( boxmins[i], boxmaxs[i] );
+
+			for ( g = 0 ; g < numGroups ; g++ ) {
+				if ( boxmins[i][0] > groupmaxs[g][0] || boxmins[i][1] > groupmaxs[g][1] || boxmins[i][2] > groupmaxs[g][2]
+					|| boxmaxs[i][0] < groupmins[g][0] || boxmaxs[i][1] < groupmins[g][1] || boxmaxs[i][2] < groupmins[g][2] ) {
+					continue;
+				}
+
+				for ( j = 0 ; j < 3 ; j++ ) {
+					mins[j] = Q_min( boxmins[i][j], groupmins[g][j] );
+					maxs[j] = Q_max( boxmaxs[i][j], groupmaxs[g][j] );
+				}
+				if ( SV_BoxVolume( mins, maxs ) > TRACE_BATCH_MERGE * ( groupVolume[g] + volume ) ) {
+					continue;
+				}
+
+				VectorCopy( mins, groupmins[g] );
+				VectorCopy( maxs, groupmaxs[g] );
+				groupVolume[g] += volume;
+				break;
+			}
+
+			if ( g == numGroups ) {
+				VectorCopy( boxmins[i], groupmins[g] );
+				VectorCopy( boxmaxs[i], groupmaxs[g] );
+				groupVolume[g] = volume;
+				numGroups++;
+			}
+			group[i] = g;
 		}
-	}
 
-	// clip to other solid entities
-	SV_ClipMoveToEntities ( &clip );
+		// clip to other solid entities
+		for ( g = 0 ; g < numGroups ; g++ ) {
+			num = SV_AreaEntities( groupmins[g], groupmaxs[g], grouplist, MAX_GENTITIES );
 
-	*results = clip.trace;
+			for ( i = 0 ; i < count ; i++ ) {
+				if ( group[i] != g ) {
+					continue;
+				}
+
+				touched = 0;
+				for ( j = 0 ; j < num ; j++ ) {
+					check = SV_GentityNum( grouplist[j] );
+					if ( check->r.absmin[0] > boxmaxs[i][0]
+					|| check->r.absmin[1] > boxmaxs[i][1]
+					|| check->r.absmin[2] > boxmaxs[i][2]
+					|| check->r.absmax[0] < boxmins[i][0]
+					|| check->r.absmax[1] < boxmins[i][1]
+					|| check->r.absmax[2] < boxmins[i][2] ) {
+						continue;
+					}
+					touchlist[touched++] = grouplist[j];
+				}
+
+				req = &job.requests[i];
+				Com_Memset( &clip, 0, sizeof( clip ) );
+				clip.trace = job.results[i];
+				SV_InitMoveClip( &clip, req->start, req->mins, req->maxs, req->end, req->passEntityNum,
+					req->contentmask, req->capsule, req->traceFlags, req->useLod );
+				SV_ClipMoveToEntityList( &clip, touchlist, touched );
+				job.results[i] = clip.trace;
+			}
+		}
+	}
+
+	SV_BENCH_END_TRACES( benchStart, numRequests );
 }
 
 
@@ -913,3 +1288,267 @@ int SV_PointContents( const vec3_t p, int passEntityNum ) {
 }
 
 
+
+/*
+=============
+SV_TraceBench_f
+
+tracebench [count] [batch]
+
+Runs player sized and point traces of random length and direction, sixteen
+at a time out of each linked entity in turn, and reports how many entity
+boxes the area queries had to check.  The traces are the same for every run
+on a map, so the result can be compared between sv_adaptiveSectors 0 and 1.
+With "batch" each sixteen go through SV_TraceBatch, which must give the same
+checksum as SV_Trace.
+=============
+*/
+#define	TRACE_BENCH_GROUP	16
+
+void SV_TraceBench_f( void ) {
+	static const vec3_t	playerMins = { -15, -15, -24 }, playerMaxs = { 15, 15, 40 };
+	static int			starts[MAX_GENTITIES];
+	traceRequest_t		requests[TRACE_BENCH_GROUP];
+	trace_t				traces[TRACE_BENCH_GROUP];
+	int					i, j, count, numStarts, seed, msec, hits;
+	unsigned			checksum;
+	byteAlias_t			fraction;
+	qboolean			batch;
+	vec3_t				dir;
+	sharedEntity_t		*gEnt;
+	traceRequest_t		*req;
+
+	if ( !com_sv_running->integer ) {
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+
+	count = Cmd_Argc() > 1 ? Com_Clampi( 1, 10000000, atoi( Cmd_Argv( 1 ) ) ) : 100000;
+	batch = (qboolean)!Q_stricmp( Cmd_Argv( 2 ), "batch" );
+
+	numStarts = 0;
+	for ( i = 0 ; i < sv.num_entities ; i++ ) {
+		gEnt = SV_GentityNum( i );
+		if ( gEnt->r.linked && !gEnt->r.bmodel ) {
+			starts[numStarts++] = i;
+		}
+	}
+	if ( !numStarts ) {
+		Com_Printf( "No linked entities to trace from.\n" );
+		return;
+	}
+
+	Com_Memset( &sv_areaStats, 0, sizeof( sv_areaStats ) );
+	seed = 1;
+	hits = 0;
+	checksum = 0;
+
+	msec = Sys_Milliseconds();
+	for ( i = 0 ; i < count ; i += TRACE_BENCH_GROUP ) {
+		gEnt = SV_GentityNum( starts[( i / TRACE_BENCH_GROUP ) % numStarts] );
+
+		Com_Memset( requests, 0, sizeof( requests ) );
+		for ( j = 0, req = requests ; j < TRACE_BENCH_GROUP ; j++, req++ ) {
+			dir[0] = Q_crandom( &seed );
+			dir[1] = Q_crandom( &seed );
+			dir[2] = 0.25f * Q_crandom( &seed );
+			VectorNormalize( dir );
+
+			VectorCopy( gEnt->r.currentOrigin, req->start );
+			VectorMA( req->start, 64.0f + 1984.0f * Q_random( &seed ), dir, req->end );
+			req->passEntityNum = gEnt->s.number;
+
+			if ( j & 1 ) {
+				VectorCopy( playerMins, req->mins );
+				VectorCopy( playerMaxs, req->maxs );
+				req->contentmask = MASK_PLAYERSOLID;
+			} else {
+				req->contentmask = MASK_SHOT;
+			}
+		}
+
+		if ( batch ) {
+			SV_TraceBatch( traces, requests, TRACE_BENCH_GROUP );
+		} else {
+			for ( j = 0, req = requests ; j < TRACE_BENCH_GROUP ; j++, req++ ) {
+				SV_Trace( &traces[j], req->start, req->mins, req->maxs, req->end, req->passEntityNum,
+					req->contentmask, req->capsule, req->traceFlags, req->useLod );
+			}
+		}
+
+		for ( j = 0 ; j < TRACE_BENCH_GROUP ; j++ ) {
+			if ( traces[j].entityNum != ENTITYNUM_NONE && traces[j].entityNum != ENTITYNUM_WORLD ) {
+				hits++;
+			}
+			fraction.f = traces[j].fraction;
+			checksum = checksum * 31 + fraction.ui + traces[j].entityNum;
+		}
+	}
+	msec = Sys_Milliseconds() - msec;
+	count = i;
+
+	Com_Printf( "%i traces from %i entities in %i msec, %.3f usec per trace, %i entity hits, checksum %08x\n",
+		count, numStarts, msec, msec * 1000.0f / count, hits, checksum );
+	Com_Printf( "%i area queries, %.2f entities checked and %.2f returned per query (%s sectors, %i nodes%s)\n",
+		sv_areaStats.queries, (float)sv_areaStats.tested / Q_max( 1, sv_areaStats.queries ),
+		(float)sv_areaStats.returned / Q_max( 1, sv_areaStats.queries ),
+		sv_adaptiveSectorTree ? "adaptive" : "fixed", sv_numworldSectors, batch ? ", batched" : "" );
+}
+
+/*
+=============
+SV_TraceStress_f
+
+tracestress [count] [threads]
+
+Checks that collision traces give the same answer no matter which thread
+runs them.  Random world traces, position tests, traces against temporary
+boxes and against rotated inline models are run one at a time first, then
+several times over on the given number of threads (default 4), and every
+result has to match its single threaded one bit for bit.
+=============
+*/
+#define	TRACE_STRESS_ROUNDS	4
+
+typedef struct traceStress_s {
+	vec3_t			start, end;
+	vec3_t			mins, maxs;
+	vec3_t			origin, angles;		// for box and inline model traces
+	clipHandle_t	model;				// -1 for a temp box of boxMins, boxMaxs
+	vec3_t			boxMins, boxMaxs;
+	int				contentmask;
+} traceStress_t;
+
+typedef struct traceStressJob_s {
+	const traceStress_t	*tests;
+	trace_t				*results;
+} traceStressJob_t;
+
+static void SV_TraceStressJob( void *data, int index ) {
+	const traceStressJob_t	*job = (const traceStressJob_t *)data;
+	const traceStress_t		*t = &job->tests[index];
+	clipHandle_t			model;
+
+	if ( t->model == 0 ) {
+		CM_BoxTrace( &job->results[index], t->start, t->end, t->mins, t->maxs, 0, t->contentmask, qfalse );
+		return;
+	}
+
+	model = t->model;
+	if ( model == -1 ) {
+		model = CM_TempBoxModel( t->boxMins, t->boxMaxs, qfalse );
+	}
+	CM_TransformedBoxTrace( &job->results[index], t->start, t->end, t->mins, t->maxs, model,
+		t->contentmask, t->origin, t->angles, qfalse );
+}
+
+void SV_TraceStress_f( void ) {
+	static const vec3_t	playerMins = { -15, -15, -24 }, playerMaxs = { 15, 15, 40 };
+	traceStress_t		*tests, *t;
+	trace_t				*reference, *results;
+	traceStressJob_t	job;
+	vec3_t				worldMins, worldMaxs, dir;
+	int					i, j, count, threads, seed, numInline, mismatches, hits;
+	int					serialMsec, threadedMsec;
+
+	if ( !com_sv_running->integer ) {
+		Com_Printf( "Server is not running.\n" );
+		return;
+	}
+
+	count = Cmd_Argc() > 1 ? Com_Clampi( 1, 1000000, atoi( Cmd_Argv( 1 ) ) ) : 100000;
+	threads = Cmd_Argc() > 2 ? Com_Clampi( 2, MAX_WORKER_THREADS + 1, atoi( Cmd_Argv( 2 ) ) ) : 4;
+
+	tests = (traceStress_t *)Z_Malloc( count * sizeof( *tests ), TAG_TEMP_WORKSPACE, qtrue );
+	reference = (trace_t *)Z_Malloc( count * sizeof( *reference ), TAG_TEMP_WORKSPACE, qtrue );
+	results = (trace_t *)Z_Malloc( count * sizeof( *results ), TAG_TEMP_WORKSPACE, qtrue );
+
+	CM_ModelBounds( 0, worldMins, worldMaxs );
+	numInline = CM_NumInlineModels();
+	seed = 1;
+
+	for ( i = 0, t = tests ; i < count ; i++, t++ ) {
+		for ( j = 0 ; j < 3 ; j++ ) {
+			t->start[j] = worldMins[j] + ( worldMaxs[j] - worldMins[j] ) * Q_random( &seed );
+			dir[j] = Q_crandom( &seed );
+		}
+		VectorNormalize( dir );
+
+		// every eighth one is a position test
+		if ( i & 7 ) {
+			VectorMA( t->start, 2048.0f * Q_random( &seed ), dir, t->end );
+		} else {
+			VectorCopy( t->start, t->end );
+		}
+
+		if ( i & 1 ) {
+			VectorCopy( playerMins, t->mins );
+			VectorCopy( playerMaxs, t->maxs );
+			t->contentmask = MASK_PLAYERSOLID;
+		} else {
+			t->contentmask = MASK_SHOT;
+		}
+
+		switch ( i % 3 ) {
+		case 0:
+			t->model = 0;
+			break;
+		case 1:
+			// a box somewhere along the trace
+			t->model = -1;
+			VectorSet( t->boxMins, -8 - 32 * Q_random( &seed ), -8 - 32 * Q_random( &seed ), -8 - 32 * Q_random( &seed ) );
+			VectorSet( t->boxMaxs, 8 + 32 * Q_random( &seed ), 8 + 32 * Q_random( &seed ), 8 + 32 * Q_random( &seed ) );
+			VectorSubtract( t->end, t->start, dir );
+			VectorMA( t->start, Q_random( &seed ), dir, t->origin );
+			break;
+		default:
+			// an inline model, rotated about the start half the time
+			t->model = numInline > 1 ? 1 + ( i / 3 ) % ( numInline - 1 ) : 0;
+			if ( i & 2 ) {
+				VectorCopy( t->start, t->origin );
+				VectorSet( t->angles, 360 * Q_random( &seed ), 360 * Q_random( &seed ), 360 * Q_random( &seed ) );
+			}
+			break;
+		}
+	}
+
+	job.tests = tests;
+
+	serialMsec = Sys_Milliseconds();
+	job.results = reference;
+	Com_ParallelFor( 1, count, SV_TraceStressJob, &job );
+	serialMsec = Sys_Milliseconds() - serialMsec;
+
+	hits = 0;
+	for ( i = 0 ; i < count ; i++ ) {
+		if ( reference[i].fraction != 1.0f || reference[i].startsolid ) {
+			hits++;
+		}
+	}
+
+	mismatches = 0;
+	threadedMsec = Sys_Milliseconds();
+	job.results = results;
+	for ( i = 0 ; i < TRACE_STRESS_ROUNDS ; i++ ) {
+		Com_Memset( results, 0xff, count * sizeof( *results ) );
+		Com_ParallelFor( threads, count, SV_TraceStressJob, &job );
+
+		for ( j = 0 ; j < count ; j++ ) {
+			if ( memcmp( &results[j], &reference[j], sizeof( trace_t ) ) ) {
+				if ( !mismatches ) {
+					Com_Printf( S_COLOR_RED "trace %i differs: fraction %f/%f, contents %i/%i\n", j,
+						results[j].fraction, reference[j].fraction, results[j].contents, reference[j].contents );
+				}
+				mismatches++;
+			}
+		}
+	}
+	threadedMsec = ( Sys_Milliseconds() - threadedMsec ) / TRACE_STRESS_ROUNDS;
+
+	Com_Printf( "%i traces (%i hit), %i msec on one thread, %i msec on %i threads, %s%i mismatches\n",
+		count, hits, serialMsec, threadedMsec, threads, mismatches ? S_COLOR_RED : "", mismatches );
+
+	Z_Free( results );
+	Z_Free( reference );
+	Z_Free( tests );
+}
@@ -414,3 +414,5 @@ qboolean UI_SaberTypeForSaber( const char *saberName, char *saberType );
 // new ui
 
 extern uiImport_t *trap;
+
+void UI_FillAppendedImports( uiImport_t *import );
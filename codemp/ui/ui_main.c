@@ -477,6 +477,8 @@ char holdSPString[MAX_STRING_CHARS]={0};
 
 uiInfo_t uiInfo;
 
+static cvarHandle_t gametypeHandle;	// g_gametype, read by the owner draws every frame
+
 static void UI_StartServerRefresh(qboolean full);
 static void UI_StopServerRefresh( void );
 static void UI_DoServerRefresh( void );
@@ -3261,17 +3263,19 @@ static qboolean UI_OwnerDrawVisible(int flags) {
 
 	while (flags) {
 		if (flags & UI_SHOW_FFA) {
-			if (trap->Cvar_VariableValue("g_gametype") != GT_FFA &&
-				trap->Cvar_VariableValue("g_gametype") != GT_HOLOCRON &&
-				trap->Cvar_VariableValue("g_gametype") != GT_JEDIMASTER) {
+			float gametype = trap->ext.Cvar_HandleValue( gametypeHandle );
+			if (gametype != GT_FFA &&
+				gametype != GT_HOLOCRON &&
+				gametype != GT_JEDIMASTER) {
 				vis = qfalse;
 			}
 			flags &= ~UI_SHOW_FFA;
 		}
 		if (flags & UI_SHOW_NOTFFA) {
-			if (trap->Cvar_VariableValue("g_gametype") == GT_FFA ||
-				trap->Cvar_VariableValue("g_gametype") == GT_HOLOCRON ||
-				trap->Cvar_VariableValue("g_gametype") != GT_JEDIMASTER) {
+			float gametype = trap->ext.Cvar_HandleValue( gametypeHandle );
+			if (gametype == GT_FFA ||
+				gametype == GT_HOLOCRON ||
+				gametype != GT_JEDIMASTER) {
 				vis = qfalse;
 			}
 			flags &= ~UI_SHOW_NOTFFA;
@@ -9853,6 +9857,8 @@ void UI_Init( qboolean inGameLoad ) {
 	UI_RegisterCvars();
 	UI_InitMemory();
 
+	gametypeHandle = trap->ext.Cvar_FindHandle( "g_gametype" );
+
 	// cache redundant calulations
 	trap->GetGlconfig( &uiInfo.uiDC.glconfig );
 
@@ -10544,6 +10550,54 @@ static void UI_StartServerRefresh(qboolean full)
 	}
 }
 
+/*
+============
+UI_FillAppendedImports
+
+Engines without the imports appended after ext.RemoveCommand get these,
+which do the same through the original ones
+============
+*/
+
+// a handle indexes the names kept here, names that don't fit get -1 and read
+// as an undefined cvar
+#define MAX_FALLBACK_CVAR_HANDLES	64
+static char fallbackCvarNames[MAX_FALLBACK_CVAR_HANDLES][MAX_QPATH];
+static int numFallbackCvarNames;
+
+static cvarHandle_t UI_Fallback_Cvar_FindHandle( const char *var_name ) {
+	int i;
+	if ( strlen( var_name ) >= MAX_QPATH )
+		return -1;
+	for ( i=0; i<numFallbackCvarNames; i++ ) {
+		if ( !Q_stricmp( fallbackCvarNames[i], var_name ) )
+			return i;
+	}
+	if ( numFallbackCvarNames == MAX_FALLBACK_CVAR_HANDLES )
+		return -1;
+	Q_strncpyz( fallbackCvarNames[numFallbackCvarNames], var_name, MAX_QPATH );
+	return numFallbackCvarNames++;
+}
+
+static void UI_Fallback_Cvar_HandleStringBuffer( cvarHandle_t handle, char *buffer, int bufsize ) {
+	if ( (unsigned)handle >= (unsigned)numFallbackCvarNames )
+		*buffer = '\0';
+	else
+		trap->Cvar_VariableStringBuffer( fallbackCvarNames[handle], buffer, bufsize );
+}
+
+static float UI_Fallback_Cvar_HandleValue( cvarHandle_t handle ) {
+	if ( (unsigned)handle >= (unsigned)numFallbackCvarNames )
+		return 0.0f;
+	return trap->Cvar_VariableValue( fallbackCvarNames[handle] );
+}
+
+void UI_FillAppendedImports( uiImport_t *import ) {
+	import->ext.Cvar_FindHandle				= UI_Fallback_Cvar_FindHandle;
+	import->ext.Cvar_HandleValue			= UI_Fallback_Cvar_HandleValue;
+	import->ext.Cvar_HandleStringBuffer		= UI_Fallback_Cvar_HandleStringBuffer;
+}
+
 /*
 ============
 GetModuleAPI
@@ -10555,15 +10609,23 @@ uiImport_t *trap = NULL;
 Q_EXPORT uiExport_t* QDECL GetModuleAPI( int apiVersion, uiImport_t *import )
 {
 	static uiExport_t uie = {0};
+	static uiImport_t import3;
 
 	assert( import );
+	if ( apiVersion == UI_API_VERSION_3 ) {
+		// the engine's table ends before the appended imports
+		memset( &import3, 0, sizeof( import3 ) );
+		memcpy( &import3, import, offsetof( uiImport_t, ext.Cvar_FindHandle ) );
+		UI_FillAppendedImports( &import3 );
+		import = &import3;
+	}
 	trap = import;
 	Com_Printf	= trap->Print;
 	Com_Error	= trap->Error;
 
 	memset( &uie, 0, sizeof( uie ) );
 
-	if ( apiVersion != UI_API_VERSION ) {
+	if ( apiVersion != UI_API_VERSION && apiVersion != UI_API_VERSION_3 ) {
 		trap->Print( "Mismatched UI_API_VERSION: expected %i, got %i\n", UI_API_VERSION, apiVersion );
 		return NULL;
 	}
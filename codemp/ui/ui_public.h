@@ -23,7 +23,8 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 
 #pragma once
 
-#define UI_API_VERSION 3
+#define UI_API_VERSION 4
+#define UI_API_VERSION_3 3	// the table up to ext.RemoveCommand, still offered to older modules
 #define UI_LEGACY_API_VERSION 7
 
 typedef struct uiClientState_s {
@@ -375,6 +376,14 @@ typedef struct uiImport_s {
 		float			(*R_Font_StrLenPixels)					( const char *text, const int iFontIndex, const float scale );
 		void			(*AddCommand)							( const char *cmd_name );
 		void			(*RemoveCommand)						( const char *cmd_name );
+
+		// the imports below are only there from UI_API_VERSION 4 on
+
+		// a handle stays bound to its cvar name for the whole session, so it can be
+		// looked up once and read every frame without hashing the name
+		cvarHandle_t	(*Cvar_FindHandle)						( const char *var_name );
+		float			(*Cvar_HandleValue)						( cvarHandle_t handle );
+		void			(*Cvar_HandleStringBuffer)				( cvarHandle_t handle, char *buffer, int bufsize );
 	} ext;
 } uiImport_t;
 
@@ -651,4 +651,6 @@ static void TranslateSyscalls( void ) {
 	trap->ext.R_Font_StrLenPixels			= trap_R_Font_StrLenPixelsFloat;
 	trap->ext.AddCommand					= UISyscall_AddCommand;
 	trap->ext.RemoveCommand					= UISyscall_RemoveCommand;
+
+	UI_FillAppendedImports( trap );
 }
@@ -24,6 +24,9 @@ along with this program; if not, see <http://www.gnu.org/licenses/>.
 
 #include "q_platform.h"
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 #if defined(__cplusplus)
 extern "C" {
@@ -105,6 +108,21 @@ static inline long Q_ftol( float f )
 }
 #endif
 
+// index of the lowest set bit, v must not be 0
+#if defined(_MSC_VER)
+static __inline int Q_ctz32( unsigned int v )
+{
+	unsigned long index;
+	_BitScanForward( &index, v );
+	return (int)index;
+}
+#else
+static inline int Q_ctz32( unsigned int v )
+{
+	return __builtin_ctz( v );
+}
+#endif
+
 signed char ClampChar( int i );
 signed short ClampShort( int i );
 int Com_Clampi( int min, int max, int value );
@@ -756,6 +756,16 @@ int main ( int argc, char* argv[] )
 	// Concatenate the command line for passing to Com_Init
 	for( i = 1; i < argc; i++ )
 	{
+#ifdef DEDICATED_BENCH
+		// SV_BenchMain reads its own --options
+		if ( argv[i][0] == '-' && argv[i][1] == '-' )
+		{
+			if ( i + 1 < argc && argv[i + 1][0] != '-' && argv[i + 1][0] != '+' )
+				i++;
+			continue;
+		}
+#endif
+
 		const bool containsSpaces = (strchr(argv[i], ' ') != NULL);
 		if (containsSpaces)
 			Q_strcat( commandLine, sizeof( commandLine ), "\"" );
@@ -783,6 +793,10 @@ int main ( int argc, char* argv[] )
 
 	NET_Init();
 
+#ifdef DEDICATED_BENCH
+	SV_BenchMain( argc, argv );
+#endif
+
 	// main game loop
 	while (1)
 	{